@@ -0,0 +1,240 @@
+// third-party libraries
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+// standard C++ libraries
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+
+// tdogl classes
+#include "tdogl/TransformBatch.h"
+#include "tdogl/Frustum.h"
+#include "tdogl/Profiler.h"
+#include "tdogl/JobSystem.h"
+#include "tdogl/OcclusionCuller.h"
+
+/*
+ Command line microbenchmarks for the CPU side of the renderer. None of them need a GL
+ context.
+
+  --bench-transforms [count]
+      times tdogl::TransformBatch against plain glm on `count` random model matrices
+      (default 1000000)
+
+  --bench-jobs [count]
+      times culling `count` boxes (default 1000000) with tdogl::JobSystem, from one thread
+      up to the number of hardware threads
+
+  --bench-occlusion [count]
+      times tdogl::OcclusionCuller on a wall and `count` boxes (default 100000), half of
+      them hidden behind the wall and half in front of it, and checks that every box is
+      classified correctly
+ */
+
+// returns a random float in [minValue, maxValue]. Uses rand, so the sequence is the same every run.
+static float RandomFloat(float minValue, float maxValue)
+{
+	return minValue + (maxValue - minValue) * (float) rand() / (float) RAND_MAX;
+}
+
+// prints one line of the comparison
+static void PrintTiming(const char* name, double glmMicroseconds, double batchMicroseconds, int count, float maxError)
+{
+	std::cout << name << ": glm " << glmMicroseconds / 1000.0 << " ms, TransformBatch "
+		<< batchMicroseconds / 1000.0 << " ms (" << glmMicroseconds / batchMicroseconds << "x, "
+		<< 1000.0 * batchMicroseconds / count << " ns per instance), max difference " << maxError << std::endl;
+}
+
+// times view-projection * model, normal matrices and bounding box transforms, plain glm vs tdogl::TransformBatch
+void BenchmarkTransformsMain(int count)
+{
+	if (count <= 0)
+		throw std::runtime_error("The instance count must be positive");
+
+	// random rotate/scale/translate model matrices and boxes
+	srand(1);
+	std::vector<glm::mat4> models(count);
+	std::vector<glm::vec3> boxMin(count);
+	std::vector<glm::vec3> boxMax(count);
+	for (int i = 0; i < count; ++i) {
+		glm::vec3 axis = glm::normalize(glm::vec3(RandomFloat(-1, 1), RandomFloat(0.1f, 1), RandomFloat(-1, 1)));
+		models[i] = glm::translate(glm::mat4(), glm::vec3(RandomFloat(-100, 100), RandomFloat(-10, 10), RandomFloat(-100, 100)))
+			* glm::rotate(glm::mat4(), RandomFloat(0, 6.2831853f), axis)
+			* glm::scale(glm::mat4(), glm::vec3(RandomFloat(0.5f, 2), RandomFloat(0.5f, 2), RandomFloat(0.5f, 2)));
+		boxMin[i] = glm::vec3(-1, -1, -1);
+		boxMax[i] = glm::vec3(1, RandomFloat(1, 3), 1);
+	}
+	glm::mat4 viewProjection = glm::perspective(glm::radians(50.0f), 4.0f / 3.0f, 0.5f, 500.0f)
+		* glm::lookAt(glm::vec3(0, 20, 150), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+
+	std::cout << count << " instances, SSE " << (tdogl::TransformBatch::simdEnabled() ? "on" : "off") << std::endl;
+
+	// view-projection * model
+	std::vector<glm::mat4> glmMatrices(count);
+	std::vector<glm::mat4> batchMatrices(count);
+	double start = tdogl::Profiler::nowMicroseconds();
+	for (int i = 0; i < count; ++i)
+		glmMatrices[i] = viewProjection * models[i];
+	double glmTime = tdogl::Profiler::nowMicroseconds() - start;
+	start = tdogl::Profiler::nowMicroseconds();
+	tdogl::TransformBatch::multiply(viewProjection, &models[0], &batchMatrices[0], count);
+	double batchTime = tdogl::Profiler::nowMicroseconds() - start;
+	float maxError = 0.0f;
+	for (int i = 0; i < count; ++i)
+		for (int c = 0; c < 4; ++c)
+			maxError = glm::max(maxError, glm::length(glmMatrices[i][c] - batchMatrices[i][c]));
+	PrintTiming("View-projection * model", glmTime, batchTime, count, maxError);
+
+	// normal matrices
+	std::vector<glm::mat3> glmNormals(count);
+	std::vector<glm::mat3> batchNormals(count);
+	start = tdogl::Profiler::nowMicroseconds();
+	for (int i = 0; i < count; ++i)
+		glmNormals[i] = glm::transpose(glm::inverse(glm::mat3(models[i])));
+	glmTime = tdogl::Profiler::nowMicroseconds() - start;
+	start = tdogl::Profiler::nowMicroseconds();
+	tdogl::TransformBatch::normalMatrices(&models[0], &batchNormals[0], count);
+	batchTime = tdogl::Profiler::nowMicroseconds() - start;
+	maxError = 0.0f;
+	for (int i = 0; i < count; ++i)
+		for (int c = 0; c < 3; ++c)
+			maxError = glm::max(maxError, glm::length(glmNormals[i][c] - batchNormals[i][c]));
+	PrintTiming("Normal matrices", glmTime, batchTime, count, maxError);
+
+	// world space bounding boxes
+	std::vector<glm::vec3> glmMin(count), glmMax(count);
+	std::vector<glm::vec3> batchMin(count), batchMax(count);
+	start = tdogl::Profiler::nowMicroseconds();
+	for (int i = 0; i < count; ++i)
+		tdogl::Frustum::transformBox(models[i], boxMin[i], boxMax[i], glmMin[i], glmMax[i]);
+	glmTime = tdogl::Profiler::nowMicroseconds() - start;
+	start = tdogl::Profiler::nowMicroseconds();
+	tdogl::TransformBatch::transformBoxes(&models[0], &boxMin[0], &boxMax[0], &batchMin[0], &batchMax[0], count);
+	batchTime = tdogl::Profiler::nowMicroseconds() - start;
+	maxError = 0.0f;
+	for (int i = 0; i < count; ++i)
+		maxError = glm::max(maxError, glm::max(glm::length(glmMin[i] - batchMin[i]), glm::length(glmMax[i] - batchMax[i])));
+	PrintTiming("Bounding boxes", glmTime, batchTime, count, maxError);
+}
+
+// times a culling pass over `count` boxes with 1 to N threads, to show how tdogl::JobSystem scales
+void BenchmarkJobsMain(int count)
+{
+	if (count <= 0)
+		throw std::runtime_error("The instance count must be positive");
+
+	srand(1);
+	std::vector<glm::mat4> models(count);
+	std::vector<glm::vec3> boxMin(count, glm::vec3(-1, -1, -1));
+	std::vector<glm::vec3> boxMax(count, glm::vec3(1, 1, 1));
+	for (int i = 0; i < count; ++i) {
+		models[i] = glm::translate(glm::mat4(), glm::vec3(RandomFloat(-100, 100), RandomFloat(-10, 10), RandomFloat(-100, 100)))
+			* glm::rotate(glm::mat4(), RandomFloat(0, 6.2831853f), glm::vec3(0, 1, 0));
+	}
+	tdogl::Frustum frustum(glm::perspective(glm::radians(50.0f), 4.0f / 3.0f, 0.5f, 500.0f)
+		* glm::lookAt(glm::vec3(0, 20, 150), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0)));
+	std::vector<glm::vec3> worldMin(count), worldMax(count);
+	std::vector<unsigned char> visible(count);
+
+	const int iterations = 20;
+	unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	double oneThreadMicroseconds = 0.0;
+	std::cout << count << " boxes, " << iterations << " iterations" << std::endl;
+	for (unsigned threads = 1; threads <= maxThreads; ++threads) {
+		tdogl::JobSystem jobs((int) threads - 1);
+		double start = tdogl::Profiler::nowMicroseconds();
+		for (int iteration = 0; iteration < iterations; ++iteration) {
+			jobs.parallelFor(count, 256, [&](size_t begin, size_t end) {
+				tdogl::TransformBatch::transformBoxes(&models[begin], &boxMin[begin], &boxMax[begin], &worldMin[begin], &worldMax[begin], end - begin);
+				for (size_t i = begin; i < end; ++i)
+					visible[i] = frustum.intersectsBox(worldMin[i], worldMax[i]);
+			});
+		}
+		double microseconds = (tdogl::Profiler::nowMicroseconds() - start) / iterations;
+		if (threads == 1)
+			oneThreadMicroseconds = microseconds;
+
+		std::cout << threads << " threads: " << microseconds / 1000.0 << " ms per pass, speedup "
+			<< oneThreadMicroseconds / microseconds << "x, efficiency "
+			<< 100.0 * oneThreadMicroseconds / microseconds / threads << "%" << std::endl;
+	}
+}
+
+// rasterizes a wall into tdogl::OcclusionCuller, then times isBoxOccluded on `count` boxes that are
+// known to be hidden behind it or in front of it. Throws if any box is classified wrongly.
+void BenchmarkOcclusionMain(int count)
+{
+	if (count <= 0)
+		throw std::runtime_error("The box count must be positive");
+
+	// the wall is a box 40 wide, 12 high and 2 deep, standing on the ground at z = 0
+	std::vector<glm::vec3> wallVertices;
+	for (int i = 0; i < 8; ++i)
+		wallVertices.push_back(glm::vec3((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f));
+	static const unsigned wallIndices[] = {
+		0, 2, 1, 1, 2, 3, //back
+		4, 5, 6, 5, 7, 6, //front
+		0, 1, 4, 1, 5, 4, //bottom
+		2, 6, 3, 3, 6, 7, //top
+		0, 4, 2, 2, 4, 6, //left
+		1, 3, 5, 3, 7, 5  //right
+	};
+	const size_t wallIndexCount = sizeof(wallIndices) / sizeof(wallIndices[0]);
+	glm::mat4 wall = glm::translate(glm::mat4(), glm::vec3(0, 6, 0)) * glm::scale(glm::mat4(), glm::vec3(20, 6, 1));
+	glm::mat4 viewProjection = glm::perspective(glm::radians(50.0f), 4.0f / 3.0f, 0.5f, 500.0f)
+		* glm::lookAt(glm::vec3(0, 5, 30), glm::vec3(0, 5, 0), glm::vec3(0, 1, 0));
+
+	// unit boxes around the middle of the wall, even ones behind it and odd ones in front of it
+	srand(1);
+	std::vector<glm::vec3> boxMin(count), boxMax(count);
+	for (int i = 0; i < count; ++i) {
+		float z = (i % 2 == 0 ? RandomFloat(-40, -5) : RandomFloat(5, 15));
+		boxMin[i] = glm::vec3(RandomFloat(-3, 3), RandomFloat(3, 7), z);
+		boxMax[i] = boxMin[i] + glm::vec3(1, 1, 1);
+	}
+
+	const int iterations = 20;
+	tdogl::OcclusionCuller culler(256, 192);
+	std::cout << count << " boxes, " << iterations << " iterations, SSE " << (tdogl::OcclusionCuller::simdEnabled() ? "on" : "off") << std::endl;
+
+	double start = tdogl::Profiler::nowMicroseconds();
+	for (int iteration = 0; iteration < iterations; ++iteration) {
+		culler.clear(viewProjection);
+		culler.rasterize(wall, &wallVertices[0], wallVertices.size(), wallIndices, wallIndexCount);
+		culler.buildHierarchy();
+	}
+	double rasterizeMicroseconds = (tdogl::Profiler::nowMicroseconds() - start) / iterations;
+
+	std::vector<unsigned char> occluded(count);
+	start = tdogl::Profiler::nowMicroseconds();
+	for (int iteration = 0; iteration < iterations; ++iteration) {
+		for (int i = 0; i < count; ++i)
+			occluded[i] = culler.isBoxOccluded(boxMin[i], boxMax[i]);
+	}
+	double testMicroseconds = (tdogl::Profiler::nowMicroseconds() - start) / iterations;
+
+	int wrong = 0;
+	for (int i = 0; i < count; ++i) {
+		if (occluded[i] != (i % 2 == 0))
+			++wrong;
+	}
+
+	std::cout << "Rasterize and build the hierarchy: " << rasterizeMicroseconds / 1000.0 << " ms ("
+		<< culler.trianglesRasterized() << " triangles, " << culler.levelCount() << " levels)" << std::endl;
+	std::cout << "isBoxOccluded: " << testMicroseconds / 1000.0 << " ms per pass, "
+		<< 1000.0 * testMicroseconds / count << " ns per box" << std::endl;
+	if (wrong > 0) {
+		std::ostringstream message;
+		message << wrong << " of " << count << " boxes were classified wrongly by the occlusion culler";
+		throw std::runtime_error(message.str());
+	}
+	std::cout << "All " << count << " boxes classified correctly" << std::endl;
+}
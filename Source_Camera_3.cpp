@@ -1,9 +1,9 @@
 #include "GL/glew.h"
-#include "glm\gtc\type_ptr.hpp"
-#include "GLFW\glfw3.h"
-#include "tdogl\Texture.h"
-#include "tdogl\Program.h"
-#include "tdogl\Camera.h"
+#include "glm/gtc/type_ptr.hpp"
+#include "GLFW/glfw3.h"
+#include "tdogl/Texture.h"
+#include "tdogl/Program.h"
+#include "tdogl/Camera.h"
 #include <iostream>
 
 #include <glm/gtc/matrix_transform.hpp>
@@ -1,8 +1,8 @@
 #include "GL/glew.h"
-#include "glm\gtc\type_ptr.hpp"
-#include "GLFW\glfw3.h"
-#include "tdogl\Texture.h"
-#include "tdogl\Program.h"
+#include "glm/gtc/type_ptr.hpp"
+#include "GLFW/glfw3.h"
+#include "tdogl/Texture.h"
+#include "tdogl/Program.h"
 #include <iostream>
 
 #include <glm/gtc/matrix_transform.hpp>
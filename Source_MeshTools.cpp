@@ -0,0 +1,118 @@
+// third-party libraries
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+// standard C++ libraries
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// tdogl classes
+#include "tdogl/MeshCache.h"
+#include "tdogl/MeshSimplifier.h"
+#include "tdogl/VirtualTexture.h"
+
+/*
+ Command line tools for baked meshes (see tdogl::MeshCache) and virtual textures
+
+  --bake-mesh <in.obj> <out.mesh> [lods]
+      converts a Wavefront OBJ file into the baked mesh format, with up to `lods` levels
+      of detail (default 4, 1 for none) made by tdogl::MeshSimplifier
+
+  --bench-mesh-load <in.obj> [iterations]
+      bakes the OBJ file next to itself, then compares the time to get the mesh into
+      VBOs by parsing the OBJ against mapping the baked file
+
+  --bake-virtual-texture <in.png> <outdir/> [tileSize]
+      cuts a large square image into the tiles of a tdogl::VirtualTexture, of `tileSize`
+      pixels (default 128) plus a border. The directory must exist.
+ */
+
+// bakes an OBJ file into a tdogl::MeshCache file, with levels of detail that each have
+// about half the triangles of the one before
+void BakeMeshMain(const std::string& objPath, const std::string& meshPath, unsigned lods)
+{
+	tdogl::MeshData mesh = tdogl::MeshData::meshDataFromObjFile(objPath);
+	if (lods > 1)
+		tdogl::MeshSimplifier::generateLods(mesh, lods);
+	tdogl::MeshCache::writeToFile(mesh, meshPath);
+	std::cout << "Baked " << objPath << " -> " << meshPath << ": " << mesh.vertexCount() << " vertices" << std::endl;
+	if (mesh.lods.empty())
+		std::cout << "  " << mesh.indices.size() / 3 << " triangles" << std::endl;
+	for (size_t i = 0; i < mesh.lods.size(); ++i) {
+		std::cout << "  LOD " << i << ": " << mesh.lods[i].indexCount / 3 << " triangles, error "
+			<< mesh.lods[i].error << std::endl;
+	}
+}
+
+// cuts an image into the tiles of every mip of a tdogl::VirtualTexture
+void BakeVirtualTextureMain(const std::string& imagePath, const std::string& directory, unsigned tileSize)
+{
+	tdogl::VirtualTexture::bake(imagePath, directory, tileSize);
+	std::cout << "Baked " << imagePath << " -> " << directory << ": tiles of " << tileSize << " pixels" << std::endl;
+}
+
+void OnErrorMeshTools(int /*errorCode*/, const char* msg)
+{
+	throw std::runtime_error(msg);
+}
+
+// times parse+upload of the OBJ file against map+upload of the baked file
+void BenchmarkMeshLoadMain(const std::string& objPath, int iterations)
+{
+	if (iterations <= 0)
+		throw std::runtime_error("The iteration count must be positive");
+
+	const std::string meshPath = objPath + ".mesh";
+	BakeMeshMain(objPath, meshPath, 1);
+
+	// a hidden window is enough to get a context for glBufferData
+	glfwSetErrorCallback(OnErrorMeshTools);
+	if (!glfwInit())
+		throw std::runtime_error("glfwInit failed");
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	GLFWwindow* window = glfwCreateWindow(64, 64, "Mesh load benchmark", NULL, NULL);
+	if (!window)
+		throw std::runtime_error("glfwCreateWindow failed. Can your hardware handle OpenGL 3.2?");
+	glfwMakeContextCurrent(window);
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK)
+		throw std::runtime_error("glewInit failed");
+	while (glGetError() != GL_NO_ERROR) {}
+
+	GLuint buffers[2];
+	glGenBuffers(2, buffers);
+
+	// glFinish makes sure the upload is included in the measured time
+	double objSeconds = 0.0;
+	for (int i = 0; i < iterations; ++i) {
+		double start = glfwGetTime();
+		tdogl::MeshData mesh = tdogl::MeshData::meshDataFromObjFile(objPath);
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+		glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(GLfloat), &mesh.vertices[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(GLuint), &mesh.indices[0], GL_STATIC_DRAW);
+		glFinish();
+		objSeconds += glfwGetTime() - start;
+	}
+
+	double cacheSeconds = 0.0;
+	for (int i = 0; i < iterations; ++i) {
+		double start = glfwGetTime();
+		tdogl::MeshCache mesh(meshPath);
+		mesh.upload(buffers[0], buffers[1]);
+		glFinish();
+		cacheSeconds += glfwGetTime() - start;
+	}
+
+	glDeleteBuffers(2, buffers);
+	glfwTerminate();
+
+	std::cout << "OBJ parse + upload:  " << 1000.0 * objSeconds / iterations << " ms" << std::endl;
+	std::cout << "Mesh map + upload:   " << 1000.0 * cacheSeconds / iterations << " ms" << std::endl;
+	std::cout << "Speedup:             " << objSeconds / cacheSeconds << "x" << std::endl;
+}
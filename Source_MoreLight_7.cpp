@@ -3,63 +3,239 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 // standard C++ libraries
 #include <cassert>
 #include <iostream>
 #include <stdexcept>
 #include <cmath>
-#include <list>
+#include <cstdlib>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <chrono>
 
 // tdogl classes
 #include "tdogl/Program.h"
+#include "tdogl/ResourceManager.h"
+#include "tdogl/TextureStreamer.h"
+#include "tdogl/VirtualTexture.h"
+#include "tdogl/GLDeleteQueue.h"
 #include "tdogl/Texture.h"
 #include "tdogl/Camera.h"
+#include "tdogl/MeshCache.h"
+#include "tdogl/RenderQueue.h"
+#include "tdogl/Frustum.h"
+#include "tdogl/OcclusionCuller.h"
+#include "tdogl/OcclusionQueries.h"
+#include "tdogl/TransformBatch.h"
+#include "tdogl/SceneGraph.h"
+#include "tdogl/JobSystem.h"
+#include "tdogl/FrameArena.h"
+#include "tdogl/AllocationCounter.h"
+#include "tdogl/TripleBuffer.h"
+#include "tdogl/MultiDrawBatch.h"
+#include "tdogl/CommandBuffer.h"
+#include "tdogl/Profiler.h"
+#include "tdogl/Framebuffer.h"
+#include "tdogl/GBuffer.h"
+#include "tdogl/DeferredLighting.h"
+#include "tdogl/PointShadowMap.h"
+#include "tdogl/CascadedShadowMap.h"
+#include "tdogl/HeadlessContext.h"
 
 /*
  Represents a textured geometry asset
 
  contains everything necessary to draw arbitrary geometry with a single texture.
   - shaders
-  - a VBO
-  - a VAO
-  - the parameters to glDrawArrays (drawType, drawStart, drawCount)
+  - a VBO, and an IBO if the geometry is indexed
+  - a VAO, one for the G-buffer shaders and one with only the positions for the depth pre-pass
+  - the parameters to glDrawArrays/glDrawElements (drawType, drawStart, drawCount, indexType)
+    for each level of detail. LOD 0 is the full mesh, all the LODs share the vertices.
+  - the object space bounding box
+  - optionally, a closed mesh inside the geometry that the occlusion culler can rasterize
  */
+const unsigned MAX_LODS7 = tdogl::MeshCache::MaxLods;
+
 struct ModelAsset {
 	tdogl::Program	*shaders;
-	tdogl::Texture	*texture;
+	tdogl::Texture	*texture; //pinned in gResources7 while the asset uses it
+	tdogl::TextureHandle	textureHandle;
+	tdogl::MeshHandle		meshHandle; //of vbo and ibo, if they came from gResources7
+	tdogl::TextureStreamer::TextureId	streamedTexture; //drawn instead of `texture` while gUseStreaming7, NoTexture if none
 	GLuint			vbo;
+	GLuint			ibo;
 	GLuint			vao;
+	GLuint			gbufferVao; //connected to gGBufferShaders7
+	GLuint			depthVao; //only "vert", connected to gDepthShaders7
 	GLenum			drawType;
-	GLint			drawStart;
-	GLint			drawCount;
+	unsigned		lodCount;
+	GLint			drawStart[MAX_LODS7]; //first vertex, or first index if indexed
+	GLint			drawCount[MAX_LODS7];
+	GLenum			indexType; //GL_NONE for glDrawArrays
 	GLfloat			shininess;
 	glm::vec3		specularColor;
+	glm::vec3		boundsMin;
+	glm::vec3		boundsMax;
+	GLint			batchMesh; //mesh id of LOD 0 in gBatch7, the other LODs follow. -1 if not batched
+	GLint			programUniforms; //index of the uniforms of `shaders` in gScenePrograms7, set by ResolveScenePrograms7
+	std::vector<glm::vec3>	occluderVertices; //empty if the asset doesn't hide what's behind it
+	std::vector<unsigned>	occluderIndices;
 
 	ModelAsset() :
 		shaders(nullptr),
 		texture(nullptr),
+		streamedTexture(tdogl::TextureStreamer::NoTexture),
 		vbo(0),
+		ibo(0),
 		vao(0),
+		gbufferVao(0),
+		depthVao(0),
 		drawType(GL_TRIANGLES),
-		drawStart(0),
-		drawCount(0),
+		lodCount(1),
+		indexType(GL_NONE),
 		shininess(0.0f),
-		specularColor(1.0f, 1.0f, 1.0f)
-	{ }
+		specularColor(1.0f, 1.0f, 1.0f),
+		boundsMin(0.0f, 0.0f, 0.0f),
+		boundsMax(0.0f, 0.0f, 0.0f),
+		batchMesh(-1),
+		programUniforms(-1)
+	{
+		for (unsigned i = 0; i < MAX_LODS7; ++i) {
+			drawStart[i] = 0;
+			drawCount[i] = 0;
+		}
+	}
 };
 
 /*
  Represents an instance of an 'ModelAsset'
- contains a pointer to the asset, and a model transformation matrix to be used
- when drawing.
+ contains a pointer to the asset, its node in gSceneGraph7, and the world matrix to be
+ used when drawing. The simulation owns the node; the render thread owns `transform`,
+ which it interpolates from the simulation's snapshots, `lod`, which it picks from the
+ size of the instance on screen, and `querySlot`.
+ Instances that are not `dynamic` must never move, so their draw commands can be cached.
  */
 struct ModelInstance {
 	ModelAsset	*asset;
+	tdogl::SceneGraph::NodeId node;
 	glm::mat4	transform;
+	unsigned	lod; //level of detail drawn in the last frame
+	int			querySlot; //slot in gQueries7 that the draw is conditional on, -1 if always drawn
+	bool		dynamic;
 	ModelInstance():
 		asset(nullptr),
-		transform()
+		node(tdogl::SceneGraph::NoParent),
+		transform(),
+		lod(0),
+		querySlot(-1),
+		dynamic(false)
+	{ }
+};
+
+/*
+ The locations of the per-draw uniforms of a program used by the scene. They are looked
+ up in advance, so that draw commands can be recorded without the GL context.
+ */
+struct ProgramUniforms7 {
+	tdogl::Program			*program;
+	GLint					model;
+	GLint					materialShininess;
+	GLint					materialSpecularColor;
+};
+
+/*
+ The GL state left bound by the previous recorded draw, so that redundant binds can be skipped
+ */
+struct RenderState7 {
+	const tdogl::Program	*program;
+	const ProgramUniforms7	*uniforms;
+	const ModelAsset		*asset;
+	GLuint					texture;
+	GLuint					vao;
+
+	RenderState7() :
+		program(nullptr),
+		uniforms(nullptr),
+		asset(nullptr),
+		texture(0),
+		vao(0)
+	{ }
+};
+
+/*
+ What the instances drawn in a frame would have cost at full detail, to measure what the
+ levels of detail save, and how many instances occlusion culling removed
+ */
+struct DrawCounts7 {
+	size_t	instances;
+	size_t	triangles;				//at the levels of detail that were drawn
+	size_t	fullDetailTriangles;	//if every instance had drawn LOD 0
+	size_t	occluded;				//in the frustum, but hidden behind occluders
+	size_t	queried;				//of `instances`, drawn only if their occlusion query passes
+
+	DrawCounts7() :
+		instances(0),
+		triangles(0),
+		fullDetailTriangles(0),
+		occluded(0),
+		queried(0)
+	{ }
+
+	void add(const DrawCounts7& other) {
+		instances += other.instances;
+		triangles += other.triangles;
+		fullDetailTriangles += other.fullDetailTriangles;
+		occluded += other.occluded;
+		queried += other.queried;
+	}
+};
+
+/*
+ What BuildRenderQueue7 found out about an instance
+ */
+enum Visibility7 {
+	Visibility_Outside,		//outside the frustum
+	Visibility_Visible,
+	Visibility_Occluder,	//visible, and drawn into the occlusion depth buffer
+	Visibility_Occluded		//in the frustum, but hidden behind occluders
+};
+
+/*
+ The command buffers that RecordQueue7 fills
+ */
+enum RecordPass7 {
+	RecordPass_Static,	//static instances that are always drawn
+	RecordPass_Dynamic,
+	RecordPass_Queried	//static instances drawn only if their occlusion query passes
+};
+
+/*
+ The world transform of an instance, split into translation, rotation and scale so that
+ it can be interpolated without shrinking or shearing
+ */
+struct Pose7 {
+	glm::vec3	translation;
+	glm::quat	rotation;
+	glm::vec3	scale;
+};
+
+/*
+ The world transforms of all of gInstances7 at one simulation step
+ */
+struct SceneSnapshot7 {
+	double				time; //seconds since the simulation started
+	std::vector<Pose7>	poses;
+
+	SceneSnapshot7() :
+		time(0.0)
 	{ }
 };
 
@@ -73,47 +249,214 @@ struct Light {
 	float		ambientCoefficient;
 };
 
+/*
+ Represents a directional light, like the sun
+*/
+struct DirectionalLight {
+	glm::vec3	direction; //the way the light travels
+	glm::vec3	intensities; //black for no light
+};
+
 // constants
 const glm::vec2 SCREEN_SIZE7(800, 600);
+const size_t MAX_LIGHTS7 = 8; //passed to the fragment shaders as MAX_LIGHTS
+const size_t RESOURCE_BUDGET7 = 256 * 1024 * 1024; //bytes of textures and meshes, beyond which the least recently used unpinned ones are evicted
+const size_t STREAM_BUDGET7 = 64 * 1024 * 1024; //bytes of the mips of the streamed textures
+const size_t STREAM_UPLOAD_BYTES7 = 4 * 1024 * 1024; //of streamed mips per frame, so a burst of loads doesn't stall a frame
+const unsigned MAX_DEFERRED_LIGHTS7 = 4096; //deferred shading isn't limited by the fragment shaders
+const float SIMULATION_STEP7 = 1.0f / 60.0f; //seconds
+const int MAX_CATCH_UP_STEPS7 = 5; //beyond this, a slow simulation drops time instead of falling further behind
+const float LOD_SCREEN_SIZE7 = 0.25f; //below this fraction of the viewport height, LOD 1 is used. Each further LOD at half the size.
+const float LOD_HYSTERESIS7 = 0.15f; //how far past a threshold the size must go before the LOD changes, so it doesn't flicker
+const unsigned OCCLUSION_WIDTH7 = 256; //size of the occlusion culling depth buffer
+const unsigned OCCLUSION_HEIGHT7 = 192;
+const size_t MAX_OCCLUDERS7 = 32; //the nearest this many static instances are rasterized as occluders
+const float OCCLUDER_SCREEN_SIZE7 = 0.1f; //smaller instances don't hide enough to be worth rasterizing
+const unsigned MAX_QUERIES7 = 1024; //occlusion queries per frame
+const float QUERY_SCREEN_SIZE7 = 0.05f; //smaller instances are cheaper to draw than to query
+const GLsizei POINT_SHADOW_SIZE7 = 512; //of each cube map face
+const GLsizei SUN_SHADOW_SIZE7 = 1024; //of each cascade
+const unsigned SUN_CASCADES7 = 3;
+const float SUN_SHADOW_DISTANCE7 = 80.0f; //from the camera. Further away, the sun casts no shadows.
+const float SUN_CASTER_DISTANCE7 = 50.0f; //how far towards the sun from a cascade a caster is still drawn
+const GLint POINT_SHADOW_UNIT7 = 5; //texture units of the shadow maps, clear of the material texture
+const GLint SUN_SHADOW_UNIT7 = 6;
+const glm::vec3 SUN_INTENSITIES7(0.5f, 0.5f, 0.45f);
+const unsigned VT_CACHE_SIDE7 = 16; //pages along each side of the page cache of the virtual texture
+const unsigned VT_UPLOADS_PER_FRAME7 = 8; //tiles copied into the page cache per frame
+const unsigned VT_FEEDBACK_DIVISOR7 = 4; //the feedback pass is this many times smaller than the screen, each way
+const GLint VT_INDIRECTION_UNIT7 = 1; //texture units of the virtual texture
+const GLint VT_CACHE_UNIT7 = 2;
+const float TERRAIN_EXTENT7 = 60.0f; //half the width of the virtual textured terrain
+const float TERRAIN_HEIGHT7 = -6.0f; //under the lowest crate
 
 // globals
 GLFWwindow	*gWindow7 = nullptr;
 double gScrollY7 = 0.0;
 tdogl::Camera gCamera7;
 ModelAsset gWoodenCrate7;
-std::list<ModelInstance> gInstances7;
+std::vector<ModelInstance> gInstances7;
+tdogl::SceneGraph gSceneGraph7;
 GLfloat gDegreesRotated7 = 0.0f;
-Light gLight7;
+std::vector<Light> gLights7;
+tdogl::RenderQueue gRenderQueue7;
+std::vector<const ModelInstance*> gVisibleInstances7;
+tdogl::RenderStats gRenderStats7;
+DrawCounts7 gDrawCounts7; //what was drawn in the last frame, including the cached commands
+std::vector<ProgramUniforms7> gScenePrograms7;
+std::vector<tdogl::CommandBuffer*> gStaticCommands7; //one per job system thread
+std::vector<tdogl::CommandBuffer*> gDynamicCommands7;
+bool gStaticCommandsValid7 = false;
+glm::mat4 gStaticCommandsCamera7; //the camera the static commands were culled and sorted for
+DrawCounts7 gStaticDrawCounts7; //what gStaticCommands7 draws
+bool gUseLods7 = true;
+tdogl::OcclusionCuller *gOcclusion7 = nullptr;
+bool gUseOcclusion7 = true;
+tdogl::OcclusionQueries *gQueries7 = nullptr;
+std::vector<tdogl::CommandBuffer*> gQueriedCommands7; //conditional draws, recorded and cached with gStaticCommands7
+std::vector<glm::vec3> gQueryBoxMin7; //world bounding box of each query slot
+std::vector<glm::vec3> gQueryBoxMax7;
+bool gUseQueries7 = false;
+tdogl::Program *gDepthShaders7 = nullptr; //positions only, for the depth pre-pass and the boxes of gQueries7
+GLint gDepthModelUniform7 = -1;
+std::vector<tdogl::CommandBuffer*> gStaticDepthCommands7; //the depth pre-pass of gStaticCommands7
+std::vector<tdogl::CommandBuffer*> gDynamicDepthCommands7;
+bool gUseDepthPrepass7 = false;
+bool gShowOverdraw7 = false;
+GLuint gFragmentQueries7[2] = { 0, 0 }; //samples passed in the colour pass, for the always drawn and the queried instances
+bool gFragmentQueriesIssued7 = false;
+GLuint gShadedFragments7 = 0; //by the colour pass, one frame late
+tdogl::Program *gGBufferShaders7 = nullptr; //draws the instances into gGBuffer7 instead of lighting them
+ProgramUniforms7 gGBufferUniforms7;
+tdogl::Program *gDeferredLightShaders7 = nullptr;
+tdogl::Program *gDeferredResolveShaders7 = nullptr;
+tdogl::GBuffer *gGBuffer7 = nullptr;
+tdogl::DeferredLighting *gDeferredLighting7 = nullptr;
+std::vector<tdogl::DeferredLighting::PointLight> gDeferredLights7; //gLights7, converted every frame
+bool gUseDeferred7 = false;
+DirectionalLight gSun7;
+tdogl::PointShadowMap *gPointShadows7 = nullptr; //of gLights7[0]
+tdogl::CascadedShadowMap *gSunShadows7 = nullptr;
+tdogl::CommandBuffer *gShadowCommands7 = nullptr; //the casters of one shadow map view, recorded and replayed straight away
+bool gUseShadows7 = true;
+bool gCacheShadows7 = true; //keep the shadows of the static instances until the light or the scene changes
+tdogl::JobSystem *gJobs7 = nullptr;
+tdogl::FrameArena *gFrameArena7 = nullptr; //per-frame scratch memory, one sub-arena per job system thread
+unsigned long long gFrameAllocations7 = 0; //heap allocations made during the last frame
+std::vector<std::string> gLightUniformNames7; //"allLights[i].position" etc., built once
+tdogl::TripleBuffer<SceneSnapshot7> gSnapshots7; //simulation -> render thread
+SceneSnapshot7 gPreviousSnapshot7; //the two newest snapshots received by the render thread
+SceneSnapshot7 gCurrentSnapshot7;
+std::atomic<bool> gQuitSimulation7(false);
+std::atomic<bool> gSimulationFailed7(false);
+std::exception_ptr gSimulationError7;
+tdogl::MultiDrawBatch *gBatch7 = nullptr;
+tdogl::Program *gBatchShaders7 = nullptr;
+bool gUseMultiDraw7 = false;
+tdogl::Profiler *gProfiler7 = nullptr;
+bool gSrgbFramebuffer7 = false; //the frames are drawn into sRGB framebuffers, which do the gamma correction. Set before InitScene7.
+#ifdef TDOGL_ASSET_DIR
+std::string path7 = std::string(TDOGL_ASSET_DIR); //set by the CMake build, e.g. for the headless mode on Linux
+#else
 std::string path7 = std::string("F:/Demo/TestVTKDemo/testModernOpenGL/");
-
-// return a new tdogl::Program created from the given vertex and fragment shader filenames
+#endif
+tdogl::ResourceManager *gResources7 = nullptr; //loads each texture, mesh and shader permutation once, and owns them
+tdogl::TextureStreamer *gStreamer7 = nullptr; //keeps the streamed textures at the mip they are seen at
+bool gUseStreaming7 = false;
+tdogl::VirtualTexture *gVirtualTexture7 = nullptr; //of the terrain, baked into path7 + "virtual-texture/". Null if it wasn't.
+bool gUseVirtualTexture7 = false;
+tdogl::Program *gTerrainShaders7 = nullptr;
+tdogl::Program *gTerrainFeedbackShaders7 = nullptr; //writes the tile each pixel of the terrain needs
+GLuint gTerrainVbo7 = 0;
+GLuint gTerrainVaos7[2] = { 0, 0 }; //for gTerrainShaders7 and gTerrainFeedbackShaders7
+
+// return the tdogl::Program of the given vertex and fragment shader filenames, built once per
+// set of defines. MAX_LIGHTS is always defined, and with gSrgbFramebuffer7, SRGB_FRAMEBUFFER
+// is too, so the shaders leave out the gamma.
 static tdogl::Program* LoadShaders7(const char* vertFilename, const char* fragFilename)
 {
-	std::vector<tdogl::Shader> shaders;
-	shaders.push_back(tdogl::Shader::shaderFromFile(path7 + vertFilename, GL_VERTEX_SHADER));
-	shaders.push_back(tdogl::Shader::shaderFromFile(path7 + fragFilename, GL_FRAGMENT_SHADER));
-	return new tdogl::Program(shaders);
+	std::ostringstream maxLights;
+	maxLights << "MAX_LIGHTS " << MAX_LIGHTS7;
+	std::vector<std::string> defines;
+	defines.push_back(maxLights.str());
+	if (gSrgbFramebuffer7)
+		defines.push_back("SRGB_FRAMEBUFFER");
+
+	return &gResources7->program(vertFilename, fragFilename, defines);
+}
+
+// loads the given texture file into `asset`, pinned so the asset can keep the pointer
+static void LoadTexture7(ModelAsset& asset, const char* filename)
+{
+	asset.textureHandle = gResources7->loadTexture(filename);
+	gResources7->pin(asset.textureHandle);
+	asset.texture = gResources7->texture(asset.textureHandle);
 }
 
-// returns a new tdogl::Texture created from the given filename
-static tdogl::Texture* LoadTexture7(const char* filename)
+// returns the texture to bind for `asset`: the streamed one while streaming is on
+static GLuint TextureObject7(const ModelAsset* asset)
 {
-	tdogl::Bitmap bmp = tdogl::Bitmap::bitmapFromFile(path7 + filename);
-	bmp.flipVertically();
-	return new tdogl::Texture(bmp);
+	if (gUseStreaming7 && asset->streamedTexture != tdogl::TextureStreamer::NoTexture)
+		return gStreamer7->object(asset->streamedTexture);
+	return asset->texture->object();
 }
 
+// prints how much of each type of resource gResources7 holds
+static void PrintResourceUsage7()
+{
+	static const char* const names[] = { "textures", "meshes", "programs" };
+	for (int t = 0; t < tdogl::ResourceManager::TypeCount; ++t) {
+		tdogl::ResourceManager::Usage usage = gResources7->usage((tdogl::ResourceManager::Type) t);
+		std::cout << "Resources, " << names[t] << ": " << usage.count << " resident, " << usage.bytes / 1024 << " KB, "
+			<< usage.loads << " loads (" << usage.hits << " already resident), " << usage.evictions << " evicted" << std::endl;
+	}
+}
+
+
+// connects the vertex layout of the crate to the attributes of `shaders`, for the bound vao and vbo
+static void SetCrateAttribPointers7(const tdogl::Program* shaders)
+{
+	// connect the xyz to the "vert" attribute of the vertex shader.
+	glEnableVertexAttribArray(shaders->attrib("vert"));
+	glVertexAttribPointer(shaders->attrib("vert"), 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), NULL);
+
+	// connect the uv coords to the "vertTexCoord" attribute of the vertex shader
+	glEnableVertexAttribArray(shaders->attrib("vertTexCoord"));
+	glVertexAttribPointer(shaders->attrib("vertTexCoord"), 2, GL_FLOAT, GL_TRUE, 8 * sizeof(GLfloat), (const GLvoid*) (3 * sizeof(GLfloat)));
+
+	// connect the normal to the "vertNormal" attribute of the vertex shader
+	glEnableVertexAttribArray(shaders->attrib("vertNormal"));
+	glVertexAttribPointer(shaders->attrib("vertNormal"), 3, GL_FLOAT, GL_TRUE, 8 * sizeof(GLfloat), (const GLvoid*) (5 * sizeof(GLfloat)));
+}
 
 // initialses the gWoodenCrate global
 static void LoadWoodenCrateAsset7()
 {
-	gWoodenCrate7.shaders = LoadShaders7("vertexShaders.txt", "FragmentShaders.txt");
+	gWoodenCrate7.shaders = LoadShaders7("vertexShaders.txt", "FragmentShaders - 7.txt");
 	gWoodenCrate7.drawType = GL_TRIANGLES;
-	gWoodenCrate7.drawStart = 0;
-	gWoodenCrate7.drawCount = 6 * 2 * 3;
-	gWoodenCrate7.texture = LoadTexture7("wooden-crate.jpg");
+	gWoodenCrate7.lodCount = 1; //a cube can't be simplified
+	gWoodenCrate7.drawStart[0] = 0;
+	gWoodenCrate7.drawCount[0] = 6 * 2 * 3;
+	LoadTexture7(gWoodenCrate7, "wooden-crate.jpg");
+	gWoodenCrate7.streamedTexture = gStreamer7->add("wooden-crate.jpg");
 	gWoodenCrate7.shininess = 80.0;
 	gWoodenCrate7.specularColor = glm::vec3(1.0f, 1.0f, 1.0f);
+	gWoodenCrate7.boundsMin = glm::vec3(-1.0f, -1.0f, -1.0f);
+	gWoodenCrate7.boundsMax = glm::vec3(1.0f, 1.0f, 1.0f);
+
+	//the crate is solid, so it occludes as its box: 8 corners, 2 counter-clockwise triangles per side
+	for (int i = 0; i < 8; ++i)
+		gWoodenCrate7.occluderVertices.push_back(glm::vec3((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f));
+	static const unsigned boxIndices[] = {
+		0, 2, 1, 1, 2, 3, //back
+		4, 5, 6, 5, 7, 6, //front
+		0, 1, 4, 1, 5, 4, //bottom
+		2, 6, 3, 3, 6, 7, //top
+		0, 4, 2, 2, 4, 6, //left
+		1, 3, 5, 3, 7, 5  //right
+	};
+	gWoodenCrate7.occluderIndices.assign(boxIndices, boxIndices + sizeof(boxIndices) / sizeof(boxIndices[0]));
+
 	glGenBuffers(1, &gWoodenCrate7.vbo);
 	glGenVertexArrays(1, &gWoodenCrate7.vao);
 
@@ -175,127 +518,1025 @@ static void LoadWoodenCrateAsset7()
 		1.0f, 1.0f, 1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f
 	};
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertexData), vertexData, GL_STATIC_DRAW);
+	SetCrateAttribPointers7(gWoodenCrate7.shaders);
 
-	// connect the xyz to the "vert" attribute of the vertex shader.
-	glEnableVertexAttribArray(gWoodenCrate7.shaders->attrib("vert"));
-	glVertexAttribPointer(gWoodenCrate7.shaders->attrib("vert"), 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), NULL);
-
-	// connect the uv coords to the "vertTexCoord" attribute of the vertex shader
-	glEnableVertexAttribArray(gWoodenCrate7.shaders->attrib("vertTexCoord"));
-	glVertexAttribPointer(gWoodenCrate7.shaders->attrib("vertTexCoord"), 2, GL_FLOAT, GL_TRUE, 8 * sizeof(GLfloat), (const GLvoid*) (3 * sizeof(GLfloat)));
+	// the same vbo for the G-buffer shaders, whose attribute locations may differ
+	glGenVertexArrays(1, &gWoodenCrate7.gbufferVao);
+	glBindVertexArray(gWoodenCrate7.gbufferVao);
+	SetCrateAttribPointers7(gGBufferShaders7);
 
-	// connect the normal to the "vertNormal" attribute of the vertex shader
-	glEnableVertexAttribArray(gWoodenCrate7.shaders->attrib("vertNormal"));
-	glVertexAttribPointer(gWoodenCrate7.shaders->attrib("vertNormal"), 3, GL_FLOAT, GL_TRUE, 8 * sizeof(GLfloat), (const GLvoid*) (5 * sizeof(GLfloat)));
+	// the same vbo with only the xyz, for the depth pre-pass
+	glGenVertexArrays(1, &gWoodenCrate7.depthVao);
+	glBindVertexArray(gWoodenCrate7.depthVao);
+	glEnableVertexAttribArray(gDepthShaders7->attrib("vert"));
+	glVertexAttribPointer(gDepthShaders7->attrib("vert"), 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), NULL);
 
 	// unbind the vao
 	glBindVertexArray(0);
 }
 
-// convenience function that returns a translation matrix
-glm::mat4 translate7(GLfloat x, GLfloat y, GLfloat z)
+// initialises `asset` from a baked mesh file (see tdogl::MeshCache), with all the levels of
+// detail in the file. The file is memory mapped and uploaded straight from the mapping, so
+// nothing is parsed at startup, and gResources7 keeps the buffers pinned for the asset.
+// `asset.shaders` must be set.
+static void LoadMeshAsset7(ModelAsset& asset, const std::string& meshFilename)
+{
+	asset.meshHandle = gResources7->loadMesh(meshFilename);
+	gResources7->pin(asset.meshHandle);
+	const tdogl::MeshBuffers* buffers = gResources7->mesh(asset.meshHandle);
+	const tdogl::MeshCache& mesh = buffers->cache();
+
+	asset.drawType = GL_TRIANGLES;
+	asset.lodCount = mesh.lodCount();
+	for (unsigned i = 0; i < asset.lodCount; ++i) {
+		asset.drawStart[i] = (GLint) mesh.lod(i).firstIndex;
+		asset.drawCount[i] = mesh.lod(i).indexCount;
+	}
+	asset.indexType = mesh.indexType();
+	asset.boundsMin = mesh.boundsMin();
+	asset.boundsMax = mesh.boundsMax();
+	asset.vbo = buffers->vbo();
+	asset.ibo = buffers->ibo();
+	glGenVertexArrays(1, &asset.vao);
+
+	//the vao records the element buffer binding
+	glBindVertexArray(asset.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, asset.vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, asset.ibo);
+	mesh.setVertexAttribPointers(*asset.shaders);
+
+	//the same buffers for the G-buffer shaders, and the positions alone for the depth pre-pass
+	glGenVertexArrays(1, &asset.gbufferVao);
+	glBindVertexArray(asset.gbufferVao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, asset.ibo);
+	mesh.setVertexAttribPointers(*gGBufferShaders7);
+
+	glGenVertexArrays(1, &asset.depthVao);
+	glBindVertexArray(asset.depthVao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, asset.ibo);
+	mesh.setVertexAttribPointer(*gDepthShaders7, "vert");
+	glBindVertexArray(0);
+}
+
+// adds an instance of `asset` to gInstances7, with a new node in gSceneGraph7 under `parent`
+static void AddInstance7(ModelAsset* asset, tdogl::SceneGraph::NodeId parent, const glm::vec3& position, const glm::vec3& scale)
 {
-	return glm::translate(glm::mat4(), glm::vec3(x, y, z));
+	ModelInstance inst;
+	inst.asset = asset;
+	inst.node = gSceneGraph7.createNode(parent);
+	gSceneGraph7.setPosition(inst.node, position);
+	gSceneGraph7.setScale(inst.node, scale);
+	gInstances7.push_back(inst);
 }
 
+// looks up the per-draw uniforms of every program used by gInstances7, points the assets at
+// them, and drops the cached commands of the previous scene. Call whenever the instances are
+// replaced.
+static void ResolveScenePrograms7()
+{
+	gScenePrograms7.clear();
+	for (size_t i = 0; i < gInstances7.size(); ++i) {
+		ModelAsset *asset = gInstances7[i].asset;
+		tdogl::Program *program = asset->shaders;
+		asset->programUniforms = -1;
+		for (size_t p = 0; p < gScenePrograms7.size() && asset->programUniforms < 0; ++p) {
+			if (gScenePrograms7[p].program == program)
+				asset->programUniforms = (GLint) p;
+		}
+		if (asset->programUniforms >= 0)
+			continue;
+
+		asset->programUniforms = (GLint) gScenePrograms7.size();
+		ProgramUniforms7 uniforms;
+		uniforms.program = program;
+		uniforms.model = program->uniform("model");
+		uniforms.materialShininess = program->uniform("materialShininess");
+		uniforms.materialSpecularColor = program->uniform("materialSpecularColor");
+		gScenePrograms7.push_back(uniforms);
+	}
+	gStaticCommandsValid7 = false;
+	if (gPointShadows7)
+		gPointShadows7->invalidate();
+	if (gSunShadows7)
+		gSunShadows7->invalidate();
+}
 
-// convenience function that returns a scaling matrix
-glm::mat4 scale7(GLfloat x, GLfloat y, GLfloat z)
+// splits a world matrix into a Pose7. The scene graph scales each node before rotating it,
+// and only the instances have non-uniform scales, so the world matrices have no shear.
+static Pose7 DecomposeTransform7(const glm::mat4& transform)
 {
-	return glm::scale(glm::mat4(), glm::vec3(x, y, z));
+	Pose7 pose;
+	pose.translation = glm::vec3(transform[3]);
+	glm::mat3 rotation(transform);
+	pose.scale = glm::vec3(glm::length(rotation[0]), glm::length(rotation[1]), glm::length(rotation[2]));
+	if (glm::determinant(rotation) < 0.0f)
+		pose.scale.x = -pose.scale.x; //a mirror, which the rotation can't hold
+	for (int c = 0; c < 3; ++c) {
+		if (pose.scale[c] != 0.0f)
+			rotation[c] /= pose.scale[c];
+	}
+	pose.rotation = glm::normalize(glm::quat_cast(rotation));
+	return pose;
 }
 
-static void CreateInstances7()
+// the world matrix of a Pose7
+static glm::mat4 ComposeTransform7(const Pose7& pose)
 {
-	ModelInstance dot;
-	dot.asset = &gWoodenCrate7;
-	dot.transform = glm::mat4();
-	gInstances7.push_back(dot);
+	glm::mat3 rotationScale = glm::mat3_cast(pose.rotation);
+	for (int c = 0; c < 3; ++c)
+		rotationScale[c] *= pose.scale[c];
+	glm::mat4 transform(rotationScale);
+	transform[3] = glm::vec4(pose.translation, 1.0f);
+	return transform;
+}
 
-	ModelInstance i;
-	i.asset = &gWoodenCrate7;
-	i.transform = translate7(0, -4, 0) * scale7(1, 2, 1);
-	gInstances7.push_back(i);
+// simulation side: updates gSceneGraph7 and publishes the world transforms of all the
+// instances as the state at `time`
+static void PublishSnapshot7(double time)
+{
+	gSceneGraph7.update();
+
+	//the write buffer is two snapshots old, so every pose is written, not just the changed ones
+	SceneSnapshot7& snapshot = gSnapshots7.writeBuffer();
+	snapshot.time = time;
+	snapshot.poses.resize(gInstances7.size());
+	for (size_t i = 0; i < gInstances7.size(); ++i)
+		snapshot.poses[i] = DecomposeTransform7(gSceneGraph7.worldTransform(gInstances7[i].node));
+	gSnapshots7.publish();
+}
 
-	ModelInstance hLeft;
-	hLeft.asset = &gWoodenCrate7;
-	hLeft.transform = translate7(-8, 0, 0) * scale7(1, 6, 1);
-	gInstances7.push_back(hLeft);
+// render side: takes the newest snapshot, if the simulation published one since the last call
+static void ReceiveSnapshot7()
+{
+	if (!gSnapshots7.consume())
+		return;
 
-	ModelInstance hRight;
-	hRight.asset = &gWoodenCrate7;
-	hRight.transform = translate7(-4, 0, 0) * scale7(1, 6, 1);
-	gInstances7.push_back(hRight);
+	std::swap(gPreviousSnapshot7, gCurrentSnapshot7);
+	gCurrentSnapshot7.time = gSnapshots7.readBuffer().time;
+	gCurrentSnapshot7.poses = gSnapshots7.readBuffer().poses;
+}
 
-	ModelInstance hMid;
-	hMid.asset = &gWoodenCrate7;
-	hMid.transform = translate7(-6, 0, 0) * scale7(2, 1, 0.8f);
-	gInstances7.push_back(hMid);
+// render side: sets the transforms of gInstances7 to the state at `time`, between the two
+// newest snapshots. Translations and scales are blended, and rotations slerped.
+static void InterpolateTransforms7(double time)
+{
+	const SceneSnapshot7& previous = gPreviousSnapshot7;
+	const SceneSnapshot7& current = gCurrentSnapshot7;
+	if (current.poses.size() != gInstances7.size())
+		return; //nothing published for this scene yet
+
+	float alpha = 1.0f;
+	if (current.time > previous.time && previous.poses.size() == current.poses.size())
+		alpha = (float) glm::clamp((time - previous.time) / (current.time - previous.time), 0.0, 1.0);
+
+	gJobs7->parallelFor(gInstances7.size(), 1024, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			if (alpha >= 1.0f) {
+				gInstances7[i].transform = ComposeTransform7(current.poses[i]);
+			} else {
+				Pose7 pose;
+				pose.translation = glm::mix(previous.poses[i].translation, current.poses[i].translation, alpha);
+				pose.rotation = glm::slerp(previous.poses[i].rotation, current.poses[i].rotation, alpha);
+				pose.scale = glm::mix(previous.poses[i].scale, current.poses[i].scale, alpha);
+				gInstances7[i].transform = ComposeTransform7(pose);
+			}
+		}
+	});
 }
 
-// renders a single 'ModelInstance'
-static void RenderInstance7(const ModelInstance& inst)
+static void CreateInstances7()
 {
-	ModelAsset *asset = inst.asset;
-	tdogl::Program *shaders = asset->shaders;
+	//the letters of "Hi" are children of one node, so the word can be moved as a whole
+	tdogl::SceneGraph::NodeId hi = gSceneGraph7.createNode();
+
+	//the dot is first, because UpdateScene7 rotates the first instance
+	AddInstance7(&gWoodenCrate7, hi, glm::vec3(0, 0, 0), glm::vec3(1, 1, 1));
+	AddInstance7(&gWoodenCrate7, hi, glm::vec3(0, -4, 0), glm::vec3(1, 2, 1));
+
+	tdogl::SceneGraph::NodeId h = gSceneGraph7.createNode(hi);
+	gSceneGraph7.setPosition(h, glm::vec3(-6, 0, 0));
+	AddInstance7(&gWoodenCrate7, h, glm::vec3(-2, 0, 0), glm::vec3(1, 6, 1));
+	AddInstance7(&gWoodenCrate7, h, glm::vec3(2, 0, 0), glm::vec3(1, 6, 1));
+	AddInstance7(&gWoodenCrate7, h, glm::vec3(0, 0, 0), glm::vec3(2, 1, 0.8f));
+	gInstances7.front().dynamic = true;
+
+	PublishSnapshot7(0.0);
+	ResolveScenePrograms7();
+}
 
-	//bind the shaders
-	shaders->use();
+// merges the geometry of every asset used by gInstances7 into gBatch7, if the
+// GL 4.3 multi-draw indirect path is available
+static void CreateMultiDrawBatch7()
+{
+	if (!tdogl::MultiDrawBatch::isSupported()) {
+		std::cout << "Multi-draw indirect not available, using per-instance draws" << std::endl;
+		return;
+	}
 
-	//set the shader uniforms
-	shaders->setUniform("camera", gCamera7.matrix());
-	shaders->setUniform("model", inst.transform);
-	shaders->setUniform("materialTex", 0); //set to 0 because the texture will be bound to GL_TEXTURE0
-	shaders->setUniform("materialShininess", asset->shininess);
-	shaders->setUniform("materialSpecularColor", asset->specularColor);
-	shaders->setUniform("light.position", gLight7.position);
-	shaders->setUniform("light.intensities", gLight7.intensities);
-	shaders->setUniform("light.attenuation", gLight7.attenuation);
-	shaders->setUniform("light.ambientCoefficient", gLight7.ambientCoefficient);
-	shaders->setUniform("cameraPosition", gCamera7.position());
+	if (!gBatchShaders7)
+		gBatchShaders7 = LoadShaders7("vertexShaders - Batched.txt", "FragmentShaders - Batched.txt");
+	tdogl::MeshData layout; //all the assets use the standard vert/vertTexCoord/vertNormal layout
+	gBatch7 = new tdogl::MultiDrawBatch(layout.attributes, layout.stride);
+
+	for (size_t i = 0; i < gInstances7.size(); ++i) {
+		ModelAsset *asset = gInstances7[i].asset;
+		if (asset->batchMesh >= 0)
+			continue;
+		for (unsigned lod = 0; lod < asset->lodCount; ++lod) {
+			GLint mesh = (GLint) gBatch7->addMesh(asset->vbo, asset->ibo, asset->indexType, asset->drawStart[lod], asset->drawCount[lod]);
+			if (lod == 0)
+				asset->batchMesh = mesh;
+		}
+	}
+	gBatch7->build(*gBatchShaders7);
+	gUseMultiDraw7 = true;
+}
 
+// sets the "numLights" and "allLights" uniforms of the currently used program from gLights7
+static void SetLightUniforms7(tdogl::Program* shaders)
+{
+	if (gLights7.size() > MAX_LIGHTS7)
+		throw std::runtime_error("Too many lights for the fragment shader");
+
+	//the names are built the first time only, so setting the lights doesn't allocate every frame
+	static const char* memberNames[] = { "position", "intensities", "attenuation", "ambientCoefficient" };
+	if (gLightUniformNames7.empty()) {
+		for (size_t i = 0; i < MAX_LIGHTS7; ++i) {
+			for (size_t m = 0; m < 4; ++m) {
+				std::ostringstream name;
+				name << "allLights[" << i << "]." << memberNames[m];
+				gLightUniformNames7.push_back(name.str());
+			}
+		}
+	}
+
+	shaders->setUniform("numLights", (GLint) gLights7.size());
+	for (size_t i = 0; i < gLights7.size(); ++i) {
+		shaders->setUniform(gLightUniformNames7[4 * i + 0].c_str(), gLights7[i].position);
+		shaders->setUniform(gLightUniformNames7[4 * i + 1].c_str(), gLights7[i].intensities);
+		shaders->setUniform(gLightUniformNames7[4 * i + 2].c_str(), gLights7[i].attenuation);
+		shaders->setUniform(gLightUniformNames7[4 * i + 3].c_str(), gLights7[i].ambientCoefficient);
+	}
+}
+
+// records the draw call of the level of detail of `inst` picked by BuildRenderQueue7. The VAO
+// of the asset must be bound.
+static void RecordDraw7(const ModelInstance& inst, tdogl::CommandBuffer& commands)
+{
+	const ModelAsset *asset = inst.asset;
+	const unsigned lod = inst.lod;
+	if (asset->indexType == GL_NONE) {
+		commands.drawArrays(asset->drawType, asset->drawStart[lod], asset->drawCount[lod]);
+	} else {
+		GLintptr indexSize = (asset->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+		commands.drawElements(asset->drawType, asset->drawCount[lod], asset->indexType, asset->drawStart[lod] * indexSize);
+	}
+}
+
+// records the draw of a single 'ModelInstance' into `commands`, only changing the GL state
+// that differs from `state`. With deferred shading, the instance is drawn into the G-buffer
+// by gGBufferShaders7 instead of being lit by its own shaders. Doesn't call OpenGL or look
+// anything up by name, so it can run on any thread. The asset must have been resolved by
+// ResolveScenePrograms7.
+static void RecordInstance7(const ModelInstance& inst, RenderState7& state, tdogl::CommandBuffer& commands)
+{
+	const ModelAsset *asset = inst.asset;
+	const tdogl::Program *shaders = (gUseDeferred7 ? gGBufferShaders7 : asset->shaders);
+	const GLuint vao = (gUseDeferred7 ? asset->gbufferVao : asset->vao);
+
+	//bind the shaders. The uniforms that are the same for every instance are set by SetFrameUniforms7
+	if (shaders != state.program) {
+		commands.useProgram(shaders->object());
+		state.program = shaders;
+		state.uniforms = (gUseDeferred7 ? &gGBufferUniforms7 : &gScenePrograms7[asset->programUniforms]);
+		state.asset = nullptr; //material uniforms belong to the previous program
+	}
+
+	//set the material uniforms
+	if (asset != state.asset) {
+		commands.setUniform(state.uniforms->materialShininess, asset->shininess);
+		commands.setUniform(state.uniforms->materialSpecularColor, asset->specularColor);
+		state.asset = asset;
+	}
+	commands.setUniform(state.uniforms->model, inst.transform);
 
 	//bind the texture
+	if (TextureObject7(asset) != state.texture) {
+		commands.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, TextureObject7(asset));
+		state.texture = TextureObject7(asset);
+	}
+
+	//bind vao and draw the level of detail picked by BuildRenderQueue7
+	if (vao != state.vao) {
+		commands.bindVertexArray(vao);
+		state.vao = vao;
+	}
+	RecordDraw7(inst, commands);
+}
+
+// records the depth pre-pass draw of a single 'ModelInstance' into `commands`, with
+// gDepthShaders7 and the position-only VAO of the asset
+static void RecordDepthInstance7(const ModelInstance& inst, RenderState7& state, tdogl::CommandBuffer& commands)
+{
+	if (state.program != gDepthShaders7) {
+		commands.useProgram(gDepthShaders7->object());
+		state.program = gDepthShaders7;
+	}
+	commands.setUniform(gDepthModelUniform7, inst.transform);
+	if (inst.asset->depthVao != state.vao) {
+		commands.bindVertexArray(inst.asset->depthVao);
+		state.vao = inst.asset->depthVao;
+	}
+	RecordDraw7(inst, commands);
+}
+
+// returns the level of detail of `asset` to draw at `screenSize`, the fraction of the viewport
+// height covered by the bounding sphere. A LOD is only left once the size is LOD_HYSTERESIS7
+// past its threshold, so an instance near a threshold doesn't switch back and forth.
+static unsigned SelectLod7(const ModelAsset& asset, unsigned current, float screenSize)
+{
+	unsigned lod = std::min(current, asset.lodCount - 1);
+	while (lod + 1 < asset.lodCount && screenSize < ldexp(LOD_SCREEN_SIZE7, -(int) lod) * (1.0f - LOD_HYSTERESIS7))
+		++lod;
+	while (lod > 0 && screenSize > ldexp(LOD_SCREEN_SIZE7, 1 - (int) lod) * (1.0f + LOD_HYSTERESIS7))
+		--lod;
+	return lod;
+}
+
+// changes the Visibility_Visible instances in `visibility` to Visibility_Occluded if they are
+// hidden behind other instances. The nearest large static instances that have an occluder
+// mesh are rasterized into gOcclusion7 first, unless `dynamicOnly` is true. Then the depth
+// from the last full rebuild is still valid, because the camera hasn't moved since and
+// dynamic instances never occlude.
+static void CullOccluded7(bool dynamicOnly, unsigned char* visibility, const glm::vec3* worldMin, const glm::vec3* worldMax,
+	const float* screenSizes, const float* distances)
+{
+	const size_t count = gInstances7.size();
+	if (!dynamicOnly) {
+		typedef std::pair<float, size_t> Candidate; //distance, instance
+		typedef std::vector<Candidate, tdogl::ArenaAllocator<Candidate> > CandidateList;
+		tdogl::ArenaAllocator<Candidate> allocator(*gFrameArena7);
+		CandidateList candidates(allocator);
+		for (size_t i = 0; i < count; ++i) {
+			const ModelInstance& inst = gInstances7[i];
+			if (visibility[i] == Visibility_Visible && !inst.dynamic && !inst.asset->occluderIndices.empty() && screenSizes[i] >= OCCLUDER_SCREEN_SIZE7)
+				candidates.push_back(Candidate(distances[i], i));
+		}
+		size_t occluders = std::min(candidates.size(), MAX_OCCLUDERS7);
+		std::partial_sort(candidates.begin(), candidates.begin() + occluders, candidates.end());
+
+		gOcclusion7->clear(gCamera7.matrix());
+		for (size_t c = 0; c < occluders; ++c) {
+			const ModelInstance& inst = gInstances7[candidates[c].second];
+			gOcclusion7->rasterize(inst.transform,
+				&inst.asset->occluderVertices[0], inst.asset->occluderVertices.size(),
+				&inst.asset->occluderIndices[0], inst.asset->occluderIndices.size());
+
+			//an occluder isn't tested against itself, where rounding could hide it
+			visibility[candidates[c].second] = Visibility_Occluder;
+		}
+		gOcclusion7->buildHierarchy();
+	}
+
+	gJobs7->parallelFor(count, 256, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			if (visibility[i] == Visibility_Visible && gOcclusion7->isBoxOccluded(worldMin[i], worldMax[i]))
+				visibility[i] = Visibility_Occluded;
+		}
+	});
+}
+
+// fills gRenderQueue7 with the instances that are inside the camera frustum and not occluded,
+// only the dynamic ones if `dynamicOnly` is true. The instances are culled, given sort keys
+// and have their level of detail picked in parallel, in ranges of gInstances7. What was
+// queued is counted in `staticCounts` and `dynamicCounts`.
+// If gUseQueries7 is set, a full rebuild also gives the large static instances a slot in
+// gQueries7, and puts their bounding boxes in gQueryBoxMin7 and gQueryBoxMax7.
+static void BuildRenderQueue7(bool dynamicOnly, DrawCounts7& staticCounts, DrawCounts7& dynamicCounts)
+{
+	gRenderQueue7.clear();
+	gVisibleInstances7.clear();
+
+	const size_t count = gInstances7.size();
+	if (count == 0)
+		return;
+
+	//the sort keys, visibility and bounds only live until the queue is built
+	typedef std::vector<uint64_t, tdogl::ArenaAllocator<uint64_t> > KeyList;
+	typedef std::vector<unsigned char, tdogl::ArenaAllocator<unsigned char> > FlagList;
+	KeyList keys(count, 0, KeyList::allocator_type(*gFrameArena7));
+	FlagList visibility(count, Visibility_Outside, FlagList::allocator_type(*gFrameArena7));
+	glm::vec3 *worldMin = gFrameArena7->allocateArray<glm::vec3>(count);
+	glm::vec3 *worldMax = gFrameArena7->allocateArray<glm::vec3>(count);
+	float *screenSizes = gFrameArena7->allocateArray<float>(count);
+	float *distances = gFrameArena7->allocateArray<float>(count);
+
+	const tdogl::Frustum frustum(gCamera7.matrix());
+	const glm::vec3 cameraPosition = gCamera7.position();
+	const float farPlane = gCamera7.farPlane();
+	const float tanHalfFov = tan(glm::radians(0.5f * gCamera7.fieldOfView()));
+	gJobs7->parallelForWithThread(count, 256, [&](unsigned thread, size_t begin, size_t end) {
+		//gather the transforms and bounds of the range into scratch arrays from this thread's
+		//sub-arena, so they can be transformed in one batch
+		const size_t n = end - begin;
+		glm::mat4 *transforms = gFrameArena7->allocateArray<glm::mat4>(n, thread);
+		glm::vec3 *boundsMin = gFrameArena7->allocateArray<glm::vec3>(n, thread);
+		glm::vec3 *boundsMax = gFrameArena7->allocateArray<glm::vec3>(n, thread);
+		for (size_t i = 0; i < n; ++i) {
+			transforms[i] = gInstances7[begin + i].transform;
+			boundsMin[i] = gInstances7[begin + i].asset->boundsMin;
+			boundsMax[i] = gInstances7[begin + i].asset->boundsMax;
+		}
+		tdogl::TransformBatch::transformBoxes(transforms, boundsMin, boundsMax, worldMin + begin, worldMax + begin, n);
+
+		for (size_t i = begin; i < end; ++i) {
+			ModelInstance& inst = gInstances7[i];
+			if (!dynamicOnly)
+				inst.querySlot = -1;
+			if (!(!dynamicOnly || inst.dynamic) || !frustum.intersectsBox(worldMin[i], worldMax[i]))
+				continue;
+			visibility[i] = Visibility_Visible;
+
+			//the projected size of the sphere around the world bounding box picks the LOD
+			distances[i] = glm::length(0.5f * (worldMin[i] + worldMax[i]) - cameraPosition);
+			float radius = 0.5f * glm::length(worldMax[i] - worldMin[i]);
+			screenSizes[i] = (distances[i] > radius ? radius / (distances[i] * tanHalfFov) : 1.0f);
+			inst.lod = (gUseLods7 ? SelectLod7(*inst.asset, inst.lod, screenSizes[i]) : 0);
+
+			float depth = distances[i] / farPlane;
+			keys[i] = tdogl::RenderQueue::makeKey(false,
+				inst.asset->shaders->object(),
+				TextureObject7(inst.asset),
+				inst.asset->vao,
+				depth);
+		}
+	});
+
+	if (gUseOcclusion7) {
+		tdogl::ProfileScope scope(*gProfiler7, "Occlusion", false);
+		CullOccluded7(dynamicOnly, &visibility[0], worldMin, worldMax, screenSizes, distances);
+	}
+
+	//the query boxes are only replaced along with the static commands that use them
+	const bool assignQueries = !dynamicOnly && gUseQueries7 && !gUseMultiDraw7;
+	if (!dynamicOnly) {
+		gQueryBoxMin7.clear();
+		gQueryBoxMax7.clear();
+	}
+	const glm::vec3 nearMargin(gCamera7.nearPlane());
+
+	//compact in instance order, so the queue doesn't depend on which thread did what
+	for (size_t i = 0; i < count; ++i) {
+		if (visibility[i] == Visibility_Outside)
+			continue;
+		ModelInstance& inst = gInstances7[i];
+		DrawCounts7& counts = (inst.dynamic ? dynamicCounts : staticCounts);
+		if (visibility[i] == Visibility_Occluded) {
+			++counts.occluded;
+			continue;
+		}
+
+		//an occluder is drawn before the queries, so its depth can hide the others. A box that
+		//the near plane could cut would be wrongly hidden, so the camera must be well outside it.
+		if (assignQueries && visibility[i] == Visibility_Visible && !inst.dynamic
+			&& screenSizes[i] >= QUERY_SCREEN_SIZE7 && gQueryBoxMin7.size() < MAX_QUERIES7
+			&& (glm::any(glm::lessThan(cameraPosition, worldMin[i] - nearMargin)) || glm::any(glm::greaterThan(cameraPosition, worldMax[i] + nearMargin)))) {
+			inst.querySlot = (int) gQueryBoxMin7.size();
+			gQueryBoxMin7.push_back(worldMin[i]);
+			gQueryBoxMax7.push_back(worldMax[i]);
+			++counts.queried;
+		}
+
+		gRenderQueue7.push(keys[i], (unsigned) gVisibleInstances7.size());
+		gVisibleInstances7.push_back(&inst);
+		++counts.instances;
+		counts.triangles += inst.asset->drawCount[inst.lod] / 3;
+		counts.fullDetailTriangles += inst.asset->drawCount[0] / 3;
+	}
+
+	gRenderQueue7.sort();
+}
+
+// records the draws of the instances in gRenderQueue7 that belong to `pass` into `buffers`,
+// and their depth pre-pass draws into `depthBuffers` unless it is null. The queue is split
+// into consecutive ranges that are recorded in parallel, one buffer per range, so replaying
+// the buffers in order keeps the sort order.
+static void RecordQueue7(std::vector<tdogl::CommandBuffer*>& buffers, RecordPass7 pass, std::vector<tdogl::CommandBuffer*>* depthBuffers)
+{
+	//small queues aren't worth splitting
+	const size_t count = gRenderQueue7.size();
+	const size_t minRange = 256;
+	const size_t ranges = std::max((size_t) 1, std::min(buffers.size(), count / minRange));
+	for (size_t r = 0; r < buffers.size(); ++r) {
+		buffers[r]->reset();
+		if (depthBuffers)
+			(*depthBuffers)[r]->reset();
+	}
+
+	gJobs7->parallelFor(ranges, 1, [&](size_t begin, size_t end) {
+		for (size_t r = begin; r < end; ++r) {
+			tdogl::CommandBuffer& commands = *buffers[r];
+			RenderState7 state, depthState;
+			for (size_t i = count * r / ranges; i < count * (r + 1) / ranges; ++i) {
+				const ModelInstance& inst = *gVisibleInstances7[gRenderQueue7.item(i)];
+				bool inPass;
+				if (pass == RecordPass_Dynamic)
+					inPass = inst.dynamic;
+				else if (pass == RecordPass_Static)
+					inPass = !inst.dynamic && inst.querySlot < 0;
+				else
+					inPass = inst.querySlot >= 0;
+				if (!inPass)
+					continue;
+
+				if (depthBuffers)
+					RecordDepthInstance7(inst, depthState, *(*depthBuffers)[r]);
+				if (pass == RecordPass_Queried) {
+					//conditional rendering only skips the draw, the state changes still happen,
+					//so `state` stays right whatever the query finds
+					commands.beginConditionalRender(gQueries7->query((unsigned) inst.querySlot), GL_QUERY_WAIT);
+					RecordInstance7(inst, state, commands);
+					commands.endConditionalRender();
+				} else {
+					RecordInstance7(inst, state, commands);
+				}
+			}
+		}
+	});
+}
+
+// draws the static instances, or the dynamic ones if `dynamic` is true, into the depth of the
+// bound shadow map. Only the ones inside `viewProjection` are drawn, at the level of detail
+// they had in the last frame.
+static void DrawShadowCasters7(const glm::mat4& viewProjection, bool dynamic)
+{
+	const tdogl::Frustum frustum(viewProjection);
+	gShadowCommands7->reset();
+	RenderState7 state;
+	for (size_t i = 0; i < gInstances7.size(); ++i) {
+		const ModelInstance& inst = gInstances7[i];
+		if (inst.dynamic != dynamic)
+			continue;
+		glm::vec3 worldMin, worldMax;
+		tdogl::Frustum::transformBox(inst.transform, inst.asset->boundsMin, inst.asset->boundsMax, worldMin, worldMax);
+		if (frustum.intersectsBox(worldMin, worldMax))
+			RecordDepthInstance7(inst, state, *gShadowCommands7);
+	}
+
+	gDepthShaders7->use();
+	gDepthShaders7->setUniform("camera", viewProjection);
+	gShadowCommands7->replay(&gRenderStats7);
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
+
+// renders the shadow maps of gLights7[0] and gSun7. The shadows of the static instances are
+// cached by the shadow maps, so each frame usually only draws the dynamic instances.
+static void UpdateShadows7()
+{
+	if (!gCacheShadows7) {
+		gPointShadows7->invalidate();
+		gSunShadows7->invalidate();
+	}
+
+	tdogl::PointShadowMap::DrawCasters drawStatic = [](const glm::mat4& viewProjection) { DrawShadowCasters7(viewProjection, false); };
+	tdogl::PointShadowMap::DrawCasters drawDynamic = [](const glm::mat4& viewProjection) { DrawShadowCasters7(viewProjection, true); };
+	if (!gLights7.empty()) {
+		float radius = tdogl::DeferredLighting::lightRadius(gLights7[0].intensities, gLights7[0].attenuation, gCamera7.farPlane());
+		gPointShadows7->update(gLights7[0].position, radius, drawStatic, drawDynamic);
+	}
+	if (gSun7.intensities != glm::vec3(0.0f))
+		gSunShadows7->update(gCamera7, SUN_SHADOW_DISTANCE7, gSun7.direction, drawStatic, drawDynamic);
+}
+
+// sets the uniforms that are the same for every draw in every program of gScenePrograms7
+static void SetFrameUniforms7()
+{
+	glm::mat4 cascadeMatrices[tdogl::CascadedShadowMap::MaxCascades];
+	for (unsigned i = 0; i < gSunShadows7->cascadeCount(); ++i)
+		cascadeMatrices[i] = gSunShadows7->shadowMatrix(i);
+
+	for (size_t i = 0; i < gScenePrograms7.size(); ++i) {
+		tdogl::Program *shaders = gScenePrograms7[i].program;
+		shaders->use();
+		shaders->setUniform("camera", gCamera7.matrix());
+		shaders->setUniform("materialTex", 0); //set to 0 because the texture will be bound to GL_TEXTURE0
+		SetLightUniforms7(shaders);
+		shaders->setUniform("cameraPosition", gCamera7.position());
+		shaders->setUniform("showOverdraw", (GLint) gShowOverdraw7);
+		shaders->setUniform("shadows", (GLint) gUseShadows7);
+		shaders->setUniform("pointShadowTex", POINT_SHADOW_UNIT7);
+		shaders->setUniform("pointShadowPlanes", gPointShadows7->nearPlane(), gPointShadows7->farPlane());
+		shaders->setUniform("sunDirection", gSun7.direction);
+		shaders->setUniform("sunIntensities", gSun7.intensities);
+		shaders->setUniform("sunShadowTex", SUN_SHADOW_UNIT7);
+		shaders->setUniform("numCascades", (GLint) gSunShadows7->cascadeCount());
+		shaders->setUniformMatrix4("cascadeMatrices", &cascadeMatrices[0][0][0], (GLsizei) gSunShadows7->cascadeCount());
+	}
+}
+
+// sets the per-frame uniforms of gGBufferShaders7, and converts gLights7 for gDeferredLighting7
+static void SetDeferredFrameUniforms7()
+{
+	gGBufferShaders7->use();
+	gGBufferShaders7->setUniform("camera", gCamera7.matrix());
+	gGBufferShaders7->setUniform("materialTex", 0); //set to 0 because the texture will be bound to GL_TEXTURE0
+
+	gDeferredLights7.resize(gLights7.size());
+	for (size_t i = 0; i < gLights7.size(); ++i) {
+		tdogl::DeferredLighting::PointLight& light = gDeferredLights7[i];
+		light.position = gLights7[i].position;
+		light.intensities = gLights7[i].intensities;
+		light.attenuation = gLights7[i].attenuation;
+		light.radius = tdogl::DeferredLighting::lightRadius(light.intensities, light.attenuation, gCamera7.farPlane());
+	}
+}
+
+// reads the number of fragments shaded by the colour pass of an earlier frame into
+// gShadedFragments7, if the GPU has finished counting. Never waits.
+static void CollectShadedFragments7()
+{
+	if (!gFragmentQueriesIssued7)
+		return;
+	GLuint available[2] = { 0, 0 };
+	glGetQueryObjectuiv(gFragmentQueries7[0], GL_QUERY_RESULT_AVAILABLE, &available[0]);
+	glGetQueryObjectuiv(gFragmentQueries7[1], GL_QUERY_RESULT_AVAILABLE, &available[1]);
+	if (!available[0] || !available[1])
+		return;
+
+	GLuint samples[2] = { 0, 0 };
+	glGetQueryObjectuiv(gFragmentQueries7[0], GL_QUERY_RESULT, &samples[0]);
+	glGetQueryObjectuiv(gFragmentQueries7[1], GL_QUERY_RESULT, &samples[1]);
+	gShadedFragments7 = samples[0] + samples[1];
+}
+
+// renders the sorted queue through gBatch7, one indirect draw per texture
+static void RenderBatched7()
+{
+	gBatchShaders7->use();
+	gBatchShaders7->setUniform("camera", gCamera7.matrix());
+	gBatchShaders7->setUniform("materialTex", 0); //set to 0 because the texture will be bound to GL_TEXTURE0
+	SetLightUniforms7(gBatchShaders7);
+	gBatchShaders7->setUniform("cameraPosition", gCamera7.position());
+	gBatchShaders7->setUniform("showOverdraw", (GLint) gShowOverdraw7);
+	++gRenderStats7.programChanges;
+
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, asset->texture->object());
+	GLuint boundTexture = 0;
+	for (size_t i = 0; i < gRenderQueue7.size(); ++i) {
+		const ModelInstance& inst = *gVisibleInstances7[gRenderQueue7.item(i)];
+		const ModelAsset *asset = inst.asset;
+
+		//the texture can't change within an indirect draw, so submit what we have so far
+		if (TextureObject7(asset) != boundTexture) {
+			gRenderStats7.drawCalls += gBatch7->flush();
+			glBindTexture(GL_TEXTURE_2D, TextureObject7(asset));
+			boundTexture = TextureObject7(asset);
+			++gRenderStats7.textureChanges;
+		}
+
+		tdogl::MultiDrawBatch::Instance data;
+		data.model = inst.transform;
+		data.material = glm::vec4(asset->specularColor, asset->shininess);
+		gBatch7->addInstance((unsigned) (asset->batchMesh + inst.lod), data);
+		gRenderStats7.triangles += asset->drawCount[inst.lod] / 3;
+	}
+	gRenderStats7.drawCalls += gBatch7->flush();
+	gRenderStats7.vertexArrayChanges = gRenderStats7.drawCalls;
 
-	//bind vao and draw
-	glBindVertexArray(asset->vao);
-	glDrawArrays(asset->drawType, asset->drawStart, asset->drawCount);
+	//the instance data of this frame is fenced, so its ring segment isn't reused too early
+	gBatch7->endFrame();
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	gBatchShaders7->stopUsing();
+}
+
+// tells gStreamer7 the screen size of the visible streamed textures, and lets it stream mips to match
+static void StreamTextures7()
+{
+	if (!gUseStreaming7)
+		return;
+
+	const tdogl::Frustum frustum(gCamera7.matrix());
+	gStreamer7->beginFrame();
+	for (size_t i = 0; i < gInstances7.size(); ++i) {
+		const ModelInstance& inst = gInstances7[i];
+		if (inst.asset->streamedTexture == tdogl::TextureStreamer::NoTexture)
+			continue;
+		glm::vec3 worldMin, worldMax;
+		tdogl::Frustum::transformBox(inst.transform, inst.asset->boundsMin, inst.asset->boundsMax, worldMin, worldMax);
+		if (!frustum.intersectsBox(worldMin, worldMax))
+			continue;
+		float radius = 0.5f * glm::length(worldMax - worldMin);
+		float pixels = tdogl::TextureStreamer::screenPixels(gCamera7, 0.5f * (worldMin + worldMax), radius, SCREEN_SIZE7.y);
+		gStreamer7->request(inst.asset->streamedTexture, pixels);
+	}
+	gStreamer7->update(STREAM_UPLOAD_BYTES7);
+}
+
+// the terrain: a square under the scene, with the whole of gVirtualTexture7 across it
+static void CreateTerrain7()
+{
+	if (!gTerrainShaders7) {
+		gTerrainShaders7 = LoadShaders7("vertexShaders - Terrain.txt", "FragmentShaders - VirtualTexture.txt");
+		gTerrainFeedbackShaders7 = LoadShaders7("vertexShaders - Terrain.txt", "FragmentShaders - VirtualTextureFeedback.txt");
+	}
+
+	const GLfloat e = TERRAIN_EXTENT7;
+	const GLfloat y = TERRAIN_HEIGHT7;
+	const GLfloat vertexData[] = {
+		//  X   Y   Z       U     V
+		   -e,  y,  e,   0.0f, 0.0f,
+		    e,  y,  e,   1.0f, 0.0f,
+		   -e,  y, -e,   0.0f, 1.0f,
+		    e,  y, -e,   1.0f, 1.0f,
+	};
+	glGenBuffers(1, &gTerrainVbo7);
+	glBindBuffer(GL_ARRAY_BUFFER, gTerrainVbo7);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertexData), vertexData, GL_STATIC_DRAW);
+
+	glGenVertexArrays(2, gTerrainVaos7);
+	const tdogl::Program* programs[2] = { gTerrainShaders7, gTerrainFeedbackShaders7 };
+	for (int i = 0; i < 2; ++i) {
+		glBindVertexArray(gTerrainVaos7[i]);
+		glEnableVertexAttribArray(programs[i]->attrib("vert"));
+		glVertexAttribPointer(programs[i]->attrib("vert"), 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), NULL);
+		glEnableVertexAttribArray(programs[i]->attrib("vertTexCoord"));
+		glVertexAttribPointer(programs[i]->attrib("vertTexCoord"), 2, GL_FLOAT, GL_TRUE, 5 * sizeof(GLfloat), (const GLvoid*) (3 * sizeof(GLfloat)));
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// sets the uniforms of "ShaderInclude - VirtualTexture.txt" that both terrain programs use
+static void SetVirtualTextureUniforms7(tdogl::Program* shaders, float mipBias)
+{
+	shaders->setUniform("vtSize", (GLfloat) gVirtualTexture7->size());
+	shaders->setUniform("vtTileSize", (GLfloat) gVirtualTexture7->tileSize());
+	shaders->setUniform("vtMipCount", (GLfloat) gVirtualTexture7->mipCount());
+	shaders->setUniform("vtMipBias", mipBias);
+}
+
+// draws the terrain. The feedback pass first draws the tile each pixel needs into a small
+// framebuffer, which is read back a frame later, so the tiles arrive over the next few
+// frames. Until then, the terrain is drawn with the mips above them.
+static void DrawTerrain7(const glm::mat4& camera)
+{
+	tdogl::ProfileScope scope(*gProfiler7, "Terrain", false);
+
+	// the feedback picks its mips as if it were as big as the viewport
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	const float mipBias = std::log((float) viewport[3] / gVirtualTexture7->feedbackHeight()) / std::log(2.0f);
+	gVirtualTexture7->bindFeedback();
+	gTerrainFeedbackShaders7->use();
+	gTerrainFeedbackShaders7->setUniform("camera", camera);
+	SetVirtualTextureUniforms7(gTerrainFeedbackShaders7, mipBias);
+	glBindVertexArray(gTerrainVaos7[1]);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	gVirtualTexture7->readFeedback();
+	gVirtualTexture7->update(VT_UPLOADS_PER_FRAME7);
+
+	gTerrainShaders7->use();
+	gTerrainShaders7->setUniform("camera", camera);
+	SetVirtualTextureUniforms7(gTerrainShaders7, 0.0f);
+	gTerrainShaders7->setUniform("vtBorder", (GLfloat) gVirtualTexture7->border());
+	gTerrainShaders7->setUniform("vtCacheSide", (GLfloat) gVirtualTexture7->cacheSide());
+	gTerrainShaders7->setUniform("vtIndirection", VT_INDIRECTION_UNIT7);
+	gTerrainShaders7->setUniform("vtCache", VT_CACHE_UNIT7);
+	glActiveTexture(GL_TEXTURE0 + VT_INDIRECTION_UNIT7);
+	glBindTexture(GL_TEXTURE_2D, gVirtualTexture7->indirectionTexture());
+	glActiveTexture(GL_TEXTURE0 + VT_CACHE_UNIT7);
+	glBindTexture(GL_TEXTURE_2D, gVirtualTexture7->cacheTexture());
+	glBindVertexArray(gTerrainVaos7[0]);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-	//unbind everything
 	glBindVertexArray(0);
 	glBindTexture(GL_TEXTURE_2D, 0);
-	shaders->stopUsing();
+	glActiveTexture(GL_TEXTURE0 + VT_INDIRECTION_UNIT7);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	gTerrainShaders7->stopUsing();
 }
 
 //draw a single frame
 static void Render7()
 {
+	// delete the GL objects the other threads let go of since the last frame, and the
+	// resources that are over the budget
+	tdogl::GLDeleteQueue::flush();
+	gResources7->beginFrame();
+	StreamTextures7();
+
 	// clear everything
 	glClearColor(0, 0, 0, 1);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	
-	// render all the instances
-	std::list<ModelInstance>::const_iterator iter;
-	for (iter = gInstances7.begin(); iter != gInstances7.end(); ++iter) {
-		RenderInstance7(*iter);
+
+	// count what the occlusion queries of the last frame found, without waiting for the GPU
+	gQueries7->collectResults();
+	CollectShadedFragments7();
+
+	// while the camera is still, the commands recorded for the static instances are
+	// replayed as they are, and only the dynamic instances are culled and recorded again
+	const glm::mat4 camera = gCamera7.matrix();
+	const bool reuseStatic = !gUseMultiDraw7 && gStaticCommandsValid7 && camera == gStaticCommandsCamera7;
+
+	// cull and sort the instances, so draws with the same state are adjacent
+	DrawCounts7 staticCounts, dynamicCounts;
+	{
+		tdogl::ProfileScope scope(*gProfiler7, "Culling", false);
+		BuildRenderQueue7(reuseStatic, staticCounts, dynamicCounts);
+	}
+
+	// record the draw commands on the worker threads
+	if (!gUseMultiDraw7) {
+		tdogl::ProfileScope scope(*gProfiler7, "Record", false);
+		if (!reuseStatic) {
+			RecordQueue7(gStaticCommands7, RecordPass_Static, gUseDepthPrepass7 ? &gStaticDepthCommands7 : nullptr);
+			RecordQueue7(gQueriedCommands7, RecordPass_Queried, nullptr);
+			gStaticCommandsCamera7 = camera;
+			gStaticCommandsValid7 = true;
+		}
+		RecordQueue7(gDynamicCommands7, RecordPass_Dynamic, gUseDepthPrepass7 ? &gDynamicDepthCommands7 : nullptr);
+	}
+
+	// the cached static commands keep the LODs they were recorded with
+	if (!reuseStatic)
+		gStaticDrawCounts7 = staticCounts;
+	gDrawCounts7 = gStaticDrawCounts7;
+	gDrawCounts7.add(dynamicCounts);
+
+	// render all the visible instances. With the overdraw view, every shaded fragment adds
+	// the same grey, so the brightness shows how often each pixel was shaded. The sRGB
+	// conversion is off for it, so each step is as bright as the last.
+	tdogl::ProfileScope scope(*gProfiler7, "Render7");
+	gRenderStats7.reset();
+	if (gShowOverdraw7) {
+		glBlendFunc(GL_ONE, GL_ONE);
+		glDisable(GL_FRAMEBUFFER_SRGB);
+	}
+	if (gUseMultiDraw7) {
+		glBeginQuery(GL_SAMPLES_PASSED, gFragmentQueries7[0]);
+		RenderBatched7();
+		glEndQuery(GL_SAMPLES_PASSED);
+		glBeginQuery(GL_SAMPLES_PASSED, gFragmentQueries7[1]);
+		glEndQuery(GL_SAMPLES_PASSED);
+	} else {
+		//deferred shading draws the same commands into the G-buffer, then lights it. The
+		//binding is read back, so the lit image goes wherever the caller was drawing.
+		GLint targetFramebuffer = 0;
+		if (gUseDeferred7) {
+			glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFramebuffer);
+			gGBuffer7->bindAndClear();
+			SetDeferredFrameUniforms7();
+		} else {
+			//the shadow maps stay bound to their own units for the whole colour pass
+			if (gUseShadows7) {
+				tdogl::ProfileScope shadowScope(*gProfiler7, "Shadows", false);
+				UpdateShadows7();
+			}
+			SetFrameUniforms7();
+			glActiveTexture(GL_TEXTURE0 + POINT_SHADOW_UNIT7);
+			glBindTexture(GL_TEXTURE_CUBE_MAP, gPointShadows7->texture());
+			glActiveTexture(GL_TEXTURE0 + SUN_SHADOW_UNIT7);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, gSunShadows7->texture());
+			glActiveTexture(GL_TEXTURE0);
+		}
+
+		//lay down the depth first, so the colour pass only shades the nearest fragment of each pixel
+		const bool depthPrepass = gUseDepthPrepass7;
+		if (depthPrepass) {
+			gDepthShaders7->use();
+			gDepthShaders7->setUniform("camera", camera);
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			for (size_t i = 0; i < gStaticDepthCommands7.size(); ++i)
+				gStaticDepthCommands7[i]->replay(&gRenderStats7);
+			for (size_t i = 0; i < gDynamicDepthCommands7.size(); ++i)
+				gDynamicDepthCommands7[i]->replay(&gRenderStats7);
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glDepthMask(GL_FALSE);
+			glDepthFunc(GL_EQUAL);
+		}
+
+		glBeginQuery(GL_SAMPLES_PASSED, gFragmentQueries7[0]);
+		for (size_t i = 0; i < gStaticCommands7.size(); ++i)
+			gStaticCommands7[i]->replay(&gRenderStats7);
+		for (size_t i = 0; i < gDynamicCommands7.size(); ++i)
+			gDynamicCommands7[i]->replay(&gRenderStats7);
+		glEndQuery(GL_SAMPLES_PASSED);
+
+		if (depthPrepass) {
+			glDepthMask(GL_TRUE);
+			glDepthFunc(GL_LESS);
+		}
+
+		//test the boxes of the queried instances against the depth drawn so far, then draw
+		//the instances whose box passed. The GPU waits for the queries, the CPU doesn't.
+		//They aren't in the depth pre-pass, so they are drawn with the normal depth test.
+		if (!gQueryBoxMin7.empty())
+			gQueries7->drawProxies(camera, &gQueryBoxMin7[0], &gQueryBoxMax7[0], (unsigned) gQueryBoxMin7.size());
+		glBeginQuery(GL_SAMPLES_PASSED, gFragmentQueries7[1]);
+		if (!gQueryBoxMin7.empty()) {
+			for (size_t i = 0; i < gQueriedCommands7.size(); ++i)
+				gQueriedCommands7[i]->replay(&gRenderStats7);
+		}
+		glEndQuery(GL_SAMPLES_PASSED);
+
+		//unbind everything
+		glBindVertexArray(0);
+		glActiveTexture(GL_TEXTURE0 + POINT_SHADOW_UNIT7);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		glActiveTexture(GL_TEXTURE0 + SUN_SHADOW_UNIT7);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glUseProgram(0);
+
+		if (gUseDeferred7) {
+			glm::vec3 ambient(0.0f);
+			for (size_t i = 0; i < gLights7.size(); ++i)
+				ambient += gLights7[i].ambientCoefficient * gLights7[i].intensities;
+			gDeferredLighting7->render(*gGBuffer7, camera, gCamera7.position(), ambient,
+				gDeferredLights7.empty() ? nullptr : &gDeferredLights7[0], (unsigned) gDeferredLights7.size(),
+				(GLuint) targetFramebuffer);
+			glEnable(GL_DEPTH_TEST);
+			glEnable(GL_BLEND);
+		}
+	}
+	gFragmentQueriesIssued7 = true;
+
+	// the terrain is only drawn forward, and isn't part of the overdraw view
+	if (gUseVirtualTexture7 && !gUseDeferred7 && !gShowOverdraw7)
+		DrawTerrain7(camera);
+
+	if (gShowOverdraw7) {
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		if (gSrgbFramebuffer7)
+			glEnable(GL_FRAMEBUFFER_SRGB);
 	}
 
-	//swap the display buffers (displays what was just drawn)
-	glfwSwapBuffers(gWindow7);
+	// everything allocated from the frame arena is dead now
+	gFrameArena7->reset();
 }
 
-// update the scene based on the time elapsed since last update
-static void Update7(float secondsElapsed)
+// animates the scene based on the time elapsed since last update
+static void UpdateScene7(float secondsElapsed)
 {
 	//rotate the first instance in `gInstances`
 	const GLfloat degreesPerSecond = 180.0f;
 	gDegreesRotated7 += secondsElapsed * degreesPerSecond;
 	while (gDegreesRotated7 > 360.0f)
 		gDegreesRotated7 -= 360.0f;
-	gInstances7.front().transform = glm::rotate(glm::mat4(), glm::radians(gDegreesRotated7), glm::vec3(0, 1, 0));
+	gSceneGraph7.setRotation(gInstances7.front().node, glm::angleAxis(glm::radians(gDegreesRotated7), glm::vec3(0, 1, 0)));
+}
 
+// advances the simulation by one fixed step and publishes the result as the state at `time`
+static void StepSimulation7(double time)
+{
+	UpdateScene7(SIMULATION_STEP7);
+	PublishSnapshot7(time);
+}
+
+// runs the simulation at a fixed rate until gQuitSimulation7 is set. Snapshot `n` is the
+// state at `n * SIMULATION_STEP7` seconds after `startMicroseconds`.
+static void SimulationThread7(double startMicroseconds)
+{
+	try {
+		const double stepMicroseconds = SIMULATION_STEP7 * 1000000.0;
+		double nextStep = startMicroseconds + stepMicroseconds;
+		while (!gQuitSimulation7) {
+			double now = tdogl::Profiler::nowMicroseconds();
+			int steps = 0;
+			while (now >= nextStep && steps < MAX_CATCH_UP_STEPS7) {
+				StepSimulation7((nextStep - startMicroseconds) / 1000000.0);
+				nextStep += stepMicroseconds;
+				++steps;
+			}
+
+			//too far behind: skip the lost steps, so a slow frame can't snowball
+			if (now >= nextStep)
+				nextStep += stepMicroseconds * floor((now - nextStep) / stepMicroseconds + 1.0);
+
+			std::this_thread::sleep_for(std::chrono::microseconds((long long) (nextStep - tdogl::Profiler::nowMicroseconds())));
+		}
+	} catch (...) {
+		gSimulationError7 = std::current_exception();
+		gSimulationFailed7 = true;
+	}
+}
+
+// steps the simulation on the calling thread and shows the result without interpolation,
+// so that headless runs and benchmarks are reproducible
+static void UpdateFixedStep7(double time)
+{
+	StepSimulation7(time);
+	ReceiveSnapshot7();
+	InterpolateTransforms7(time);
+}
+
+// moves the camera and changes the light based on keyboard and mouse input
+static void ProcessInput7(float secondsElapsed)
+{
 	//move position of camera based on WASD keys, and XZ keys for up and down
 	const float moveSpeed = 4.0; //units per second
 	if (glfwGetKey(gWindow7, 'S')) {
@@ -314,19 +1555,99 @@ static void Update7(float secondsElapsed)
 		gCamera7.offsetPosition(secondsElapsed * moveSpeed * glm::vec3(0, 1, 0));
 	}
 
-	//move light
+	//move the first light
 	if (glfwGetKey(gWindow7, '1'))
-		gLight7.position = gCamera7.position();
+		gLights7[0].position = gCamera7.position();
 	else if (glfwGetKey(gWindow7, '2'))
-		gLight7.position = glm::vec3(-4, 0, 4);
+		gLights7[0].position = glm::vec3(-4, 0, 4);
 
-	// change light color
+	// change the color of the first light
 	if (glfwGetKey(gWindow7, '3'))
-		gLight7.intensities = glm::vec3(1, 0, 0); //red
+		gLights7[0].intensities = glm::vec3(1, 0, 0); //red
 	else if (glfwGetKey(gWindow7, '4'))
-		gLight7.intensities = glm::vec3(0, 1, 0); //green
+		gLights7[0].intensities = glm::vec3(0, 1, 0); //green
 	else if (glfwGetKey(gWindow7, '5'))
-		gLight7.intensities = glm::vec3(1, 1, 1); //white
+		gLights7[0].intensities = glm::vec3(1, 1, 1); //white
+
+	// switch between multi-draw indirect and per-instance draws
+	if (glfwGetKey(gWindow7, '6'))
+		gUseMultiDraw7 = (gBatch7 != nullptr && !gUseDeferred7);
+	else if (glfwGetKey(gWindow7, '7'))
+		gUseMultiDraw7 = false;
+
+	// switch the levels of detail on and off. The cached commands were recorded with the old LODs.
+	if (glfwGetKey(gWindow7, '8') && !gUseLods7) {
+		gUseLods7 = true;
+		gStaticCommandsValid7 = false;
+	} else if (glfwGetKey(gWindow7, '9') && gUseLods7) {
+		gUseLods7 = false;
+		gStaticCommandsValid7 = false;
+	}
+
+	// switch occlusion culling on and off
+	if (glfwGetKey(gWindow7, 'O') && !gUseOcclusion7) {
+		gUseOcclusion7 = true;
+		gStaticCommandsValid7 = false;
+	} else if (glfwGetKey(gWindow7, 'P') && gUseOcclusion7) {
+		gUseOcclusion7 = false;
+		gStaticCommandsValid7 = false;
+	}
+
+	// switch the GPU occlusion queries on and off
+	if (glfwGetKey(gWindow7, 'Q') && !gUseQueries7) {
+		gUseQueries7 = true;
+		gStaticCommandsValid7 = false;
+	} else if (glfwGetKey(gWindow7, 'E') && gUseQueries7) {
+		gUseQueries7 = false;
+		gStaticCommandsValid7 = false;
+	}
+
+	// switch the depth pre-pass on and off, and show or hide the overdraw
+	if (glfwGetKey(gWindow7, 'F') && !gUseDepthPrepass7) {
+		gUseDepthPrepass7 = true;
+		gStaticCommandsValid7 = false;
+	} else if (glfwGetKey(gWindow7, 'G') && gUseDepthPrepass7) {
+		gUseDepthPrepass7 = false;
+		gStaticCommandsValid7 = false;
+	}
+	if (glfwGetKey(gWindow7, 'V'))
+		gShowOverdraw7 = true;
+	else if (glfwGetKey(gWindow7, 'B'))
+		gShowOverdraw7 = false;
+
+	// switch between deferred and forward shading. Deferred shading only has per-instance
+	// draws, and forward shading only takes MAX_LIGHTS7 lights.
+	if (glfwGetKey(gWindow7, 'K') && !gUseDeferred7) {
+		gUseDeferred7 = true;
+		gUseMultiDraw7 = false;
+		gStaticCommandsValid7 = false;
+	} else if (glfwGetKey(gWindow7, 'L') && gUseDeferred7 && gLights7.size() <= MAX_LIGHTS7) {
+		gUseDeferred7 = false;
+		gStaticCommandsValid7 = false;
+	}
+
+	// switch the shadows on and off, and the sun. Only forward shading has them.
+	if (glfwGetKey(gWindow7, 'N'))
+		gUseShadows7 = true;
+	else if (glfwGetKey(gWindow7, 'M'))
+		gUseShadows7 = false;
+	if (glfwGetKey(gWindow7, 'T') && !gUseStreaming7) {
+		gUseStreaming7 = true;
+		gStaticCommandsValid7 = false;
+	} else if (glfwGetKey(gWindow7, 'Y') && gUseStreaming7) {
+		gUseStreaming7 = false;
+		gStaticCommandsValid7 = false;
+	}
+	if (glfwGetKey(gWindow7, 'U'))
+		gSun7.intensities = SUN_INTENSITIES7;
+	else if (glfwGetKey(gWindow7, 'I'))
+		gSun7.intensities = glm::vec3(0.0f);
+
+	// show or hide the virtual textured terrain, if its tiles were found
+	if (glfwGetKey(gWindow7, 'H'))
+		gUseVirtualTexture7 = (gVirtualTexture7 != nullptr);
+	else if (glfwGetKey(gWindow7, 'J'))
+		gUseVirtualTexture7 = false;
 
 
 	//rotate camera based on mouse movement
@@ -345,6 +1666,7 @@ static void Update7(float secondsElapsed)
 	gScrollY7 = 0;
 }
 
+
 // records how far the y axis has been scrolled
 void OnScroll7(GLFWwindow* window, double deltaX, double deltaY)
 {
@@ -356,6 +1678,178 @@ void OnError7(int errorCode, const char* msg)
 	throw std::runtime_error(msg);
 }
 
+// deletes the job system, the frame arena, the command buffers, the occlusion culler, the
+// queries, the deferred shading buffers and the shadow maps made by InitScene7
+static void DeleteJobs7()
+{
+	for (size_t i = 0; i < gStaticCommands7.size(); ++i) {
+		delete gStaticCommands7[i];
+		delete gDynamicCommands7[i];
+		delete gQueriedCommands7[i];
+		delete gStaticDepthCommands7[i];
+		delete gDynamicDepthCommands7[i];
+	}
+	gStaticCommands7.clear();
+	gDynamicCommands7.clear();
+	gQueriedCommands7.clear();
+	gStaticDepthCommands7.clear();
+	gDynamicDepthCommands7.clear();
+	gStaticCommandsValid7 = false;
+	gQueryBoxMin7.clear();
+	gQueryBoxMax7.clear();
+	delete gOcclusion7;
+	gOcclusion7 = nullptr;
+	delete gQueries7;
+	gQueries7 = nullptr;
+	glDeleteQueries(2, gFragmentQueries7);
+	gFragmentQueriesIssued7 = false;
+	delete gGBuffer7;
+	gGBuffer7 = nullptr;
+	delete gDeferredLighting7;
+	gDeferredLighting7 = nullptr;
+	delete gPointShadows7;
+	gPointShadows7 = nullptr;
+	delete gSunShadows7;
+	gSunShadows7 = nullptr;
+	delete gShadowCommands7;
+	gShadowCommands7 = nullptr;
+	delete gFrameArena7;
+	gFrameArena7 = nullptr;
+	delete gStreamer7;
+	gStreamer7 = nullptr;
+	delete gVirtualTexture7;
+	gVirtualTexture7 = nullptr;
+	gUseVirtualTexture7 = false;
+	glDeleteVertexArrays(2, gTerrainVaos7);
+	gTerrainVaos7[0] = gTerrainVaos7[1] = 0;
+	glDeleteBuffers(1, &gTerrainVbo7);
+	gTerrainVbo7 = 0;
+	delete gJobs7;
+	gJobs7 = nullptr;
+}
+
+// loads the assets, creates the scene and sets up the GL state. Needs a current context.
+static void InitScene7()
+{
+	// print out some info about the graphics drivers
+	std::cout << "OpenGL version: " << glGetString(GL_VERSION) << std::endl;
+	std::cout << "GLSL version: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << std::endl;
+	std::cout << "Vendor: " << glGetString(GL_VENDOR) << std::endl;
+	std::cout << "Renderer: " << glGetString(GL_RENDERER) << std::endl;
+
+	// make sure OpenGL version 3.2 API is available
+	if (!GLEW_VERSION_3_2)
+		throw std::runtime_error("OpenGL 3.2 API is not available.");
+
+	// shaders, programs and textures let go of on other threads are deleted on this one
+	tdogl::GLDeleteQueue::setGLThread();
+	if (!gResources7)
+		gResources7 = new tdogl::ResourceManager(path7, RESOURCE_BUDGET7);
+	gStreamer7 = new tdogl::TextureStreamer(path7, STREAM_BUDGET7);
+
+	// start the worker threads for the scene update and culling
+	gJobs7 = new tdogl::JobSystem();
+	std::cout << "Job system threads: " << gJobs7->threadCount() << std::endl;
+
+	// per-frame scratch memory, and one command buffer per thread that can record draws
+	gFrameArena7 = new tdogl::FrameArena(256 * 1024, gJobs7->threadCount());
+	for (unsigned i = 0; i < gJobs7->threadCount(); ++i) {
+		gStaticCommands7.push_back(new tdogl::CommandBuffer());
+		gDynamicCommands7.push_back(new tdogl::CommandBuffer());
+		gQueriedCommands7.push_back(new tdogl::CommandBuffer());
+		gStaticDepthCommands7.push_back(new tdogl::CommandBuffer());
+		gDynamicDepthCommands7.push_back(new tdogl::CommandBuffer());
+	}
+
+	// hides instances behind large nearby ones before they are queued
+	gOcclusion7 = new tdogl::OcclusionCuller(OCCLUSION_WIDTH7, OCCLUSION_HEIGHT7);
+	std::cout << "Occlusion culling: " << (tdogl::OcclusionCuller::simdEnabled() ? "SSE2" : "scalar") << std::endl;
+
+	// positions only, for the depth pre-pass and the occlusion query boxes. Loaded once, the
+	// position-only VAOs of the assets refer to it.
+	if (!gDepthShaders7)
+		gDepthShaders7 = LoadShaders7("vertexShaders - DepthOnly.txt", "FragmentShaders - DepthOnly.txt");
+	gDepthModelUniform7 = gDepthShaders7->uniform("model");
+
+	// the GPU tests the bounding boxes of large instances against the depth buffer, and
+	// counts the fragments that the colour pass shades
+	gQueries7 = new tdogl::OcclusionQueries(*gDepthShaders7, MAX_QUERIES7);
+	glGenQueries(2, gFragmentQueries7);
+
+	// the G-buffer and the light volumes of deferred shading
+	if (!gGBufferShaders7) {
+		gGBufferShaders7 = LoadShaders7("vertexShaders.txt", "FragmentShaders - GBuffer.txt");
+		gDeferredLightShaders7 = LoadShaders7("vertexShaders - DeferredLight.txt", "FragmentShaders - DeferredLight.txt");
+		gDeferredResolveShaders7 = LoadShaders7("vertexShaders - FullScreen.txt", "FragmentShaders - DeferredResolve.txt");
+	}
+	gGBufferUniforms7.program = gGBufferShaders7;
+	gGBufferUniforms7.model = gGBufferShaders7->uniform("model");
+	gGBufferUniforms7.materialShininess = gGBufferShaders7->uniform("materialShininess");
+	gGBufferUniforms7.materialSpecularColor = gGBufferShaders7->uniform("materialSpecularColor");
+	gGBuffer7 = new tdogl::GBuffer((GLsizei) SCREEN_SIZE7.x, (GLsizei) SCREEN_SIZE7.y, *gGBufferShaders7);
+	gDeferredLighting7 = new tdogl::DeferredLighting(*gDeferredLightShaders7, *gDeferredResolveShaders7,
+		(GLsizei) SCREEN_SIZE7.x, (GLsizei) SCREEN_SIZE7.y, MAX_DEFERRED_LIGHTS7);
+	std::cout << "Occlusion queries: " << (gQueries7->target() == GL_ANY_SAMPLES_PASSED ? "any samples passed" : "samples passed") << std::endl;
+
+	// the shadows of the first light and the sun, drawn with gDepthShaders7
+	gPointShadows7 = new tdogl::PointShadowMap(POINT_SHADOW_SIZE7, 0.1f);
+	gSunShadows7 = new tdogl::CascadedShadowMap(SUN_SHADOW_SIZE7, SUN_CASCADES7, SUN_CASTER_DISTANCE7);
+	gShadowCommands7 = new tdogl::CommandBuffer();
+
+	// the terrain, if its tiles were baked with --bake-virtual-texture
+	try {
+		gVirtualTexture7 = new tdogl::VirtualTexture(path7 + "virtual-texture/", VT_CACHE_SIDE7,
+			(GLsizei) SCREEN_SIZE7.x / VT_FEEDBACK_DIVISOR7, (GLsizei) SCREEN_SIZE7.y / VT_FEEDBACK_DIVISOR7);
+	} catch (const std::exception& e) {
+		std::cout << "Virtual texture: none (" << e.what() << ")" << std::endl;
+	}
+	if (gVirtualTexture7) {
+		CreateTerrain7();
+		std::cout << "Virtual texture: " << gVirtualTexture7->size() << " pixels wide, " << gVirtualTexture7->mipCount()
+			<< " mips of " << gVirtualTexture7->tileSize() << " pixel tiles" << std::endl;
+	}
+
+	// OpenGL settings
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LESS);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	if (gSrgbFramebuffer7)
+		glEnable(GL_FRAMEBUFFER_SRGB); //blend in linear space, and convert to sRGB when storing
+	std::cout << "Gamma correction: " << (gSrgbFramebuffer7 ? "sRGB framebuffer" : "shader") << std::endl;
+
+	// initialize the gWoodenCrate asset
+	LoadWoodenCrateAsset7();
+
+	// create all the instances in the 3D scene based on the gWoodenCrate asset
+	CreateInstances7();
+
+	// merge the asset geometry for multi-draw indirect, if the hardware supports it
+	CreateMultiDrawBatch7();
+	PrintResourceUsage7();
+
+	// setup gCamera
+	gCamera7.setPosition(glm::vec3(-4, 0, 17));
+	gCamera7.setViewportAspectRatio(SCREEN_SIZE7.x / SCREEN_SIZE7.y);
+	gCamera7.setNearAndFarPlanes(0.5f, 100.0f);
+
+	// setup gLights
+	Light light;
+	light.position = glm::vec3(-4, 0, 4);
+	light.intensities = glm::vec3(1, 1, 1); //white
+	light.attenuation = 0.2f;
+	light.ambientCoefficient = 0.005f;
+	gLights7.clear();
+	gLights7.push_back(light);
+
+	// the sun is off until switched on
+	gSun7.direction = glm::normalize(glm::vec3(-0.4f, -1.0f, -0.3f));
+	gSun7.intensities = glm::vec3(0.0f);
+
+	// time the frame phases on the CPU and GPU
+	gProfiler7 = new tdogl::Profiler();
+}
+
 // the program starts here
 void AppMain_7()
 {
@@ -370,6 +1864,7 @@ void AppMain_7()
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
 	glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+	glfwWindowHint(GLFW_SRGB_CAPABLE, GL_TRUE);
 	gWindow7 = glfwCreateWindow((int) SCREEN_SIZE7.x, (int) SCREEN_SIZE7.y, "OpenGL Tutorial", NULL, NULL);
 	if (!gWindow7)
 		throw std::runtime_error("glfwCreateWindow failed. Can your hardware handle OpenGL 3.2?");
@@ -385,56 +1880,89 @@ void AppMain_7()
 	if (glewInit() != GLEW_OK)
 		throw std::runtime_error("glewInit failed");
 
+	// the hint is only a request, so check what the window got
+	GLint colorEncoding = GL_LINEAR;
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_BACK_LEFT, GL_FRAMEBUFFER_ATTACHMENT_COLOR_ENCODING, &colorEncoding);
+	gSrgbFramebuffer7 = (colorEncoding == GL_SRGB);
+
 	// GLEW throws some errors, so discard all the errors so far
 	while (glGetError() != GL_NO_ERROR) {}
 
-	// print out some info about the graphics drivers
-	std::cout << "OpenGL version: " << glGetString(GL_VERSION) << std::endl;
-	std::cout << "GLSL version: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << std::endl;
-	std::cout << "Vendor: " << glGetString(GL_VENDOR) << std::endl;
-	std::cout << "Renderer: " << glGetString(GL_RENDERER) << std::endl;
-
-	// make sure OpenGL version 3.2 API is available
-	if (!GLEW_VERSION_3_2)
-		throw std::runtime_error("OpenGL 3.2 API is not available.");
-
-	// OpenGL settings
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_LESS);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	// initialize the gWoodenCrate asset
-	LoadWoodenCrateAsset7();
-
-	// create all the instances in the 3D scene based on the gWoodenCrate asset
-	CreateInstances7();
+	// load everything and set up the GL state
+	InitScene7();
 
-	// setup gCamera
-	gCamera7.setPosition(glm::vec3(-4, 0, 17));
-	gCamera7.setViewportAspectRatio(SCREEN_SIZE7.x / SCREEN_SIZE7.y);
-	gCamera7.setNearAndFarPlanes(0.5f, 100.0f);
+	// the scene is simulated at a fixed rate on its own thread
+	double simulationStart = tdogl::Profiler::nowMicroseconds();
+	gQuitSimulation7 = false;
+	std::thread simulation(SimulationThread7, simulationStart);
 
-	// setup gLight
-	gLight7.position = glm::vec3(-4, 0, 4);
-	gLight7.intensities = glm::vec3(1, 1, 1); //white
-	gLight7.attenuation = 0.2f;
-	gLight7.ambientCoefficient = 0.005f;
+	// makes sure the thread is joined even if rendering throws
+	struct StopSimulation {
+		std::thread& thread;
+		~StopSimulation() {
+			gQuitSimulation7 = true;
+			if (thread.joinable())
+				thread.join();
+		}
+	} stopSimulation = { simulation };
 
 	// run while the window is open
 	float lastTime = (float) glfwGetTime();
-	while (!glfwWindowShouldClose(gWindow7)) {
+	float lastStatsTime = lastTime;
+	while (!glfwWindowShouldClose(gWindow7) && !gSimulationFailed7) {
+		gProfiler7->beginFrame();
+		unsigned long long allocationsBefore = tdogl::AllocationCounter::allocations();
+
 		// process pending events
 		glfwPollEvents();
 
-		// update the scene based on the time elapsed since last update
+		// move the camera, then show the simulation one step in the past, blending
+		// between the two snapshots around that time
 		float thisTime = (float) glfwGetTime();
-		Update7(thisTime - lastTime);
+		{
+			tdogl::ProfileScope scope(*gProfiler7, "Update7", false);
+			ProcessInput7(thisTime - lastTime);
+			ReceiveSnapshot7();
+			double renderTime = (tdogl::Profiler::nowMicroseconds() - simulationStart) / 1000000.0 - SIMULATION_STEP7;
+			InterpolateTransforms7(renderTime);
+		}
 		lastTime = thisTime;
 
 		// draw one frame
 		Render7();
 
+		//swap the display buffers (displays what was just drawn)
+		{
+			tdogl::ProfileScope scope(*gProfiler7, "Swap");
+			glfwSwapBuffers(gWindow7);
+		}
+		gFrameAllocations7 = tdogl::AllocationCounter::allocations() - allocationsBefore;
+		gProfiler7->endFrame();
+
+		// show the draw statistics in the title bar, once per second
+		if (thisTime - lastStatsTime >= 1.0f) {
+			std::ostringstream title;
+			title << "OpenGL Tutorial - " << gRenderStats7.drawCalls << " draws, "
+				<< gRenderStats7.programChanges << " program / "
+				<< gRenderStats7.textureChanges << " texture / "
+				<< gRenderStats7.vertexArrayChanges << " VAO changes - "
+				<< gDrawCounts7.triangles << " of " << gDrawCounts7.fullDetailTriangles << " triangles, "
+				<< gDrawCounts7.occluded << " occluded, "
+				<< gDrawCounts7.queried << " queried (" << gQueries7->occludedCount() << " hidden), "
+				<< (gUseDepthPrepass7 ? "pre-pass, " : "") << gShadedFragments7 << " fragments shaded, "
+				<< (gUseDeferred7 ? "deferred" : "forward") << " - ";
+			if (gUseVirtualTexture7) {
+				title << "terrain " << gVirtualTexture7->residentPages() << " pages ("
+					<< gVirtualTexture7->pendingTiles() << " loading) - ";
+			}
+			title << "Render7 "
+				<< gProfiler7->cpuMilliseconds("Render7") << " ms CPU, "
+				<< gProfiler7->gpuMilliseconds("Render7") << " ms GPU, "
+				<< gFrameAllocations7 << " heap allocations";
+			glfwSetWindowTitle(gWindow7, title.str().c_str());
+			lastStatsTime = thisTime;
+		}
+
 		// check for errors
 		GLenum error = glGetError();
 		if (error != GL_NO_ERROR)
@@ -445,12 +1973,712 @@ void AppMain_7()
 			glfwSetWindowShouldClose(gWindow7, GL_TRUE);
 	}
 
+	// stop the simulation, and pass on its error if it failed
+	gQuitSimulation7 = true;
+	simulation.join();
+	if (gSimulationFailed7)
+		std::rethrow_exception(gSimulationError7);
+
+	// save the last frames for chrome://tracing
+	gProfiler7->writeChromeTrace(path7 + "profile-trace.json");
+	delete gProfiler7;
+	gProfiler7 = nullptr;
+	DeleteJobs7();
+
 	// clean up and exit
 	glfwTerminate();
 }
 
+// counts the pixels of two RGBA bitmaps that differ by more than `tolerance` in any channel
+static unsigned CountDifferentPixels7(const tdogl::Bitmap& a, const tdogl::Bitmap& b, int tolerance)
+{
+	if (a.width() != b.width() || a.height() != b.height() || a.format() != b.format())
+		throw std::runtime_error("Reference image has a different size or format");
+
+	unsigned different = 0;
+	const unsigned char* pa = a.pixelBuffer();
+	const unsigned char* pb = b.pixelBuffer();
+	const unsigned channels = (unsigned) a.format();
+	const unsigned pixelCount = a.width() * a.height();
+	for (unsigned i = 0; i < pixelCount; ++i) {
+		for (unsigned c = 0; c < channels; ++c) {
+			if (abs((int) pa[i * channels + c] - (int) pb[i * channels + c]) > tolerance) {
+				++different;
+				break;
+			}
+		}
+	}
+	return different;
+}
+
+// renders `frames` frames with a fixed time step into an offscreen framebuffer, without a
+// window, and saves the last frame to `outputPath`. If `referencePath` is not empty, the
+// result is compared with that image. Returns false if it differs.
+bool HeadlessMain_7(int frames, const std::string& outputPath, const std::string& referencePath)
+{
+	// create a context with nothing on screen
+	tdogl::HeadlessContext context;
+	std::cout << "Headless context: " << tdogl::HeadlessContext::backendName() << std::endl;
+
+	// load everything and set up the GL state
+	gSrgbFramebuffer7 = true;
+	InitScene7();
+
+	// render into an sRGB framebuffer the size of the window
+	tdogl::Framebuffer framebuffer((GLsizei) SCREEN_SIZE7.x, (GLsizei) SCREEN_SIZE7.y, GL_SRGB8_ALPHA8);
+
+	// stepping the simulation on this thread keeps the output identical from run to run
+	// the first half of the frames warms up the arenas and buffers, after that a frame
+	// shouldn't touch the heap
+	double startTime = tdogl::Profiler::nowMicroseconds();
+	unsigned long long steadyAllocations = 0;
+	for (int frame = 0; frame < frames; ++frame) {
+		gProfiler7->beginFrame();
+		unsigned long long allocationsBefore = tdogl::AllocationCounter::allocations();
+		{
+			tdogl::ProfileScope scope(*gProfiler7, "Update7", false);
+			UpdateFixedStep7((frame + 1) * (double) SIMULATION_STEP7);
+		}
+
+		framebuffer.bind();
+		Render7();
+		framebuffer.unbind();
+		gFrameAllocations7 = tdogl::AllocationCounter::allocations() - allocationsBefore;
+		if (frame >= frames / 2)
+			steadyAllocations += gFrameAllocations7;
+		gProfiler7->endFrame();
+
+		GLenum error = glGetError();
+		if (error != GL_NO_ERROR)
+			std::cerr << "OpenGL Error " << error << std::endl;
+	}
+	glFinish();
+	double totalMilliseconds = (tdogl::Profiler::nowMicroseconds() - startTime) / 1000.0;
+
+	std::cout << "Rendered " << frames << " frames in " << totalMilliseconds << " ms ("
+		<< (frames > 0 ? totalMilliseconds / frames : 0.0) << " ms per frame), last frame "
+		<< gRenderStats7.drawCalls << " draws, " << gDrawCounts7.triangles << " triangles ("
+		<< gDrawCounts7.fullDetailTriangles << " at full detail), " << gDrawCounts7.occluded << " instances occluded, "
+		<< gDrawCounts7.queried << " queried (" << gQueries7->occludedCount() << " hidden by their query), "
+		<< gShadedFragments7 << " fragments shaded" << std::endl;
+	std::cout << steadyAllocations << " heap allocations in the last " << (frames - frames / 2) << " frames" << std::endl;
+
+	// read back and save the last frame
+	tdogl::Bitmap image = framebuffer.readPixels();
+	image.saveToPngFile(outputPath);
+	std::cout << "Saved " << outputPath << std::endl;
+
+	gProfiler7->writeChromeTrace(path7 + "profile-trace-headless.json");
+	delete gProfiler7;
+	gProfiler7 = nullptr;
+	DeleteJobs7();
+
+	if (referencePath.empty())
+		return true;
+
+	// software and hardware rasterizers differ slightly, so allow a little noise
+	tdogl::Bitmap reference = tdogl::Bitmap::bitmapFromFile(referencePath);
+	unsigned different = CountDifferentPixels7(image, reference, 8);
+	unsigned allowed = image.width() * image.height() / 1000;
+	std::cout << different << " pixels differ from " << referencePath
+		<< " (" << allowed << " allowed)" << std::endl;
+	return different <= allowed;
+}
+
+/*
+ The camera movement of a benchmark scene
+ */
+enum CameraPath7 {
+	CameraPath_Static,		//looks at the whole grid from above
+	CameraPath_Orbit,		//circles the grid, looking at its center
+	CameraPath_Flythrough	//flies low over the grid, so the visible set keeps changing
+};
 
+/*
+ The options of a benchmark scene, combined with |
+ */
+enum BenchmarkOption7 {
+	BenchmarkOption_None = 0,
+	BenchmarkOption_MultiDraw = 1 << 0,
+	BenchmarkOption_Occlusion = 1 << 1,
+	BenchmarkOption_City = 1 << 2,
+	BenchmarkOption_Queries = 1 << 3,
+	BenchmarkOption_DepthPrepass = 1 << 4,
+	BenchmarkOption_Deferred = 1 << 5,
+	BenchmarkOption_Shadows = 1 << 6,
+	BenchmarkOption_UncachedShadows = 1 << 7,
+	BenchmarkOption_Streaming = 1 << 8
+};
 
+/*
+ A synthetic scene for the benchmark: a square grid of crates lit by point lights
+ */
+struct BenchmarkScene7 {
+	BenchmarkScene7(const std::string& name, int crates, int lights, int textures, CameraPath7 path, unsigned options = BenchmarkOption_None, const std::string& mesh = std::string()) :
+		name(name),
+		crates(crates),
+		lights(lights),
+		textures(textures),
+		path(path),
+		multiDraw((options & BenchmarkOption_MultiDraw) != 0),
+		mesh(mesh),
+		occlusion((options & BenchmarkOption_Occlusion) != 0),
+		city((options & BenchmarkOption_City) != 0),
+		queries((options & BenchmarkOption_Queries) != 0),
+		depthPrepass((options & BenchmarkOption_DepthPrepass) != 0),
+		deferred((options & BenchmarkOption_Deferred) != 0),
+		shadows((options & BenchmarkOption_Shadows) != 0),
+		uncachedShadows((options & BenchmarkOption_UncachedShadows) != 0),
+		streaming((options & BenchmarkOption_Streaming) != 0)
+	{
+	}
 
+	std::string	name;
+	int			crates;
+	int			lights;		//at most MAX_LIGHTS7, or MAX_DEFERRED_LIGHTS7 if `deferred`
+	int			textures;	//tinted copies of the crate texture, assigned round robin
+	CameraPath7	path;
+	bool		multiDraw;	//use gBatch7, if the hardware supports it
+	std::string	mesh;		//baked mesh drawn instead of the crate, relative to path7. Empty for the crate.
+	bool		occlusion;	//hide instances behind the nearest ones with gOcclusion7
+	bool		city;		//stretch the crates into towers of different heights
+	bool		queries;	//draw the large static instances conditionally on gQueries7
+	bool		depthPrepass; //draw the depth first, then shade with GL_EQUAL
+	bool		deferred;	//light the G-buffer instead of each instance, for up to MAX_DEFERRED_LIGHTS7 lights
+	bool		shadows;	//shadows of the first light and a sun. Forward shading only, without `multiDraw`.
+	bool		uncachedShadows; //draw the static instances into the shadow maps every frame
+	bool		streaming;	//stream the crate texture with gStreamer7, at the mip it is seen at
+};
 
+/*
+ The measurements of one benchmark scene
+ */
+struct BenchmarkResult7 {
+	explicit BenchmarkResult7(const BenchmarkScene7& scene) : scene(scene) {}
+
+	BenchmarkScene7		scene;
+	bool				multiDraw;
+	std::vector<double>	frameMilliseconds;
+	double				gpuMilliseconds;	//mean GPU time of "Render7", negative if not measured
+	double				visibleInstances;	//the rest are means per frame
+	double				occludedInstances;
+	double				queriedInstances;
+	double				queryOccludedInstances; //found hidden by their query, one frame late
+	double				shadedFragments;		//one frame late
+	double				staticShadowRedraws;	//shadow map faces and cascades whose static instances were drawn again
+	double				triangles;
+	double				fullDetailTriangles;
+	double				drawCalls;
+	double				programChanges;
+	double				textureChanges;
+	double				vertexArrayChanges;
+	double				heapAllocations;
+	double				textureBytes;	//resident in gResources7 at the end of the run
+	double				meshBytes;
+	double				streamedBytes;	//resident in gStreamer7 at the end of the run
+	double				streamUploadBytes; //per frame
+};
 
+// the scenes run by `--bench` when no scene is named
+static const BenchmarkScene7 BENCHMARK_SCENES7[] = {
+	BenchmarkScene7("crates-100", 100, 1, 1, CameraPath_Orbit),
+	BenchmarkScene7("crates-2500", 2500, 1, 1, CameraPath_Orbit),
+	BenchmarkScene7("crates-2500-mdi", 2500, 1, 1, CameraPath_Orbit, BenchmarkOption_MultiDraw),
+	BenchmarkScene7("lights-8", 400, 8, 1, CameraPath_Orbit),
+	BenchmarkScene7("textures-16", 1000, 2, 16, CameraPath_Orbit),
+	BenchmarkScene7("flythrough", 2500, 4, 4, CameraPath_Flythrough),
+	BenchmarkScene7("static", 2500, 1, 1, CameraPath_Static),
+	BenchmarkScene7("city", 2500, 4, 4, CameraPath_Flythrough, BenchmarkOption_Occlusion | BenchmarkOption_City),
+	BenchmarkScene7("city-no-occlusion", 2500, 4, 4, CameraPath_Flythrough, BenchmarkOption_City),
+	BenchmarkScene7("city-queries", 2500, 4, 4, CameraPath_Flythrough, BenchmarkOption_City | BenchmarkOption_Queries),
+	BenchmarkScene7("city-prepass", 2500, 4, 4, CameraPath_Flythrough, BenchmarkOption_Occlusion | BenchmarkOption_City | BenchmarkOption_DepthPrepass),
+	BenchmarkScene7("deferred-lights-1", 2500, 1, 1, CameraPath_Orbit, BenchmarkOption_Deferred),
+	BenchmarkScene7("deferred-lights-16", 2500, 16, 1, CameraPath_Orbit, BenchmarkOption_Deferred),
+	BenchmarkScene7("deferred-lights-256", 2500, 256, 1, CameraPath_Orbit, BenchmarkOption_Deferred),
+	BenchmarkScene7("deferred-lights-4096", 2500, 4096, 1, CameraPath_Orbit, BenchmarkOption_Deferred),
+	BenchmarkScene7("city-shadows", 2500, 4, 4, CameraPath_Flythrough, BenchmarkOption_Occlusion | BenchmarkOption_City | BenchmarkOption_Shadows),
+	BenchmarkScene7("city-shadows-uncached", 2500, 4, 4, CameraPath_Flythrough, BenchmarkOption_Occlusion | BenchmarkOption_City | BenchmarkOption_Shadows | BenchmarkOption_UncachedShadows),
+	BenchmarkScene7("flythrough-streaming", 2500, 4, 1, CameraPath_Flythrough, BenchmarkOption_Streaming),
+	BenchmarkScene7("city-mesh", 2500, 4, 4, CameraPath_Flythrough, BenchmarkOption_Occlusion | BenchmarkOption_City, "sphere.mesh"),
+};
+
+// the asset of the current benchmark scene (the crate or a loaded mesh) followed by its
+// tinted copies, one per texture
+std::vector<ModelAsset*> gBenchmarkAssets7;
+
+// deletes the assets made for the previous benchmark scene. The copies share the geometry
+// of the first asset, and the first asset shares the texture of the crate. Their textures
+// and mesh are unpinned, so gResources7 keeps them for the next scene until it needs the room.
+static void DeleteBenchmarkAssets7()
+{
+	for (size_t i = 1; i < gBenchmarkAssets7.size(); ++i) {
+		gResources7->unpin(gBenchmarkAssets7[i]->textureHandle);
+		delete gBenchmarkAssets7[i];
+	}
+	if (!gBenchmarkAssets7.empty() && gBenchmarkAssets7[0] != &gWoodenCrate7) {
+		ModelAsset* mesh = gBenchmarkAssets7[0];
+		glDeleteVertexArrays(1, &mesh->vao);
+		glDeleteVertexArrays(1, &mesh->gbufferVao);
+		glDeleteVertexArrays(1, &mesh->depthVao);
+		gResources7->unpin(mesh->meshHandle);
+		delete mesh;
+	}
+	gBenchmarkAssets7.clear();
+}
+
+// returns half the width of the crate grid of `scene`
+static float BenchmarkExtent7(const BenchmarkScene7& scene)
+{
+	const float spacing = 4.0f;
+	int side = (int) ceil(sqrt((double) scene.crates));
+	return 0.5f * spacing * side;
+}
+
+// replaces gInstances7 and gLights7 with the grid of `scene`
+static void CreateBenchmarkScene7(const BenchmarkScene7& scene)
+{
+	const int maxLights = (int) (scene.deferred ? MAX_DEFERRED_LIGHTS7 : MAX_LIGHTS7);
+	if (scene.lights < 1 || scene.lights > maxLights || scene.textures < 1 || scene.crates < 1 || (scene.deferred && scene.multiDraw)
+		|| (scene.shadows && (scene.deferred || scene.multiDraw)))
+		throw std::runtime_error("Invalid benchmark scene: " + scene.name);
+
+	// one asset per texture, sharing the geometry and shaders of the crate or the mesh
+	DeleteBenchmarkAssets7();
+	ModelAsset* base = &gWoodenCrate7;
+	if (!scene.mesh.empty()) {
+		base = new ModelAsset(gWoodenCrate7);
+		base->vbo = base->ibo = base->vao = base->gbufferVao = base->depthVao = 0;
+		base->meshHandle = tdogl::MeshHandle();
+		base->batchMesh = -1;
+		base->occluderVertices.clear(); //the crate's box doesn't fit the mesh, which may not be solid
+		base->occluderIndices.clear();
+		gBenchmarkAssets7.push_back(base); //deleted by DeleteBenchmarkAssets7 if loading fails
+		LoadMeshAsset7(*base, scene.mesh);
+	} else {
+		gBenchmarkAssets7.push_back(base);
+	}
+	if (scene.textures > 1) {
+		tdogl::Bitmap original = tdogl::Bitmap::bitmapFromFile(path7 + "wooden-crate.jpg");
+		original.flipVertically();
+		for (int t = 1; t < scene.textures; ++t) {
+			tdogl::Bitmap bmp = original;
+			glm::vec3 tint(0.5f + 0.5f * (float) sin(t * 1.7), 0.5f + 0.5f * (float) sin(t * 2.3 + 1.0), 0.5f + 0.5f * (float) sin(t * 3.1 + 2.0));
+			unsigned channels = (unsigned) bmp.format();
+			unsigned char* pixels = bmp.pixelBuffer();
+			for (unsigned i = 0; i < bmp.width() * bmp.height(); ++i) {
+				for (unsigned c = 0; c < channels && c < 3; ++c)
+					pixels[i * channels + c] = (unsigned char) (pixels[i * channels + c] * tint[c]);
+			}
+
+			std::ostringstream name;
+			name << "wooden-crate.jpg#tint" << t;
+			ModelAsset* asset = new ModelAsset(*base);
+			asset->textureHandle = gResources7->addTexture(name.str(), bmp);
+			gResources7->pin(asset->textureHandle);
+			asset->texture = gResources7->texture(asset->textureHandle);
+			asset->streamedTexture = tdogl::TextureStreamer::NoTexture; //the tint isn't in the file
+			asset->batchMesh = -1;
+			gBenchmarkAssets7.push_back(asset);
+		}
+	}
+
+	// a mesh is scaled and centered to fill the 2x2x2 box of a crate
+	glm::vec3 boundsSize = base->boundsMax - base->boundsMin;
+	float scale = 2.0f / std::max(boundsSize.x, std::max(boundsSize.y, boundsSize.z));
+	glm::vec3 center = 0.5f * (base->boundsMin + base->boundsMax);
+
+	// a square grid of crates on the XZ plane, centered on the origin
+	const float spacing = 4.0f;
+	int side = (int) ceil(sqrt((double) scene.crates));
+	float extent = BenchmarkExtent7(scene);
+	gInstances7.clear();
+	gSceneGraph7.clear();
+	tdogl::SceneGraph::NodeId grid = gSceneGraph7.createNode();
+	for (int i = 0; i < scene.crates; ++i) {
+		glm::vec3 position(-extent + spacing * (0.5f + i % side), 0, -extent + spacing * (0.5f + i / side));
+		glm::vec3 instanceScale(scale);
+		if (scene.city) {
+			//towers 1 to 8 crates high, standing on the ground. The first one stays a crate, so it can spin.
+			float height = (i == 0 ? 1.0f : 1.0f + (float) ((i * 7919) % 8));
+			instanceScale.y *= height;
+			position.y += height - 1.0f;
+		}
+		AddInstance7(gBenchmarkAssets7[i % gBenchmarkAssets7.size()], grid, position - instanceScale * center, instanceScale);
+	}
+	gInstances7.front().dynamic = true; //UpdateScene7 rotates it
+	gDegreesRotated7 = 0.0f;
+	PublishSnapshot7(0.0);
+	ResolveScenePrograms7();
+
+	// lights in a ring above the grid. More lights than forward shading takes are scattered
+	// over the grid instead, each reaching far enough to cover the grid a few times over.
+	gLights7.clear();
+	const bool scattered = (scene.lights > (int) MAX_LIGHTS7);
+	const float reach = std::max(4.0f, 2.0f * extent * (float) sqrt(4.0 / scene.lights));
+	unsigned seed = 12345;
+	for (int l = 0; l < scene.lights; ++l) {
+		float angle = 6.2831853f * l / scene.lights;
+		Light light;
+		light.intensities = (l == 0 ? glm::vec3(1, 1, 1) : glm::vec3(0.5f + 0.5f * cos(angle), 0.5f + 0.5f * sin(angle), 0.75f));
+		if (scattered) {
+			float random[3];
+			for (int c = 0; c < 3; ++c) {
+				seed = seed * 1664525u + 1013904223u;
+				random[c] = (seed >> 8) / 16777216.0f;
+			}
+			light.position = glm::vec3(extent * (2.0f * random[0] - 1.0f), 1.0f + 4.0f * random[1], extent * (2.0f * random[2] - 1.0f));
+			light.intensities *= 0.5f;
+			light.attenuation = 128.0f / (reach * reach); //fades to 1/256 at `reach`
+			light.ambientCoefficient = 0.005f / scene.lights;
+		} else {
+			light.position = glm::vec3(0.5f * extent * cos(angle), 6.0f, 0.5f * extent * sin(angle));
+			light.attenuation = 0.01f;
+			light.ambientCoefficient = 0.005f;
+		}
+		gLights7.push_back(light);
+	}
+
+	// rebuild the multi-draw batch for the new assets
+	delete gBatch7;
+	gBatch7 = nullptr;
+	gUseMultiDraw7 = false;
+	gWoodenCrate7.batchMesh = -1;
+	if (scene.multiDraw)
+		CreateMultiDrawBatch7();
+
+	gCamera7.setNearAndFarPlanes(0.5f, std::max(100.0f, 4.0f * extent));
+	gUseOcclusion7 = scene.occlusion;
+	gUseQueries7 = scene.queries;
+	gUseDepthPrepass7 = scene.depthPrepass;
+	gUseDeferred7 = scene.deferred;
+	gUseShadows7 = scene.shadows;
+	gCacheShadows7 = !scene.uncachedShadows;
+	gUseStreaming7 = scene.streaming;
+	gSun7.intensities = (scene.shadows ? SUN_INTENSITIES7 : glm::vec3(0.0f));
+}
+
+// moves gCamera7 along the path of `scene`, `time` seconds after the start
+static void MoveBenchmarkCamera7(const BenchmarkScene7& scene, float time)
+{
+	float extent = BenchmarkExtent7(scene);
+	glm::vec3 position;
+	glm::vec3 target;
+	switch (scene.path) {
+	case CameraPath_Static:
+		position = glm::vec3(0.0f, 0.6f * extent + 5.0f, 1.2f * extent + 5.0f);
+		target = glm::vec3(0, 0, 0);
+		break;
+	case CameraPath_Orbit:
+		position = glm::vec3((0.75f * extent + 5.0f) * cos(0.5f * time), 0.4f * extent + 3.0f, (0.75f * extent + 5.0f) * sin(0.5f * time));
+		target = glm::vec3(0, 0, 0);
+		break;
+	case CameraPath_Flythrough:
+		position = glm::vec3(0.3f * extent * sin(0.7f * time), 3.0f, extent - fmod(8.0f * time, 2.0f * extent));
+		target = position + glm::vec3(0.3f * cos(0.7f * time), -0.3f, -1.0f);
+		break;
+	}
+	gCamera7.setPosition(position);
+	gCamera7.lookAt(target);
+}
+
+// returns the `percent` percentile of the sorted `values`, using the nearest rank
+static double Percentile7(const std::vector<double>& sorted, double percent)
+{
+	if (sorted.empty())
+		return 0.0;
+	size_t rank = (size_t) ceil(percent / 100.0 * sorted.size());
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// renders `frames` frames of `scene` into `framebuffer`, after `warmupFrames` unmeasured ones
+static BenchmarkResult7 RunBenchmarkScene7(const BenchmarkScene7& scene, int warmupFrames, int frames, const tdogl::Framebuffer& framebuffer)
+{
+	CreateBenchmarkScene7(scene);
+
+	BenchmarkResult7 result(scene);
+	result.multiDraw = gUseMultiDraw7;
+	result.gpuMilliseconds = 0.0;
+	result.visibleInstances = 0.0;
+	result.occludedInstances = 0.0;
+	result.queriedInstances = 0.0;
+	result.queryOccludedInstances = 0.0;
+	result.shadedFragments = 0.0;
+	result.staticShadowRedraws = 0.0;
+	result.triangles = 0.0;
+	result.fullDetailTriangles = 0.0;
+	result.drawCalls = 0.0;
+	result.programChanges = 0.0;
+	result.textureChanges = 0.0;
+	result.vertexArrayChanges = 0.0;
+	result.heapAllocations = 0.0;
+	result.textureBytes = 0.0;
+	result.meshBytes = 0.0;
+	result.streamedBytes = 0.0;
+	result.streamUploadBytes = 0.0;
+	unsigned long long streamUploadsBefore = 0;
+	int gpuSamples = 0;
+
+	// like a swap chain, let the CPU run at most two frames ahead of the GPU
+	std::deque<GLsync> fences;
+	for (int frame = 0; frame < warmupFrames + frames; ++frame) {
+		if (frame == warmupFrames)
+			streamUploadsBefore = gStreamer7->uploadedBytes(); //the tails and first mips go up in the warmup
+		double frameStart = tdogl::Profiler::nowMicroseconds();
+		gProfiler7->beginFrame();
+		unsigned long long allocationsBefore = tdogl::AllocationCounter::allocations();
+		UpdateFixedStep7((frame + 1) * (double) SIMULATION_STEP7);
+		unsigned shadowRedrawsBefore = gPointShadows7->staticRedraws() + gSunShadows7->staticRedraws();
+		MoveBenchmarkCamera7(scene, frame * SIMULATION_STEP7);
+
+		framebuffer.bind();
+		Render7();
+		framebuffer.unbind();
+		gFrameAllocations7 = tdogl::AllocationCounter::allocations() - allocationsBefore;
+		gProfiler7->endFrame();
+
+		fences.push_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+		if (fences.size() > 2) {
+			glClientWaitSync(fences.front(), GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			glDeleteSync(fences.front());
+			fences.pop_front();
+		}
+		double frameEnd = tdogl::Profiler::nowMicroseconds();
+
+		if (frame < warmupFrames)
+			continue;
+		result.frameMilliseconds.push_back((frameEnd - frameStart) / 1000.0);
+		result.visibleInstances += gDrawCounts7.instances;
+		result.occludedInstances += gDrawCounts7.occluded;
+		result.queriedInstances += gDrawCounts7.queried;
+		result.queryOccludedInstances += gQueries7->occludedCount();
+		result.shadedFragments += gShadedFragments7;
+		result.staticShadowRedraws += gPointShadows7->staticRedraws() + gSunShadows7->staticRedraws() - shadowRedrawsBefore;
+		result.triangles += gDrawCounts7.triangles;
+		result.fullDetailTriangles += gDrawCounts7.fullDetailTriangles;
+		result.drawCalls += gRenderStats7.drawCalls;
+		result.programChanges += gRenderStats7.programChanges;
+		result.textureChanges += gRenderStats7.textureChanges;
+		result.vertexArrayChanges += gRenderStats7.vertexArrayChanges;
+		result.heapAllocations += gFrameAllocations7;
+		if (gProfiler7->gpuTimingEnabled()) {
+			result.gpuMilliseconds += gProfiler7->gpuMilliseconds("Render7");
+			++gpuSamples;
+		}
+	}
+	glFinish();
+	for (size_t i = 0; i < fences.size(); ++i)
+		glDeleteSync(fences[i]);
+
+	GLenum error = glGetError();
+	if (error != GL_NO_ERROR)
+		std::cerr << "OpenGL Error " << error << " in benchmark scene " << scene.name << std::endl;
+
+	double count = std::max(1.0, (double) result.frameMilliseconds.size());
+	result.visibleInstances /= count;
+	result.occludedInstances /= count;
+	result.queriedInstances /= count;
+	result.queryOccludedInstances /= count;
+	result.shadedFragments /= count;
+	result.staticShadowRedraws /= count;
+	result.triangles /= count;
+	result.fullDetailTriangles /= count;
+	result.drawCalls /= count;
+	result.programChanges /= count;
+	result.textureChanges /= count;
+	result.vertexArrayChanges /= count;
+	result.heapAllocations /= count;
+	result.textureBytes = (double) gResources7->usage(tdogl::ResourceManager::Type_Texture).bytes;
+	result.meshBytes = (double) gResources7->usage(tdogl::ResourceManager::Type_Mesh).bytes;
+	result.streamedBytes = (double) gStreamer7->residentBytes();
+	result.streamUploadBytes = (gStreamer7->uploadedBytes() - streamUploadsBefore) / count;
+	result.gpuMilliseconds = (gpuSamples > 0 ? result.gpuMilliseconds / gpuSamples : -1.0);
+	std::sort(result.frameMilliseconds.begin(), result.frameMilliseconds.end());
+	return result;
+}
+
+// returns `text` as a quoted JSON string
+static std::string JsonString7(const std::string& text)
+{
+	std::string result = "\"";
+	for (size_t i = 0; i < text.size(); ++i) {
+		if (text[i] == '"' || text[i] == '\\')
+			result += '\\';
+		if ((unsigned char) text[i] >= 0x20)
+			result += text[i];
+	}
+	return result + "\"";
+}
+
+// writes the benchmark results as JSON
+static void WriteBenchmarkJson7(const std::string& filePath, const std::vector<BenchmarkResult7>& results, int warmupFrames, int frames)
+{
+	static const char* pathNames[] = { "static", "orbit", "flythrough" };
+
+	std::ofstream out(filePath.c_str());
+	if (!out)
+		throw std::runtime_error("Failed to open benchmark output file: " + filePath);
+
+	out << "{\n";
+	out << "  \"renderer\": " << JsonString7((const char*) glGetString(GL_RENDERER)) << ",\n";
+	out << "  \"glVersion\": " << JsonString7((const char*) glGetString(GL_VERSION)) << ",\n";
+	out << "  \"context\": " << JsonString7(tdogl::HeadlessContext::backendName()) << ",\n";
+	out << "  \"threads\": " << gJobs7->threadCount() << ",\n";
+	out << "  \"width\": " << SCREEN_SIZE7.x << ",\n";
+	out << "  \"height\": " << SCREEN_SIZE7.y << ",\n";
+	out << "  \"warmupFrames\": " << warmupFrames << ",\n";
+	out << "  \"frames\": " << frames << ",\n";
+	out << "  \"scenes\": [\n";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchmarkResult7& r = results[i];
+		double mean = 0.0;
+		for (size_t f = 0; f < r.frameMilliseconds.size(); ++f)
+			mean += r.frameMilliseconds[f];
+		mean /= std::max((size_t) 1, r.frameMilliseconds.size());
+
+		out << "    {\n";
+		out << "      \"name\": " << JsonString7(r.scene.name) << ",\n";
+		out << "      \"crates\": " << r.scene.crates << ",\n";
+		out << "      \"lights\": " << r.scene.lights << ",\n";
+		out << "      \"textures\": " << r.scene.textures << ",\n";
+		out << "      \"cameraPath\": \"" << pathNames[r.scene.path] << "\",\n";
+		out << "      \"multiDraw\": " << (r.multiDraw ? "true" : "false") << ",\n";
+		out << "      \"mesh\": " << (r.scene.mesh.empty() ? std::string("null") : JsonString7(r.scene.mesh)) << ",\n";
+		out << "      \"occlusion\": " << (r.scene.occlusion ? "true" : "false") << ",\n";
+		out << "      \"city\": " << (r.scene.city ? "true" : "false") << ",\n";
+		out << "      \"queries\": " << (r.scene.queries ? "true" : "false") << ",\n";
+		out << "      \"depthPrepass\": " << (r.scene.depthPrepass ? "true" : "false") << ",\n";
+		out << "      \"deferred\": " << (r.scene.deferred ? "true" : "false") << ",\n";
+		out << "      \"shadows\": " << (r.scene.shadows ? "true" : "false") << ",\n";
+		out << "      \"uncachedShadows\": " << (r.scene.uncachedShadows ? "true" : "false") << ",\n";
+		out << "      \"streaming\": " << (r.scene.streaming ? "true" : "false") << ",\n";
+		out << "      \"cpuFrameMs\": { \"mean\": " << mean
+			<< ", \"p50\": " << Percentile7(r.frameMilliseconds, 50)
+			<< ", \"p90\": " << Percentile7(r.frameMilliseconds, 90)
+			<< ", \"p95\": " << Percentile7(r.frameMilliseconds, 95)
+			<< ", \"p99\": " << Percentile7(r.frameMilliseconds, 99)
+			<< ", \"max\": " << (r.frameMilliseconds.empty() ? 0.0 : r.frameMilliseconds.back()) << " },\n";
+		out << "      \"gpuRenderMs\": ";
+		if (r.gpuMilliseconds < 0.0)
+			out << "null,\n";
+		else
+			out << r.gpuMilliseconds << ",\n";
+		out << "      \"visibleInstances\": " << r.visibleInstances << ",\n";
+		out << "      \"occludedInstances\": " << r.occludedInstances << ",\n";
+		out << "      \"queriedInstances\": " << r.queriedInstances << ",\n";
+		out << "      \"queryOccludedInstances\": " << r.queryOccludedInstances << ",\n";
+		out << "      \"shadedFragments\": " << r.shadedFragments << ",\n";
+		out << "      \"staticShadowRedraws\": " << r.staticShadowRedraws << ",\n";
+		out << "      \"triangles\": " << r.triangles << ",\n";
+		out << "      \"fullDetailTriangles\": " << r.fullDetailTriangles << ",\n";
+		out << "      \"drawCalls\": " << r.drawCalls << ",\n";
+		out << "      \"programChanges\": " << r.programChanges << ",\n";
+		out << "      \"textureChanges\": " << r.textureChanges << ",\n";
+		out << "      \"vertexArrayChanges\": " << r.vertexArrayChanges << ",\n";
+		out << "      \"heapAllocationsPerFrame\": " << r.heapAllocations << ",\n";
+		out << "      \"textureBytes\": " << r.textureBytes << ",\n";
+		out << "      \"meshBytes\": " << r.meshBytes << ",\n";
+		out << "      \"streamedBytes\": " << r.streamedBytes << ",\n";
+		out << "      \"streamUploadBytesPerFrame\": " << r.streamUploadBytes << "\n";
+		out << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n";
+	out << "}\n";
+}
+
+// parses a scene given on the command line as "crates,lights,textures,path[,option...]", with
+// path one of static, orbit or flythrough. The options are mdi, occlusion, city, queries,
+// prepass, deferred, shadows, uncached-shadows, streaming and mesh=<file>, a baked mesh drawn
+// instead of the crate.
+static BenchmarkScene7 ParseBenchmarkScene7(const std::string& spec)
+{
+	BenchmarkScene7 scene(spec, 0, 0, 0, CameraPath_Static);
+
+	std::string pathName;
+	std::istringstream in(spec);
+	char comma = 0;
+	in >> scene.crates >> comma >> scene.lights >> comma >> scene.textures >> comma;
+	std::getline(in, pathName, ',');
+	if (!in && !in.eof())
+		throw std::runtime_error("Invalid benchmark scene: " + spec);
+
+	std::string option;
+	while (std::getline(in, option, ',')) {
+		if (option == "mdi")
+			scene.multiDraw = true;
+		else if (option == "occlusion")
+			scene.occlusion = true;
+		else if (option == "city")
+			scene.city = true;
+		else if (option == "queries")
+			scene.queries = true;
+		else if (option == "prepass")
+			scene.depthPrepass = true;
+		else if (option == "deferred")
+			scene.deferred = true;
+		else if (option == "shadows")
+			scene.shadows = true;
+		else if (option == "uncached-shadows")
+			scene.shadows = scene.uncachedShadows = true;
+		else if (option == "streaming")
+			scene.streaming = true;
+		else if (option.compare(0, 5, "mesh=") == 0)
+			scene.mesh = option.substr(5);
+		else
+			throw std::runtime_error("Invalid benchmark scene option: " + option);
+	}
+
+	if (pathName == "static")
+		scene.path = CameraPath_Static;
+	else if (pathName == "orbit")
+		scene.path = CameraPath_Orbit;
+	else if (pathName == "flythrough")
+		scene.path = CameraPath_Flythrough;
+	else
+		throw std::runtime_error("Invalid benchmark camera path: " + pathName);
+	return scene;
+}
+
+// runs the benchmark scenes headless and writes the results to `outputPath` as JSON.
+// `sceneName` selects one of BENCHMARK_SCENES7 or describes a custom scene (see
+// ParseBenchmarkScene7). If it is empty, all of BENCHMARK_SCENES7 are run.
+void BenchmarkMain_7(const std::string& outputPath, int frames, const std::string& sceneName)
+{
+	std::vector<BenchmarkScene7> scenes;
+	const size_t sceneCount = sizeof(BENCHMARK_SCENES7) / sizeof(BENCHMARK_SCENES7[0]);
+	for (size_t i = 0; i < sceneCount; ++i) {
+		if (sceneName.empty() || sceneName == BENCHMARK_SCENES7[i].name)
+			scenes.push_back(BENCHMARK_SCENES7[i]);
+	}
+	if (scenes.empty())
+		scenes.push_back(ParseBenchmarkScene7(sceneName));
+
+	// create a context with nothing on screen, and load everything
+	tdogl::HeadlessContext context;
+	gSrgbFramebuffer7 = true;
+	InitScene7();
+	tdogl::Framebuffer framebuffer((GLsizei) SCREEN_SIZE7.x, (GLsizei) SCREEN_SIZE7.y, GL_SRGB8_ALPHA8);
+
+	const int warmupFrames = 30;
+	std::vector<BenchmarkResult7> results;
+	for (size_t i = 0; i < scenes.size(); ++i) {
+		results.push_back(RunBenchmarkScene7(scenes[i], warmupFrames, frames, framebuffer));
+		const BenchmarkResult7& r = results.back();
+		std::cout << r.scene.name << ": p50 " << Percentile7(r.frameMilliseconds, 50)
+			<< " ms, p99 " << Percentile7(r.frameMilliseconds, 99)
+			<< " ms, GPU " << r.gpuMilliseconds << " ms, "
+			<< r.drawCalls << " draws, "
+			<< r.triangles << " of " << r.fullDetailTriangles << " triangles, "
+			<< r.occludedInstances << " occluded, "
+			<< r.queryOccludedInstances << " of " << r.queriedInstances << " queried hidden, "
+			<< r.shadedFragments << " fragments shaded, "
+			<< r.heapAllocations << " heap allocations per frame" << std::endl;
+	}
+
+	WriteBenchmarkJson7(outputPath, results, warmupFrames, frames);
+	std::cout << "Saved " << outputPath << std::endl;
+
+	DeleteBenchmarkAssets7();
+	delete gProfiler7;
+	gProfiler7 = nullptr;
+	DeleteJobs7();
+}
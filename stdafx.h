@@ -5,10 +5,16 @@
 
 #pragma once
 
-#include "targetver.h"
-
 #include <stdio.h>
+
+#ifdef _WIN32
+#include "targetver.h"
 #include <tchar.h>
+#else
+// elsewhere the command line is plain chars, and _tmain is just main
+typedef char _TCHAR;
+#define _tmain main
+#endif
 
 
 
@@ -0,0 +1,84 @@
+/*
+ tdogl::AllocationCounter
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace tdogl;
+
+// zero-initialised before anything runs, so allocations made by other static
+// constructors are counted too
+static std::atomic<unsigned long long> sAllocations;
+static std::atomic<unsigned long long> sBytes;
+
+unsigned long long AllocationCounter::allocations() {
+    return sAllocations.load();
+}
+
+unsigned long long AllocationCounter::bytes() {
+    return sBytes.load();
+}
+
+static void* CountedAllocate(size_t size) {
+    sAllocations.fetch_add(1, std::memory_order_relaxed);
+    sBytes.fetch_add(size, std::memory_order_relaxed);
+    void* p = malloc(size > 0 ? size : 1);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size) {
+    return CountedAllocate(size);
+}
+
+void* operator new[](size_t size) {
+    return CountedAllocate(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw() {
+    try {
+        return CountedAllocate(size);
+    } catch(...) {
+        return NULL;
+    }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw() {
+    try {
+        return CountedAllocate(size);
+    } catch(...) {
+        return NULL;
+    }
+}
+
+void operator delete(void* p) throw() {
+    free(p);
+}
+
+void operator delete[](void* p) throw() {
+    free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw() {
+    free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) throw() {
+    free(p);
+}
@@ -0,0 +1,40 @@
+/*
+ tdogl::AllocationCounter
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+namespace tdogl {
+
+    /**
+     Counts heap allocations made through operator new, in every thread.
+
+     AllocationCounter.cpp replaces the global operator new and delete of the whole program
+     with versions that count calls and then use malloc and free. Memory that libraries get
+     from malloc directly is not counted.
+
+     To check that a piece of code doesn't allocate, compare `allocations()` before and
+     after it.
+     */
+    class AllocationCounter {
+    public:
+        /** @result Number of calls to operator new and new[] since the program started */
+        static unsigned long long allocations();
+
+        /** @result Number of bytes requested from operator new and new[] since the program started */
+        static unsigned long long bytes();
+    };
+
+}
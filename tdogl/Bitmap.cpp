@@ -19,12 +19,17 @@
 #include "Bitmap.h"
 #include <stdexcept>
 #include <cstdlib>
+#include <algorithm>
 
 //uses stb_image to try load files
 #define STBI_FAILURE_USERMSG
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+//uses stb_image_write to save PNG files
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
 using namespace tdogl;
 
 
@@ -162,14 +167,8 @@ inline unsigned GetPixelOffset(unsigned col, unsigned row, unsigned width, unsig
 
 inline bool RectsOverlap(unsigned srcCol, unsigned srcRow, unsigned destCol, unsigned destRow, unsigned width, unsigned height){
     unsigned colDiff = srcCol > destCol ? srcCol - destCol : destCol - srcCol;
-    if(colDiff < width)
-        return true;
-    
     unsigned rowDiff = srcRow > destRow ? srcRow - destRow : destRow - srcRow;
-    if(rowDiff < height)
-        return true;
-    
-    return false;
+    return colDiff < width && rowDiff < height;
 }
 
 
@@ -200,6 +199,11 @@ Bitmap Bitmap::bitmapFromFile(std::string filePath) {
     return bmp;
 }
 
+void Bitmap::saveToPngFile(const std::string& filePath) const {
+    if(!stbi_write_png(filePath.c_str(), _width, _height, _format, _pixels, _width * _format))
+        throw std::runtime_error(std::string("Failed to write PNG file: ") + filePath);
+}
+
 Bitmap::Bitmap(const Bitmap& other) :
     _pixels(NULL)
 {
@@ -275,6 +279,28 @@ void Bitmap::rotate90CounterClockwise() {
     _width = swapTmp;
 }
 
+Bitmap Bitmap::halfSize() const {
+    const unsigned width = (_width > 1 ? _width / 2 : 1);
+    const unsigned height = (_height > 1 ? _height / 2 : 1);
+    Bitmap half(width, height, _format);
+    for(unsigned row = 0; row < height; ++row){
+        unsigned row0 = std::min(2 * row, _height - 1);
+        unsigned row1 = std::min(2 * row + 1, _height - 1);
+        for(unsigned col = 0; col < width; ++col){
+            unsigned col0 = std::min(2 * col, _width - 1);
+            unsigned col1 = std::min(2 * col + 1, _width - 1);
+            const unsigned char* p00 = getPixel(col0, row0);
+            const unsigned char* p01 = getPixel(col1, row0);
+            const unsigned char* p10 = getPixel(col0, row1);
+            const unsigned char* p11 = getPixel(col1, row1);
+            unsigned char* out = half.getPixel(col, row);
+            for(unsigned c = 0; c < (unsigned)_format; ++c)
+                out[c] = (unsigned char)((p00[c] + p01[c] + p10[c] + p11[c] + 2) / 4);
+        }
+    }
+    return half;
+}
+
 void Bitmap::copyRectFromBitmap(const Bitmap& src, 
                                 unsigned srcCol, 
                                 unsigned srcRow, 
@@ -291,10 +317,10 @@ void Bitmap::copyRectFromBitmap(const Bitmap& src,
     if(width == 0 || height == 0)
         throw std::runtime_error("Can't copy zero height/width rectangle");
     
-    if(srcCol + width >= src.width() || srcRow + height >= src.height())
+    if(srcCol + width > src.width() || srcRow + height > src.height())
         throw std::runtime_error("Rectangle doesn't fit within source bitmap");
 
-    if(destCol + width >= _width || destRow + height >= _height)
+    if(destCol + width > _width || destRow + height > _height)
         throw std::runtime_error("Rectangle doesn't fit within destination bitmap");
     
     if(_pixels == src._pixels && RectsOverlap(srcCol, srcRow, destCol, destRow, width, height))
@@ -302,7 +328,7 @@ void Bitmap::copyRectFromBitmap(const Bitmap& src,
     
     FormatConverterFunc converter = NULL;
     if(_format != src._format)
-        converter = ConverterFuncForFormats(_format, src._format);
+        converter = ConverterFuncForFormats(src._format, _format);
     
     for(unsigned row = 0; row < height; ++row){
         for(unsigned col = 0; col < width; ++col){
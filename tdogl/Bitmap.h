@@ -58,6 +58,13 @@ namespace tdogl {
          Tries to load the given file into a tdogl::Bitmap.
          */
         static Bitmap bitmapFromFile(std::string filePath);
+
+        /**
+         Writes the bitmap to a PNG file.
+
+         @throws std::exception if the file can not be written.
+         */
+        void saveToPngFile(const std::string& filePath) const;
                 
         /** width in pixels */
         unsigned width() const;
@@ -102,6 +109,13 @@ namespace tdogl {
          */
         void rotate90CounterClockwise();
         
+        /**
+         Returns the next mip of this bitmap: half the width and height, rounded down but at
+         least 1, each pixel the average of a 2x2 block. An odd last row or column is
+         averaged with itself.
+         */
+        Bitmap halfSize() const;
+        
         /**
          Copies a rectangular area from the given source bitmap into this bitmap.
          
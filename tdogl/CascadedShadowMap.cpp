@@ -0,0 +1,240 @@
+/*
+ tdogl::CascadedShadowMap
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "CascadedShadowMap.h"
+#include "Camera.h"
+#include <stdexcept>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace tdogl;
+
+//the slices are this much of the way from even depths to a geometric series
+static const float SplitBlend = 0.75f;
+
+//a cascade covers a sphere this much larger than its slice, so the camera can move a while
+//before the static casters have to be drawn again
+static const float CacheMargin = 0.25f;
+
+static GLuint CreateTextureArray(GLsizei size, unsigned layers) {
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    //linear filtering of a compared texture averages four comparisons on most hardware
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, (GLsizei)layers, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return texture;
+}
+
+//a framebuffer with only a depth attachment, the first layer of `textureArray`
+static GLuint CreateFramebuffer(GLuint textureArray, GLenum& status) {
+    GLuint framebuffer = 0;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textureArray, 0, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return framebuffer;
+}
+
+CascadedShadowMap::CascadedShadowMap(GLsizei size, unsigned cascades, float casterDistance) :
+    _size(size),
+    _cascadeCount(cascades),
+    _casterDistance(casterDistance),
+    _direction(0, -1, 0),
+    _hasDynamic(false),
+    _staticRedraws(0),
+    _staticTexture(0),
+    _texture(0),
+    _staticFramebuffer(0),
+    _framebuffer(0)
+{
+    if(size <= 0 || cascades == 0 || cascades > MaxCascades)
+        throw std::runtime_error("Invalid cascaded shadow map size or cascade count");
+
+    for(unsigned i = 0; i < MaxCascades; ++i){
+        _cascades[i].center = glm::vec3(0.0f);
+        _cascades[i].radius = 0.0f;
+        _cascades[i].valid = false;
+    }
+
+    _staticTexture = CreateTextureArray(size, cascades);
+    _texture = CreateTextureArray(size, cascades);
+    GLenum staticStatus = 0, status = 0;
+    _staticFramebuffer = CreateFramebuffer(_staticTexture, staticStatus);
+    _framebuffer = CreateFramebuffer(_texture, status);
+    if(staticStatus != GL_FRAMEBUFFER_COMPLETE || status != GL_FRAMEBUFFER_COMPLETE){
+        GLuint framebuffers[2] = { _staticFramebuffer, _framebuffer };
+        glDeleteFramebuffers(2, framebuffers);
+        GLuint textures[2] = { _staticTexture, _texture };
+        glDeleteTextures(2, textures);
+        std::ostringstream msg;
+        msg << "Cascaded shadow map framebuffer incomplete, status 0x" << std::hex << (status != GL_FRAMEBUFFER_COMPLETE ? status : staticStatus);
+        throw std::runtime_error(msg.str());
+    }
+}
+
+CascadedShadowMap::~CascadedShadowMap() {
+    GLuint framebuffers[2] = { _staticFramebuffer, _framebuffer };
+    glDeleteFramebuffers(2, framebuffers);
+    GLuint textures[2] = { _staticTexture, _texture };
+    glDeleteTextures(2, textures);
+}
+
+GLuint CascadedShadowMap::texture() const {
+    return _hasDynamic ? _texture : _staticTexture;
+}
+
+GLsizei CascadedShadowMap::size() const {
+    return _size;
+}
+
+unsigned CascadedShadowMap::cascadeCount() const {
+    return _cascadeCount;
+}
+
+unsigned CascadedShadowMap::staticRedraws() const {
+    return _staticRedraws;
+}
+
+const glm::mat4& CascadedShadowMap::shadowMatrix(unsigned cascade) const {
+    if(cascade >= _cascadeCount)
+        throw std::runtime_error("Cascade out of range");
+    return _cascades[cascade].shadowMatrix;
+}
+
+void CascadedShadowMap::invalidate() {
+    for(unsigned i = 0; i < MaxCascades; ++i)
+        _cascades[i].valid = false;
+}
+
+void CascadedShadowMap::placeCascade(Cascade& cascade, const glm::vec3& center, float radius) const {
+    //look along the light, with any up vector that isn't parallel to it
+    glm::vec3 up = (std::abs(_direction.y) > 0.99f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0));
+    glm::mat4 rotation = glm::lookAt(glm::vec3(0.0f), _direction, up);
+
+    //snap the center to whole texels across the light, so the shadows don't crawl over
+    //the texels when the cascade moves
+    glm::vec3 lightCenter(rotation * glm::vec4(center, 1.0f));
+    float texel = 2.0f * radius / _size;
+    lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+    lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+
+    //the eye is `_casterDistance` towards the light from the sphere
+    glm::mat4 view = glm::translate(glm::mat4(1.0f), -lightCenter - glm::vec3(0.0f, 0.0f, radius + _casterDistance)) * rotation;
+    glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2.0f * radius + _casterDistance);
+
+    //from clip space to texture coordinates and depth
+    glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+
+    cascade.center = center;
+    cascade.radius = radius;
+    cascade.viewProjection = projection * view;
+    cascade.shadowMatrix = bias * cascade.viewProjection;
+}
+
+void CascadedShadowMap::update(const Camera& camera, float shadowDistance, const glm::vec3& direction,
+                               const DrawCasters& drawStatic, const DrawCasters& drawDynamic)
+{
+    glm::vec3 newDirection = glm::normalize(direction);
+    if(newDirection != _direction){
+        _direction = newDirection;
+        invalidate();
+    }
+
+    //the caller's framebuffer and viewport are put back at the end
+    GLint previousFramebuffer = 0;
+    GLint viewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    glViewport(0, 0, _size, _size);
+    glDepthMask(GL_TRUE);
+    //slope scaled, so surfaces at a grazing angle to the light don't shadow themselves
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+
+    const float nearPlane = camera.nearPlane();
+    const float farPlane = std::max(nearPlane * 2.0f, std::min(shadowDistance, camera.farPlane()));
+    const float tanHalfFov = std::tan(glm::radians(0.5f * camera.fieldOfView()));
+    const float aspect = camera.viewportAspectRatio();
+    const glm::vec3 forward = camera.forward();
+    const glm::vec3 right = camera.right();
+    const glm::vec3 up = camera.up();
+
+    float sliceStart = nearPlane;
+    for(unsigned i = 0; i < _cascadeCount; ++i){
+        float t = (float)(i + 1) / _cascadeCount;
+        float geometricEnd = nearPlane * std::pow(farPlane / nearPlane, t);
+        float evenEnd = nearPlane + (farPlane - nearPlane) * t;
+        float sliceEnd = SplitBlend * geometricEnd + (1.0f - SplitBlend) * evenEnd;
+
+        //the sphere around the corners of the slice
+        glm::vec3 corners[8];
+        glm::vec3 center(0.0f);
+        for(unsigned c = 0; c < 8; ++c){
+            float depth = (c < 4 ? sliceStart : sliceEnd);
+            float x = ((c & 1) ? 1.0f : -1.0f) * depth * tanHalfFov * aspect;
+            float y = ((c & 2) ? 1.0f : -1.0f) * depth * tanHalfFov;
+            corners[c] = camera.position() + depth * forward + x * right + y * up;
+            center += corners[c] / 8.0f;
+        }
+        float radius = 0.0f;
+        for(unsigned c = 0; c < 8; ++c)
+            radius = std::max(radius, glm::length(corners[c] - center));
+        sliceStart = sliceEnd;
+
+        //move the cascade, and draw its static casters again, only once the slice leaves it
+        Cascade& cascade = _cascades[i];
+        if(!cascade.valid || glm::length(center - cascade.center) + radius > cascade.radius){
+            placeCascade(cascade, center, radius * (1.0f + CacheMargin));
+            glBindFramebuffer(GL_FRAMEBUFFER, _staticFramebuffer);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _staticTexture, 0, (GLint)i);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            drawStatic(cascade.viewProjection);
+            cascade.valid = true;
+            ++_staticRedraws;
+        }
+    }
+
+    //the dynamic casters, on top of a copy of the cached layers
+    _hasDynamic = (drawDynamic != nullptr);
+    if(_hasDynamic){
+        for(unsigned i = 0; i < _cascadeCount; ++i){
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, _staticFramebuffer);
+            glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _staticTexture, 0, (GLint)i);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _framebuffer);
+            glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _texture, 0, (GLint)i);
+            glBlitFramebuffer(0, 0, _size, _size, 0, 0, _size, _size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+            drawDynamic(_cascades[i].viewProjection);
+        }
+    }
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)previousFramebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
@@ -0,0 +1,125 @@
+/*
+ tdogl::CascadedShadowMap
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <functional>
+
+namespace tdogl {
+
+    class Camera;
+
+    /**
+     The shadows of a directional light, like the sun, over the part of the view nearest
+     the camera.
+
+     The view is cut into slices along its depth, each twice as deep as the last or so, and
+     each slice gets an orthographic shadow map of its own, one layer of a texture array. So
+     the shadows near the camera get as many texels as the ones far away.
+
+     Each cascade covers a sphere a bit larger than its slice, and stays where it is while
+     the slice fits inside. Only then is it moved, and its static casters drawn again. The
+     rest of the time, the cached layer is copied into the texture that is sampled, and
+     only the dynamic casters are drawn on top.
+
+     A shader picks the first cascade whose `shadowMatrix` maps the point inside [0, 1],
+     and samples the layer with a sampler2DArrayShadow.
+     */
+    class CascadedShadowMap {
+    public:
+        enum { MaxCascades = 4 };
+
+        /**
+         Draws the shadow casters with the given view-projection matrix, into the bound
+         framebuffer. Only the depth is kept.
+         */
+        typedef std::function<void(const glm::mat4& viewProjection)> DrawCasters;
+
+        /**
+         @param size            Width and height of each cascade, in pixels
+         @param cascades        From 1 to `MaxCascades`
+         @param casterDistance  How far towards the light from its cascade a caster can
+                                still be drawn
+
+         @throws std::exception if the framebuffers are incomplete.
+         */
+        CascadedShadowMap(GLsizei size, unsigned cascades, float casterDistance);
+        ~CascadedShadowMap();
+
+        /** @result The GL_TEXTURE_2D_ARRAY to sample, one layer per cascade */
+        GLuint texture() const;
+
+        GLsizei size() const;
+        unsigned cascadeCount() const;
+
+        /** @result How many times the static casters of a cascade have been drawn, in total */
+        unsigned staticRedraws() const;
+
+        /**
+         @result The matrix from world space to the texture coordinates and depth of
+                 `cascade`, as of the last `update`
+         */
+        const glm::mat4& shadowMatrix(unsigned cascade) const;
+
+        /**
+         Makes the next `update` draw the static casters of every cascade again
+         */
+        void invalidate();
+
+        /**
+         Draws the shadows of the light in the view of `camera`, up to `shadowDistance`
+         from it. Restores the framebuffer binding and the viewport.
+
+         @param direction    The way the light travels
+         @param drawStatic   Draws the casters that never move. Only called for the
+                             cascades that moved.
+         @param drawDynamic  Draws the other casters. May be empty, then the cached layers
+                             are sampled directly.
+         */
+        void update(const Camera& camera, float shadowDistance, const glm::vec3& direction,
+                    const DrawCasters& drawStatic, const DrawCasters& drawDynamic);
+
+    private:
+        struct Cascade {
+            glm::vec3 center;   //of the sphere the shadow map covers
+            float radius;
+            glm::mat4 viewProjection;
+            glm::mat4 shadowMatrix;
+            bool valid;
+        };
+
+        GLsizei _size;
+        unsigned _cascadeCount;
+        float _casterDistance;
+        glm::vec3 _direction;
+        Cascade _cascades[MaxCascades];
+        bool _hasDynamic;
+        unsigned _staticRedraws;
+        GLuint _staticTexture;
+        GLuint _texture;
+        GLuint _staticFramebuffer;
+        GLuint _framebuffer;
+
+        void placeCascade(Cascade& cascade, const glm::vec3& center, float radius) const;
+
+        //copying disabled
+        CascadedShadowMap(const CascadedShadowMap&);
+        const CascadedShadowMap& operator=(const CascadedShadowMap&);
+    };
+
+}
@@ -0,0 +1,294 @@
+/*
+ tdogl::CommandBuffer
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "CommandBuffer.h"
+#include <stdexcept>
+#include <cstring>
+
+using namespace tdogl;
+
+enum Opcode {
+    Op_UseProgram,
+    Op_BindTexture,
+    Op_BindVertexArray,
+    Op_BindUniformBlock,
+    Op_Uniform1i,
+    Op_Uniform1f,
+    Op_Uniform3f,
+    Op_Uniform4f,
+    Op_UniformMatrix4,
+    Op_DrawArrays,
+    Op_DrawElements,
+    Op_BeginConditionalRender,
+    Op_EndConditionalRender
+};
+
+// every command starts with a header, so replay can find the next one
+struct CommandHeader {
+    unsigned opcode;
+    unsigned size; //bytes including the header, a multiple of CommandAlignment
+};
+
+struct UseProgramCommand { CommandHeader header; GLuint program; };
+struct BindTextureCommand { CommandHeader header; GLenum unit; GLenum target; GLuint texture; };
+struct BindVertexArrayCommand { CommandHeader header; GLuint vao; };
+struct BindUniformBlockCommand { CommandHeader header; GLuint binding; GLuint buffer; GLintptr offset; GLsizeiptr size; };
+struct Uniform1iCommand { CommandHeader header; GLint location; GLint value; };
+struct Uniform1fCommand { CommandHeader header; GLint location; GLfloat value; };
+struct Uniform3fCommand { CommandHeader header; GLint location; GLfloat value[3]; };
+struct Uniform4fCommand { CommandHeader header; GLint location; GLfloat value[4]; };
+struct UniformMatrix4Command { CommandHeader header; GLint location; GLfloat value[16]; };
+struct DrawArraysCommand { CommandHeader header; GLenum mode; GLint first; GLsizei count; };
+struct DrawElementsCommand { CommandHeader header; GLenum mode; GLsizei count; GLenum type; GLintptr offset; };
+struct BeginConditionalRenderCommand { CommandHeader header; GLuint query; GLenum mode; };
+
+// keeps the GLintptr members of the commands aligned
+static const size_t CommandAlignment = 8;
+
+CommandBuffer::CommandBuffer(size_t blockSize) :
+    _blockSize(blockSize),
+    _currentBlock(0),
+    _commandCount(0)
+{
+    if(_blockSize < sizeof(UniformMatrix4Command) + CommandAlignment)
+        throw std::runtime_error("CommandBuffer block size is too small");
+}
+
+CommandBuffer::~CommandBuffer() {
+    for(size_t i = 0; i < _blocks.size(); ++i)
+        delete[] _blocks[i].data;
+}
+
+void CommandBuffer::reset() {
+    for(size_t i = 0; i < _blocks.size(); ++i)
+        _blocks[i].used = 0;
+    _currentBlock = 0;
+    _commandCount = 0;
+}
+
+size_t CommandBuffer::commandCount() const {
+    return _commandCount;
+}
+
+size_t CommandBuffer::bytesUsed() const {
+    size_t bytes = 0;
+    for(size_t i = 0; i < _blocks.size(); ++i)
+        bytes += _blocks[i].used;
+    return bytes;
+}
+
+void* CommandBuffer::_allocate(unsigned opcode, size_t size) {
+    size = (size + CommandAlignment - 1) / CommandAlignment * CommandAlignment;
+
+    //move on to the next block when this one is full, allocating it the first time only
+    while(_currentBlock < _blocks.size() && _blocks[_currentBlock].used + size > _blockSize)
+        ++_currentBlock;
+    if(_currentBlock == _blocks.size()){
+        Block block;
+        block.data = new unsigned char[_blockSize];
+        block.used = 0;
+        _blocks.push_back(block);
+    }
+
+    Block& block = _blocks[_currentBlock];
+    CommandHeader* header = (CommandHeader*)(block.data + block.used);
+    header->opcode = opcode;
+    header->size = (unsigned)size;
+    block.used += size;
+    ++_commandCount;
+    return header;
+}
+
+void CommandBuffer::useProgram(GLuint program) {
+    UseProgramCommand* c = (UseProgramCommand*)_allocate(Op_UseProgram, sizeof(UseProgramCommand));
+    c->program = program;
+}
+
+void CommandBuffer::bindTexture(GLenum unit, GLenum target, GLuint texture) {
+    BindTextureCommand* c = (BindTextureCommand*)_allocate(Op_BindTexture, sizeof(BindTextureCommand));
+    c->unit = unit;
+    c->target = target;
+    c->texture = texture;
+}
+
+void CommandBuffer::bindVertexArray(GLuint vao) {
+    BindVertexArrayCommand* c = (BindVertexArrayCommand*)_allocate(Op_BindVertexArray, sizeof(BindVertexArrayCommand));
+    c->vao = vao;
+}
+
+void CommandBuffer::bindUniformBlock(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+    BindUniformBlockCommand* c = (BindUniformBlockCommand*)_allocate(Op_BindUniformBlock, sizeof(BindUniformBlockCommand));
+    c->binding = binding;
+    c->buffer = buffer;
+    c->offset = offset;
+    c->size = size;
+}
+
+void CommandBuffer::setUniform(GLint location, GLint value) {
+    Uniform1iCommand* c = (Uniform1iCommand*)_allocate(Op_Uniform1i, sizeof(Uniform1iCommand));
+    c->location = location;
+    c->value = value;
+}
+
+void CommandBuffer::setUniform(GLint location, GLfloat value) {
+    Uniform1fCommand* c = (Uniform1fCommand*)_allocate(Op_Uniform1f, sizeof(Uniform1fCommand));
+    c->location = location;
+    c->value = value;
+}
+
+void CommandBuffer::setUniform(GLint location, const glm::vec3& value) {
+    Uniform3fCommand* c = (Uniform3fCommand*)_allocate(Op_Uniform3f, sizeof(Uniform3fCommand));
+    c->location = location;
+    memcpy(c->value, &value[0], sizeof(c->value));
+}
+
+void CommandBuffer::setUniform(GLint location, const glm::vec4& value) {
+    Uniform4fCommand* c = (Uniform4fCommand*)_allocate(Op_Uniform4f, sizeof(Uniform4fCommand));
+    c->location = location;
+    memcpy(c->value, &value[0], sizeof(c->value));
+}
+
+void CommandBuffer::setUniform(GLint location, const glm::mat4& value) {
+    UniformMatrix4Command* c = (UniformMatrix4Command*)_allocate(Op_UniformMatrix4, sizeof(UniformMatrix4Command));
+    c->location = location;
+    memcpy(c->value, &value[0][0], sizeof(c->value));
+}
+
+void CommandBuffer::drawArrays(GLenum mode, GLint first, GLsizei count) {
+    DrawArraysCommand* c = (DrawArraysCommand*)_allocate(Op_DrawArrays, sizeof(DrawArraysCommand));
+    c->mode = mode;
+    c->first = first;
+    c->count = count;
+}
+
+void CommandBuffer::drawElements(GLenum mode, GLsizei count, GLenum type, GLintptr offset) {
+    DrawElementsCommand* c = (DrawElementsCommand*)_allocate(Op_DrawElements, sizeof(DrawElementsCommand));
+    c->mode = mode;
+    c->count = count;
+    c->type = type;
+    c->offset = offset;
+}
+
+void CommandBuffer::beginConditionalRender(GLuint query, GLenum mode) {
+    BeginConditionalRenderCommand* c = (BeginConditionalRenderCommand*)_allocate(Op_BeginConditionalRender, sizeof(BeginConditionalRenderCommand));
+    c->query = query;
+    c->mode = mode;
+}
+
+void CommandBuffer::endConditionalRender() {
+    _allocate(Op_EndConditionalRender, sizeof(CommandHeader));
+}
+
+void CommandBuffer::replay(RenderStats* stats) const {
+    RenderStats ignored;
+    if(!stats)
+        stats = &ignored;
+
+    for(size_t b = 0; b < _blocks.size(); ++b){
+        const unsigned char* pos = _blocks[b].data;
+        const unsigned char* end = pos + _blocks[b].used;
+        while(pos < end){
+            const CommandHeader* header = (const CommandHeader*)pos;
+            switch(header->opcode){
+                case Op_UseProgram:
+                    glUseProgram(((const UseProgramCommand*)pos)->program);
+                    ++stats->programChanges;
+                    break;
+
+                case Op_BindTexture: {
+                    const BindTextureCommand* c = (const BindTextureCommand*)pos;
+                    glActiveTexture(c->unit);
+                    glBindTexture(c->target, c->texture);
+                    ++stats->textureChanges;
+                    break;
+                }
+
+                case Op_BindVertexArray:
+                    glBindVertexArray(((const BindVertexArrayCommand*)pos)->vao);
+                    ++stats->vertexArrayChanges;
+                    break;
+
+                case Op_BindUniformBlock: {
+                    const BindUniformBlockCommand* c = (const BindUniformBlockCommand*)pos;
+                    glBindBufferRange(GL_UNIFORM_BUFFER, c->binding, c->buffer, c->offset, c->size);
+                    break;
+                }
+
+                case Op_Uniform1i: {
+                    const Uniform1iCommand* c = (const Uniform1iCommand*)pos;
+                    glUniform1i(c->location, c->value);
+                    break;
+                }
+
+                case Op_Uniform1f: {
+                    const Uniform1fCommand* c = (const Uniform1fCommand*)pos;
+                    glUniform1f(c->location, c->value);
+                    break;
+                }
+
+                case Op_Uniform3f: {
+                    const Uniform3fCommand* c = (const Uniform3fCommand*)pos;
+                    glUniform3fv(c->location, 1, c->value);
+                    break;
+                }
+
+                case Op_Uniform4f: {
+                    const Uniform4fCommand* c = (const Uniform4fCommand*)pos;
+                    glUniform4fv(c->location, 1, c->value);
+                    break;
+                }
+
+                case Op_UniformMatrix4: {
+                    const UniformMatrix4Command* c = (const UniformMatrix4Command*)pos;
+                    glUniformMatrix4fv(c->location, 1, GL_FALSE, c->value);
+                    break;
+                }
+
+                case Op_DrawArrays: {
+                    const DrawArraysCommand* c = (const DrawArraysCommand*)pos;
+                    glDrawArrays(c->mode, c->first, c->count);
+                    ++stats->drawCalls;
+                    if(c->mode == GL_TRIANGLES)
+                        stats->triangles += c->count / 3;
+                    break;
+                }
+
+                case Op_DrawElements: {
+                    const DrawElementsCommand* c = (const DrawElementsCommand*)pos;
+                    glDrawElements(c->mode, c->count, c->type, (const GLvoid*)c->offset);
+                    ++stats->drawCalls;
+                    if(c->mode == GL_TRIANGLES)
+                        stats->triangles += c->count / 3;
+                    break;
+                }
+
+                case Op_BeginConditionalRender: {
+                    const BeginConditionalRenderCommand* c = (const BeginConditionalRenderCommand*)pos;
+                    glBeginConditionalRender(c->query, c->mode);
+                    break;
+                }
+
+                case Op_EndConditionalRender:
+                    glEndConditionalRender();
+                    break;
+
+                default:
+                    throw std::runtime_error("Corrupt command buffer");
+            }
+            pos += header->size;
+        }
+    }
+}
@@ -0,0 +1,119 @@
+/*
+ tdogl::CommandBuffer
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "RenderQueue.h"
+
+namespace tdogl {
+
+    /**
+     A list of GL commands that is recorded now and issued later.
+
+     Recording doesn't call OpenGL, so command buffers can be filled on worker threads, one
+     buffer per thread, and then replayed in order on the thread that owns the context.
+
+     Commands are packed one after another into blocks of memory. The blocks are kept when
+     the buffer is reset, so once a buffer has grown to the size of a frame's work,
+     recording allocates nothing.
+
+     A buffer that isn't reset can be replayed any number of times, which caches the
+     commands of draws that don't change from frame to frame.
+     */
+    class CommandBuffer {
+    public:
+        /**
+         @param blockSize  Bytes per block of memory. Commands are at most 80 bytes.
+         */
+        explicit CommandBuffer(size_t blockSize = 64 * 1024);
+        ~CommandBuffer();
+
+        /** Removes all the commands. Allocated memory is kept for the next recording. */
+        void reset();
+
+        /** @result Number of commands recorded since the last `reset` */
+        size_t commandCount() const;
+
+        /** @result Bytes used by the recorded commands */
+        size_t bytesUsed() const;
+
+        /** glUseProgram */
+        void useProgram(GLuint program);
+
+        /** glActiveTexture followed by glBindTexture */
+        void bindTexture(GLenum unit, GLenum target, GLuint texture);
+
+        /** glBindVertexArray */
+        void bindVertexArray(GLuint vao);
+
+        /** glBindBufferRange(GL_UNIFORM_BUFFER, ...), for a uniform block at `binding` */
+        void bindUniformBlock(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+        /**
+         Sets a uniform of the program in use when the command is replayed. The location must
+         already be known, e.g. from tdogl::Program::uniform, because looking it up needs the
+         context.
+         */
+        void setUniform(GLint location, GLint value);
+        void setUniform(GLint location, GLfloat value);
+        void setUniform(GLint location, const glm::vec3& value);
+        void setUniform(GLint location, const glm::vec4& value);
+        void setUniform(GLint location, const glm::mat4& value);
+
+        /** glDrawArrays */
+        void drawArrays(GLenum mode, GLint first, GLsizei count);
+
+        /** glDrawElements, with `offset` into the element buffer of the bound VAO */
+        void drawElements(GLenum mode, GLsizei count, GLenum type, GLintptr offset);
+
+        /**
+         glBeginConditionalRender: the draws up to `endConditionalRender` are skipped by the
+         GPU if `query` found no samples. The query must have been issued before the replay.
+         */
+        void beginConditionalRender(GLuint query, GLenum mode);
+
+        /** glEndConditionalRender */
+        void endConditionalRender();
+
+        /**
+         Issues the recorded commands. Must be called with a current context.
+
+         @param stats  If not NULL, the draws and state changes are added to it
+         */
+        void replay(RenderStats* stats = NULL) const;
+
+    private:
+        struct Block {
+            unsigned char* data;
+            size_t used;
+        };
+
+        size_t _blockSize;
+        std::vector<Block> _blocks;
+        size_t _currentBlock;
+        size_t _commandCount;
+
+        void* _allocate(unsigned opcode, size_t size);
+
+        //copying disabled
+        CommandBuffer(const CommandBuffer&);
+        const CommandBuffer& operator=(const CommandBuffer&);
+    };
+
+}
@@ -0,0 +1,183 @@
+/*
+ tdogl::DeferredLighting
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "DeferredLighting.h"
+#include "GBuffer.h"
+#include "Program.h"
+#include <stdexcept>
+#include <cmath>
+#include <algorithm>
+
+using namespace tdogl;
+
+DeferredLighting::DeferredLighting(Program& lightProgram, Program& resolveProgram,
+                                   GLsizei width, GLsizei height, unsigned maxLights) :
+    _lightProgram(lightProgram),
+    _resolveProgram(resolveProgram),
+    _accumulation(width, height, GL_RGBA16F, false),
+    _maxLights(maxLights),
+    _lightBuffer(0),
+    _lightTexture(0),
+    _cubeVao(0),
+    _cubeVbo(0),
+    _cubeIbo(0),
+    _emptyVao(0)
+{
+    if(maxLights == 0)
+        throw std::runtime_error("DeferredLighting needs room for at least one light");
+
+    //two RGBA32F texels per light
+    glGenBuffers(1, &_lightBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, _lightBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, maxLights * sizeof(PointLight), NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glGenTextures(1, &_lightTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, _lightTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, _lightBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    //the cube from -1 to 1, counter-clockwise seen from outside
+    const GLfloat corners[8 * 3] = {
+        -1, -1, -1,  1, -1, -1,  -1, 1, -1,  1, 1, -1,
+        -1, -1,  1,  1, -1,  1,  -1, 1,  1,  1, 1,  1
+    };
+    const GLubyte indices[36] = {
+        0, 2, 1, 1, 2, 3,
+        4, 5, 6, 5, 7, 6,
+        0, 1, 4, 1, 5, 4,
+        2, 6, 3, 3, 6, 7,
+        0, 4, 2, 2, 4, 6,
+        1, 3, 5, 3, 7, 5
+    };
+    glGenVertexArrays(1, &_cubeVao);
+    glGenBuffers(1, &_cubeVbo);
+    glGenBuffers(1, &_cubeIbo);
+    glBindVertexArray(_cubeVao);
+    glBindBuffer(GL_ARRAY_BUFFER, _cubeVbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _cubeIbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(lightProgram.attrib("vert"));
+    glVertexAttribPointer(lightProgram.attrib("vert"), 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), NULL);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    //the core profile draws nothing without a vertex array, even if it has no attributes
+    glGenVertexArrays(1, &_emptyVao);
+}
+
+DeferredLighting::~DeferredLighting() {
+    glDeleteTextures(1, &_lightTexture);
+    GLuint buffers[3] = { _lightBuffer, _cubeVbo, _cubeIbo };
+    glDeleteBuffers(3, buffers);
+    GLuint vertexArrays[2] = { _cubeVao, _emptyVao };
+    glDeleteVertexArrays(2, vertexArrays);
+}
+
+unsigned DeferredLighting::maxLights() const {
+    return _maxLights;
+}
+
+float DeferredLighting::lightRadius(const glm::vec3& intensities, float attenuation, float maxRadius) {
+    //solve intensity / (1 + attenuation * r^2) = 1/256 for r
+    float intensity = std::max(intensities.x, std::max(intensities.y, intensities.z));
+    if(intensity * 256.0f <= 1.0f)
+        return 0.0f;
+    if(attenuation <= 0.0f)
+        return maxRadius;
+    return std::min(maxRadius, std::sqrt((intensity * 256.0f - 1.0f) / attenuation));
+}
+
+void DeferredLighting::render(const GBuffer& gbuffer,
+                              const glm::mat4& viewProjection,
+                              const glm::vec3& cameraPosition,
+                              const glm::vec3& ambient,
+                              const PointLight* lights,
+                              unsigned count,
+                              GLuint targetFramebuffer)
+{
+    if(count > _maxLights)
+        throw std::runtime_error("Too many lights for DeferredLighting");
+
+    //orphan the buffer, so the GPU can still read last frame's lights
+    glBindBuffer(GL_TEXTURE_BUFFER, _lightBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, _maxLights * sizeof(PointLight), NULL, GL_STREAM_DRAW);
+    if(count > 0)
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, count * sizeof(PointLight), lights);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, gbuffer.albedoTexture());
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, gbuffer.normalTexture());
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, gbuffer.depthTexture());
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_BUFFER, _lightTexture);
+
+    //add up the lights, each over the pixels its volume covers
+    _accumulation.bind();
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+    glEnable(GL_DEPTH_CLAMP);
+
+    _lightProgram.use();
+    _lightProgram.setUniform("camera", viewProjection);
+    _lightProgram.setUniform("inverseCamera", glm::inverse(viewProjection));
+    _lightProgram.setUniform("cameraPosition", cameraPosition);
+    _lightProgram.setUniform("albedoTex", 0);
+    _lightProgram.setUniform("normalTex", 1);
+    _lightProgram.setUniform("depthTex", 2);
+    _lightProgram.setUniform("lights", 3);
+    glBindVertexArray(_cubeVao);
+    if(count > 0)
+        glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, NULL, (GLsizei)count);
+    _lightProgram.stopUsing();
+
+    glDisable(GL_DEPTH_CLAMP);
+    glDisable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+    glDisable(GL_BLEND);
+
+    //ambient and gamma, into the target
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _accumulation.colorTexture());
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, gbuffer.albedoTexture());
+    _resolveProgram.use();
+    _resolveProgram.setUniform("lightTex", 0);
+    _resolveProgram.setUniform("albedoTex", 1);
+    _resolveProgram.setUniform("depthTex", 2);
+    _resolveProgram.setUniform("ambient", ambient);
+    glBindVertexArray(_emptyVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    _resolveProgram.stopUsing();
+
+    //unbind everything
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    for(int unit = 2; unit >= 0; --unit){
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+}
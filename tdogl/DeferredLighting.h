@@ -0,0 +1,114 @@
+/*
+ tdogl::DeferredLighting
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "Framebuffer.h"
+
+namespace tdogl {
+
+    class Program;
+    class GBuffer;
+
+    /**
+     Lights the contents of a tdogl::GBuffer with many point lights.
+
+     Each light is drawn as a cube around the sphere it reaches, all the lights in one
+     instanced draw, so the cost is the number of pixels each light covers rather than
+     instances times lights. The inside faces of the cubes are drawn, with depth clamping,
+     so a light still counts when the camera is inside it. The fragment shader rebuilds the
+     world position from the depth, and adds the light into a floating point accumulation
+     buffer with additive blending.
+
+     A full screen pass then adds the ambient light, applies the gamma, and writes the
+     result to the target framebuffer.
+
+     The lights are read from a texture buffer, two texels per light, in the layout of
+     `PointLight`.
+     */
+    class DeferredLighting {
+    public:
+        /** A light in the layout of the texture buffer */
+        struct PointLight {
+            glm::vec3 position;
+            float radius;           //beyond this, the light is ignored. See `lightRadius`.
+            glm::vec3 intensities;
+            float attenuation;      //1 / (1 + attenuation * distance^2)
+        };
+
+        /**
+         @param lightProgram    Draws the light volumes. Needs a "vert" attribute (vec3), and
+                                "camera", "inverseCamera", "cameraPosition", "albedoTex",
+                                "normalTex", "depthTex" and "lights" uniforms.
+         @param resolveProgram  The full screen pass. Needs "lightTex", "albedoTex",
+                                "depthTex" and "ambient" uniforms.
+         @param width           Width of the G-buffers that will be lit, in pixels
+         @param height          Height of the G-buffers that will be lit, in pixels
+         @param maxLights       The most lights per `render`
+
+         @throws std::exception if the accumulation buffer can't be created.
+         */
+        DeferredLighting(Program& lightProgram, Program& resolveProgram,
+                         GLsizei width, GLsizei height, unsigned maxLights);
+        ~DeferredLighting();
+
+        unsigned maxLights() const;
+
+        /**
+         @result The distance at which a light with these `intensities` and `attenuation`
+                 falls below 1/256, the smallest step of an 8 bit color. At most `maxRadius`.
+         */
+        static float lightRadius(const glm::vec3& intensities, float attenuation, float maxRadius);
+
+        /**
+         Lights `gbuffer` and writes the result to `targetFramebuffer`, which must be the same
+         size. Leaves `targetFramebuffer` bound, and depth testing and blending disabled.
+
+         @param viewProjection  The camera the G-buffer was drawn with
+         @param ambient         Light that reaches every surface, e.g. the sum of the ambient
+                                terms of the lights
+         @param lights          `count` lights, at most `maxLights`
+
+         @throws std::exception if there are too many lights.
+         */
+        void render(const GBuffer& gbuffer,
+                    const glm::mat4& viewProjection,
+                    const glm::vec3& cameraPosition,
+                    const glm::vec3& ambient,
+                    const PointLight* lights,
+                    unsigned count,
+                    GLuint targetFramebuffer);
+
+    private:
+        Program& _lightProgram;
+        Program& _resolveProgram;
+        Framebuffer _accumulation;
+        unsigned _maxLights;
+        GLuint _lightBuffer;
+        GLuint _lightTexture;
+        GLuint _cubeVao;
+        GLuint _cubeVbo;
+        GLuint _cubeIbo;
+        GLuint _emptyVao; //for the full screen triangle, made from gl_VertexID
+
+        //copying disabled
+        DeferredLighting(const DeferredLighting&);
+        const DeferredLighting& operator=(const DeferredLighting&);
+    };
+
+}
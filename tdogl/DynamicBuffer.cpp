@@ -0,0 +1,162 @@
+/*
+ tdogl::DynamicBuffer
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "DynamicBuffer.h"
+#include <stdexcept>
+#include <cassert>
+#include <algorithm>
+
+using namespace tdogl;
+
+static const GLbitfield PersistentFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+DynamicBuffer::DynamicBuffer(GLenum target, GLsizeiptr segmentSize) :
+    _target(target),
+    _object(0),
+    _segmentSize(segmentSize > 0 ? segmentSize : 1),
+    _persistent(GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage),
+    _mapping(NULL),
+    _segment(0),
+    _used(0),
+    _writing(false),
+    _stallCount(0)
+{
+    for(unsigned i = 0; i < SegmentCount; ++i)
+        _fences[i] = NULL;
+    _create();
+}
+
+DynamicBuffer::~DynamicBuffer() {
+    _destroy();
+}
+
+GLuint DynamicBuffer::object() const {
+    return _object;
+}
+
+bool DynamicBuffer::persistent() const {
+    return _persistent;
+}
+
+void* DynamicBuffer::beginWrite(GLsizeiptr size, GLsizeiptr alignment, GLintptr& offset) {
+    assert(!_writing && "endWrite must be called before the next beginWrite");
+    if(alignment < 1)
+        alignment = 1;
+
+    for(;;){
+        GLintptr segmentStart = (GLintptr)_segment * _segmentSize;
+        GLintptr start = (segmentStart + _used + alignment - 1) / alignment * alignment;
+        if(start + size <= segmentStart + _segmentSize){
+            offset = start;
+            _used = start + size - segmentStart;
+            break;
+        }
+
+        //recreate the buffer with room for this frame so far, twice over. Draws already
+        //issued keep the old buffer alive until the GPU is done with it.
+        _segmentSize = std::max(_segmentSize * 2, (_used + size + alignment) * 2);
+        _destroy();
+        _create();
+        _used = 0;
+    }
+    _writing = true;
+
+    if(_persistent)
+        return _mapping + offset;
+
+    glBindBuffer(_target, _object);
+    void* pointer = glMapBufferRange(_target, offset, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    if(!pointer)
+        throw std::runtime_error("glMapBufferRange failed");
+    return pointer;
+}
+
+void DynamicBuffer::endWrite() {
+    assert(_writing && "endWrite without beginWrite");
+    _writing = false;
+    if(_persistent)
+        return; //coherent mapping: the writes are visible to commands issued from now on
+
+    glBindBuffer(_target, _object);
+    glUnmapBuffer(_target);
+    glBindBuffer(_target, 0);
+}
+
+void DynamicBuffer::endFrame() {
+    if(_fences[_segment])
+        glDeleteSync(_fences[_segment]);
+    _fences[_segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    _segment = (_segment + 1) % SegmentCount;
+    _used = 0;
+    _waitForFence(_segment);
+}
+
+unsigned DynamicBuffer::stallCount() const {
+    return _stallCount;
+}
+
+void DynamicBuffer::_create() {
+    glGenBuffers(1, &_object);
+    glBindBuffer(_target, _object);
+    GLsizeiptr totalSize = _segmentSize * SegmentCount;
+    if(_persistent){
+        glBufferStorage(_target, totalSize, NULL, PersistentFlags);
+        _mapping = (unsigned char*)glMapBufferRange(_target, 0, totalSize, PersistentFlags);
+        if(!_mapping){
+            glBindBuffer(_target, 0);
+            throw std::runtime_error("Persistent glMapBufferRange failed");
+        }
+    } else {
+        glBufferData(_target, totalSize, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(_target, 0);
+}
+
+void DynamicBuffer::_destroy() {
+    //the GPU may still be reading any segment
+    for(unsigned i = 0; i < SegmentCount; ++i)
+        _waitForFence(i);
+
+    if(_mapping){
+        glBindBuffer(_target, _object);
+        glUnmapBuffer(_target);
+        glBindBuffer(_target, 0);
+        _mapping = NULL;
+    }
+    glDeleteBuffers(1, &_object);
+    _object = 0;
+}
+
+void DynamicBuffer::_waitForFence(unsigned segment) {
+    GLsync fence = _fences[segment];
+    if(!fence)
+        return;
+
+    //a zero timeout just checks, so stalls can be counted
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if(result == GL_TIMEOUT_EXPIRED){
+        ++_stallCount;
+        result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000); //1 second
+        while(result == GL_TIMEOUT_EXPIRED)
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    }
+    if(result == GL_WAIT_FAILED)
+        throw std::runtime_error("glClientWaitSync failed");
+
+    glDeleteSync(fence);
+    _fences[segment] = NULL;
+}
@@ -0,0 +1,101 @@
+/*
+ tdogl::DynamicBuffer
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+
+namespace tdogl {
+
+    /**
+     A buffer object for data that is rewritten every frame, such as instance transforms or
+     indirect draw commands.
+
+     The buffer is split into `SegmentCount` segments used in turn, one per frame. When a
+     frame ends its segment is fenced, and a segment is only written again once the GPU has
+     passed its fence, so the CPU never writes over data the GPU is still reading and the
+     driver never has to stall or copy.
+
+     With OpenGL 4.4 or ARB_buffer_storage the whole buffer is mapped once, persistently
+     and coherently. Otherwise each write maps its range with GL_MAP_UNSYNCHRONIZED_BIT,
+     which is safe because of the fences.
+     */
+    class DynamicBuffer {
+    public:
+        static const unsigned SegmentCount = 3;
+
+        /**
+         @param target       The binding point used for mapping, e.g. GL_ARRAY_BUFFER
+         @param segmentSize  Initial size in bytes of each segment. Grows when a frame needs more.
+         */
+        DynamicBuffer(GLenum target, GLsizeiptr segmentSize);
+        ~DynamicBuffer();
+
+        /**
+         @result The buffer object, as created by glGenBuffers. Changes when the buffer grows,
+                 so get it after `beginWrite`.
+         */
+        GLuint object() const;
+
+        /** @result True if the buffer is persistently mapped */
+        bool persistent() const;
+
+        /**
+         Reserves `size` bytes in this frame's segment and returns a pointer to write them
+         to. Call `endWrite` before the data is used by the GPU.
+
+         @param size       Number of bytes
+         @param alignment  The offset will be a multiple of this. Need not be a power of two.
+         @param offset     Receives the offset of the reserved bytes from the start of the buffer
+         */
+        void* beginWrite(GLsizeiptr size, GLsizeiptr alignment, GLintptr& offset);
+
+        /** Finishes the write started by `beginWrite` */
+        void endWrite();
+
+        /**
+         Fences the GPU commands that read this frame's segment, and moves on to the next
+         segment, waiting if the GPU is still using it.
+
+         Call once per frame, after the draws that use the data.
+         */
+        void endFrame();
+
+        /** @result How many times `endFrame` had to wait for the GPU */
+        unsigned stallCount() const;
+
+    private:
+        GLenum _target;
+        GLuint _object;
+        GLsizeiptr _segmentSize;
+        bool _persistent;
+        unsigned char* _mapping; //the whole buffer, if persistent
+        unsigned _segment;
+        GLsizeiptr _used; //bytes used in the current segment
+        GLsync _fences[SegmentCount];
+        bool _writing;
+        unsigned _stallCount;
+
+        void _create();
+        void _destroy();
+        void _waitForFence(unsigned segment);
+
+        //copying disabled
+        DynamicBuffer(const DynamicBuffer&);
+        const DynamicBuffer& operator=(const DynamicBuffer&);
+    };
+
+}
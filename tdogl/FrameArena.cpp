@@ -0,0 +1,113 @@
+/*
+ tdogl::FrameArena
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "FrameArena.h"
+#include <stdexcept>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace tdogl;
+
+// rounds `value` up to a multiple of `alignment`, which is a power of two
+static size_t AlignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+FrameArena::FrameArena(size_t bytesPerThread, unsigned threadCount) :
+    _overflowCount(0)
+{
+    if(threadCount == 0)
+        throw std::runtime_error("FrameArena needs at least one thread");
+
+    for(unsigned i = 0; i < threadCount; ++i){
+        SubArena* arena = new SubArena();
+        arena->data = (unsigned char*)malloc(bytesPerThread);
+        if(!arena->data && bytesPerThread > 0)
+            throw std::bad_alloc();
+        arena->capacity = bytesPerThread;
+        arena->used = 0;
+        arena->overflowBytes = 0;
+        _arenas.push_back(arena);
+    }
+}
+
+FrameArena::~FrameArena() {
+    reset();
+    for(size_t i = 0; i < _arenas.size(); ++i){
+        free(_arenas[i]->data);
+        delete _arenas[i];
+    }
+}
+
+unsigned FrameArena::threadCount() const {
+    return (unsigned)_arenas.size();
+}
+
+void* FrameArena::allocate(size_t size, size_t alignment, unsigned thread) {
+    if(thread >= _arenas.size())
+        throw std::runtime_error("FrameArena has no sub-arena for this thread");
+    if(alignment == 0 || (alignment & (alignment - 1)) != 0)
+        throw std::runtime_error("FrameArena alignment must be a power of two");
+
+    SubArena& arena = *_arenas[thread];
+    size_t offset = AlignUp((size_t)(uintptr_t)arena.data + arena.used, alignment) - (size_t)(uintptr_t)arena.data;
+    if(arena.data && offset + size <= arena.capacity){
+        arena.used = offset + size;
+        return arena.data + offset;
+    }
+
+    //doesn't fit this frame. Remember how much was missing, so `reset` can grow the arena.
+    void* block = malloc(size + alignment);
+    if(!block)
+        throw std::bad_alloc();
+    arena.overflow.push_back(block);
+    arena.overflowBytes += size + alignment;
+    ++_overflowCount;
+    return (void*)AlignUp((size_t)(uintptr_t)block, alignment);
+}
+
+void FrameArena::reset() {
+    for(size_t i = 0; i < _arenas.size(); ++i){
+        SubArena& arena = *_arenas[i];
+        if(!arena.overflow.empty()){
+            for(size_t b = 0; b < arena.overflow.size(); ++b)
+                free(arena.overflow[b]);
+            arena.overflow.clear();
+
+            //grow to fit the whole of the last frame, with room to spare
+            size_t capacity = (arena.used + arena.overflowBytes) * 3 / 2;
+            unsigned char* data = (unsigned char*)malloc(capacity);
+            if(data){
+                free(arena.data);
+                arena.data = data;
+                arena.capacity = capacity;
+            }
+            arena.overflowBytes = 0;
+        }
+        arena.used = 0;
+    }
+}
+
+size_t FrameArena::bytesUsed() const {
+    size_t bytes = 0;
+    for(size_t i = 0; i < _arenas.size(); ++i)
+        bytes += _arenas[i]->used + _arenas[i]->overflowBytes;
+    return bytes;
+}
+
+unsigned FrameArena::overflowCount() const {
+    return _overflowCount;
+}
@@ -0,0 +1,164 @@
+/*
+ tdogl::FrameArena
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace tdogl {
+
+    /**
+     A bump allocator for data that only lives until the end of the frame.
+
+     Allocating moves a pointer forward, and `reset` moves it back to the start, so nothing
+     is freed one piece at a time. There is one sub-arena per thread, so worker threads can
+     allocate without locking: thread `i` must only allocate from sub-arena `i`, as passed to
+     functions by tdogl::JobSystem::parallelForWithThread.
+
+     When a sub-arena runs out, the allocation comes from the heap instead, and `reset`
+     grows the sub-arena to fit what the frame needed. After the first few frames, a frame
+     with the same amount of work allocates nothing from the heap.
+     */
+    class FrameArena {
+    public:
+        /**
+         @param bytesPerThread  Initial size of each sub-arena
+         @param threadCount     Number of sub-arenas
+         */
+        FrameArena(size_t bytesPerThread, unsigned threadCount);
+        ~FrameArena();
+
+        unsigned threadCount() const;
+
+        /**
+         @result `size` bytes aligned to `alignment`, a power of two. Valid until `reset`.
+         */
+        void* allocate(size_t size, size_t alignment = 16, unsigned thread = 0);
+
+        /** @result Uninitialised space for `count` objects of type T. Valid until `reset`. */
+        template<typename T>
+        T* allocateArray(size_t count, unsigned thread = 0) {
+            return (T*)allocate(count * sizeof(T), std::alignment_of<T>::value, thread);
+        }
+
+        /**
+         Frees everything allocated since the last reset, growing sub-arenas that overflowed.
+         No other thread may be allocating.
+         */
+        void reset();
+
+        /** @result Bytes allocated since the last `reset`, in all sub-arenas */
+        size_t bytesUsed() const;
+
+        /** @result Number of allocations that didn't fit and came from the heap, ever */
+        unsigned overflowCount() const;
+
+    private:
+        struct SubArena {
+            unsigned char* data;
+            size_t capacity;
+            size_t used;
+            size_t overflowBytes;
+            std::vector<void*> overflow;
+        };
+
+        std::vector<SubArena*> _arenas; //separate allocations, so threads don't share cache lines
+        unsigned _overflowCount;
+
+        //copying disabled
+        FrameArena(const FrameArena&);
+        const FrameArena& operator=(const FrameArena&);
+    };
+
+    /**
+     An STL allocator that takes memory from a sub-arena of a tdogl::FrameArena, so that
+     standard containers can hold per-frame data, e.g.
+
+         std::vector<int, ArenaAllocator<int> > v(ArenaAllocator<int>(arena));
+
+     `deallocate` does nothing. The container must be destroyed before the arena is reset.
+     */
+    template<typename T>
+    class ArenaAllocator {
+    public:
+        typedef T value_type;
+        typedef T* pointer;
+        typedef const T* const_pointer;
+        typedef T& reference;
+        typedef const T& const_reference;
+        typedef size_t size_type;
+        typedef ptrdiff_t difference_type;
+
+        template<typename U>
+        struct rebind { typedef ArenaAllocator<U> other; };
+
+        explicit ArenaAllocator(FrameArena& arena, unsigned thread = 0) :
+            _arena(&arena),
+            _thread(thread)
+        {
+        }
+
+        template<typename U>
+        ArenaAllocator(const ArenaAllocator<U>& other) :
+            _arena(other.arena()),
+            _thread(other.thread())
+        {
+        }
+
+        pointer allocate(size_type count, const void* /*hint*/ = 0) {
+            return _arena->allocateArray<T>(count, _thread);
+        }
+
+        void deallocate(pointer /*p*/, size_type /*count*/) {
+        }
+
+        size_type max_size() const {
+            return (size_type)-1 / sizeof(T);
+        }
+
+        void construct(pointer p, const T& value) {
+            new((void*)p) T(value);
+        }
+
+        void destroy(pointer p) {
+            p->~T();
+        }
+
+        pointer address(reference r) const { return &r; }
+        const_pointer address(const_reference r) const { return &r; }
+
+        FrameArena* arena() const { return _arena; }
+        unsigned thread() const { return _thread; }
+
+    private:
+        FrameArena* _arena;
+        unsigned _thread;
+    };
+
+    template<typename T, typename U>
+    bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+        return a.arena() == b.arena() && a.thread() == b.thread();
+    }
+
+    template<typename T, typename U>
+    bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+        return !(a == b);
+    }
+
+}
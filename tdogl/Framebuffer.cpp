@@ -0,0 +1,105 @@
+/*
+ tdogl::Framebuffer
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "Framebuffer.h"
+#include <stdexcept>
+#include <sstream>
+
+using namespace tdogl;
+
+Framebuffer::Framebuffer(GLsizei width, GLsizei height, GLenum colorFormat, bool withDepth) :
+    _object(0),
+    _colorTexture(0),
+    _depthRenderbuffer(0),
+    _width(width),
+    _height(height)
+{
+    glGenTextures(1, &_colorTexture);
+    glBindTexture(GL_TEXTURE_2D, _colorTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, colorFormat, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &_object);
+    glBindFramebuffer(GL_FRAMEBUFFER, _object);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _colorTexture, 0);
+
+    if(withDepth){
+        glGenRenderbuffers(1, &_depthRenderbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, _depthRenderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _depthRenderbuffer);
+    }
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if(status != GL_FRAMEBUFFER_COMPLETE){
+        glDeleteFramebuffers(1, &_object);
+        glDeleteTextures(1, &_colorTexture);
+        if(_depthRenderbuffer) glDeleteRenderbuffers(1, &_depthRenderbuffer);
+        std::ostringstream msg;
+        msg << "Framebuffer incomplete, status 0x" << std::hex << status;
+        throw std::runtime_error(msg.str());
+    }
+}
+
+Framebuffer::~Framebuffer() {
+    glDeleteFramebuffers(1, &_object);
+    glDeleteTextures(1, &_colorTexture);
+    if(_depthRenderbuffer) glDeleteRenderbuffers(1, &_depthRenderbuffer);
+}
+
+GLuint Framebuffer::object() const {
+    return _object;
+}
+
+GLuint Framebuffer::colorTexture() const {
+    return _colorTexture;
+}
+
+GLsizei Framebuffer::width() const {
+    return _width;
+}
+
+GLsizei Framebuffer::height() const {
+    return _height;
+}
+
+void Framebuffer::bind() const {
+    glBindFramebuffer(GL_FRAMEBUFFER, _object);
+    glViewport(0, 0, _width, _height);
+}
+
+void Framebuffer::unbind() const {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+Bitmap Framebuffer::readPixels() const {
+    Bitmap bmp((unsigned)_width, (unsigned)_height, Bitmap::Format_RGBA);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _object);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, _width, _height, GL_RGBA, GL_UNSIGNED_BYTE, bmp.pixelBuffer());
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    //OpenGL returns the bottom row first
+    bmp.flipVertically();
+    return bmp;
+}
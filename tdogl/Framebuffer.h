@@ -0,0 +1,78 @@
+/*
+ tdogl::Framebuffer
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+#include "Bitmap.h"
+
+namespace tdogl {
+
+    /**
+     An offscreen render target: a framebuffer object with a color texture and a depth
+     renderbuffer.
+     */
+    class Framebuffer {
+    public:
+        /**
+         @param width        Width in pixels
+         @param height       Height in pixels
+         @param colorFormat  Internal format of the color texture, e.g. GL_RGBA8
+         @param withDepth    If true, a 24 bit depth renderbuffer is attached
+
+         @throws std::exception if the framebuffer is incomplete.
+         */
+        Framebuffer(GLsizei width, GLsizei height, GLenum colorFormat = GL_RGBA8, bool withDepth = true);
+
+        /**
+         Deletes the framebuffer, texture and renderbuffer
+         */
+        ~Framebuffer();
+
+        /** @result The framebuffer object, as created by glGenFramebuffers */
+        GLuint object() const;
+
+        /** @result The color texture, as created by glGenTextures */
+        GLuint colorTexture() const;
+
+        GLsizei width() const;
+        GLsizei height() const;
+
+        /** Binds the framebuffer for drawing and sets the viewport to cover it */
+        void bind() const;
+
+        /** Binds the default framebuffer. The caller must restore the viewport. */
+        void unbind() const;
+
+        /**
+         Reads the color attachment back into a RGBA bitmap, with the top row first like a
+         bitmap loaded from a file. Waits for rendering to finish.
+         */
+        Bitmap readPixels() const;
+
+    private:
+        GLuint _object;
+        GLuint _colorTexture;
+        GLuint _depthRenderbuffer;
+        GLsizei _width;
+        GLsizei _height;
+
+        //copying disabled
+        Framebuffer(const Framebuffer&);
+        const Framebuffer& operator=(const Framebuffer&);
+    };
+
+}
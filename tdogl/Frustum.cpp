@@ -0,0 +1,67 @@
+/*
+ tdogl::Frustum
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "Frustum.h"
+
+using namespace tdogl;
+
+Frustum::Frustum(const glm::mat4& m) {
+    //Gribb & Hartmann: each plane is a sum/difference of the matrix rows
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    _planes[0] = row3 + row0; //left
+    _planes[1] = row3 - row0; //right
+    _planes[2] = row3 + row1; //bottom
+    _planes[3] = row3 - row1; //top
+    _planes[4] = row3 + row2; //near
+    _planes[5] = row3 - row2; //far
+}
+
+bool Frustum::intersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const {
+    for(int i = 0; i < 6; ++i){
+        const glm::vec4& plane = _planes[i];
+        //the corner furthest along the plane normal
+        glm::vec3 positive(plane.x >= 0.0f ? boxMax.x : boxMin.x,
+                           plane.y >= 0.0f ? boxMax.y : boxMin.y,
+                           plane.z >= 0.0f ? boxMax.z : boxMin.z);
+        if(glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+void Frustum::transformBox(const glm::mat4& transform,
+                           const glm::vec3& boxMin,
+                           const glm::vec3& boxMax,
+                           glm::vec3& outMin,
+                           glm::vec3& outMax)
+{
+    //Arvo's method: accumulate the min/max contribution of each matrix element
+    glm::vec3 translation(transform[3]);
+    outMin = translation;
+    outMax = translation;
+    for(int col = 0; col < 3; ++col){
+        for(int row = 0; row < 3; ++row){
+            float a = transform[col][row] * boxMin[col];
+            float b = transform[col][row] * boxMax[col];
+            outMin[row] += (a < b ? a : b);
+            outMax[row] += (a < b ? b : a);
+        }
+    }
+}
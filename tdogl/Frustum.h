@@ -0,0 +1,55 @@
+/*
+ tdogl::Frustum
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+namespace tdogl {
+
+    /**
+     The six clipping planes of a view-projection matrix, in world space.
+
+     Used to skip drawing things that are entirely off screen.
+     */
+    class Frustum {
+    public:
+        /**
+         Extracts the planes from `viewProjection`, e.g. tdogl::Camera::matrix()
+         */
+        explicit Frustum(const glm::mat4& viewProjection);
+
+        /**
+         @result False if the axis aligned box is completely outside the frustum. May return
+                 true for some boxes that are just outside a corner of the frustum.
+         */
+        bool intersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+
+        /**
+         Transforms an object space axis aligned box, returning the world space axis aligned
+         box that encloses it.
+         */
+        static void transformBox(const glm::mat4& transform,
+                                 const glm::vec3& boxMin,
+                                 const glm::vec3& boxMax,
+                                 glm::vec3& outMin,
+                                 glm::vec3& outMax);
+
+    private:
+        glm::vec4 _planes[6];
+    };
+
+}
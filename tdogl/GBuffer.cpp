@@ -0,0 +1,116 @@
+/*
+ tdogl::GBuffer
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "GBuffer.h"
+#include "Program.h"
+#include <stdexcept>
+#include <sstream>
+#include <algorithm>
+
+using namespace tdogl;
+
+static GLuint CreateTexture(GLsizei width, GLsizei height, GLint internalFormat, GLenum format, GLenum type) {
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+GBuffer::GBuffer(GLsizei width, GLsizei height, const Program& geometryProgram) :
+    _object(0),
+    _albedoTexture(0),
+    _normalTexture(0),
+    _depthTexture(0),
+    _width(width),
+    _height(height)
+{
+    //GLSL 1.50 can't place the outputs, so route whatever locations the linker picked
+    GLint albedoLocation = glGetFragDataLocation(geometryProgram.object(), "albedoSpecular");
+    GLint normalLocation = glGetFragDataLocation(geometryProgram.object(), "normalShininess");
+    if(albedoLocation < 0 || normalLocation < 0 || albedoLocation > 7 || normalLocation > 7)
+        throw std::runtime_error("G-buffer program needs albedoSpecular and normalShininess outputs");
+
+    _albedoTexture = CreateTexture(width, height, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+    _normalTexture = CreateTexture(width, height, GL_RGBA16F, GL_RGBA, GL_FLOAT);
+    _depthTexture = CreateTexture(width, height, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT);
+
+    glGenFramebuffers(1, &_object);
+    glBindFramebuffer(GL_FRAMEBUFFER, _object);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _albedoTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, _normalTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _depthTexture, 0);
+
+    //the draw buffers are part of the framebuffer state, so this is only done once
+    GLenum drawBuffers[8] = { GL_NONE, GL_NONE, GL_NONE, GL_NONE, GL_NONE, GL_NONE, GL_NONE, GL_NONE };
+    drawBuffers[albedoLocation] = GL_COLOR_ATTACHMENT0;
+    drawBuffers[normalLocation] = GL_COLOR_ATTACHMENT1;
+    glDrawBuffers(std::max(albedoLocation, normalLocation) + 1, drawBuffers);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if(status != GL_FRAMEBUFFER_COMPLETE){
+        glDeleteFramebuffers(1, &_object);
+        GLuint textures[3] = { _albedoTexture, _normalTexture, _depthTexture };
+        glDeleteTextures(3, textures);
+        std::ostringstream msg;
+        msg << "G-buffer incomplete, status 0x" << std::hex << status;
+        throw std::runtime_error(msg.str());
+    }
+}
+
+GBuffer::~GBuffer() {
+    glDeleteFramebuffers(1, &_object);
+    GLuint textures[3] = { _albedoTexture, _normalTexture, _depthTexture };
+    glDeleteTextures(3, textures);
+}
+
+GLuint GBuffer::object() const {
+    return _object;
+}
+
+GLuint GBuffer::albedoTexture() const {
+    return _albedoTexture;
+}
+
+GLuint GBuffer::normalTexture() const {
+    return _normalTexture;
+}
+
+GLuint GBuffer::depthTexture() const {
+    return _depthTexture;
+}
+
+GLsizei GBuffer::width() const {
+    return _width;
+}
+
+GLsizei GBuffer::height() const {
+    return _height;
+}
+
+void GBuffer::bindAndClear() const {
+    glBindFramebuffer(GL_FRAMEBUFFER, _object);
+    glViewport(0, 0, _width, _height);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_BLEND);
+}
@@ -0,0 +1,83 @@
+/*
+ tdogl::GBuffer
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+
+namespace tdogl {
+
+    class Program;
+
+    /**
+     The geometry buffer of a deferred renderer: a framebuffer object that stores the
+     surface attributes of the nearest fragment of each pixel, to be lit afterwards by
+     tdogl::DeferredLighting.
+
+      - albedo texture, GL_RGBA8: the surface color, and the specular intensity in alpha
+      - normal texture, GL_RGBA16F: the world space normal, and the shininess in alpha
+      - depth texture, GL_DEPTH_COMPONENT24: the world position is rebuilt from it
+
+     All three are sampled with texelFetch, so they have no mipmaps and no filtering.
+     */
+    class GBuffer {
+    public:
+        /**
+         @param width            Width in pixels
+         @param height           Height in pixels
+         @param geometryProgram  The program that fills the buffer. Its "albedoSpecular"
+                                 and "normalShininess" outputs are routed to the albedo and
+                                 normal textures, wherever the linker put them.
+
+         @throws std::exception if the program lacks the outputs, or the framebuffer is incomplete.
+         */
+        GBuffer(GLsizei width, GLsizei height, const Program& geometryProgram);
+
+        /**
+         Deletes the framebuffer and the textures
+         */
+        ~GBuffer();
+
+        /** @result The framebuffer object, as created by glGenFramebuffers */
+        GLuint object() const;
+
+        GLuint albedoTexture() const;
+        GLuint normalTexture() const;
+        GLuint depthTexture() const;
+
+        GLsizei width() const;
+        GLsizei height() const;
+
+        /**
+         Binds the framebuffer for drawing, sets the viewport to cover it and clears it.
+         Also disables blending, which would mix the normals.
+         */
+        void bindAndClear() const;
+
+    private:
+        GLuint _object;
+        GLuint _albedoTexture;
+        GLuint _normalTexture;
+        GLuint _depthTexture;
+        GLsizei _width;
+        GLsizei _height;
+
+        //copying disabled
+        GBuffer(const GBuffer&);
+        const GBuffer& operator=(const GBuffer&);
+    };
+
+}
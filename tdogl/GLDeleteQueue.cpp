@@ -0,0 +1,96 @@
+/*
+ tdogl::GLDeleteQueue
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "GLDeleteQueue.h"
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cassert>
+
+using namespace tdogl;
+
+//guards everything below. Deletes are rare, so one lock is plenty.
+static std::mutex gMutex;
+static std::thread::id gGLThread; //no thread until setGLThread
+static std::vector<GLuint> gShaders;
+static std::vector<GLuint> gPrograms;
+static std::vector<GLuint> gTextures;
+
+static bool OnGLThreadLocked() {
+    return gGLThread == std::thread::id() || gGLThread == std::this_thread::get_id();
+}
+
+//@result True if the caller should delete the object now, false if it was queued
+static bool QueueUnlessGLThread(std::vector<GLuint>& queue, GLuint object) {
+    std::lock_guard<std::mutex> lock(gMutex);
+    if(OnGLThreadLocked())
+        return true;
+    queue.push_back(object);
+    return false;
+}
+
+void GLDeleteQueue::setGLThread() {
+    std::lock_guard<std::mutex> lock(gMutex);
+    gGLThread = std::this_thread::get_id();
+}
+
+bool GLDeleteQueue::onGLThread() {
+    std::lock_guard<std::mutex> lock(gMutex);
+    return OnGLThreadLocked();
+}
+
+void GLDeleteQueue::deleteShader(GLuint shader) {
+    if(shader != 0 && QueueUnlessGLThread(gShaders, shader))
+        glDeleteShader(shader);
+}
+
+void GLDeleteQueue::deleteProgram(GLuint program) {
+    if(program != 0 && QueueUnlessGLThread(gPrograms, program))
+        glDeleteProgram(program);
+}
+
+void GLDeleteQueue::deleteTexture(GLuint texture) {
+    if(texture != 0 && QueueUnlessGLThread(gTextures, texture))
+        glDeleteTextures(1, &texture);
+}
+
+unsigned GLDeleteQueue::flush() {
+    //take the queues, and delete without holding the lock
+    std::vector<GLuint> shaders, programs, textures;
+    {
+        std::lock_guard<std::mutex> lock(gMutex);
+        assert(OnGLThreadLocked());
+        if(gShaders.empty() && gPrograms.empty() && gTextures.empty())
+            return 0;
+        shaders.swap(gShaders);
+        programs.swap(gPrograms);
+        textures.swap(gTextures);
+    }
+
+    //programs first, so the shaders are no longer attached to anything
+    for(size_t i = 0; i < programs.size(); ++i)
+        glDeleteProgram(programs[i]);
+    for(size_t i = 0; i < shaders.size(); ++i)
+        glDeleteShader(shaders[i]);
+    if(!textures.empty())
+        glDeleteTextures((GLsizei)textures.size(), &textures[0]);
+    return (unsigned)(shaders.size() + programs.size() + textures.size());
+}
+
+unsigned GLDeleteQueue::pending() {
+    std::lock_guard<std::mutex> lock(gMutex);
+    return (unsigned)(gShaders.size() + gPrograms.size() + gTextures.size());
+}
@@ -0,0 +1,57 @@
+/*
+ tdogl::GLDeleteQueue
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+
+namespace tdogl {
+
+    /**
+     Deletes GL objects on the thread that owns the GL context, whichever thread lets go
+     of them.
+
+     tdogl::Shader, tdogl::Program and tdogl::Texture free their objects through here. On
+     the GL thread, or before one is set, an object is deleted right away. On any other
+     thread it is queued, and deleted by the next `flush` on the GL thread.
+     */
+    class GLDeleteQueue {
+    public:
+        /**
+         Makes the calling thread the one that owns the GL context
+         */
+        static void setGLThread();
+
+        /** @result True on the GL thread, or on any thread if none has been set */
+        static bool onGLThread();
+
+        static void deleteShader(GLuint shader);
+        static void deleteProgram(GLuint program);
+        static void deleteTexture(GLuint texture);
+
+        /**
+         Deletes the objects the other threads queued. Call it on the GL thread, e.g. once
+         per frame.
+
+         @result The number of objects deleted
+         */
+        static unsigned flush();
+
+        /** @result The number of objects waiting for the next `flush` */
+        static unsigned pending();
+    };
+
+}
@@ -0,0 +1,170 @@
+/*
+ tdogl::HeadlessContext
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "HeadlessContext.h"
+#include <GL/glew.h>
+#include <stdexcept>
+#include <cstring>
+
+#ifdef TDOGL_USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#else
+#include <GLFW/glfw3.h>
+#endif
+
+using namespace tdogl;
+
+#ifdef TDOGL_USE_EGL
+
+// prefers Mesa's surfaceless platform, which needs no X server or DRM device
+static EGLDisplay OpenEGLDisplay() {
+    const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if(extensions && strstr(extensions, "EGL_MESA_platform_surfaceless")){
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if(getPlatformDisplay){
+            EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+            if(display != EGL_NO_DISPLAY)
+                return display;
+        }
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+HeadlessContext::HeadlessContext(int majorVersion, int minorVersion) :
+    _display(NULL),
+    _surface(NULL),
+    _context(NULL)
+{
+    EGLDisplay display = OpenEGLDisplay();
+    if(display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+        throw std::runtime_error("eglInitialize failed");
+    _display = display;
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if(!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || configCount == 0){
+        eglTerminate(display);
+        throw std::runtime_error("eglChooseConfig found no pbuffer config with desktop OpenGL");
+    }
+
+    //rendering goes into a tdogl::Framebuffer, so the surface only has to exist
+    const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    EGLSurface surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+    if(surface == EGL_NO_SURFACE){
+        eglTerminate(display);
+        throw std::runtime_error("eglCreatePbufferSurface failed");
+    }
+    _surface = surface;
+
+    eglBindAPI(EGL_OPENGL_API);
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, majorVersion,
+        EGL_CONTEXT_MINOR_VERSION_KHR, minorVersion,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+        EGL_NONE
+    };
+    _context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+    if(_context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, (EGLContext)_context)){
+        if(_context != EGL_NO_CONTEXT) eglDestroyContext(display, (EGLContext)_context);
+        eglDestroySurface(display, surface);
+        eglTerminate(display);
+        throw std::runtime_error("eglCreateContext failed. Can your driver handle OpenGL 3.2?");
+    }
+
+    //a GLEW built for GLX, as most distributions ship it, loads the GL functions and then
+    //fails only because there is no X display
+    glewExperimental = GL_TRUE;
+    GLenum glewStatus = glewInit();
+    if(glewStatus != GLEW_OK && glewStatus != GLEW_ERROR_NO_GLX_DISPLAY){
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, (EGLContext)_context);
+        eglDestroySurface(display, surface);
+        eglTerminate(display);
+        throw std::runtime_error("glewInit failed");
+    }
+    while(glGetError() != GL_NO_ERROR) {}
+}
+
+HeadlessContext::~HeadlessContext() {
+    EGLDisplay display = (EGLDisplay)_display;
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(display, (EGLContext)_context);
+    if(_surface) eglDestroySurface(display, (EGLSurface)_surface);
+    eglTerminate(display);
+}
+
+const char* HeadlessContext::backendName() {
+    return "EGL pbuffer";
+}
+
+#else
+
+static void OnHeadlessError(int /*errorCode*/, const char* msg) {
+    throw std::runtime_error(msg);
+}
+
+HeadlessContext::HeadlessContext(int majorVersion, int minorVersion) :
+    _display(NULL),
+    _surface(NULL),
+    _context(NULL)
+{
+    glfwSetErrorCallback(OnHeadlessError);
+    if(!glfwInit())
+        throw std::runtime_error("glfwInit failed");
+
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, majorVersion);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minorVersion);
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    GLFWwindow* window = glfwCreateWindow(1, 1, "headless", NULL, NULL);
+    if(!window){
+        glfwTerminate();
+        throw std::runtime_error("glfwCreateWindow failed. Can your hardware handle OpenGL 3.2?");
+    }
+    _context = window;
+    glfwMakeContextCurrent(window);
+
+    glewExperimental = GL_TRUE;
+    if(glewInit() != GLEW_OK){
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        throw std::runtime_error("glewInit failed");
+    }
+    while(glGetError() != GL_NO_ERROR) {}
+}
+
+HeadlessContext::~HeadlessContext() {
+    glfwDestroyWindow((GLFWwindow*)_context);
+    glfwTerminate();
+}
+
+const char* HeadlessContext::backendName() {
+    return "hidden GLFW window";
+}
+
+#endif
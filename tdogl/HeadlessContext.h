@@ -0,0 +1,58 @@
+/*
+ tdogl::HeadlessContext
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+namespace tdogl {
+
+    /**
+     An OpenGL core profile context with nothing on screen, for rendering into a
+     tdogl::Framebuffer.
+
+     When built with TDOGL_USE_EGL defined, as the CMake build for Linux does, the context is
+     created through EGL with a 1x1 pbuffer surface, which needs neither a window system nor
+     a GPU: Mesa's llvmpipe driver works. Otherwise an invisible GLFW window provides the
+     context.
+
+     The context is current on the calling thread once the constructor returns, and GLEW
+     has been initialised.
+     */
+    class HeadlessContext {
+    public:
+        /**
+         @throws std::exception if no context of at least the given version can be created.
+         */
+        HeadlessContext(int majorVersion = 3, int minorVersion = 2);
+
+        /**
+         Destroys the context
+         */
+        ~HeadlessContext();
+
+        /** @result "EGL pbuffer" or "hidden GLFW window" */
+        static const char* backendName();
+
+    private:
+        void* _display;
+        void* _surface;
+        void* _context;
+
+        //copying disabled
+        HeadlessContext(const HeadlessContext&);
+        const HeadlessContext& operator=(const HeadlessContext&);
+    };
+
+}
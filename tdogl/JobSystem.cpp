@@ -0,0 +1,190 @@
+/*
+ tdogl::JobSystem
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "JobSystem.h"
+#include <algorithm>
+
+using namespace tdogl;
+
+JobSystem::JobSystem(int workerCount) :
+    _activeLoops(0),
+    _quit(false)
+{
+    if(workerCount < 0)
+        workerCount = std::max(1, (int)std::thread::hardware_concurrency()) - 1;
+
+    for(int i = 0; i <= workerCount; ++i)
+        _queues.push_back(new WorkQueue());
+    for(int i = 1; i <= workerCount; ++i)
+        _threads.push_back(std::thread(&JobSystem::_workerMain, this, (unsigned)i));
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(_wakeMutex);
+        _quit = true;
+    }
+    _wake.notify_all();
+    for(size_t i = 0; i < _threads.size(); ++i)
+        _threads[i].join();
+    for(size_t i = 0; i < _queues.size(); ++i)
+        delete _queues[i];
+}
+
+unsigned JobSystem::threadCount() const {
+    return (unsigned)_queues.size();
+}
+
+void JobSystem::_run(size_t count, size_t grainSize, Callback callback, const void* function) {
+    if(count == 0)
+        return;
+    if(grainSize == 0)
+        grainSize = 1;
+    if(_threads.empty() || count <= grainSize){
+        callback(function, 0, 0, count);
+        return;
+    }
+
+    std::atomic<size_t> remaining(count);
+    Job root;
+    root.callback = callback;
+    root.function = function;
+    root.begin = 0;
+    root.end = count;
+    root.grainSize = grainSize;
+    root.remaining = &remaining;
+    {
+        std::lock_guard<std::mutex> lock(_queues[0]->mutex);
+        _queues[0]->pushBack(root);
+    }
+
+    //wake the workers
+    {
+        std::lock_guard<std::mutex> lock(_wakeMutex);
+        ++_activeLoops;
+    }
+    _wake.notify_all();
+
+    //help until every item is done. Some of the last jobs may still be running on workers.
+    while(remaining.load() > 0){
+        Job job;
+        if(_popOrSteal(0, job))
+            _execute(0, job);
+        else
+            std::this_thread::yield();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_wakeMutex);
+        --_activeLoops;
+    }
+}
+
+void JobSystem::_workerMain(unsigned threadIndex) {
+    for(;;){
+        if(_activeLoops.load() == 0){
+            std::unique_lock<std::mutex> lock(_wakeMutex);
+            while(!_quit && _activeLoops.load() == 0)
+                _wake.wait(lock);
+            if(_quit)
+                return;
+        }
+
+        Job job;
+        if(_popOrSteal(threadIndex, job))
+            _execute(threadIndex, job);
+        else
+            std::this_thread::yield();
+    }
+}
+
+bool JobSystem::_popOrSteal(unsigned threadIndex, Job& job) {
+    //newest job from our own deque: the smallest range, and likely still in cache
+    {
+        WorkQueue& own = *_queues[threadIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(own.popBack(job))
+            return true;
+    }
+
+    //oldest job from someone else's deque: the biggest range
+    const size_t queueCount = _queues.size();
+    for(size_t i = 1; i < queueCount; ++i){
+        WorkQueue& victim = *_queues[(threadIndex + i) % queueCount];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(victim.popFront(job))
+            return true;
+    }
+    return false;
+}
+
+void JobSystem::_execute(unsigned threadIndex, Job job) {
+    //split off the upper halves for other threads to steal
+    while(job.end - job.begin > job.grainSize){
+        Job upper = job;
+        upper.begin = job.begin + (job.end - job.begin) / 2;
+        job.end = upper.begin;
+
+        WorkQueue& own = *_queues[threadIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.pushBack(upper);
+    }
+
+    job.callback(job.function, threadIndex, job.begin, job.end);
+    job.remaining->fetch_sub(job.end - job.begin);
+}
+
+
+//
+// WorkQueue
+//
+
+JobSystem::WorkQueue::WorkQueue() :
+    ring(64),
+    head(0),
+    count(0)
+{
+}
+
+void JobSystem::WorkQueue::pushBack(const Job& job) {
+    if(count == ring.size()){
+        //unwrap into a ring twice the size
+        std::vector<Job> bigger(ring.size() * 2);
+        for(size_t i = 0; i < count; ++i)
+            bigger[i] = ring[(head + i) & (ring.size() - 1)];
+        ring.swap(bigger);
+        head = 0;
+    }
+    ring[(head + count) & (ring.size() - 1)] = job;
+    ++count;
+}
+
+bool JobSystem::WorkQueue::popBack(Job& job) {
+    if(count == 0)
+        return false;
+    --count;
+    job = ring[(head + count) & (ring.size() - 1)];
+    return true;
+}
+
+bool JobSystem::WorkQueue::popFront(Job& job) {
+    if(count == 0)
+        return false;
+    job = ring[head];
+    head = (head + 1) & (ring.size() - 1);
+    --count;
+    return true;
+}
@@ -0,0 +1,132 @@
+/*
+ tdogl::JobSystem
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tdogl {
+
+    /**
+     A pool of worker threads that split ranges of work between them by work stealing.
+
+     Every thread, including the one calling `parallelFor`, has its own deque of jobs. A
+     thread splits its range in half, keeps the lower half and pushes the upper half onto
+     the back of its deque, until the range is no bigger than the grain size. Idle threads
+     steal from the front of other threads' deques, which is where the biggest ranges are.
+
+     `parallelFor` must only be called from one thread at a time, and not from inside a
+     job. Workers sleep while there is no loop running.
+
+     The function given to a loop is called through a pointer rather than copied into a
+     std::function, and the deques are rings that keep their memory, so running a loop
+     doesn't allocate.
+     */
+    class JobSystem {
+    public:
+        /**
+         @param workerCount  Number of threads to start in addition to the calling thread.
+                             Defaults to one less than the number of hardware threads.
+         */
+        explicit JobSystem(int workerCount = -1);
+
+        /** Stops and joins the worker threads */
+        ~JobSystem();
+
+        /** @result The number of threads that run jobs, including the calling thread */
+        unsigned threadCount() const;
+
+        /**
+         Calls `function` on sub-ranges that cover [0, count) exactly once, in parallel, and
+         returns when all of them have finished. The calling thread runs jobs too.
+
+         @param count      Number of items
+         @param grainSize  Ranges of this many items or fewer are not split any further
+         @param function   Called as `function(begin, end)` with each sub-range, to process
+                           the items in [begin, end). Must not throw.
+         */
+        template<typename Function>
+        void parallelFor(size_t count, size_t grainSize, const Function& function) {
+            _run(count, grainSize, &_callRange<Function>, &function);
+        }
+
+        /**
+         Like `parallelFor`, but `function` is called as `function(thread, begin, end)`, where
+         `thread` is the index in [0, threadCount) of the thread running the sub-range. The
+         calling thread is 0. Useful for per-thread scratch memory.
+         */
+        template<typename Function>
+        void parallelForWithThread(size_t count, size_t grainSize, const Function& function) {
+            _run(count, grainSize, &_callThreadRange<Function>, &function);
+        }
+
+    private:
+        typedef void (*Callback)(const void* function, unsigned thread, size_t begin, size_t end);
+
+        struct Job {
+            Callback callback;
+            const void* function;
+            size_t begin;
+            size_t end;
+            size_t grainSize;
+            std::atomic<size_t>* remaining;
+        };
+
+        /** A deque of jobs in a ring buffer, which only allocates when it grows */
+        struct WorkQueue {
+            std::mutex mutex;
+            std::vector<Job> ring; //the size is a power of two
+            size_t head;
+            size_t count;
+
+            WorkQueue();
+            void pushBack(const Job& job);
+            bool popBack(Job& job);
+            bool popFront(Job& job);
+        };
+
+        std::vector<WorkQueue*> _queues; //_queues[0] belongs to the thread calling parallelFor
+        std::vector<std::thread> _threads;
+        std::mutex _wakeMutex;
+        std::condition_variable _wake;
+        std::atomic<int> _activeLoops;
+        bool _quit;
+
+        template<typename Function>
+        static void _callRange(const void* function, unsigned /*thread*/, size_t begin, size_t end) {
+            (*(const Function*)function)(begin, end);
+        }
+
+        template<typename Function>
+        static void _callThreadRange(const void* function, unsigned thread, size_t begin, size_t end) {
+            (*(const Function*)function)(thread, begin, end);
+        }
+
+        void _run(size_t count, size_t grainSize, Callback callback, const void* function);
+        void _workerMain(unsigned threadIndex);
+        bool _popOrSteal(unsigned threadIndex, Job& job);
+        void _execute(unsigned threadIndex, Job job);
+
+        //copying disabled
+        JobSystem(const JobSystem&);
+        const JobSystem& operator=(const JobSystem&);
+    };
+
+}
@@ -0,0 +1,528 @@
+/*
+ tdogl::MeshCache
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "MeshCache.h"
+#include "Program.h"
+#include <stdexcept>
+#include <fstream>
+#include <map>
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace tdogl;
+
+static const char MeshCacheMagic[4] = { 'T', 'D', 'M', 'C' };
+static const uint32_t MeshCacheVersion = 2; //2 added the LOD table
+static const uint64_t MeshCachePayloadAlignment = 16;
+
+// on-disk layout. All fields are little endian, the payloads are aligned to 16 bytes.
+struct MeshCacheFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t vertexCount;
+    uint32_t stride;
+    uint32_t indexCount;
+    uint32_t indexType;
+    uint32_t attributeCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint64_t vertexDataOffset;
+    uint64_t vertexDataSize;
+    uint64_t indexDataOffset;
+    uint64_t indexDataSize;
+    uint32_t lodCount;
+    uint32_t reserved;
+};
+
+struct MeshCacheFileAttribute {
+    char name[32];
+    uint32_t size;
+    uint32_t type;
+    uint32_t normalized;
+    uint32_t offset;
+};
+
+// follows the attributes
+struct MeshCacheFileLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+    uint32_t reserved;
+};
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// whether `size` bytes at `offset` are inside a file of `fileSize` bytes, without overflowing
+static bool SectionFits(uint64_t offset, uint64_t size, uint64_t fileSize) {
+    return offset <= fileSize && size <= fileSize - offset;
+}
+
+static MeshAttribute MakeAttribute(const char* name, GLint size, GLuint offset) {
+    MeshAttribute attrib;
+    memset(attrib.name, 0, sizeof(attrib.name));
+    strncpy(attrib.name, name, sizeof(attrib.name) - 1);
+    attrib.size = size;
+    attrib.type = GL_FLOAT;
+    attrib.normalized = GL_FALSE;
+    attrib.offset = offset;
+    return attrib;
+}
+
+
+//
+// MeshData
+//
+
+MeshData::MeshData() :
+    stride(8 * sizeof(GLfloat)),
+    boundsMin(0.0f),
+    boundsMax(0.0f)
+{
+    attributes.push_back(MakeAttribute("vert", 3, 0));
+    attributes.push_back(MakeAttribute("vertTexCoord", 2, 3 * sizeof(GLfloat)));
+    attributes.push_back(MakeAttribute("vertNormal", 3, 5 * sizeof(GLfloat)));
+}
+
+GLsizei MeshData::vertexCount() const {
+    return (GLsizei)(vertices.size() * sizeof(GLfloat) / stride);
+}
+
+namespace {
+    // a corner of an OBJ face: zero based position/texcoord/normal indices, -1 if absent
+    struct ObjCorner {
+        int v, vt, vn;
+        bool operator < (const ObjCorner& other) const {
+            if(v != other.v) return v < other.v;
+            if(vt != other.vt) return vt < other.vt;
+            return vn < other.vn;
+        }
+    };
+}
+
+// OBJ indices are one based, and negative values are relative to the end of the list
+static int ResolveObjIndex(long idx, size_t count) {
+    if(idx > 0 && (size_t)idx <= count) return (int)(idx - 1);
+    if(idx < 0 && (size_t)(-idx) <= count) return (int)(count + idx);
+    throw std::runtime_error("OBJ face index out of range");
+}
+
+static ObjCorner ParseObjCorner(const char*& cursor,
+                                size_t positionCount,
+                                size_t texCoordCount,
+                                size_t normalCount)
+{
+    ObjCorner corner = { -1, -1, -1 };
+    char* end = NULL;
+    corner.v = ResolveObjIndex(strtol(cursor, &end, 10), positionCount);
+    cursor = end;
+    if(*cursor == '/'){
+        ++cursor;
+        if(*cursor != '/'){
+            corner.vt = ResolveObjIndex(strtol(cursor, &end, 10), texCoordCount);
+            cursor = end;
+        }
+        if(*cursor == '/'){
+            ++cursor;
+            corner.vn = ResolveObjIndex(strtol(cursor, &end, 10), normalCount);
+            cursor = end;
+        }
+    }
+    return corner;
+}
+
+MeshData MeshData::meshDataFromObjFile(const std::string& filePath) {
+    std::ifstream f(filePath.c_str(), std::ios::in | std::ios::binary);
+    if(!f.is_open())
+        throw std::runtime_error(std::string("Failed to open file: ") + filePath);
+
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> texCoords;
+    std::vector<glm::vec3> normals;
+    std::map<ObjCorner, GLuint> cornerIndices;
+    MeshData mesh;
+
+    std::string line;
+    std::vector<ObjCorner> face;
+    while(std::getline(f, line)){
+        const char* cursor = line.c_str();
+        char* end = NULL;
+        if(cursor[0] == 'v' && cursor[1] == ' '){
+            glm::vec3 p;
+            cursor += 2;
+            for(int i = 0; i < 3; ++i){ p[i] = strtof(cursor, &end); cursor = end; }
+            positions.push_back(p);
+        } else if(cursor[0] == 'v' && cursor[1] == 't' && cursor[2] == ' '){
+            glm::vec2 uv;
+            cursor += 3;
+            for(int i = 0; i < 2; ++i){ uv[i] = strtof(cursor, &end); cursor = end; }
+            texCoords.push_back(uv);
+        } else if(cursor[0] == 'v' && cursor[1] == 'n' && cursor[2] == ' '){
+            glm::vec3 n;
+            cursor += 3;
+            for(int i = 0; i < 3; ++i){ n[i] = strtof(cursor, &end); cursor = end; }
+            normals.push_back(n);
+        } else if(cursor[0] == 'f' && cursor[1] == ' '){
+            cursor += 2;
+            face.clear();
+            while(*cursor){
+                while(*cursor == ' ' || *cursor == '\t' || *cursor == '\r') ++cursor;
+                if(*cursor == '\0') break;
+                face.push_back(ParseObjCorner(cursor, positions.size(), texCoords.size(), normals.size()));
+            }
+            if(face.size() < 3)
+                throw std::runtime_error(std::string("OBJ face with less than 3 vertices in: ") + filePath);
+
+            glm::vec3 faceNormal = glm::cross(positions[face[1].v] - positions[face[0].v],
+                                              positions[face[2].v] - positions[face[0].v]);
+            if(glm::length(faceNormal) > 0.0f)
+                faceNormal = glm::normalize(faceNormal);
+
+            //triangulate as a fan around the first corner
+            for(size_t tri = 1; tri + 1 < face.size(); ++tri){
+                const ObjCorner corners[3] = { face[0], face[tri], face[tri + 1] };
+                for(int c = 0; c < 3; ++c){
+                    std::map<ObjCorner, GLuint>::const_iterator found = cornerIndices.find(corners[c]);
+                    if(found != cornerIndices.end()){
+                        mesh.indices.push_back(found->second);
+                        continue;
+                    }
+
+                    const glm::vec3& p = positions[corners[c].v];
+                    glm::vec2 uv = (corners[c].vt >= 0 ? texCoords[corners[c].vt] : glm::vec2(0.0f));
+                    glm::vec3 n = (corners[c].vn >= 0 ? normals[corners[c].vn] : faceNormal);
+                    GLuint index = (GLuint)(mesh.vertices.size() / 8);
+                    //flat normals are per face, so those corners can't be shared between faces
+                    if(corners[c].vn >= 0)
+                        cornerIndices[corners[c]] = index;
+
+                    const GLfloat vertex[8] = { p.x, p.y, p.z, uv.x, uv.y, n.x, n.y, n.z };
+                    mesh.vertices.insert(mesh.vertices.end(), vertex, vertex + 8);
+                    mesh.indices.push_back(index);
+                }
+            }
+        }
+    }
+
+    if(mesh.indices.empty())
+        throw std::runtime_error(std::string("OBJ file contains no faces: ") + filePath);
+
+    mesh.boundsMin = glm::vec3(mesh.vertices[0], mesh.vertices[1], mesh.vertices[2]);
+    mesh.boundsMax = mesh.boundsMin;
+    for(size_t i = 0; i < mesh.vertices.size(); i += 8){
+        glm::vec3 p(mesh.vertices[i], mesh.vertices[i + 1], mesh.vertices[i + 2]);
+        mesh.boundsMin = glm::min(mesh.boundsMin, p);
+        mesh.boundsMax = glm::max(mesh.boundsMax, p);
+    }
+
+    return mesh;
+}
+
+
+//
+// MeshCache
+//
+
+void MeshCache::writeToFile(const MeshData& mesh, const std::string& filePath) {
+    const GLsizei vertexCount = mesh.vertexCount();
+    const bool shortIndices = (vertexCount <= 0xFFFF);
+
+    MeshCacheFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MeshCacheMagic, sizeof(header.magic));
+    header.version = MeshCacheVersion;
+    header.vertexCount = (uint32_t)vertexCount;
+    header.stride = (uint32_t)mesh.stride;
+    header.indexCount = (uint32_t)mesh.indices.size();
+    header.indexType = (shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
+    header.attributeCount = (uint32_t)mesh.attributes.size();
+    for(int i = 0; i < 3; ++i){
+        header.boundsMin[i] = mesh.boundsMin[i];
+        header.boundsMax[i] = mesh.boundsMax[i];
+    }
+
+    //a mesh without LODs is written as a single LOD covering all the indices
+    std::vector<MeshCacheFileLod> lods;
+    for(size_t i = 0; i < mesh.lods.size(); ++i){
+        if(mesh.lods[i].firstIndex + (size_t)mesh.lods[i].indexCount > mesh.indices.size())
+            throw std::runtime_error("Mesh LOD is outside the index buffer");
+        MeshCacheFileLod lod = { mesh.lods[i].firstIndex, (uint32_t)mesh.lods[i].indexCount, mesh.lods[i].error, 0 };
+        lods.push_back(lod);
+    }
+    if(lods.empty()){
+        MeshCacheFileLod lod = { 0, header.indexCount, 0.0f, 0 };
+        lods.push_back(lod);
+    }
+    if(lods.size() > MaxLods)
+        throw std::runtime_error("Mesh has too many LODs");
+    header.lodCount = (uint32_t)lods.size();
+
+    uint64_t descriptorEnd = sizeof(header) + header.attributeCount * sizeof(MeshCacheFileAttribute)
+                           + header.lodCount * sizeof(MeshCacheFileLod);
+    header.vertexDataOffset = AlignUp(descriptorEnd, MeshCachePayloadAlignment);
+    header.vertexDataSize = mesh.vertices.size() * sizeof(GLfloat);
+    header.indexDataOffset = AlignUp(header.vertexDataOffset + header.vertexDataSize, MeshCachePayloadAlignment);
+    header.indexDataSize = header.indexCount * (shortIndices ? sizeof(GLushort) : sizeof(GLuint));
+
+    std::ofstream f(filePath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!f.is_open())
+        throw std::runtime_error(std::string("Failed to open file for writing: ") + filePath);
+
+    f.write((const char*)&header, sizeof(header));
+    for(size_t i = 0; i < mesh.attributes.size(); ++i){
+        MeshCacheFileAttribute attrib;
+        memset(&attrib, 0, sizeof(attrib));
+        memcpy(attrib.name, mesh.attributes[i].name, sizeof(attrib.name));
+        attrib.size = (uint32_t)mesh.attributes[i].size;
+        attrib.type = mesh.attributes[i].type;
+        attrib.normalized = mesh.attributes[i].normalized;
+        attrib.offset = mesh.attributes[i].offset;
+        f.write((const char*)&attrib, sizeof(attrib));
+    }
+    f.write((const char*)&lods[0], (std::streamsize)(lods.size() * sizeof(MeshCacheFileLod)));
+
+    const char padding[MeshCachePayloadAlignment] = { 0 };
+    f.write(padding, (std::streamsize)(header.vertexDataOffset - descriptorEnd));
+    f.write((const char*)&mesh.vertices[0], (std::streamsize)header.vertexDataSize);
+    f.write(padding, (std::streamsize)(header.indexDataOffset - header.vertexDataOffset - header.vertexDataSize));
+    if(shortIndices){
+        std::vector<GLushort> shorts(mesh.indices.begin(), mesh.indices.end());
+        f.write((const char*)&shorts[0], (std::streamsize)header.indexDataSize);
+    } else {
+        f.write((const char*)&mesh.indices[0], (std::streamsize)header.indexDataSize);
+    }
+
+    if(!f.good())
+        throw std::runtime_error(std::string("Failed to write mesh cache: ") + filePath);
+}
+
+MeshCache::MeshCache(const std::string& filePath) :
+    _mapping(NULL),
+    _mappingSize(0),
+    _fileHandle(NULL),
+    _mappingHandle(NULL),
+    _boundsMin(0.0f),
+    _boundsMax(0.0f),
+    _vertexCount(0),
+    _stride(0),
+    _indexCount(0),
+    _indexType(GL_UNSIGNED_SHORT),
+    _vertexData(NULL),
+    _indexData(NULL)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error(std::string("Failed to open file: ") + filePath);
+    _fileHandle = file;
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    _mappingSize = (size_t)size.QuadPart;
+
+    _mappingHandle = (_mappingSize > 0 ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL);
+    if(_mappingHandle)
+        _mapping = MapViewOfFile((HANDLE)_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw std::runtime_error(std::string("Failed to open file: ") + filePath);
+
+    struct stat st;
+    fstat(fd, &st);
+    _mappingSize = (size_t)st.st_size;
+    if(_mappingSize > 0){
+        _mapping = mmap(NULL, _mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(_mapping == MAP_FAILED) _mapping = NULL;
+    }
+    close(fd);
+#endif
+
+    if(!_mapping){
+        _unmap();
+        throw std::runtime_error(std::string("Failed to map file: ") + filePath);
+    }
+
+    //validate before touching any payload so a truncated file can't be read out of bounds
+    const MeshCacheFileHeader* header = (const MeshCacheFileHeader*)_mapping;
+    const unsigned char* base = (const unsigned char*)_mapping;
+    std::string error;
+    if(_mappingSize < sizeof(MeshCacheFileHeader) || memcmp(header->magic, MeshCacheMagic, sizeof(header->magic)) != 0)
+        error = "Not a mesh cache file: ";
+    else if(header->version != MeshCacheVersion)
+        error = "Unsupported mesh cache version: ";
+    else if(header->lodCount < 1 || header->lodCount > MaxLods)
+        error = "Invalid LOD count in mesh cache file: ";
+    else if(header->stride == 0 || (header->indexType != GL_UNSIGNED_SHORT && header->indexType != GL_UNSIGNED_INT))
+        error = "Invalid vertex layout in mesh cache file: ";
+    else if(!SectionFits(sizeof(MeshCacheFileHeader), (uint64_t)header->attributeCount * sizeof(MeshCacheFileAttribute)
+                + (uint64_t)header->lodCount * sizeof(MeshCacheFileLod), _mappingSize) ||
+            !SectionFits(header->vertexDataOffset, header->vertexDataSize, _mappingSize) ||
+            !SectionFits(header->indexDataOffset, header->indexDataSize, _mappingSize))
+        error = "Truncated mesh cache file: ";
+    //upload() reads count * element size bytes, so that must be inside the sections
+    else if((uint64_t)header->vertexCount * header->stride > header->vertexDataSize ||
+            (uint64_t)header->indexCount * (header->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint))
+                > header->indexDataSize)
+        error = "Mesh cache counts don't fit their data: ";
+    if(!error.empty()){
+        _unmap();
+        throw std::runtime_error(error + filePath);
+    }
+
+    const MeshCacheFileAttribute* fileAttribs = (const MeshCacheFileAttribute*)(base + sizeof(MeshCacheFileHeader));
+    for(uint32_t i = 0; i < header->attributeCount; ++i){
+        MeshAttribute attrib;
+        memcpy(attrib.name, fileAttribs[i].name, sizeof(attrib.name));
+        attrib.name[sizeof(attrib.name) - 1] = '\0';
+        attrib.size = (GLint)fileAttribs[i].size;
+        attrib.type = fileAttribs[i].type;
+        attrib.normalized = (GLboolean)fileAttribs[i].normalized;
+        attrib.offset = fileAttribs[i].offset;
+        _attributes.push_back(attrib);
+    }
+
+    const MeshCacheFileLod* fileLods = (const MeshCacheFileLod*)(fileAttribs + header->attributeCount);
+    for(uint32_t i = 0; i < header->lodCount; ++i){
+        if((uint64_t)fileLods[i].firstIndex + fileLods[i].indexCount > header->indexCount){
+            _unmap();
+            throw std::runtime_error("Mesh cache LOD is outside the index buffer: " + filePath);
+        }
+        MeshLod lod = { fileLods[i].firstIndex, (GLsizei)fileLods[i].indexCount, fileLods[i].error };
+        _lods.push_back(lod);
+    }
+
+    _boundsMin = glm::vec3(header->boundsMin[0], header->boundsMin[1], header->boundsMin[2]);
+    _boundsMax = glm::vec3(header->boundsMax[0], header->boundsMax[1], header->boundsMax[2]);
+    _vertexCount = (GLsizei)header->vertexCount;
+    _stride = (GLsizei)header->stride;
+    _indexCount = (GLsizei)header->indexCount;
+    _indexType = header->indexType;
+    _vertexData = base + header->vertexDataOffset;
+    _indexData = base + header->indexDataOffset;
+}
+
+MeshCache::~MeshCache() {
+    _unmap();
+}
+
+void MeshCache::_unmap() {
+#ifdef _WIN32
+    if(_mapping) UnmapViewOfFile(_mapping);
+    if(_mappingHandle) CloseHandle((HANDLE)_mappingHandle);
+    if(_fileHandle) CloseHandle((HANDLE)_fileHandle);
+#else
+    if(_mapping) munmap(_mapping, _mappingSize);
+#endif
+    _mapping = NULL;
+    _mappingHandle = NULL;
+    _fileHandle = NULL;
+}
+
+GLsizei MeshCache::vertexCount() const {
+    return _vertexCount;
+}
+
+GLsizei MeshCache::stride() const {
+    return _stride;
+}
+
+GLsizei MeshCache::indexCount() const {
+    return _indexCount;
+}
+
+GLenum MeshCache::indexType() const {
+    return _indexType;
+}
+
+unsigned MeshCache::lodCount() const {
+    return (unsigned)_lods.size();
+}
+
+const MeshLod& MeshCache::lod(unsigned index) const {
+    return _lods[index];
+}
+
+const std::vector<MeshAttribute>& MeshCache::attributes() const {
+    return _attributes;
+}
+
+const glm::vec3& MeshCache::boundsMin() const {
+    return _boundsMin;
+}
+
+const glm::vec3& MeshCache::boundsMax() const {
+    return _boundsMax;
+}
+
+const GLvoid* MeshCache::vertexData() const {
+    return _vertexData;
+}
+
+GLsizeiptr MeshCache::vertexDataSize() const {
+    return (GLsizeiptr)_vertexCount * _stride;
+}
+
+const GLvoid* MeshCache::indexData() const {
+    return _indexData;
+}
+
+GLsizeiptr MeshCache::indexDataSize() const {
+    return (GLsizeiptr)_indexCount * (_indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+}
+
+void MeshCache::upload(GLuint vbo, GLuint ibo, GLenum usage) const {
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertexDataSize(), vertexData(), usage);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexDataSize(), indexData(), usage);
+}
+
+void MeshCache::setVertexAttribPointers(const Program& program) const {
+    for(size_t i = 0; i < _attributes.size(); ++i){
+        const MeshAttribute& a = _attributes[i];
+        GLint location = program.attrib(a.name);
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, a.size, a.type, a.normalized, _stride, (const GLvoid*)(size_t)a.offset);
+    }
+}
+
+void MeshCache::setVertexAttribPointer(const Program& program, const GLchar* attribName) const {
+    for(size_t i = 0; i < _attributes.size(); ++i){
+        const MeshAttribute& a = _attributes[i];
+        if(strcmp(a.name, attribName) != 0)
+            continue;
+        GLint location = program.attrib(a.name);
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, a.size, a.type, a.normalized, _stride, (const GLvoid*)(size_t)a.offset);
+        return;
+    }
+    throw std::runtime_error(std::string("Mesh has no vertex attribute: ") + attribName);
+}
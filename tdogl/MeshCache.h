@@ -0,0 +1,191 @@
+/*
+ tdogl::MeshCache
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+namespace tdogl {
+
+    class Program;
+
+    /**
+     Describes one interleaved vertex attribute of a mesh.
+
+     The fields map directly onto the arguments of glVertexAttribPointer. The attribute is
+     connected to the shader attribute with the same `name`.
+     */
+    struct MeshAttribute {
+        char name[32];
+        GLint size;
+        GLenum type;
+        GLboolean normalized;
+        GLuint offset;
+    };
+
+    /**
+     A level of detail of a mesh: a range of its index buffer. All the levels of a mesh
+     share its vertices.
+     */
+    struct MeshLod {
+        GLuint firstIndex;
+        GLsizei indexCount;
+        float error; //largest simplification error, in mesh units. 0 for LOD 0
+    };
+
+    /**
+     Mesh geometry held in ordinary memory.
+
+     Produced by parsing a source mesh (e.g. a Wavefront OBJ file), and used as the input when
+     baking a tdogl::MeshCache file. The vertices are interleaved as
+     "vert" (xyz), "vertTexCoord" (uv), "vertNormal" (xyz).
+
+     If `lods` is empty, all of `indices` is one mesh. Otherwise each LOD is a range of
+     `indices`, see tdogl::MeshSimplifier::generateLods.
+     */
+    struct MeshData {
+        std::vector<GLfloat> vertices;
+        std::vector<GLuint> indices;
+        std::vector<MeshLod> lods;
+        std::vector<MeshAttribute> attributes;
+        GLsizei stride;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+
+        MeshData();
+
+        /** Number of vertices in `vertices` */
+        GLsizei vertexCount() const;
+
+        /**
+         Parses a Wavefront OBJ file.
+
+         Faces with more than three vertices are triangulated as a fan. Faces without normals
+         get a flat face normal.
+
+         @throws std::exception if the file can not be read or is malformed.
+         */
+        static MeshData meshDataFromObjFile(const std::string& filePath);
+    };
+
+    /**
+     A baked, read-only mesh file that is memory mapped instead of parsed.
+
+     The file holds a fixed header, the vertex layout descriptor, the bounding box, the
+     table of levels of detail and the vertex and index payloads. Once mapped, the payloads
+     are handed to glBufferData without being copied or converted.
+     */
+    class MeshCache {
+    public:
+        /** The most levels of detail a mesh can have */
+        static const unsigned MaxLods = 8;
+
+        /**
+         Writes `mesh` to `filePath` in the baked format.
+
+         Indices are stored as GL_UNSIGNED_SHORT when every index fits, otherwise as
+         GL_UNSIGNED_INT.
+
+         @throws std::exception if the file can not be written.
+         */
+        static void writeToFile(const MeshData& mesh, const std::string& filePath);
+
+        /**
+         Memory maps a baked mesh file.
+
+         @throws std::exception if the file can not be mapped or is not a valid mesh cache.
+         */
+        explicit MeshCache(const std::string& filePath);
+
+        /**
+         Unmaps the file
+         */
+        ~MeshCache();
+
+        GLsizei vertexCount() const;
+        GLsizei stride() const;
+        GLsizei indexCount() const;
+
+        /** GL_UNSIGNED_SHORT or GL_UNSIGNED_INT */
+        GLenum indexType() const;
+
+        /** @result Number of levels of detail, at least 1. LOD 0 is the full mesh. */
+        unsigned lodCount() const;
+
+        /** @result The index range of a level of detail */
+        const MeshLod& lod(unsigned index) const;
+
+        const std::vector<MeshAttribute>& attributes() const;
+        const glm::vec3& boundsMin() const;
+        const glm::vec3& boundsMax() const;
+
+        /** Pointer into the mapped file, valid for the lifetime of this object */
+        const GLvoid* vertexData() const;
+        GLsizeiptr vertexDataSize() const;
+        const GLvoid* indexData() const;
+        GLsizeiptr indexDataSize() const;
+
+        /**
+         Uploads the payloads straight from the mapping.
+
+         Binds `vbo` to GL_ARRAY_BUFFER and `ibo` to GL_ELEMENT_ARRAY_BUFFER. Bind the target
+         VAO first so that it records the element buffer.
+         */
+        void upload(GLuint vbo, GLuint ibo, GLenum usage = GL_STATIC_DRAW) const;
+
+        /**
+         Enables and connects every attribute in the layout to the attribute of the same name
+         in `program`. The VBO must be bound to GL_ARRAY_BUFFER.
+
+         @throws std::exception if the program lacks one of the attributes.
+         */
+        void setVertexAttribPointers(const Program& program) const;
+
+        /**
+         Enables and connects only the attribute of the layout named `attribName`, e.g. to
+         make a position-only VAO for a depth pass. The VBO must be bound to GL_ARRAY_BUFFER.
+
+         @throws std::exception if the layout or the program lacks the attribute.
+         */
+        void setVertexAttribPointer(const Program& program, const GLchar* attribName) const;
+
+    private:
+        void* _mapping;
+        size_t _mappingSize;
+        void* _fileHandle;
+        void* _mappingHandle;
+        std::vector<MeshAttribute> _attributes;
+        std::vector<MeshLod> _lods;
+        glm::vec3 _boundsMin;
+        glm::vec3 _boundsMax;
+        GLsizei _vertexCount;
+        GLsizei _stride;
+        GLsizei _indexCount;
+        GLenum _indexType;
+        const unsigned char* _vertexData;
+        const unsigned char* _indexData;
+
+        void _unmap();
+
+        //copying disabled
+        MeshCache(const MeshCache&);
+        const MeshCache& operator=(const MeshCache&);
+    };
+
+}
@@ -0,0 +1,319 @@
+/*
+ tdogl::MeshSimplifier
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "MeshSimplifier.h"
+#include <stdexcept>
+#include <algorithm>
+#include <queue>
+#include <map>
+#include <cmath>
+
+using namespace tdogl;
+
+// borders are kept by planes through them, weighted this much more than face planes
+static const double BorderWeight = 100.0;
+
+// a collapse is refused if it turns a triangle's normal by more than about 80 degrees
+static const double MinNormalDot = 0.2;
+
+namespace {
+    // symmetric 4x4 matrix: the weighted sum of squared distances to a set of planes,
+    // and the sum of the weights
+    struct Quadric {
+        double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+        double weight;
+
+        Quadric() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0), weight(0) {}
+
+        // the plane ax + by + cz + d = 0, with (a, b, c) of unit length
+        Quadric(double a, double b, double c, double d, double weight) :
+            a2(weight * a * a), ab(weight * a * b), ac(weight * a * c), ad(weight * a * d),
+            b2(weight * b * b), bc(weight * b * c), bd(weight * b * d),
+            c2(weight * c * c), cd(weight * c * d), d2(weight * d * d),
+            weight(weight)
+        {}
+
+        void operator += (const Quadric& q) {
+            a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+            b2 += q.b2; bc += q.bc; bd += q.bd;
+            c2 += q.c2; cd += q.cd; d2 += q.d2;
+            weight += q.weight;
+        }
+
+        // the weighted mean of the squared distances, so its root is a distance
+        double meanError(const glm::vec3& p) const {
+            return (weight > 0.0 ? error(p) / weight : 0.0);
+        }
+
+        double error(const glm::vec3& p) const {
+            double x = p.x, y = p.y, z = p.z;
+            return a2*x*x + 2*ab*x*y + 2*ac*x*z + 2*ad*x
+                 + b2*y*y + 2*bc*y*z + 2*bd*y
+                 + c2*z*z + 2*cd*z
+                 + d2;
+        }
+    };
+
+    // collapsing `from` onto `to`. Stale once either vertex has changed since it was queued.
+    struct Collapse {
+        double cost;
+        unsigned from, to;
+        unsigned fromVersion, toVersion;
+
+        bool operator < (const Collapse& other) const {
+            return cost > other.cost; //std::priority_queue pops the largest
+        }
+    };
+
+    struct PositionLess {
+        bool operator () (const glm::vec3& a, const glm::vec3& b) const {
+            if(a.x != b.x) return a.x < b.x;
+            if(a.y != b.y) return a.y < b.y;
+            return a.z < b.z;
+        }
+    };
+}
+
+static glm::vec3 TriangleNormal(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    return glm::cross(b - a, c - a);
+}
+
+std::vector<GLuint> MeshSimplifier::simplify(const MeshData& mesh, size_t firstIndex, size_t indexCount,
+                                             size_t targetTriangleCount, float* error)
+{
+    if(firstIndex + indexCount > mesh.indices.size() || indexCount % 3 != 0)
+        throw std::runtime_error("Invalid index range to simplify");
+    if(error)
+        *error = 0.0f;
+
+    //weld the vertices that share a position, since UV and normal seams split them
+    const size_t floatsPerVertex = mesh.stride / sizeof(GLfloat);
+    std::map<glm::vec3, unsigned, PositionLess> welding;
+    std::vector<glm::vec3> positions;
+    std::vector<GLuint> representative; //a vertex of the mesh at each welded position
+    std::vector<unsigned> welded(mesh.vertexCount());
+    for(GLsizei v = 0; v < mesh.vertexCount(); ++v){
+        const GLfloat* p = &mesh.vertices[v * floatsPerVertex];
+        glm::vec3 position(p[0], p[1], p[2]);
+        std::map<glm::vec3, unsigned, PositionLess>::const_iterator found = welding.find(position);
+        if(found != welding.end()){
+            welded[v] = found->second;
+        } else {
+            welded[v] = (unsigned)positions.size();
+            welding[position] = welded[v];
+            positions.push_back(position);
+            representative.push_back((GLuint)v);
+        }
+    }
+
+    //triangles as mesh vertex indices, and in welded positions
+    const size_t triangleCount = indexCount / 3;
+    std::vector<GLuint> corners(mesh.indices.begin() + firstIndex, mesh.indices.begin() + firstIndex + indexCount);
+    std::vector<unsigned> triangles(indexCount);
+    std::vector<unsigned char> alive(triangleCount, 1);
+    std::vector<std::vector<unsigned> > trianglesAround(positions.size());
+    size_t aliveCount = 0;
+    for(size_t t = 0; t < triangleCount; ++t){
+        for(int c = 0; c < 3; ++c)
+            triangles[3 * t + c] = welded[corners[3 * t + c]];
+        unsigned a = triangles[3 * t], b = triangles[3 * t + 1], c = triangles[3 * t + 2];
+        if(a == b || b == c || a == c){
+            alive[t] = 0;
+            continue;
+        }
+        for(int k = 0; k < 3; ++k)
+            trianglesAround[triangles[3 * t + k]].push_back((unsigned)t);
+        ++aliveCount;
+    }
+
+    //each position starts with the planes of the triangles around it
+    std::vector<Quadric> quadrics(positions.size());
+    std::map<std::pair<unsigned, unsigned>, int> edgeUses;
+    for(size_t t = 0; t < triangleCount; ++t){
+        if(!alive[t])
+            continue;
+        const unsigned* tri = &triangles[3 * t];
+        glm::vec3 n = TriangleNormal(positions[tri[0]], positions[tri[1]], positions[tri[2]]);
+        double area = glm::length(n);
+        if(area <= 0.0)
+            continue;
+        n /= (float)area;
+        Quadric q(n.x, n.y, n.z, -glm::dot(n, positions[tri[0]]), area);
+        for(int k = 0; k < 3; ++k){
+            quadrics[tri[k]] += q;
+            unsigned a = tri[k], b = tri[(k + 1) % 3];
+            ++edgeUses[std::make_pair(std::min(a, b), std::max(a, b))];
+        }
+    }
+
+    //edges with only one triangle are borders. A plane through the edge, at right angles
+    //to the triangle, penalises moving the border.
+    for(size_t t = 0; t < triangleCount; ++t){
+        if(!alive[t])
+            continue;
+        const unsigned* tri = &triangles[3 * t];
+        glm::vec3 n = TriangleNormal(positions[tri[0]], positions[tri[1]], positions[tri[2]]);
+        for(int k = 0; k < 3; ++k){
+            unsigned a = tri[k], b = tri[(k + 1) % 3];
+            if(edgeUses[std::make_pair(std::min(a, b), std::max(a, b))] != 1)
+                continue;
+            glm::vec3 edge = positions[b] - positions[a];
+            glm::vec3 borderNormal = glm::cross(edge, n);
+            float length = glm::length(borderNormal);
+            if(length <= 0.0f)
+                continue;
+            borderNormal /= length;
+            Quadric q(borderNormal.x, borderNormal.y, borderNormal.z, -glm::dot(borderNormal, positions[a]),
+                      BorderWeight * glm::dot(edge, edge));
+            quadrics[a] += q;
+            quadrics[b] += q;
+        }
+    }
+
+    //queue both directions of every edge
+    std::vector<unsigned> versions(positions.size(), 0);
+    std::vector<unsigned char> removed(positions.size(), 0);
+    std::priority_queue<Collapse> queue;
+    for(std::map<std::pair<unsigned, unsigned>, int>::const_iterator it = edgeUses.begin(); it != edgeUses.end(); ++it){
+        unsigned a = it->first.first, b = it->first.second;
+        Quadric q = quadrics[a];
+        q += quadrics[b];
+        Collapse ab = { q.error(positions[b]), a, b, 0, 0 };
+        Collapse ba = { q.error(positions[a]), b, a, 0, 0 };
+        queue.push(ab);
+        queue.push(ba);
+    }
+
+    double maxError = 0.0;
+    std::vector<unsigned> neighbours;
+    while(aliveCount > targetTriangleCount && !queue.empty()){
+        Collapse collapse = queue.top();
+        queue.pop();
+        const unsigned from = collapse.from, to = collapse.to;
+        if(removed[from] || removed[to] || versions[from] != collapse.fromVersion || versions[to] != collapse.toVersion)
+            continue;
+
+        //moving `from` onto `to` must not flip or flatten the triangles that stay
+        bool valid = true;
+        const std::vector<unsigned>& around = trianglesAround[from];
+        for(size_t i = 0; i < around.size() && valid; ++i){
+            unsigned t = around[i];
+            if(!alive[t])
+                continue;
+            const unsigned* tri = &triangles[3 * t];
+            if(tri[0] == to || tri[1] == to || tri[2] == to)
+                continue; //this one collapses
+
+            glm::vec3 p[3], moved[3];
+            for(int k = 0; k < 3; ++k){
+                p[k] = positions[tri[k]];
+                moved[k] = (tri[k] == from ? positions[to] : p[k]);
+            }
+            glm::vec3 before = TriangleNormal(p[0], p[1], p[2]);
+            glm::vec3 after = TriangleNormal(moved[0], moved[1], moved[2]);
+            float lengths = glm::length(before) * glm::length(after);
+            valid = (lengths > 0.0f && glm::dot(before, after) > MinNormalDot * lengths);
+        }
+        if(!valid)
+            continue;
+
+        //collapse: the triangles on the edge go, the others move their corner to `to`
+        removed[from] = 1;
+        ++versions[to];
+        quadrics[to] += quadrics[from];
+        maxError = std::max(maxError, quadrics[to].meanError(positions[to]));
+        for(size_t i = 0; i < around.size(); ++i){
+            unsigned t = around[i];
+            if(!alive[t])
+                continue;
+            unsigned* tri = &triangles[3 * t];
+            if(tri[0] == to || tri[1] == to || tri[2] == to){
+                alive[t] = 0;
+                --aliveCount;
+                continue;
+            }
+            for(int k = 0; k < 3; ++k){
+                if(tri[k] == from){
+                    tri[k] = to;
+                    corners[3 * t + k] = representative[to];
+                }
+            }
+            trianglesAround[to].push_back(t);
+        }
+
+        //queue new collapses from and onto `to`
+        neighbours.clear();
+        const std::vector<unsigned>& aroundTo = trianglesAround[to];
+        for(size_t i = 0; i < aroundTo.size(); ++i){
+            unsigned t = aroundTo[i];
+            if(!alive[t])
+                continue;
+            for(int k = 0; k < 3; ++k){
+                if(triangles[3 * t + k] != to)
+                    neighbours.push_back(triangles[3 * t + k]);
+            }
+        }
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+        for(size_t i = 0; i < neighbours.size(); ++i){
+            unsigned n = neighbours[i];
+            Quadric q = quadrics[to];
+            q += quadrics[n];
+            Collapse onto = { q.error(positions[n]), to, n, versions[to], versions[n] };
+            Collapse into = { q.error(positions[to]), n, to, versions[n], versions[to] };
+            queue.push(onto);
+            queue.push(into);
+        }
+    }
+
+    std::vector<GLuint> result;
+    result.reserve(aliveCount * 3);
+    for(size_t t = 0; t < triangleCount; ++t){
+        if(alive[t])
+            result.insert(result.end(), corners.begin() + 3 * t, corners.begin() + 3 * t + 3);
+    }
+    if(error)
+        *error = (float)sqrt(std::max(0.0, maxError));
+    return result;
+}
+
+void MeshSimplifier::generateLods(MeshData& mesh, unsigned maxLods, float reduction) {
+    if(!mesh.lods.empty())
+        throw std::runtime_error("Mesh already has LODs");
+    maxLods = std::min(maxLods, MeshCache::MaxLods);
+
+    MeshLod lod0 = { 0, (GLsizei)mesh.indices.size(), 0.0f };
+    mesh.lods.push_back(lod0);
+
+    //simplify the full mesh every time, so errors don't build up from LOD to LOD
+    const size_t fullTriangles = mesh.indices.size() / 3;
+    size_t target = fullTriangles;
+    while(mesh.lods.size() < maxLods){
+        target = (size_t)(target * reduction);
+        if(target < 4)
+            break;
+
+        float error = 0.0f;
+        std::vector<GLuint> indices = simplify(mesh, 0, fullTriangles * 3, target, &error);
+        const MeshLod& previous = mesh.lods.back();
+        if(indices.empty() || indices.size() > (size_t)previous.indexCount * 9 / 10)
+            break; //nothing left that can be collapsed
+
+        MeshLod lod = { (GLuint)mesh.indices.size(), (GLsizei)indices.size(), error };
+        mesh.indices.insert(mesh.indices.end(), indices.begin(), indices.end());
+        mesh.lods.push_back(lod);
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ tdogl::MeshSimplifier
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "MeshCache.h"
+
+namespace tdogl {
+
+    /**
+     Reduces the triangle count of a tdogl::MeshData by edge collapses, to make
+     levels of detail.
+
+     Vertices that share a position are welded, and each edge is given the cost of
+     collapsing one end onto the other. The cost is measured with quadric error metrics
+     (Garland & Heckbert): the sum of squared distances to the planes of the triangles
+     around the original vertices, each weighted by its triangle's area. The cheapest edge
+     is collapsed first. Collapses that would flip a triangle are skipped. Open borders add
+     planes through their edges, weighted by a large constant times the squared edge
+     length, so that outlines are kept.
+
+     Only the indices change. A collapse moves a vertex onto an existing vertex, so every
+     level of detail can index the original vertex buffer. The moved corners take the
+     vertex kept for the welded position, so UV and normal seams through a collapsed area
+     are merged: it gets the attributes of one side of the seam.
+     */
+    class MeshSimplifier {
+    public:
+        /**
+         @param mesh                 The mesh to simplify. Only the triangles in
+                                     [firstIndex, firstIndex + indexCount) of `mesh.indices` are used.
+         @param firstIndex           First index of the triangles to simplify
+         @param indexCount           Number of indices, a multiple of 3
+         @param targetTriangleCount  Stop once this few triangles remain
+         @param error                If not NULL, receives the largest error of a collapse accepted,
+                                     in mesh units: the root of the weighted mean squared
+                                     distance from the kept vertex to the planes it stands for
+
+         @result The indices of the simplified triangles. A collapse removes the triangles on
+                 its edge together, usually two, so the result can be a triangle below the
+                 target. More are left when no more edges can be collapsed.
+         */
+        static std::vector<GLuint> simplify(const MeshData& mesh, size_t firstIndex, size_t indexCount,
+                                            size_t targetTriangleCount, float* error = NULL);
+
+        /**
+         Appends levels of detail to `mesh.indices` and describes all of them in `mesh.lods`.
+         LOD 0 is the original triangles. Each further LOD aims for `reduction` times the
+         triangles of the one before. Stops early if a LOD barely reduces the previous one.
+
+         @param mesh       The mesh. Must have no LODs yet.
+         @param maxLods    The most LODs in total, including LOD 0. At most MeshCache::MaxLods.
+         @param reduction  Fraction of the triangles kept from one LOD to the next
+         */
+        static void generateLods(MeshData& mesh, unsigned maxLods, float reduction = 0.5f);
+    };
+
+}
@@ -0,0 +1,253 @@
+/*
+ tdogl::MultiDrawBatch
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "MultiDrawBatch.h"
+#include "Program.h"
+#include <stdexcept>
+#include <cassert>
+#include <cstddef>
+#include <algorithm>
+#include <map>
+#include <cstring>
+
+using namespace tdogl;
+
+bool MultiDrawBatch::isSupported() {
+    return GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+}
+
+MultiDrawBatch::MultiDrawBatch(const std::vector<MeshAttribute>& layout, GLsizei stride) :
+    _layout(layout),
+    _stride(stride),
+    _vao(0),
+    _vbo(0),
+    _ibo(0),
+    _instanceBuffer(NULL),
+    _indirectBuffer(NULL),
+    _instanceBufferInVao(0),
+    _modelLocation(-1),
+    _materialLocation(-1)
+{
+    if(!isSupported())
+        throw std::runtime_error("MultiDrawBatch requires OpenGL 4.3 or ARB_multi_draw_indirect");
+}
+
+MultiDrawBatch::~MultiDrawBatch() {
+    if(_vao) glDeleteVertexArrays(1, &_vao);
+    GLuint buffers[2] = { _vbo, _ibo };
+    glDeleteBuffers(2, buffers);
+    delete _instanceBuffer;
+    delete _indirectBuffer;
+}
+
+unsigned MultiDrawBatch::addMesh(GLuint vbo, GLuint ibo, GLenum indexType, GLint first, GLsizei count) {
+    assert(_vao == 0 && "meshes must be added before build()");
+    Mesh mesh;
+    mesh.sourceVbo = vbo;
+    mesh.sourceIbo = ibo;
+    mesh.sourceIndexType = indexType;
+    mesh.sourceFirst = first;
+    mesh.count = count;
+    mesh.baseVertex = 0;
+    mesh.firstIndex = 0;
+    _meshes.push_back(mesh);
+    return (unsigned)(_meshes.size() - 1);
+}
+
+void MultiDrawBatch::build(const Program& program) {
+    //work out where each mesh goes in the shared buffers, and gather the indices
+    std::vector<GLuint> indices;
+    std::vector<VertexCopy> copies;
+    std::map<GLuint, GLint> copiedVbos; //source buffer of indexed meshes -> its base vertex
+    GLint totalVertices = 0;
+    for(size_t i = 0; i < _meshes.size(); ++i){
+        Mesh& mesh = _meshes[i];
+        mesh.firstIndex = (GLuint)indices.size();
+
+        if(mesh.sourceIbo == 0){
+            //only the drawn range of vertices is copied, so the indices start at 0
+            VertexCopy copy = { mesh.sourceVbo, (GLintptr)mesh.sourceFirst * _stride, (GLintptr)totalVertices * _stride, (GLsizeiptr)mesh.count * _stride };
+            copies.push_back(copy);
+            mesh.baseVertex = totalVertices;
+            for(GLsizei v = 0; v < mesh.count; ++v)
+                indices.push_back((GLuint)v);
+            totalVertices += mesh.count;
+        } else {
+            //indices refer to the whole source buffer, so all of it is copied, once for
+            //all the meshes drawn from it (e.g. the levels of detail of a baked mesh)
+            std::map<GLuint, GLint>::const_iterator copied = copiedVbos.find(mesh.sourceVbo);
+            if(copied != copiedVbos.end()){
+                mesh.baseVertex = copied->second;
+            } else {
+                GLint vboSize = 0;
+                glBindBuffer(GL_COPY_READ_BUFFER, mesh.sourceVbo);
+                glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &vboSize);
+                VertexCopy copy = { mesh.sourceVbo, 0, (GLintptr)totalVertices * _stride, (GLsizeiptr)vboSize };
+                copies.push_back(copy);
+                mesh.baseVertex = totalVertices;
+                copiedVbos[mesh.sourceVbo] = totalVertices;
+                totalVertices += vboSize / _stride;
+            }
+
+            if(mesh.count == 0)
+                continue;
+            glBindBuffer(GL_COPY_READ_BUFFER, mesh.sourceIbo);
+            if(mesh.sourceIndexType == GL_UNSIGNED_SHORT){
+                std::vector<GLushort> shorts(mesh.count);
+                glGetBufferSubData(GL_COPY_READ_BUFFER, mesh.sourceFirst * sizeof(GLushort), mesh.count * sizeof(GLushort), &shorts[0]);
+                indices.insert(indices.end(), shorts.begin(), shorts.end());
+            } else {
+                indices.resize(indices.size() + mesh.count);
+                glGetBufferSubData(GL_COPY_READ_BUFFER, mesh.sourceFirst * sizeof(GLuint), mesh.count * sizeof(GLuint), &indices[mesh.firstIndex]);
+            }
+        }
+    }
+
+    //copy the vertices GPU side
+    glGenBuffers(1, &_vbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _vbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)totalVertices * _stride, NULL, GL_STATIC_DRAW);
+    for(size_t i = 0; i < copies.size(); ++i){
+        if(copies[i].size == 0)
+            continue;
+        glBindBuffer(GL_COPY_READ_BUFFER, copies[i].sourceVbo);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, copies[i].readOffset, copies[i].writeOffset, copies[i].size);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glGenBuffers(1, &_ibo);
+    _instanceBuffer = new DynamicBuffer(GL_ARRAY_BUFFER, InitialInstanceCapacity * sizeof(Instance));
+    _indirectBuffer = new DynamicBuffer(GL_DRAW_INDIRECT_BUFFER, _meshes.size() * 4 * sizeof(DrawElementsIndirectCommand));
+    glGenVertexArrays(1, &_vao);
+    glBindVertexArray(_vao);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.empty() ? NULL : &indices[0], GL_STATIC_DRAW);
+
+    //per-vertex attributes
+    glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+    for(size_t i = 0; i < _layout.size(); ++i){
+        const MeshAttribute& a = _layout[i];
+        GLint location = program.attrib(a.name);
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, a.size, a.type, a.normalized, _stride, (const GLvoid*)(size_t)a.offset);
+    }
+
+    //per-instance attributes
+    _modelLocation = program.attrib("instanceModel");
+    _materialLocation = program.attrib("instanceMaterial");
+    _setInstanceAttribPointers();
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    _meshInstanceCounts.resize(_meshes.size());
+}
+
+void MultiDrawBatch::addInstance(unsigned mesh, const Instance& instance) {
+    assert(mesh < _meshes.size());
+    _pendingMeshes.push_back(mesh);
+    _pendingInstances.push_back(instance);
+}
+
+bool MultiDrawBatch::hasInstances() const {
+    return !_pendingInstances.empty();
+}
+
+unsigned MultiDrawBatch::flush() {
+    if(_pendingInstances.empty())
+        return 0;
+    assert(_vao != 0 && "build() must be called before drawing");
+
+    //counting sort by mesh, so each mesh is one command with a contiguous instance range
+    std::fill(_meshInstanceCounts.begin(), _meshInstanceCounts.end(), 0u);
+    for(size_t i = 0; i < _pendingMeshes.size(); ++i)
+        ++_meshInstanceCounts[_pendingMeshes[i]];
+
+    _commands.clear();
+    GLuint baseInstance = 0;
+    for(size_t m = 0; m < _meshes.size(); ++m){
+        GLuint instanceCount = _meshInstanceCounts[m];
+        _meshInstanceCounts[m] = baseInstance; //now the write cursor for this mesh
+        if(instanceCount == 0)
+            continue;
+        DrawElementsIndirectCommand cmd;
+        cmd.count = (GLuint)_meshes[m].count;
+        cmd.instanceCount = instanceCount;
+        cmd.firstIndex = _meshes[m].firstIndex;
+        cmd.baseVertex = _meshes[m].baseVertex;
+        cmd.baseInstance = baseInstance;
+        _commands.push_back(cmd);
+        baseInstance += instanceCount;
+    }
+
+    _sortedInstances.resize(_pendingInstances.size());
+    for(size_t i = 0; i < _pendingInstances.size(); ++i)
+        _sortedInstances[_meshInstanceCounts[_pendingMeshes[i]]++] = _pendingInstances[i];
+
+    //stream the instances into this frame's segment. Aligning to the instance size makes
+    //the offset a whole number of instances, which is added to every baseInstance.
+    GLintptr instanceOffset = 0;
+    GLsizeiptr instanceBytes = _sortedInstances.size() * sizeof(Instance);
+    void* instanceData = _instanceBuffer->beginWrite(instanceBytes, sizeof(Instance), instanceOffset);
+    memcpy(instanceData, &_sortedInstances[0], instanceBytes);
+    _instanceBuffer->endWrite();
+    GLuint firstInstance = (GLuint)(instanceOffset / sizeof(Instance));
+    for(size_t i = 0; i < _commands.size(); ++i)
+        _commands[i].baseInstance += firstInstance;
+
+    GLintptr commandOffset = 0;
+    GLsizeiptr commandBytes = _commands.size() * sizeof(DrawElementsIndirectCommand);
+    void* commandData = _indirectBuffer->beginWrite(commandBytes, sizeof(GLuint), commandOffset);
+    memcpy(commandData, &_commands[0], commandBytes);
+    _indirectBuffer->endWrite();
+
+    glBindVertexArray(_vao);
+    if(_instanceBuffer->object() != _instanceBufferInVao)
+        _setInstanceAttribPointers(); //the buffer grew
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirectBuffer->object());
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const GLvoid*)commandOffset, (GLsizei)_commands.size(), 0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    _pendingMeshes.clear();
+    _pendingInstances.clear();
+    return 1;
+}
+
+void MultiDrawBatch::endFrame() {
+    if(!_instanceBuffer)
+        return;
+    _instanceBuffer->endFrame();
+    _indirectBuffer->endFrame();
+}
+
+void MultiDrawBatch::_setInstanceAttribPointers() {
+    //a mat4 attribute takes four consecutive locations
+    glBindBuffer(GL_ARRAY_BUFFER, _instanceBuffer->object());
+    for(GLint column = 0; column < 4; ++column){
+        glEnableVertexAttribArray(_modelLocation + column);
+        glVertexAttribPointer(_modelLocation + column, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                              (const GLvoid*)(offsetof(Instance, model) + column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(_modelLocation + column, 1);
+    }
+    glEnableVertexAttribArray(_materialLocation);
+    glVertexAttribPointer(_materialLocation, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (const GLvoid*)offsetof(Instance, material));
+    glVertexAttribDivisor(_materialLocation, 1);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    _instanceBufferInVao = _instanceBuffer->object();
+}
@@ -0,0 +1,160 @@
+/*
+ tdogl::MultiDrawBatch
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "MeshCache.h"
+#include "DynamicBuffer.h"
+
+namespace tdogl {
+
+    class Program;
+
+    /**
+     Draws many instances of many different meshes with a single glMultiDrawElementsIndirect.
+
+     All meshes are merged into one shared vertex buffer and one shared index buffer. Each
+     frame the instances are added, grouped by mesh, and submitted from an indirect command
+     buffer built on the CPU. The per-instance model matrix and material are vertex
+     attributes with a divisor of 1, selected through each command's baseInstance.
+
+     The instances and commands are streamed through tdogl::DynamicBuffer rings, so call
+     `endFrame` once per frame after the last `flush`.
+
+     Requires OpenGL 4.3 (or ARB_multi_draw_indirect and ARB_base_instance). Check
+     `isSupported` and fall back to ordinary per-instance draws when it returns false.
+     */
+    class MultiDrawBatch {
+    public:
+        /**
+         The per-instance data, laid out as the "instanceModel" (mat4) and
+         "instanceMaterial" (vec4: specular rgb, shininess) vertex attributes.
+         */
+        struct Instance {
+            glm::mat4 model;
+            glm::vec4 material;
+        };
+
+        /** @result True if the current context can use this class */
+        static bool isSupported();
+
+        /**
+         @param layout  The vertex layout shared by all meshes that will be added
+         @param stride  Size in bytes of one vertex
+         */
+        MultiDrawBatch(const std::vector<MeshAttribute>& layout, GLsizei stride);
+        ~MultiDrawBatch();
+
+        /**
+         Queues a mesh to be merged into the shared buffers by `build`.
+
+         The vertices are copied from `vbo` on the GPU. Meshes drawn with glDrawArrays pass
+         `ibo` = 0 and get sequential indices. Indexed meshes copy the whole of `vbo`, but
+         only once for all the meshes that share it.
+
+         @param vbo         Buffer holding the vertices, in the layout given to the constructor
+         @param ibo         Element buffer, or 0 if the mesh is not indexed
+         @param indexType   GL_UNSIGNED_SHORT or GL_UNSIGNED_INT. Ignored if `ibo` is 0
+         @param first       First vertex (or first index if indexed) of the mesh
+         @param count       Number of vertices (or indices if indexed) to draw
+
+         @result The mesh id to pass to `addInstance`
+         */
+        unsigned addMesh(GLuint vbo, GLuint ibo, GLenum indexType, GLint first, GLsizei count);
+
+        /**
+         Creates the shared buffers and the VAO, copying in all the meshes added so far.
+
+         @param program  Program used to look up the attribute locations
+         */
+        void build(const Program& program);
+
+        /** Adds one instance of `mesh` to the next `flush` */
+        void addInstance(unsigned mesh, const Instance& instance);
+
+        /** @result True if there are instances waiting to be flushed */
+        bool hasInstances() const;
+
+        /**
+         Draws every instance added since the last flush with one indirect call.
+
+         The caller must have bound the program and textures.
+
+         @result The number of GL draw calls issued (0 or 1)
+         */
+        unsigned flush();
+
+        /** Fences this frame's instance and command data. Call once per frame. */
+        void endFrame();
+
+    private:
+        struct Mesh {
+            GLuint sourceVbo;
+            GLuint sourceIbo;
+            GLenum sourceIndexType;
+            GLint sourceFirst;
+            GLsizei count;
+            GLint baseVertex;
+            GLuint firstIndex;
+        };
+
+        //a range of a source buffer copied into _vbo by `build`
+        struct VertexCopy {
+            GLuint sourceVbo;
+            GLintptr readOffset;
+            GLintptr writeOffset;
+            GLsizeiptr size;
+        };
+
+        static const unsigned InitialInstanceCapacity = 16384; //per frame, grows if needed
+
+        struct DrawElementsIndirectCommand {
+            GLuint count;
+            GLuint instanceCount;
+            GLuint firstIndex;
+            GLint baseVertex;
+            GLuint baseInstance;
+        };
+
+        std::vector<MeshAttribute> _layout;
+        GLsizei _stride;
+        std::vector<Mesh> _meshes;
+        GLuint _vao;
+        GLuint _vbo;
+        GLuint _ibo;
+        DynamicBuffer* _instanceBuffer;
+        DynamicBuffer* _indirectBuffer;
+        GLuint _instanceBufferInVao; //the buffer object the instance attributes point into
+        GLint _modelLocation;
+        GLint _materialLocation;
+
+        std::vector<unsigned> _pendingMeshes;
+        std::vector<Instance> _pendingInstances;
+        std::vector<unsigned> _meshInstanceCounts;
+        std::vector<Instance> _sortedInstances;
+        std::vector<DrawElementsIndirectCommand> _commands;
+
+        void _setInstanceAttribPointers();
+
+        //copying disabled
+        MultiDrawBatch(const MultiDrawBatch&);
+        const MultiDrawBatch& operator=(const MultiDrawBatch&);
+    };
+
+}
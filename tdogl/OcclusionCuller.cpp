@@ -0,0 +1,300 @@
+/*
+ tdogl::OcclusionCuller
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "OcclusionCuller.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#if (GLM_ARCH & GLM_ARCH_SSE2)
+#include <emmintrin.h>
+#define TDOGL_OCCLUSION_SIMD 1
+#endif
+
+using namespace tdogl;
+
+OcclusionCuller::OcclusionCuller(unsigned width, unsigned height) :
+    _width(width),
+    _height(height),
+    _hierarchyBuilt(false),
+    _trianglesRasterized(0)
+{
+    if(width == 0 || height == 0 || width % 4 != 0)
+        throw std::runtime_error("OcclusionCuller width must be a multiple of 4");
+
+    //halve the size down to 1x1. Odd sizes round up, so every pixel has a parent texel.
+    size_t offset = 0;
+    unsigned w = width, h = height;
+    for(;;){
+        Level level = { w, h, offset };
+        _levels.push_back(level);
+        offset += (size_t)w * h;
+        if(w == 1 && h == 1)
+            break;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+    _depths.assign(offset, 1.0f);
+}
+
+#ifdef TDOGL_OCCLUSION_SIMD
+bool OcclusionCuller::simdEnabled() {
+    return true;
+}
+#else
+bool OcclusionCuller::simdEnabled() {
+    return false;
+}
+#endif
+
+unsigned OcclusionCuller::width() const {
+    return _width;
+}
+
+unsigned OcclusionCuller::height() const {
+    return _height;
+}
+
+unsigned OcclusionCuller::levelCount() const {
+    return (unsigned)_levels.size();
+}
+
+void OcclusionCuller::clear(const glm::mat4& viewProjection) {
+    _viewProjection = viewProjection;
+    std::fill(_depths.begin(), _depths.begin() + (size_t)_width * _height, 1.0f);
+    _hierarchyBuilt = false;
+    _trianglesRasterized = 0;
+}
+
+void OcclusionCuller::rasterize(const glm::mat4& model,
+                                const glm::vec3* vertices,
+                                size_t vertexCount,
+                                const unsigned* indices,
+                                size_t indexCount)
+{
+    const glm::mat4 modelViewProjection = _viewProjection * model;
+    if(_clipVertices.size() < vertexCount)
+        _clipVertices.resize(vertexCount);
+    for(size_t i = 0; i < vertexCount; ++i)
+        _clipVertices[i] = modelViewProjection * glm::vec4(vertices[i], 1.0f);
+
+    for(size_t i = 0; i + 2 < indexCount; i += 3){
+        if(indices[i] >= vertexCount || indices[i + 1] >= vertexCount || indices[i + 2] >= vertexCount)
+            throw std::runtime_error("Occluder index out of range");
+        _rasterizeClipTriangle(_clipVertices[indices[i]], _clipVertices[indices[i + 1]], _clipVertices[indices[i + 2]]);
+    }
+    _hierarchyBuilt = false;
+}
+
+// the point where the clip space edge a-b crosses the near plane z = -w
+static glm::vec4 NearPlaneIntersection(const glm::vec4& a, const glm::vec4& b) {
+    float da = a.z + a.w;
+    float db = b.z + b.w;
+    return a + (b - a) * (da / (da - db));
+}
+
+static glm::vec3 ClipToScreen(const glm::vec4& v, float width, float height) {
+    float invW = 1.0f / v.w;
+    return glm::vec3((v.x * invW * 0.5f + 0.5f) * width,
+                     (v.y * invW * 0.5f + 0.5f) * height,
+                     v.z * invW * 0.5f + 0.5f);
+}
+
+void OcclusionCuller::_rasterizeClipTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c) {
+    //trivially outside one of the frustum sides
+    if((a.x > a.w && b.x > b.w && c.x > c.w) || (a.x < -a.w && b.x < -b.w && c.x < -c.w) ||
+       (a.y > a.w && b.y > b.w && c.y > c.w) || (a.y < -a.w && b.y < -b.w && c.y < -c.w) ||
+       (a.z < -a.w && b.z < -b.w && c.z < -c.w))
+        return;
+
+    //clip against the near plane, giving a polygon of up to 4 vertices (Sutherland-Hodgman)
+    const glm::vec4* in[3] = { &a, &b, &c };
+    glm::vec4 polygon[4];
+    int count = 0;
+    for(int i = 0; i < 3; ++i){
+        const glm::vec4& p = *in[i];
+        const glm::vec4& q = *in[(i + 1) % 3];
+        bool pInside = (p.z >= -p.w);
+        bool qInside = (q.z >= -q.w);
+        if(pInside)
+            polygon[count++] = p;
+        if(pInside != qInside)
+            polygon[count++] = NearPlaneIntersection(p, q);
+    }
+
+    const float w = (float)_width, h = (float)_height;
+    for(int i = 1; i + 1 < count; ++i){
+        _rasterizeScreenTriangle(ClipToScreen(polygon[0], w, h),
+                                 ClipToScreen(polygon[i], w, h),
+                                 ClipToScreen(polygon[i + 1], w, h));
+    }
+}
+
+void OcclusionCuller::_rasterizeScreenTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    //counter-clockwise triangles have a positive area, the rest are back faces
+    float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    if(!(area > 0.0f))
+        return;
+
+    //pixels whose centers are inside the screen and the triangle's bounding box
+    int minX = std::max(0, (int)floor(std::min(a.x, std::min(b.x, c.x)) - 0.5f) + 1);
+    int maxX = std::min((int)_width - 1, (int)ceil(std::max(a.x, std::max(b.x, c.x)) - 0.5f) - 1);
+    int minY = std::max(0, (int)floor(std::min(a.y, std::min(b.y, c.y)) - 0.5f) + 1);
+    int maxY = std::min((int)_height - 1, (int)ceil(std::max(a.y, std::max(b.y, c.y)) - 0.5f) - 1);
+    if(minX > maxX || minY > maxY)
+        return;
+    ++_trianglesRasterized;
+
+    //edge functions e(x, y) = ex * x + ey * y + e0, positive inside. Edge i is opposite vertex i.
+    const glm::vec3* v[3] = { &a, &b, &c };
+    float ex[3], ey[3], e0[3];
+    for(int i = 0; i < 3; ++i){
+        const glm::vec3& p = *v[(i + 1) % 3];
+        const glm::vec3& q = *v[(i + 2) % 3];
+        ex[i] = p.y - q.y;
+        ey[i] = q.x - p.x;
+        e0[i] = -(ex[i] * p.x + ey[i] * p.y);
+    }
+
+    //depth is linear in screen space: z = zx * x + zy * y + z0
+    const float invArea = 1.0f / area;
+    const float zx = (ex[0] * a.z + ex[1] * b.z + ex[2] * c.z) * invArea;
+    const float zy = (ey[0] * a.z + ey[1] * b.z + ey[2] * c.z) * invArea;
+    const float z0 = (e0[0] * a.z + e0[1] * b.z + e0[2] * c.z) * invArea;
+
+#ifdef TDOGL_OCCLUSION_SIMD
+    //four pixels per step, starting on a multiple of 4 so the loads are within the row
+    const int startX = minX & ~3;
+    const __m128 laneX = _mm_setr_ps(startX + 0.5f, startX + 1.5f, startX + 2.5f, startX + 3.5f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 stepE[3];
+    for(int i = 0; i < 3; ++i)
+        stepE[i] = _mm_set1_ps(4.0f * ex[i]);
+    const __m128 stepZ = _mm_set1_ps(4.0f * zx);
+
+    for(int y = minY; y <= maxY; ++y){
+        const float py = y + 0.5f;
+        __m128 e[3];
+        for(int i = 0; i < 3; ++i)
+            e[i] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ex[i]), laneX), _mm_set1_ps(ey[i] * py + e0[i]));
+        __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zx), laneX), _mm_set1_ps(zy * py + z0));
+
+        float* row = &_depths[(size_t)y * _width];
+        for(int x = startX; x <= maxX; x += 4){
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e[0], zero), _mm_cmpge_ps(e[1], zero)), _mm_cmpge_ps(e[2], zero));
+            if(_mm_movemask_ps(inside) != 0){
+                __m128 depth = _mm_loadu_ps(row + x);
+                __m128 nearer = _mm_min_ps(depth, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, depth)));
+            }
+            for(int i = 0; i < 3; ++i)
+                e[i] = _mm_add_ps(e[i], stepE[i]);
+            z = _mm_add_ps(z, stepZ);
+        }
+    }
+#else
+    for(int y = minY; y <= maxY; ++y){
+        const float py = y + 0.5f;
+        float* row = &_depths[(size_t)y * _width];
+        for(int x = minX; x <= maxX; ++x){
+            const float px = x + 0.5f;
+            if(ex[0] * px + ey[0] * py + e0[0] < 0.0f ||
+               ex[1] * px + ey[1] * py + e0[1] < 0.0f ||
+               ex[2] * px + ey[2] * py + e0[2] < 0.0f)
+                continue;
+            float z = zx * px + zy * py + z0;
+            if(z < row[x])
+                row[x] = z;
+        }
+    }
+#endif
+}
+
+void OcclusionCuller::buildHierarchy() {
+    for(size_t l = 1; l < _levels.size(); ++l){
+        const Level& below = _levels[l - 1];
+        const Level& level = _levels[l];
+        const float* src = &_depths[below.offset];
+        float* dst = &_depths[level.offset];
+        for(unsigned y = 0; y < level.height; ++y){
+            //an odd last row or column has no neighbour, so it is paired with itself
+            const float* row0 = src + (size_t)(2 * y) * below.width;
+            const float* row1 = src + (size_t)std::min(2 * y + 1, below.height - 1) * below.width;
+            for(unsigned x = 0; x < level.width; ++x){
+                unsigned x0 = 2 * x;
+                unsigned x1 = std::min(x0 + 1, below.width - 1);
+                dst[(size_t)y * level.width + x] = std::max(std::max(row0[x0], row0[x1]), std::max(row1[x0], row1[x1]));
+            }
+        }
+    }
+    _hierarchyBuilt = true;
+}
+
+bool OcclusionCuller::isBoxOccluded(const glm::vec3& worldMin, const glm::vec3& worldMax) const {
+    if(!_hierarchyBuilt)
+        return false;
+
+    //screen rectangle and nearest depth of the 8 corners
+    float minX = 1e30f, maxX = -1e30f, minY = 1e30f, maxY = -1e30f, minZ = 1e30f;
+    for(int i = 0; i < 8; ++i){
+        glm::vec4 corner((i & 1) ? worldMax.x : worldMin.x,
+                         (i & 2) ? worldMax.y : worldMin.y,
+                         (i & 4) ? worldMax.z : worldMin.z,
+                         1.0f);
+        glm::vec4 clip = _viewProjection * corner;
+        if(clip.z < -clip.w || clip.w <= 0.0f)
+            return false; //crosses the near plane
+        glm::vec3 screen = ClipToScreen(clip, (float)_width, (float)_height);
+        minX = std::min(minX, screen.x);
+        maxX = std::max(maxX, screen.x);
+        minY = std::min(minY, screen.y);
+        maxY = std::max(maxY, screen.y);
+        minZ = std::min(minZ, screen.z);
+    }
+
+    //every pixel the rectangle touches, not only those whose centers it covers
+    int x0 = std::max(0, (int)floor(minX));
+    int x1 = std::min((int)_width - 1, (int)floor(maxX));
+    int y0 = std::max(0, (int)floor(minY));
+    int y1 = std::min((int)_height - 1, (int)floor(maxY));
+    if(x0 > x1 || y0 > y1)
+        return false;
+
+    //the finest level where the rectangle covers at most 2x2 texels
+    unsigned l = 0;
+    while(l + 1 < _levels.size() && ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1))
+        ++l;
+
+    const Level& level = _levels[l];
+    const float* depths = &_depths[level.offset];
+    for(int y = y0 >> l; y <= (y1 >> l); ++y){
+        for(int x = x0 >> l; x <= (x1 >> l); ++x){
+            if(depths[(size_t)y * level.width + x] >= minZ)
+                return false;
+        }
+    }
+    return true;
+}
+
+float OcclusionCuller::depth(unsigned level, unsigned x, unsigned y) const {
+    if(level >= _levels.size() || x >= _levels[level].width || y >= _levels[level].height)
+        throw std::runtime_error("Occlusion depth texel out of range");
+    return _depths[_levels[level].offset + (size_t)y * _levels[level].width + x];
+}
+
+unsigned OcclusionCuller::trianglesRasterized() const {
+    return _trianglesRasterized;
+}
@@ -0,0 +1,128 @@
+/*
+ tdogl::OcclusionCuller
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <vector>
+
+namespace tdogl {
+
+    /**
+     Software occlusion culling on the CPU, without OpenGL.
+
+     A few large occluders are rasterized into a small depth buffer, four pixels at a time
+     with SSE2 (or one at a time if the compiler doesn't target SSE2). The depth buffer is
+     then reduced into a hierarchical Z pyramid, where each texel holds the furthest depth
+     of the four below it. A box is occluded if it is behind every texel of the pyramid
+     that its screen rectangle covers. The pyramid level is picked so that only a 2x2 block
+     of texels has to be read.
+
+     Depths go from 0 at the near plane to 1 at the far plane, and the buffer is cleared to 1.
+     Use it once per frame:
+
+         culler.clear(camera.matrix());
+         culler.rasterize(model, vertices, vertexCount, indices, indexCount); //for each occluder
+         culler.buildHierarchy();
+         bool hidden = culler.isBoxOccluded(worldMin, worldMax);
+
+     `isBoxOccluded` doesn't change the culler, so it can be called from many threads.
+     */
+    class OcclusionCuller {
+    public:
+        /**
+         @param width   Width of the depth buffer in pixels, a multiple of 4
+         @param height  Height of the depth buffer in pixels
+
+         @throws std::exception if the size is invalid.
+         */
+        OcclusionCuller(unsigned width, unsigned height);
+
+        /** @result True if the SSE2 rasterizer is compiled in */
+        static bool simdEnabled();
+
+        unsigned width() const;
+        unsigned height() const;
+
+        /** Number of levels in the pyramid, including the depth buffer itself */
+        unsigned levelCount() const;
+
+        /**
+         Clears the depth buffer for a new frame, seen through `viewProjection`, e.g.
+         tdogl::Camera::matrix(). Boxes are not occluded until `buildHierarchy` is called.
+         */
+        void clear(const glm::mat4& viewProjection);
+
+        /**
+         Rasterizes the triangles of an occluder into the depth buffer. Triangles are
+         front-facing if they are counter-clockwise, and back faces are skipped, so the
+         mesh must be closed and every point inside it must be hidden from the camera.
+
+         @param model        Object to world transform of the occluder
+         @param vertices     Object space positions
+         @param vertexCount  Number of `vertices`
+         @param indices      Three indices into `vertices` per triangle
+         @param indexCount   Number of `indices`
+         */
+        void rasterize(const glm::mat4& model,
+                       const glm::vec3* vertices,
+                       size_t vertexCount,
+                       const unsigned* indices,
+                       size_t indexCount);
+
+        /**
+         Builds the pyramid from the depth buffer. Call after the last `rasterize` of a frame.
+         */
+        void buildHierarchy();
+
+        /**
+         @result True if the world space box is certainly hidden behind the occluders. False
+                 if it may be visible, crosses the near plane, or is outside the screen.
+         */
+        bool isBoxOccluded(const glm::vec3& worldMin, const glm::vec3& worldMax) const;
+
+        /** @result The depth of a texel of the pyramid. Level 0 is the depth buffer. */
+        float depth(unsigned level, unsigned x, unsigned y) const;
+
+        /** @result Triangles drawn into the depth buffer since `clear` */
+        unsigned trianglesRasterized() const;
+
+    private:
+        struct Level {
+            unsigned width;
+            unsigned height;
+            size_t offset; //into _depths
+        };
+
+        unsigned _width;
+        unsigned _height;
+        std::vector<Level> _levels;
+        std::vector<float> _depths; //all the levels, level 0 first
+        std::vector<glm::vec4> _clipVertices; //scratch for `rasterize`
+        glm::mat4 _viewProjection;
+        bool _hierarchyBuilt;
+        unsigned _trianglesRasterized;
+
+        void _rasterizeClipTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+        void _rasterizeScreenTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+
+        //copying disabled
+        OcclusionCuller(const OcclusionCuller&);
+        const OcclusionCuller& operator=(const OcclusionCuller&);
+    };
+
+}
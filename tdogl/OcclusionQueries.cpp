@@ -0,0 +1,151 @@
+/*
+ tdogl::OcclusionQueries
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "OcclusionQueries.h"
+#include "Program.h"
+#include <stdexcept>
+#include <glm/gtc/type_ptr.hpp>
+
+using namespace tdogl;
+
+OcclusionQueries::OcclusionQueries(const Program& proxyProgram, unsigned capacity) :
+    _program(proxyProgram),
+    _cameraLocation(proxyProgram.uniform("camera")),
+    _modelLocation(proxyProgram.uniform("model")),
+    _target(GLEW_VERSION_3_3 || GLEW_ARB_occlusion_query2 ? GL_ANY_SAMPLES_PASSED : GL_SAMPLES_PASSED),
+    _vao(0),
+    _vbo(0),
+    _ibo(0),
+    _queries(capacity, 0),
+    _issued(0),
+    _visible(0),
+    _occluded(0),
+    _pending(0)
+{
+    if(capacity == 0)
+        throw std::runtime_error("OcclusionQueries needs at least one slot");
+    glGenQueries((GLsizei)capacity, &_queries[0]);
+
+    //the unit cube, scaled and moved onto each box by the "model" matrix
+    const GLfloat corners[8 * 3] = {
+        0, 0, 0,  1, 0, 0,  0, 1, 0,  1, 1, 0,
+        0, 0, 1,  1, 0, 1,  0, 1, 1,  1, 1, 1
+    };
+    const GLubyte indices[36] = {
+        0, 2, 1, 1, 2, 3,
+        4, 5, 6, 5, 7, 6,
+        0, 1, 4, 1, 5, 4,
+        2, 6, 3, 3, 6, 7,
+        0, 4, 2, 2, 4, 6,
+        1, 3, 5, 3, 7, 5
+    };
+    glGenVertexArrays(1, &_vao);
+    glGenBuffers(1, &_vbo);
+    glGenBuffers(1, &_ibo);
+    glBindVertexArray(_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(proxyProgram.attrib("vert"));
+    glVertexAttribPointer(proxyProgram.attrib("vert"), 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), NULL);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+OcclusionQueries::~OcclusionQueries() {
+    glDeleteQueries((GLsizei)_queries.size(), &_queries[0]);
+    glDeleteVertexArrays(1, &_vao);
+    GLuint buffers[2] = { _vbo, _ibo };
+    glDeleteBuffers(2, buffers);
+}
+
+GLenum OcclusionQueries::target() const {
+    return _target;
+}
+
+unsigned OcclusionQueries::capacity() const {
+    return (unsigned)_queries.size();
+}
+
+GLuint OcclusionQueries::query(unsigned slot) const {
+    if(slot >= _queries.size())
+        throw std::runtime_error("Occlusion query slot out of range");
+    return _queries[slot];
+}
+
+void OcclusionQueries::collectResults() {
+    _visible = 0;
+    _occluded = 0;
+    _pending = 0;
+    for(unsigned i = 0; i < _issued; ++i){
+        GLuint available = 0;
+        glGetQueryObjectuiv(_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available){
+            ++_pending;
+            continue;
+        }
+        GLuint samples = 0;
+        glGetQueryObjectuiv(_queries[i], GL_QUERY_RESULT, &samples);
+        if(samples)
+            ++_visible;
+        else
+            ++_occluded;
+    }
+}
+
+void OcclusionQueries::drawProxies(const glm::mat4& viewProjection, const glm::vec3* boxMin, const glm::vec3* boxMax, unsigned count) {
+    if(count > _queries.size())
+        throw std::runtime_error("More occlusion query boxes than slots");
+
+    _program.use();
+    glUniformMatrix4fv(_cameraLocation, 1, GL_FALSE, glm::value_ptr(viewProjection));
+    glBindVertexArray(_vao);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+
+    for(unsigned i = 0; i < count; ++i){
+        //scale then move the unit cube onto the box
+        glm::mat4 model(1.0f);
+        model[0][0] = boxMax[i].x - boxMin[i].x;
+        model[1][1] = boxMax[i].y - boxMin[i].y;
+        model[2][2] = boxMax[i].z - boxMin[i].z;
+        model[3] = glm::vec4(boxMin[i], 1.0f);
+        glUniformMatrix4fv(_modelLocation, 1, GL_FALSE, glm::value_ptr(model));
+
+        glBeginQuery(_target, _queries[i]);
+        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, NULL);
+        glEndQuery(_target);
+    }
+    _issued = count;
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+    glBindVertexArray(0);
+    _program.stopUsing();
+}
+
+unsigned OcclusionQueries::visibleCount() const {
+    return _visible;
+}
+
+unsigned OcclusionQueries::occludedCount() const {
+    return _occluded;
+}
+
+unsigned OcclusionQueries::pendingCount() const {
+    return _pending;
+}
@@ -0,0 +1,104 @@
+/*
+ tdogl::OcclusionQueries
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace tdogl {
+
+    class Program;
+
+    /**
+     GPU occlusion queries on bounding box proxies.
+
+     Each frame, `drawProxies` draws a box per slot with colour and depth writes off, inside
+     an occlusion query. The boxes are tested against the depth of everything drawn before
+     them. Draws of the real geometry can then be wrapped in glBeginConditionalRender with
+     the slot's query (see `query`), so the GPU skips them when no sample of the box passed,
+     without the CPU waiting for the result.
+
+     The results are also read back, one frame late and without stalling, by
+     `collectResults`, to count how many of the boxes were hidden.
+
+     Uses GL_ANY_SAMPLES_PASSED on OpenGL 3.3 (or ARB_occlusion_query2), and GL_SAMPLES_PASSED
+     otherwise. Every slot keeps the same query object, so recorded draws that refer to it
+     stay valid from frame to frame.
+     */
+    class OcclusionQueries {
+    public:
+        /**
+         @param proxyProgram  Draws the boxes. Needs a "vert" attribute (vec3) and "camera"
+                              and "model" uniforms (mat4).
+         @param capacity      Number of slots, i.e. the most boxes per frame
+         */
+        OcclusionQueries(const Program& proxyProgram, unsigned capacity);
+        ~OcclusionQueries();
+
+        /** GL_ANY_SAMPLES_PASSED or GL_SAMPLES_PASSED */
+        GLenum target() const;
+
+        unsigned capacity() const;
+
+        /** @result The query object of a slot, for glBeginConditionalRender */
+        GLuint query(unsigned slot) const;
+
+        /**
+         Reads the results of the queries issued by the last `drawProxies`, if the GPU has
+         finished them. Never waits. Call before `drawProxies` reissues the queries.
+         */
+        void collectResults();
+
+        /**
+         Draws the world space boxes, box `i` into the query of slot `i`. Leaves no program
+         or VAO bound, and colour and depth writes on.
+
+         @param viewProjection  e.g. tdogl::Camera::matrix()
+         @param count           At most `capacity`
+         */
+        void drawProxies(const glm::mat4& viewProjection, const glm::vec3* boxMin, const glm::vec3* boxMax, unsigned count);
+
+        /** @result Boxes that were found visible, of those collected by `collectResults` */
+        unsigned visibleCount() const;
+
+        /** @result Boxes that were found hidden, of those collected by `collectResults` */
+        unsigned occludedCount() const;
+
+        /** @result Queries that weren't finished when `collectResults` was called */
+        unsigned pendingCount() const;
+
+    private:
+        const Program& _program;
+        GLint _cameraLocation;
+        GLint _modelLocation;
+        GLenum _target;
+        GLuint _vao;
+        GLuint _vbo;
+        GLuint _ibo;
+        std::vector<GLuint> _queries;
+        unsigned _issued; //slots used by the last drawProxies
+        unsigned _visible;
+        unsigned _occluded;
+        unsigned _pending;
+
+        //copying disabled
+        OcclusionQueries(const OcclusionQueries&);
+        const OcclusionQueries& operator=(const OcclusionQueries&);
+    };
+
+}
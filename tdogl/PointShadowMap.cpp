@@ -0,0 +1,188 @@
+/*
+ tdogl::PointShadowMap
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "PointShadowMap.h"
+#include <stdexcept>
+#include <sstream>
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace tdogl;
+
+//the look direction and up vector of each face, in the orientation the cube map expects
+static const glm::vec3 FaceDirections[6] = {
+    glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0),
+    glm::vec3(0, 1, 0), glm::vec3(0, -1, 0),
+    glm::vec3(0, 0, 1), glm::vec3(0, 0, -1)
+};
+static const glm::vec3 FaceUps[6] = {
+    glm::vec3(0, -1, 0), glm::vec3(0, -1, 0),
+    glm::vec3(0, 0, 1), glm::vec3(0, 0, -1),
+    glm::vec3(0, -1, 0), glm::vec3(0, -1, 0)
+};
+
+static GLuint CreateCubeMap(GLsizei size) {
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+    //linear filtering of a compared texture averages four comparisons on most hardware
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    for(unsigned face = 0; face < 6; ++face)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    return texture;
+}
+
+//a framebuffer with only a depth attachment, the first face of `cubeMap`
+static GLuint CreateFramebuffer(GLuint cubeMap, GLenum& status) {
+    GLuint framebuffer = 0;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X, cubeMap, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return framebuffer;
+}
+
+PointShadowMap::PointShadowMap(GLsizei size, float nearPlane) :
+    _size(size),
+    _nearPlane(nearPlane),
+    _farPlane(nearPlane),
+    _position(0.0f),
+    _staticValid(false),
+    _hasDynamic(false),
+    _staticRedraws(0),
+    _staticTexture(0),
+    _texture(0),
+    _staticFramebuffer(0),
+    _framebuffer(0)
+{
+    if(size <= 0 || nearPlane <= 0.0f)
+        throw std::runtime_error("Invalid point shadow map size or near plane");
+
+    _staticTexture = CreateCubeMap(size);
+    _texture = CreateCubeMap(size);
+    GLenum staticStatus = 0, status = 0;
+    _staticFramebuffer = CreateFramebuffer(_staticTexture, staticStatus);
+    _framebuffer = CreateFramebuffer(_texture, status);
+    if(staticStatus != GL_FRAMEBUFFER_COMPLETE || status != GL_FRAMEBUFFER_COMPLETE){
+        GLuint framebuffers[2] = { _staticFramebuffer, _framebuffer };
+        glDeleteFramebuffers(2, framebuffers);
+        GLuint textures[2] = { _staticTexture, _texture };
+        glDeleteTextures(2, textures);
+        std::ostringstream msg;
+        msg << "Point shadow map framebuffer incomplete, status 0x" << std::hex << (status != GL_FRAMEBUFFER_COMPLETE ? status : staticStatus);
+        throw std::runtime_error(msg.str());
+    }
+}
+
+PointShadowMap::~PointShadowMap() {
+    GLuint framebuffers[2] = { _staticFramebuffer, _framebuffer };
+    glDeleteFramebuffers(2, framebuffers);
+    GLuint textures[2] = { _staticTexture, _texture };
+    glDeleteTextures(2, textures);
+}
+
+GLuint PointShadowMap::texture() const {
+    return _hasDynamic ? _texture : _staticTexture;
+}
+
+GLsizei PointShadowMap::size() const {
+    return _size;
+}
+
+float PointShadowMap::nearPlane() const {
+    return _nearPlane;
+}
+
+float PointShadowMap::farPlane() const {
+    return _farPlane;
+}
+
+unsigned PointShadowMap::staticRedraws() const {
+    return _staticRedraws;
+}
+
+glm::mat4 PointShadowMap::faceMatrix(unsigned face) const {
+    if(face >= 6)
+        throw std::runtime_error("Cube map face out of range");
+    glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, _nearPlane, _farPlane);
+    return projection * glm::lookAt(_position, _position + FaceDirections[face], FaceUps[face]);
+}
+
+void PointShadowMap::invalidate() {
+    _staticValid = false;
+}
+
+void PointShadowMap::drawFace(GLuint framebuffer, GLuint cubeMap, unsigned face, bool clear, const DrawCasters& draw) const {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, cubeMap, 0);
+    if(clear)
+        glClear(GL_DEPTH_BUFFER_BIT);
+    draw(faceMatrix(face));
+}
+
+void PointShadowMap::update(const glm::vec3& position, float radius,
+                            const DrawCasters& drawStatic, const DrawCasters& drawDynamic)
+{
+    //the caller's framebuffer and viewport are put back at the end
+    GLint previousFramebuffer = 0;
+    GLint viewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    glViewport(0, 0, _size, _size);
+    glDepthMask(GL_TRUE);
+    //slope scaled, so surfaces at a grazing angle to the light don't shadow themselves
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+
+    //the static casters, only when the light has moved
+    const float farPlane = std::max(radius, 2.0f * _nearPlane);
+    if(!_staticValid || position != _position || farPlane != _farPlane){
+        _position = position;
+        _farPlane = farPlane;
+        for(unsigned face = 0; face < 6; ++face)
+            drawFace(_staticFramebuffer, _staticTexture, face, true, drawStatic);
+        _staticValid = true;
+        ++_staticRedraws;
+    }
+
+    //the dynamic casters, on top of a copy of the cached faces
+    _hasDynamic = (drawDynamic != nullptr);
+    if(_hasDynamic){
+        for(unsigned face = 0; face < 6; ++face){
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, _staticFramebuffer);
+            glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, _staticTexture, 0);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _framebuffer);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, _texture, 0);
+            glBlitFramebuffer(0, 0, _size, _size, 0, 0, _size, _size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            drawFace(_framebuffer, _texture, face, false, drawDynamic);
+        }
+    }
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)previousFramebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
@@ -0,0 +1,116 @@
+/*
+ tdogl::PointShadowMap
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <functional>
+
+namespace tdogl {
+
+    /**
+     The shadows of a point light: a depth cube map, seen from the light in all six
+     directions.
+
+     The shadows of the static casters are kept in a second cube map, and only drawn again
+     when the light moves, its radius changes, or `invalidate` is called. Otherwise the
+     cached faces are copied into the cube map that is sampled, and only the dynamic
+     casters are drawn on top of them.
+
+     Each face is a 90 degree perspective view with the usual window space depth, so a
+     shader finds the depth to compare with from the vector `v` from the light:
+
+         major = max(abs(v.x), max(abs(v.y), abs(v.z)))
+         depth = ((f + n) / (f - n) - 2fn / ((f - n) * major)) * 0.5 + 0.5
+
+     where n is `nearPlane` and f is `farPlane`. The cube map has GL_TEXTURE_COMPARE_MODE
+     set, so it is sampled with a samplerCubeShadow.
+     */
+    class PointShadowMap {
+    public:
+        /**
+         Draws the shadow casters with the given view-projection matrix, into the bound
+         framebuffer. Only the depth is kept.
+         */
+        typedef std::function<void(const glm::mat4& viewProjection)> DrawCasters;
+
+        /**
+         @param size       Width and height of each face, in pixels
+         @param nearPlane  Casters closer to the light than this cast no shadow
+
+         @throws std::exception if the framebuffers are incomplete.
+         */
+        PointShadowMap(GLsizei size, float nearPlane);
+        ~PointShadowMap();
+
+        /** @result The cube map to sample, with the static and the dynamic casters */
+        GLuint texture() const;
+
+        GLsizei size() const;
+        float nearPlane() const;
+
+        /** @result The radius given to the last `update` */
+        float farPlane() const;
+
+        /** @result How many times the static casters have been drawn */
+        unsigned staticRedraws() const;
+
+        /**
+         @result The view-projection matrix of `face`, from 0 to 5 in the order of
+                 GL_TEXTURE_CUBE_MAP_POSITIVE_X onwards, as of the last `update`
+         */
+        glm::mat4 faceMatrix(unsigned face) const;
+
+        /**
+         Makes the next `update` draw the static casters again, e.g. because they moved or
+         the scene was replaced
+         */
+        void invalidate();
+
+        /**
+         Draws the shadows of a light at `position` that reaches `radius`. Restores the
+         framebuffer binding and the viewport.
+
+         @param drawStatic   Draws the casters that never move. Only called when the cache
+                             is out of date.
+         @param drawDynamic  Draws the other casters. May be empty, then the cached cube
+                             map is sampled directly.
+         */
+        void update(const glm::vec3& position, float radius,
+                    const DrawCasters& drawStatic, const DrawCasters& drawDynamic);
+
+    private:
+        GLsizei _size;
+        float _nearPlane;
+        float _farPlane;
+        glm::vec3 _position;
+        bool _staticValid;
+        bool _hasDynamic;
+        unsigned _staticRedraws;
+        GLuint _staticTexture;
+        GLuint _texture;
+        GLuint _staticFramebuffer;
+        GLuint _framebuffer;
+
+        void drawFace(GLuint framebuffer, GLuint cubeMap, unsigned face, bool clear, const DrawCasters& draw) const;
+
+        //copying disabled
+        PointShadowMap(const PointShadowMap&);
+        const PointShadowMap& operator=(const PointShadowMap&);
+    };
+
+}
@@ -0,0 +1,266 @@
+/*
+ tdogl::Profiler
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "Profiler.h"
+#include <stdexcept>
+#include <fstream>
+#include <cassert>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <chrono>
+#endif
+
+using namespace tdogl;
+
+double Profiler::nowMicroseconds() {
+#ifdef _WIN32
+    //std::chrono::high_resolution_clock is only millisecond accurate in VS2013
+    static LARGE_INTEGER frequency = { 0 };
+    if(frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart * 1000000.0 / (double)frequency.QuadPart;
+#else
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+Profiler::Profiler(unsigned maxTraceFrames) :
+    _gpuTiming(GLEW_VERSION_3_3 || GLEW_ARB_timer_query),
+    _gpuToCpuOffset(0.0),
+    _frameIndex(0),
+    _traceStart(0),
+    _maxTraceFrames(maxTraceFrames)
+{
+    for(unsigned i = 0; i < FrameLatency; ++i){
+        _frames[i].queriesUsed = 0;
+        _frames[i].pending = false;
+    }
+    _trace.reserve(maxTraceFrames);
+
+    //line the GPU clock up with the CPU clock so both can share a trace timeline
+    if(_gpuTiming){
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        _gpuToCpuOffset = nowMicroseconds() - (double)gpuNow / 1000.0;
+    }
+}
+
+Profiler::~Profiler() {
+    for(unsigned i = 0; i < FrameLatency; ++i){
+        if(!_frames[i].queries.empty())
+            glDeleteQueries((GLsizei)_frames[i].queries.size(), &_frames[i].queries[0]);
+    }
+}
+
+bool Profiler::gpuTimingEnabled() const {
+    return _gpuTiming;
+}
+
+void Profiler::beginFrame() {
+    Frame& frame = _frames[_frameIndex];
+
+    //this slot's queries are about to be reused. Results that still aren't ready after
+    //FrameLatency frames are dropped rather than waited for.
+    if(frame.pending)
+        _collect(frame);
+
+    frame.scopes.clear();
+    frame.queriesUsed = 0;
+    frame.pending = true;
+    _openScopes.clear();
+}
+
+void Profiler::endFrame() {
+    assert(_openScopes.empty() && "every beginScope needs an endScope");
+    _frameIndex = (_frameIndex + 1) % FrameLatency;
+
+    //collect every older frame whose results are ready, oldest first
+    for(unsigned i = 0; i < FrameLatency; ++i){
+        Frame& frame = _frames[(_frameIndex + i) % FrameLatency];
+        if(!frame.pending || frame.queriesUsed == 0){
+            if(frame.pending) _collect(frame);
+            continue;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(frame.queries[frame.queriesUsed - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available)
+            break; //queries complete in order, so nothing newer is ready either
+        _collect(frame);
+    }
+}
+
+void Profiler::beginScope(const char* name, bool gpu) {
+    Frame& frame = _frames[_frameIndex];
+    Scope scope;
+    scope.name = name;
+    scope.depth = (unsigned)_openScopes.size();
+    scope.cpuBegin = nowMicroseconds();
+    scope.cpuEnd = scope.cpuBegin;
+    scope.gpuQuery = -1;
+
+    if(gpu && _gpuTiming){
+        if(frame.queriesUsed + 2 > frame.queries.size()){
+            size_t oldSize = frame.queries.size();
+            frame.queries.resize(oldSize + 16);
+            glGenQueries(16, &frame.queries[oldSize]);
+        }
+        scope.gpuQuery = (int)frame.queriesUsed;
+        glQueryCounter(frame.queries[frame.queriesUsed], GL_TIMESTAMP);
+        frame.queriesUsed += 2;
+    }
+
+    _openScopes.push_back((unsigned)frame.scopes.size());
+    frame.scopes.push_back(scope);
+}
+
+void Profiler::endScope() {
+    assert(!_openScopes.empty());
+    Frame& frame = _frames[_frameIndex];
+    Scope& scope = frame.scopes[_openScopes.back()];
+    _openScopes.pop_back();
+
+    if(scope.gpuQuery >= 0)
+        glQueryCounter(frame.queries[scope.gpuQuery + 1], GL_TIMESTAMP);
+    scope.cpuEnd = nowMicroseconds();
+}
+
+void Profiler::_collect(Frame& frame) {
+    frame.pending = false;
+
+    //only read the GPU results if they are all ready, so this never blocks
+    bool gpuReady = false;
+    if(frame.queriesUsed > 0){
+        GLint available = 0;
+        glGetQueryObjectiv(frame.queries[frame.queriesUsed - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        gpuReady = (available != 0);
+    }
+
+    //once the trace is full, the oldest frame's events are overwritten, so after the first
+    //few hundred frames nothing here allocates
+    std::vector<TraceEvent> noTrace;
+    std::vector<TraceEvent>* traceEvents = &noTrace;
+    if(_maxTraceFrames > 0){
+        if(_trace.size() < _maxTraceFrames){
+            _trace.push_back(std::vector<TraceEvent>());
+            traceEvents = &_trace.back();
+        } else {
+            traceEvents = &_trace[_traceStart];
+            _traceStart = (_traceStart + 1) % _trace.size();
+        }
+    }
+    std::vector<TraceEvent>& events = *traceEvents;
+    std::vector<ScopeTiming>& timings = _collectedTimings;
+    events.clear();
+    timings.clear();
+    for(size_t i = 0; i < frame.scopes.size(); ++i){
+        const Scope& scope = frame.scopes[i];
+        double gpuMs = -1.0;
+        TraceEvent cpuEvent = { scope.name, scope.cpuBegin, scope.cpuEnd - scope.cpuBegin, 1 };
+        events.push_back(cpuEvent);
+
+        if(scope.gpuQuery >= 0 && gpuReady){
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(frame.queries[scope.gpuQuery], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(frame.queries[scope.gpuQuery + 1], GL_QUERY_RESULT, &end);
+            gpuMs = (double)(end - begin) / 1000000.0;
+            TraceEvent gpuEvent = { scope.name, (double)begin / 1000.0 + _gpuToCpuOffset, (double)(end - begin) / 1000.0, 2 };
+            events.push_back(gpuEvent);
+        }
+
+        //aggregate scopes with the same name at the same depth
+        size_t t = 0;
+        while(t < timings.size() && !(timings[t].depth == scope.depth && timings[t].name == scope.name))
+            ++t;
+        if(t == timings.size()){
+            ScopeTiming timing;
+            timing.name = scope.name;
+            timing.depth = scope.depth;
+            timing.calls = 0;
+            timing.cpuMilliseconds = 0.0;
+            timing.gpuMilliseconds = -1.0;
+            timings.push_back(timing);
+        }
+        timings[t].calls += 1;
+        timings[t].cpuMilliseconds += (scope.cpuEnd - scope.cpuBegin) / 1000.0;
+        if(gpuMs >= 0.0)
+            timings[t].gpuMilliseconds = (timings[t].gpuMilliseconds < 0.0 ? 0.0 : timings[t].gpuMilliseconds) + gpuMs;
+    }
+
+    _lastFrame.swap(timings);
+}
+
+const std::vector<Profiler::ScopeTiming>& Profiler::lastFrame() const {
+    return _lastFrame;
+}
+
+double Profiler::cpuMilliseconds(const std::string& name) const {
+    for(size_t i = 0; i < _lastFrame.size(); ++i){
+        if(_lastFrame[i].depth == 0 && _lastFrame[i].name == name)
+            return _lastFrame[i].cpuMilliseconds;
+    }
+    return 0.0;
+}
+
+double Profiler::gpuMilliseconds(const std::string& name) const {
+    for(size_t i = 0; i < _lastFrame.size(); ++i){
+        if(_lastFrame[i].depth == 0 && _lastFrame[i].name == name)
+            return (_lastFrame[i].gpuMilliseconds < 0.0 ? 0.0 : _lastFrame[i].gpuMilliseconds);
+    }
+    return 0.0;
+}
+
+void Profiler::writeChromeTrace(const std::string& filePath) const {
+    std::ofstream f(filePath.c_str(), std::ios::out | std::ios::trunc);
+    if(!f.is_open())
+        throw std::runtime_error(std::string("Failed to open file for writing: ") + filePath);
+
+    f.precision(15);
+    f << "{\"traceEvents\":[\n";
+    f << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+    f << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+    for(size_t frame = 0; frame < _trace.size(); ++frame){
+        const std::vector<TraceEvent>& events = _trace[(_traceStart + frame) % _trace.size()];
+        for(size_t i = 0; i < events.size(); ++i){
+            f << ",\n{\"name\":\"" << events[i].name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << events[i].thread
+              << ",\"ts\":" << events[i].begin << ",\"dur\":" << events[i].duration << "}";
+        }
+    }
+    f << "\n]}\n";
+
+    if(!f.good())
+        throw std::runtime_error(std::string("Failed to write trace: ") + filePath);
+}
+
+
+//
+// ProfileScope
+//
+
+ProfileScope::ProfileScope(Profiler& profiler, const char* name, bool gpu) :
+    _profiler(profiler)
+{
+    _profiler.beginScope(name, gpu);
+}
+
+ProfileScope::~ProfileScope() {
+    _profiler.endScope();
+}
@@ -0,0 +1,151 @@
+/*
+ tdogl::Profiler
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+namespace tdogl {
+
+    /**
+     Measures named, nestable scopes on the CPU and the GPU, per frame.
+
+     GPU times come from a pair of GL_TIMESTAMP queries around each scope. Query objects are
+     kept in a ring of `FrameLatency` frames and only read back once their results are
+     available, so profiling never stalls the pipeline. GPU times therefore arrive a few
+     frames after the CPU times; `lastFrame` returns the newest frame that has both.
+
+     Frames can be exported to the Chrome trace event format and viewed in
+     chrome://tracing.
+     */
+    class Profiler {
+    public:
+        /** Aggregated time for all the scopes with the same name and depth in a frame */
+        struct ScopeTiming {
+            std::string name;
+            unsigned depth;
+            unsigned calls;
+            double cpuMilliseconds;
+            double gpuMilliseconds; //negative if the GPU wasn't timed
+        };
+
+        /** Number of frames the GPU results may lag behind */
+        static const unsigned FrameLatency = 4;
+
+        /**
+         GPU timing is enabled if the context supports timer queries (GL 3.3 or
+         ARB_timer_query). Must be created with a current GL context.
+
+         @param maxTraceFrames  How many of the most recent frames to keep for `writeChromeTrace`
+         */
+        explicit Profiler(unsigned maxTraceFrames = 600);
+        ~Profiler();
+
+        /** @result True if GPU times are being measured */
+        bool gpuTimingEnabled() const;
+
+        void beginFrame();
+
+        /** Closes the frame and collects any GPU results that have become available */
+        void endFrame();
+
+        /**
+         Starts a scope. `name` is kept for the trace, so it must outlive the profiler.
+         String literals are ideal.
+         */
+        void beginScope(const char* name, bool gpu = true);
+        void endScope();
+
+        /** @result The timings of the newest frame that has complete results */
+        const std::vector<ScopeTiming>& lastFrame() const;
+
+        /** @result The total CPU time of the named top level scope in `lastFrame`, or 0 */
+        double cpuMilliseconds(const std::string& name) const;
+
+        /** @result The total GPU time of the named top level scope in `lastFrame`, or 0 */
+        double gpuMilliseconds(const std::string& name) const;
+
+        /**
+         Writes the retained frames as Chrome trace JSON. CPU scopes are on thread 1 and
+         GPU scopes on thread 2.
+
+         @throws std::exception if the file can not be written.
+         */
+        void writeChromeTrace(const std::string& filePath) const;
+
+        /** Microseconds from an arbitrary, fixed starting point */
+        static double nowMicroseconds();
+
+    private:
+        struct Scope {
+            const char* name;
+            unsigned depth;
+            double cpuBegin;
+            double cpuEnd;
+            int gpuQuery; //index of the begin query in the frame's pool, or -1
+        };
+
+        struct Frame {
+            std::vector<Scope> scopes;
+            std::vector<GLuint> queries;
+            unsigned queriesUsed;
+            bool pending;
+        };
+
+        struct TraceEvent {
+            const char* name;
+            double begin;
+            double duration;
+            int thread;
+        };
+
+        bool _gpuTiming;
+        double _gpuToCpuOffset;
+        Frame _frames[FrameLatency];
+        unsigned _frameIndex;
+        std::vector<unsigned> _openScopes;
+        std::vector<ScopeTiming> _lastFrame;
+        std::vector<ScopeTiming> _collectedTimings; //swapped with _lastFrame, so both keep their memory
+        std::vector<std::vector<TraceEvent> > _trace; //a ring of frames, oldest at _traceStart
+        size_t _traceStart;
+        unsigned _maxTraceFrames;
+
+        void _collect(Frame& frame);
+
+        //copying disabled
+        Profiler(const Profiler&);
+        const Profiler& operator=(const Profiler&);
+    };
+
+    /**
+     Times the enclosing C++ scope with a tdogl::Profiler.
+     */
+    class ProfileScope {
+    public:
+        ProfileScope(Profiler& profiler, const char* name, bool gpu = true);
+        ~ProfileScope();
+
+    private:
+        Profiler& _profiler;
+
+        //copying disabled
+        ProfileScope(const ProfileScope&);
+        const ProfileScope& operator=(const ProfileScope&);
+    };
+
+}
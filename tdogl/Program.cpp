@@ -17,6 +17,7 @@
  */
 
 #include "Program.h"
+#include "GLDeleteQueue.h"
 #include <stdexcept>
 #include <glm/gtc/type_ptr.hpp>
 
@@ -64,7 +65,7 @@ Program::Program(const std::vector<Shader>& shaders) :
 
 Program::~Program() {
     //might be 0 if ctor fails by throwing exception
-    if(_object != 0) glDeleteProgram(_object);
+    GLDeleteQueue::deleteProgram(_object);
 }
 
 GLuint Program::object() const {
@@ -26,6 +26,9 @@ namespace tdogl {
 
     /**
      Represents an OpenGL program made by linking shaders.
+
+     The program is deleted through tdogl::GLDeleteQueue, so the Program can be deleted
+     on any thread.
      */
     class Program { 
     public:
@@ -0,0 +1,123 @@
+/*
+ tdogl::RenderQueue
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "RenderQueue.h"
+#include <cstring>
+
+using namespace tdogl;
+
+// key layout, most significant bit first:
+//   opaque:      0 | program:12 | texture:12 | vao:12 | depth:24 | unused:3
+//   translucent: 1 | inverted depth:24 | program:12 | texture:12 | vao:12 | unused:3
+static const unsigned ObjectBits = 12;
+static const unsigned DepthBits = 24;
+static const uint64_t ObjectMask = (1u << ObjectBits) - 1;
+static const uint64_t DepthMax = (1u << DepthBits) - 1;
+
+RenderStats::RenderStats() {
+    reset();
+}
+
+void RenderStats::reset() {
+    drawCalls = 0;
+    programChanges = 0;
+    textureChanges = 0;
+    vertexArrayChanges = 0;
+    triangles = 0;
+}
+
+uint64_t RenderQueue::makeKey(bool translucent, GLuint program, GLuint texture, GLuint vao, float depth) {
+    if(depth < 0.0f) depth = 0.0f;
+    if(depth > 1.0f) depth = 1.0f;
+    uint64_t quantizedDepth = (uint64_t)(depth * (float)DepthMax);
+    uint64_t state = ((program & ObjectMask) << (2 * ObjectBits)) |
+                     ((texture & ObjectMask) << ObjectBits) |
+                     (vao & ObjectMask);
+
+    if(translucent)
+        return (1ull << 63) | ((DepthMax - quantizedDepth) << (3 * ObjectBits + 3)) | (state << 3);
+    else
+        return (state << (DepthBits + 3)) | (quantizedDepth << 3);
+}
+
+RenderQueue::RenderQueue()
+{
+}
+
+void RenderQueue::clear() {
+    _entries.clear();
+}
+
+void RenderQueue::push(uint64_t key, unsigned item) {
+    Entry e = { key, item };
+    _entries.push_back(e);
+}
+
+void RenderQueue::sort() {
+    const size_t count = _entries.size();
+    if(count < 2)
+        return;
+    _scratch.resize(count);
+
+    //histogram all eight bytes in one sweep
+    unsigned histograms[8][256];
+    memset(histograms, 0, sizeof(histograms));
+    for(size_t i = 0; i < count; ++i){
+        uint64_t key = _entries[i].key;
+        for(unsigned pass = 0; pass < 8; ++pass)
+            ++histograms[pass][(key >> (pass * 8)) & 0xFF];
+    }
+
+    Entry* src = &_entries[0];
+    Entry* dest = &_scratch[0];
+    for(unsigned pass = 0; pass < 8; ++pass){
+        unsigned* histogram = histograms[pass];
+        const unsigned shift = pass * 8;
+
+        //every key has the same byte here, so this pass wouldn't move anything
+        if(histogram[(src[0].key >> shift) & 0xFF] == count)
+            continue;
+
+        unsigned offset = 0;
+        for(unsigned bucket = 0; bucket < 256; ++bucket){
+            unsigned bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+
+        for(size_t i = 0; i < count; ++i)
+            dest[histogram[(src[i].key >> shift) & 0xFF]++] = src[i];
+
+        Entry* swapTmp = src;
+        src = dest;
+        dest = swapTmp;
+    }
+
+    if(src != &_entries[0])
+        _entries.swap(_scratch);
+}
+
+size_t RenderQueue::size() const {
+    return _entries.size();
+}
+
+uint64_t RenderQueue::key(size_t index) const {
+    return _entries[index].key;
+}
+
+unsigned RenderQueue::item(size_t index) const {
+    return _entries[index].item;
+}
@@ -0,0 +1,89 @@
+/*
+ tdogl::RenderQueue
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+#include <stdint.h>
+
+namespace tdogl {
+
+    /**
+     Counters for the GL work issued while drawing one frame.
+     */
+    struct RenderStats {
+        unsigned drawCalls;
+        unsigned programChanges;
+        unsigned textureChanges;
+        unsigned vertexArrayChanges;
+        unsigned triangles;
+
+        RenderStats();
+        void reset();
+    };
+
+    /**
+     A list of draws that is sorted by a 64 bit key before being issued.
+
+     Keys made with `makeKey` order opaque draws by program, then texture, then VAO, then
+     front-to-back depth, so that consecutive draws share as much GL state as possible and
+     the depth test can reject hidden fragments early. Translucent draws are sorted after
+     all the opaque ones, back-to-front.
+
+     Each entry carries an arbitrary `item` value, usually an index into an array of
+     whatever is being drawn.
+     */
+    class RenderQueue {
+    public:
+        /**
+         Builds a sort key.
+
+         Only the low 12 bits of each object name are used. Names that collide still draw
+         correctly, they just aren't guaranteed to be adjacent.
+
+         @param translucent  True if the draw is blended and must be drawn back-to-front
+         @param program      The program object
+         @param texture      The texture object
+         @param vao          The vertex array object
+         @param depth        Normalized distance from the camera, clamped to [0, 1]
+         */
+        static uint64_t makeKey(bool translucent, GLuint program, GLuint texture, GLuint vao, float depth);
+
+        RenderQueue();
+
+        /** Removes all entries. Allocated memory is kept for the next frame. */
+        void clear();
+
+        void push(uint64_t key, unsigned item);
+
+        /** Sorts the entries by ascending key with a stable LSD radix sort */
+        void sort();
+
+        size_t size() const;
+        uint64_t key(size_t index) const;
+        unsigned item(size_t index) const;
+
+    private:
+        struct Entry {
+            uint64_t key;
+            unsigned item;
+        };
+        std::vector<Entry> _entries;
+        std::vector<Entry> _scratch;
+    };
+
+}
@@ -0,0 +1,304 @@
+/*
+ tdogl::ResourceManager
+
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "ResourceManager.h"
+#include "Bitmap.h"
+#include "Texture.h"
+#include <stdexcept>
+#include <sstream>
+
+using namespace tdogl;
+
+MeshBuffers::MeshBuffers(const std::string& filePath) :
+    _cache(filePath),
+    _vbo(0),
+    _ibo(0)
+{
+    glGenBuffers(1, &_vbo);
+    glGenBuffers(1, &_ibo);
+    try {
+        _cache.upload(_vbo, _ibo);
+    } catch(...) {
+        //the destructor won't run, so the buffers go here
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glDeleteBuffers(1, &_vbo);
+        glDeleteBuffers(1, &_ibo);
+        throw;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+MeshBuffers::~MeshBuffers() {
+    glDeleteBuffers(1, &_vbo);
+    glDeleteBuffers(1, &_ibo);
+}
+
+const MeshCache& MeshBuffers::cache() const {
+    return _cache;
+}
+
+GLuint MeshBuffers::vbo() const {
+    return _vbo;
+}
+
+GLuint MeshBuffers::ibo() const {
+    return _ibo;
+}
+
+//tdogl::Texture uploads greyscale as RGB(A), and drivers store RGB textures as RGBA, so
+//every texel takes 4 bytes. The mipmaps below level 0 add a third.
+static size_t TextureBytes(const Bitmap& bitmap, GLint minMagFilter) {
+    size_t bytes = (size_t)bitmap.width() * bitmap.height() * 4;
+    return (Texture::isMipmapFilter(minMagFilter) ? bytes * 4 / 3 : bytes);
+}
+
+static std::string TextureKey(const std::string& name, GLint minMagFilter, GLint wrapMode) {
+    std::ostringstream key;
+    key << "texture|" << name << '|' << minMagFilter << '|' << wrapMode;
+    return key.str();
+}
+
+ResourceManager::ResourceManager(const std::string& directory, size_t budgetBytes) :
+    _directory(directory),
+    _budget(budgetBytes),
+    _frame(0),
+    _shaders(directory)
+{
+    for(unsigned i = 0; i < TypeCount; ++i){
+        _usage[i].count = 0;
+        _usage[i].bytes = 0;
+        _usage[i].loads = 0;
+        _usage[i].hits = 0;
+        _usage[i].evictions = 0;
+    }
+}
+
+ResourceManager::~ResourceManager() {
+    for(size_t i = 0; i < _slots.size(); ++i){
+        delete _slots[i].texture;
+        delete _slots[i].mesh;
+    }
+}
+
+TextureHandle ResourceManager::loadTexture(const std::string& file, GLint minMagFilter, GLint wrapMode) {
+    std::string key = TextureKey(file, minMagFilter, wrapMode);
+    unsigned index = findKey(key);
+    if(index == _slots.size()){
+        Bitmap bitmap = Bitmap::bitmapFromFile(_directory + file);
+        bitmap.flipVertically();
+        return makeTexture(key, bitmap, minMagFilter, wrapMode);
+    }
+
+    TextureHandle handle;
+    handle._index = index;
+    handle._generation = _slots[index].generation;
+    return handle;
+}
+
+TextureHandle ResourceManager::addTexture(const std::string& name, const Bitmap& bitmap, GLint minMagFilter, GLint wrapMode) {
+    std::string key = TextureKey(name, minMagFilter, wrapMode);
+    unsigned index = findKey(key);
+    if(index == _slots.size())
+        return makeTexture(key, bitmap, minMagFilter, wrapMode);
+
+    TextureHandle handle;
+    handle._index = index;
+    handle._generation = _slots[index].generation;
+    return handle;
+}
+
+TextureHandle ResourceManager::makeTexture(const std::string& key, const Bitmap& bitmap, GLint minMagFilter, GLint wrapMode) {
+    Texture* texture = new Texture(bitmap, minMagFilter, wrapMode);
+    TextureHandle handle;
+    handle._index = addSlot(Type_Texture, key, texture, NULL, TextureBytes(bitmap, minMagFilter));
+    handle._generation = _slots[handle._index].generation;
+    return handle;
+}
+
+MeshHandle ResourceManager::loadMesh(const std::string& file) {
+    std::string key = "mesh|" + file;
+    MeshHandle handle;
+    handle._index = findKey(key);
+    if(handle._index == _slots.size()){
+        MeshBuffers* mesh = new MeshBuffers(_directory + file);
+        size_t bytes = (size_t)(mesh->cache().vertexDataSize() + mesh->cache().indexDataSize());
+        handle._index = addSlot(Type_Mesh, key, NULL, mesh, bytes);
+    }
+    handle._generation = _slots[handle._index].generation;
+    return handle;
+}
+
+Program& ResourceManager::program(const std::string& vertexFile,
+                                  const std::string& fragmentFile,
+                                  const std::vector<std::string>& defines)
+{
+    size_t programsBefore = _shaders.programCount();
+    Program& program = _shaders.program(vertexFile, fragmentFile, defines);
+    Usage& usage = _usage[Type_Program];
+    ++usage.loads;
+    if(_shaders.programCount() == programsBefore)
+        ++usage.hits;
+    usage.count = (unsigned)_shaders.programCount();
+    return program;
+}
+
+Texture* ResourceManager::texture(TextureHandle handle) {
+    Slot* slot = find(Type_Texture, handle._index, handle._generation);
+    return slot ? slot->texture : NULL;
+}
+
+const MeshBuffers* ResourceManager::mesh(MeshHandle handle) {
+    Slot* slot = find(Type_Mesh, handle._index, handle._generation);
+    return slot ? slot->mesh : NULL;
+}
+
+void ResourceManager::pin(TextureHandle handle) {
+    Slot* slot = find(Type_Texture, handle._index, handle._generation);
+    if(slot)
+        ++slot->pins;
+}
+
+void ResourceManager::unpin(TextureHandle handle) {
+    Slot* slot = find(Type_Texture, handle._index, handle._generation);
+    if(slot && slot->pins > 0)
+        --slot->pins;
+}
+
+void ResourceManager::pin(MeshHandle handle) {
+    Slot* slot = find(Type_Mesh, handle._index, handle._generation);
+    if(slot)
+        ++slot->pins;
+}
+
+void ResourceManager::unpin(MeshHandle handle) {
+    Slot* slot = find(Type_Mesh, handle._index, handle._generation);
+    if(slot && slot->pins > 0)
+        --slot->pins;
+}
+
+void ResourceManager::beginFrame() {
+    ++_frame;
+    enforceBudget();
+}
+
+size_t ResourceManager::budget() const {
+    return _budget;
+}
+
+void ResourceManager::setBudget(size_t budgetBytes) {
+    _budget = budgetBytes;
+}
+
+size_t ResourceManager::residentBytes() const {
+    return _usage[Type_Texture].bytes + _usage[Type_Mesh].bytes;
+}
+
+ResourceManager::Usage ResourceManager::usage(Type type) const {
+    if(type < 0 || type >= TypeCount)
+        throw std::runtime_error("Invalid resource type");
+    return _usage[type];
+}
+
+ResourceManager::Slot* ResourceManager::find(Type type, unsigned index, unsigned generation) {
+    if(index >= _slots.size())
+        return NULL;
+    Slot& slot = _slots[index];
+    if(slot.generation != generation || slot.type != type || (!slot.texture && !slot.mesh))
+        return NULL;
+    slot.lastUsedFrame = _frame;
+    return &slot;
+}
+
+//@result The slot of the resident resource with the key, marked used, or _slots.size() if none
+unsigned ResourceManager::findKey(const std::string& key) {
+    std::map<std::string, unsigned>::iterator found = _slotsByKey.find(key);
+    if(found == _slotsByKey.end())
+        return (unsigned)_slots.size();
+
+    Slot& slot = _slots[found->second];
+    slot.lastUsedFrame = _frame;
+    ++_usage[slot.type].loads;
+    ++_usage[slot.type].hits;
+    return found->second;
+}
+
+unsigned ResourceManager::addSlot(Type type, const std::string& key, Texture* texture, MeshBuffers* mesh, size_t bytes) {
+    unsigned index;
+    if(_freeSlots.empty()){
+        index = (unsigned)_slots.size();
+        Slot slot = Slot(); //the rest is filled in below
+        slot.generation = 1; //handles start at 0, so a default handle never matches
+        _slots.push_back(slot);
+    } else {
+        index = _freeSlots.back();
+        _freeSlots.pop_back();
+    }
+
+    Slot& slot = _slots[index];
+    slot.type = type;
+    slot.key = key;
+    slot.texture = texture;
+    slot.mesh = mesh;
+    slot.bytes = bytes;
+    slot.pins = 0;
+    slot.lastUsedFrame = _frame;
+    _slotsByKey[key] = index;
+
+    Usage& usage = _usage[type];
+    ++usage.count;
+    ++usage.loads;
+    usage.bytes += bytes;
+
+    enforceBudget();
+    return index;
+}
+
+void ResourceManager::evict(unsigned index) {
+    Slot& slot = _slots[index];
+    Usage& usage = _usage[slot.type];
+    --usage.count;
+    usage.bytes -= slot.bytes;
+    ++usage.evictions;
+
+    delete slot.texture; slot.texture = NULL;
+    delete slot.mesh; slot.mesh = NULL;
+    _slotsByKey.erase(slot.key);
+    slot.key.clear();
+    //the handles to what was here are stale from now on
+    ++slot.generation;
+    _freeSlots.push_back(index);
+}
+
+void ResourceManager::enforceBudget() {
+    while(residentBytes() > _budget){
+        //the least recently used resource that may go
+        unsigned oldest = (unsigned)_slots.size();
+        for(unsigned i = 0; i < _slots.size(); ++i){
+            const Slot& slot = _slots[i];
+            if((!slot.texture && !slot.mesh) || slot.pins > 0 || slot.lastUsedFrame >= _frame)
+                continue;
+            if(oldest == _slots.size() || slot.lastUsedFrame < _slots[oldest].lastUsedFrame)
+                oldest = i;
+        }
+        //everything left is pinned or in use, so the budget stays exceeded for now
+        if(oldest == _slots.size())
+            break;
+        evict(oldest);
+    }
+}
@@ -0,0 +1,209 @@
+/*
+ tdogl::ResourceManager
+
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "MeshCache.h"
+#include "ShaderLibrary.h"
+
+namespace tdogl {
+
+    class Bitmap;
+    class Texture;
+
+    /**
+     A baked mesh file (see tdogl::MeshCache) uploaded into a vertex and an index buffer.
+     The file stays mapped, for its layout and levels of detail.
+     */
+    class MeshBuffers {
+    public:
+        /** @throws std::exception if the file can not be mapped or is not a valid mesh cache. */
+        explicit MeshBuffers(const std::string& filePath);
+
+        /** Deletes the buffers */
+        ~MeshBuffers();
+
+        const MeshCache& cache() const;
+        GLuint vbo() const;
+        GLuint ibo() const;
+
+    private:
+        MeshCache _cache;
+        GLuint _vbo;
+        GLuint _ibo;
+
+        //copying disabled
+        MeshBuffers(const MeshBuffers&);
+        const MeshBuffers& operator=(const MeshBuffers&);
+    };
+
+    /**
+     Names a resource of a tdogl::ResourceManager. Once the resource is evicted, the handle
+     is stale: the manager returns NULL for it, even if its slot holds something new.
+     A default constructed handle is never valid.
+     */
+    template <class T>
+    class ResourceHandle {
+    public:
+        ResourceHandle() : _index(0), _generation(0) {}
+        bool operator==(const ResourceHandle& other) const { return _index == other._index && _generation == other._generation; }
+        bool operator!=(const ResourceHandle& other) const { return !(*this == other); }
+
+    private:
+        friend class ResourceManager;
+        unsigned _index;
+        unsigned _generation;
+    };
+
+    typedef ResourceHandle<Texture> TextureHandle;
+    typedef ResourceHandle<MeshBuffers> MeshHandle;
+
+    /**
+     Loads textures, meshes and programs from a directory, once each.
+
+     A texture or mesh is keyed by its file and the parameters it was loaded with, and
+     loading it again gives the same handle while it is resident. Programs are built by a
+     tdogl::ShaderLibrary, and kept until the manager is deleted.
+
+     Textures and meshes count towards a budget of video memory. When they go over it, the
+     least recently used ones are evicted, but never a pinned one, or one used since the last
+     `beginFrame`. A pointer from `texture` or `mesh` is valid until the next
+     `beginFrame`, or for as long as the resource is pinned, so keep the handle rather than
+     the pointer.
+
+     The sizes are estimates: a driver may pad or compress what it is given.
+     */
+    class ResourceManager {
+    public:
+        enum Type { Type_Texture, Type_Mesh, Type_Program, TypeCount };
+
+        /** How much of one type of resource is resident */
+        struct Usage {
+            unsigned count;
+            size_t bytes;       //0 for programs, their size is up to the driver
+            unsigned loads;     //in total
+            unsigned hits;      //loads that found the resource resident, in total
+            unsigned evictions; //in total
+        };
+
+        /**
+         @param directory    Prefixed to every file name, e.g. "assets/"
+         @param budgetBytes  Of textures and meshes together
+         */
+        ResourceManager(const std::string& directory, size_t budgetBytes);
+
+        /** Deletes every resource, pinned or not */
+        ~ResourceManager();
+
+        /**
+         Loads an image file, flipped so the first row is the bottom one, as OpenGL expects.
+
+         @throws std::exception if the file can not be loaded.
+         */
+        TextureHandle loadTexture(const std::string& file,
+                                  GLint minMagFilter = GL_LINEAR,
+                                  GLint wrapMode = GL_CLAMP_TO_EDGE);
+
+        /**
+         Makes a texture of a bitmap built in code. `name` stands in for a file name: if a
+         texture of that name is resident, `bitmap` is ignored and its handle returned.
+         */
+        TextureHandle addTexture(const std::string& name,
+                                 const Bitmap& bitmap,
+                                 GLint minMagFilter = GL_LINEAR,
+                                 GLint wrapMode = GL_CLAMP_TO_EDGE);
+
+        /**
+         Loads a baked mesh file and uploads it.
+
+         @throws std::exception if the file can not be mapped or is not a valid mesh cache.
+         */
+        MeshHandle loadMesh(const std::string& file);
+
+        /**
+         @result The program of the two shader files with `defines`, see
+                 tdogl::ShaderLibrary::program
+         */
+        Program& program(const std::string& vertexFile,
+                         const std::string& fragmentFile,
+                         const std::vector<std::string>& defines = std::vector<std::string>());
+
+        /** @result The resource, or NULL if the handle is stale. Marks it used this frame. */
+        Texture* texture(TextureHandle handle);
+        const MeshBuffers* mesh(MeshHandle handle);
+
+        /**
+         A pinned resource is never evicted. Pins are counted, so each `pin` needs an
+         `unpin`. Stale handles are ignored.
+         */
+        void pin(TextureHandle handle);
+        void unpin(TextureHandle handle);
+        void pin(MeshHandle handle);
+        void unpin(MeshHandle handle);
+
+        /**
+         Starts a new frame, and evicts what it takes to get back under the budget. Loads
+         evict too, but only what hasn't been used in the frame.
+         */
+        void beginFrame();
+
+        size_t budget() const;
+        void setBudget(size_t budgetBytes);
+
+        /** @result The bytes of all the resident textures and meshes */
+        size_t residentBytes() const;
+
+        Usage usage(Type type) const;
+
+    private:
+        struct Slot {
+            unsigned generation; //of the handles to what is in the slot now
+            Type type;
+            std::string key;
+            Texture* texture;
+            MeshBuffers* mesh;
+            size_t bytes;
+            unsigned pins;
+            unsigned long long lastUsedFrame;
+        };
+
+        std::string _directory;
+        size_t _budget;
+        unsigned long long _frame;
+        std::vector<Slot> _slots;
+        std::vector<unsigned> _freeSlots;
+        std::map<std::string, unsigned> _slotsByKey; //only the resident resources
+        Usage _usage[TypeCount];
+        ShaderLibrary _shaders;
+
+        Slot* find(Type type, unsigned index, unsigned generation);
+        unsigned findKey(const std::string& key);
+        unsigned addSlot(Type type, const std::string& key, Texture* texture, MeshBuffers* mesh, size_t bytes);
+        TextureHandle makeTexture(const std::string& key, const Bitmap& bitmap, GLint minMagFilter, GLint wrapMode);
+        void evict(unsigned index);
+        void enforceBudget();
+
+        //copying disabled
+        ResourceManager(const ResourceManager&);
+        const ResourceManager& operator=(const ResourceManager&);
+    };
+
+}
@@ -0,0 +1,222 @@
+/*
+ tdogl::SceneGraph
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "SceneGraph.h"
+#include <stdexcept>
+#include <algorithm>
+
+using namespace tdogl;
+
+static const unsigned NoParentIndex = 0xFFFFFFFF;
+
+// applies scale, then rotation, then translation
+static glm::mat4 LocalTransform(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale) {
+    glm::mat4 m = glm::mat4_cast(rotation);
+    m[0] *= scale.x;
+    m[1] *= scale.y;
+    m[2] *= scale.z;
+    m[3] = glm::vec4(position, 1.0f);
+    return m;
+}
+
+SceneGraph::SceneGraph() :
+    _needsSort(false),
+    _dirtyCount(0)
+{
+}
+
+void SceneGraph::clear() {
+    _positions.clear();
+    _rotations.clear();
+    _scales.clear();
+    _world.clear();
+    _parentIndices.clear();
+    _depths.clear();
+    _nodes.clear();
+    _dirty.clear();
+    _changed.clear();
+    _indices.clear();
+    _needsSort = false;
+    _dirtyCount = 0;
+}
+
+SceneGraph::NodeId SceneGraph::createNode(NodeId parent) {
+    unsigned parentIndex = NoParentIndex;
+    unsigned depth = 0;
+    if(parent != NoParent){
+        parentIndex = _index(parent);
+        depth = _depths[parentIndex] + 1;
+    }
+
+    NodeId node = (NodeId)_indices.size();
+    unsigned index = (unsigned)_nodes.size();
+    _indices.push_back(index);
+    _nodes.push_back(node);
+    _positions.push_back(glm::vec3(0.0f));
+    _rotations.push_back(glm::quat());
+    _scales.push_back(glm::vec3(1.0f));
+    _world.push_back(glm::mat4());
+    _parentIndices.push_back(parentIndex);
+    _depths.push_back(depth);
+    _dirty.push_back(1);
+    _changed.push_back(0);
+    ++_dirtyCount;
+
+    //appending keeps parents before children, but not the depth order
+    if(index > 0 && _depths[index - 1] > depth)
+        _needsSort = true;
+    return node;
+}
+
+size_t SceneGraph::size() const {
+    return _nodes.size();
+}
+
+SceneGraph::NodeId SceneGraph::parent(NodeId node) const {
+    unsigned parentIndex = _parentIndices[_index(node)];
+    return parentIndex == NoParentIndex ? NoParent : _nodes[parentIndex];
+}
+
+const glm::vec3& SceneGraph::position(NodeId node) const {
+    return _positions[_index(node)];
+}
+
+void SceneGraph::setPosition(NodeId node, const glm::vec3& position) {
+    unsigned index = _index(node);
+    _positions[index] = position;
+    _markDirty(index);
+}
+
+const glm::quat& SceneGraph::rotation(NodeId node) const {
+    return _rotations[_index(node)];
+}
+
+void SceneGraph::setRotation(NodeId node, const glm::quat& rotation) {
+    unsigned index = _index(node);
+    _rotations[index] = rotation;
+    _markDirty(index);
+}
+
+const glm::vec3& SceneGraph::scale(NodeId node) const {
+    return _scales[_index(node)];
+}
+
+void SceneGraph::setScale(NodeId node, const glm::vec3& scale) {
+    unsigned index = _index(node);
+    _scales[index] = scale;
+    _markDirty(index);
+}
+
+size_t SceneGraph::update() {
+    if(_needsSort)
+        _sortByDepth();
+
+    //nothing changed since the last update, so no world matrix changes either
+    if(_dirtyCount == 0){
+        if(!_changed.empty())
+            std::fill(_changed.begin(), _changed.end(), (unsigned char)0);
+        return 0;
+    }
+
+    //parents come first, so a parent's `_changed` flag is final when its children are visited
+    size_t recomputed = 0;
+    const size_t count = _nodes.size();
+    for(size_t i = 0; i < count; ++i){
+        unsigned parentIndex = _parentIndices[i];
+        bool parentChanged = (parentIndex != NoParentIndex && _changed[parentIndex]);
+        if(!_dirty[i] && !parentChanged){
+            _changed[i] = 0;
+            continue;
+        }
+
+        glm::mat4 local = LocalTransform(_positions[i], _rotations[i], _scales[i]);
+        _world[i] = (parentIndex == NoParentIndex ? local : _world[parentIndex] * local);
+        _dirty[i] = 0;
+        _changed[i] = 1;
+        ++recomputed;
+    }
+    _dirtyCount = 0;
+    return recomputed;
+}
+
+const glm::mat4& SceneGraph::worldTransform(NodeId node) const {
+    return _world[_index(node)];
+}
+
+bool SceneGraph::worldChanged(NodeId node) const {
+    return _changed[_index(node)] != 0;
+}
+
+unsigned SceneGraph::_index(NodeId node) const {
+    if(node >= _indices.size())
+        throw std::runtime_error("SceneGraph node does not exist");
+    return _indices[node];
+}
+
+void SceneGraph::_markDirty(unsigned index) {
+    if(!_dirty[index]){
+        _dirty[index] = 1;
+        ++_dirtyCount;
+    }
+}
+
+void SceneGraph::_sortByDepth() {
+    //counting sort by depth. It is stable, so parents stay before their children.
+    unsigned maxDepth = 0;
+    for(size_t i = 0; i < _depths.size(); ++i)
+        maxDepth = std::max(maxDepth, _depths[i]);
+    std::vector<unsigned> starts(maxDepth + 2, 0);
+    for(size_t i = 0; i < _depths.size(); ++i)
+        ++starts[_depths[i] + 1];
+    for(size_t d = 1; d < starts.size(); ++d)
+        starts[d] += starts[d - 1];
+    std::vector<unsigned> newIndices(_nodes.size());
+    for(size_t i = 0; i < _nodes.size(); ++i)
+        newIndices[i] = starts[_depths[i]]++;
+
+    std::vector<glm::vec3> positions(_positions.size());
+    std::vector<glm::quat> rotations(_rotations.size());
+    std::vector<glm::vec3> scales(_scales.size());
+    std::vector<glm::mat4> world(_world.size());
+    std::vector<unsigned> parentIndices(_parentIndices.size());
+    std::vector<unsigned> depths(_depths.size());
+    std::vector<NodeId> nodes(_nodes.size());
+    std::vector<unsigned char> dirty(_dirty.size());
+    std::vector<unsigned char> changed(_changed.size());
+    for(size_t i = 0; i < _nodes.size(); ++i){
+        unsigned n = newIndices[i];
+        positions[n] = _positions[i];
+        rotations[n] = _rotations[i];
+        scales[n] = _scales[i];
+        world[n] = _world[i];
+        parentIndices[n] = (_parentIndices[i] == NoParentIndex ? NoParentIndex : newIndices[_parentIndices[i]]);
+        depths[n] = _depths[i];
+        nodes[n] = _nodes[i];
+        dirty[n] = _dirty[i];
+        changed[n] = _changed[i];
+        _indices[_nodes[i]] = n;
+    }
+    _positions.swap(positions);
+    _rotations.swap(rotations);
+    _scales.swap(scales);
+    _world.swap(world);
+    _parentIndices.swap(parentIndices);
+    _depths.swap(depths);
+    _nodes.swap(nodes);
+    _dirty.swap(dirty);
+    _changed.swap(changed);
+    _needsSort = false;
+}
@@ -0,0 +1,106 @@
+/*
+ tdogl::SceneGraph
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+
+namespace tdogl {
+
+    /**
+     A hierarchy of nodes, each with a local translation, rotation and scale.
+
+     The nodes are stored in arrays sorted by depth in the tree, so every parent comes
+     before its children. `update` walks the arrays once, front to back, and only
+     recomputes the world matrices of nodes that were changed or whose parent's world
+     matrix changed.
+
+     Nodes are referred to by a NodeId, which stays valid when the arrays are re-sorted.
+     */
+    class SceneGraph {
+    public:
+        typedef unsigned NodeId;
+
+        /** The parent of root nodes */
+        static const NodeId NoParent = 0xFFFFFFFF;
+
+        SceneGraph();
+
+        /** Removes all the nodes */
+        void clear();
+
+        /**
+         Adds a node with an identity local transform.
+
+         @param parent  An existing node, or NoParent for a root node
+         @result The id of the new node
+         @throws std::exception if `parent` doesn't exist
+         */
+        NodeId createNode(NodeId parent = NoParent);
+
+        /** @result The number of nodes */
+        size_t size() const;
+
+        NodeId parent(NodeId node) const;
+
+        const glm::vec3& position(NodeId node) const;
+        void setPosition(NodeId node, const glm::vec3& position);
+
+        const glm::quat& rotation(NodeId node) const;
+        void setRotation(NodeId node, const glm::quat& rotation);
+
+        const glm::vec3& scale(NodeId node) const;
+        void setScale(NodeId node, const glm::vec3& scale);
+
+        /**
+         Recomputes the world matrices of the changed subtrees.
+
+         @result The number of world matrices that were recomputed
+         */
+        size_t update();
+
+        /** @result The world matrix as of the last `update` */
+        const glm::mat4& worldTransform(NodeId node) const;
+
+        /** @result True if the world matrix was recomputed by the last `update` */
+        bool worldChanged(NodeId node) const;
+
+    private:
+        //indexed by position in the depth sorted arrays
+        std::vector<glm::vec3> _positions;
+        std::vector<glm::quat> _rotations;
+        std::vector<glm::vec3> _scales;
+        std::vector<glm::mat4> _world;
+        std::vector<unsigned> _parentIndices;
+        std::vector<unsigned> _depths;
+        std::vector<NodeId> _nodes;
+        std::vector<unsigned char> _dirty;
+        std::vector<unsigned char> _changed;
+
+        //indexed by NodeId
+        std::vector<unsigned> _indices;
+
+        bool _needsSort;
+        size_t _dirtyCount;
+
+        unsigned _index(NodeId node) const;
+        void _markDirty(unsigned index);
+        void _sortByDepth();
+    };
+
+}
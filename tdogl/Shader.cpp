@@ -17,6 +17,7 @@
  */
 
 #include "Shader.h"
+#include "GLDeleteQueue.h"
 #include <stdexcept>
 #include <fstream>
 #include <string>
@@ -58,8 +59,7 @@ Shader::Shader(const std::string& shaderCode, GLenum shaderType) :
         throw std::runtime_error(msg);
     }
     
-    _refCount = new unsigned;
-    *_refCount = 1;
+    _refCount = new std::atomic<unsigned>(1);
 }
 
 Shader::Shader(const Shader& other) :
@@ -79,14 +79,21 @@ GLuint Shader::object() const {
 }
 
 Shader& Shader::operator = (const Shader& other) {
+    //retain first, so assigning a shader to itself doesn't delete it
+    std::atomic<unsigned>* refCount = other._refCount;
+    GLuint object = other._object;
+    refCount->fetch_add(1, std::memory_order_relaxed);
     _release();
-    _object = other._object;
-    _refCount = other._refCount;
-    _retain();
+    _object = object;
+    _refCount = refCount;
     return *this;
 }
 
 Shader Shader::shaderFromFile(const std::string& filePath, GLenum shaderType) {
+    return shaderFromFile(filePath, shaderType, std::vector<std::string>());
+}
+
+Shader Shader::shaderFromFile(const std::string& filePath, GLenum shaderType, const std::vector<std::string>& defines) {
     //open file
     std::ifstream f;
     f.open(filePath.c_str(), std::ios::in | std::ios::binary);
@@ -99,20 +106,51 @@ Shader Shader::shaderFromFile(const std::string& filePath, GLenum shaderType) {
     buffer << f.rdbuf();
 
     //return new shader
-    Shader shader(buffer.str(), shaderType);
+    Shader shader(addDefines(buffer.str(), defines), shaderType);
     return shader;
 }
 
+std::string Shader::addDefines(const std::string& shaderCode, const std::vector<std::string>& defines) {
+    if(defines.empty())
+        return shaderCode;
+
+    //nothing but comments and whitespace may come before #version, so it stays first
+    size_t insertAt = 0;
+    unsigned linesBefore = 0;
+    size_t versionAt = shaderCode.find("#version");
+    if(versionAt != std::string::npos){
+        size_t lineEnd = shaderCode.find('\n', versionAt);
+        insertAt = (lineEnd == std::string::npos ? shaderCode.size() : lineEnd + 1);
+        for(size_t i = 0; i < insertAt; ++i){
+            if(shaderCode[i] == '\n')
+                ++linesBefore;
+        }
+    }
+
+    std::ostringstream code;
+    code << shaderCode.substr(0, insertAt);
+    if(insertAt > 0 && shaderCode[insertAt - 1] != '\n'){
+        code << '\n';
+        ++linesBefore;
+    }
+    for(size_t i = 0; i < defines.size(); ++i)
+        code << "#define " << defines[i] << '\n';
+    //GLSL 1.50 numbers the line after "#line n" as n + 1
+    code << "#line " << linesBefore << '\n';
+    code << shaderCode.substr(insertAt);
+    return code.str();
+}
+
 void Shader::_retain() {
     assert(_refCount);
-    *_refCount += 1;
+    _refCount->fetch_add(1, std::memory_order_relaxed);
 }
 
 void Shader::_release() {
-    assert(_refCount && *_refCount > 0);
-    *_refCount -= 1;
-    if(*_refCount == 0){
-        glDeleteShader(_object); _object = 0;
+    assert(_refCount && _refCount->load() > 0);
+    //acquire-release, so the last copy sees everything the others did before deleting
+    if(_refCount->fetch_sub(1, std::memory_order_acq_rel) == 1){
+        GLDeleteQueue::deleteShader(_object); _object = 0;
         delete _refCount; _refCount = NULL;
     }
 }
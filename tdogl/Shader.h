@@ -20,6 +20,8 @@
 
 #include <GL/glew.h>
 #include <string>
+#include <vector>
+#include <atomic>
 
 namespace tdogl {
 
@@ -41,6 +43,29 @@ namespace tdogl {
         static Shader shaderFromFile(const std::string& filePath, GLenum shaderType);
         
         
+        /**
+         Creates a variant of a shader from a text file, with a #define for each of `defines`.
+         The source can then pick what to compile with #ifdef.
+         
+         @param filePath    The path to the text file containing the shader source.
+         @param shaderType  Same as the argument to glCreateShader. For example GL_VERTEX_SHADER
+                            or GL_FRAGMENT_SHADER.
+         @param defines     Each is the rest of a #define line, e.g. "SRGB_FRAMEBUFFER" or
+                            "MAX_LIGHTS 8". See `addDefines`.
+         
+         @throws std::exception if an error occurs.
+         */
+        static Shader shaderFromFile(const std::string& filePath, GLenum shaderType, const std::vector<std::string>& defines);
+        
+        
+        /**
+         @result `shaderCode` with a #define line for each of `defines`, after the #version
+                 line if there is one. A #line directive follows them, so compile errors
+                 still give the line numbers of the original code.
+         */
+        static std::string addDefines(const std::string& shaderCode, const std::vector<std::string>& defines);
+        
+        
         /**
          Creates a shader from a string of shader source code.
          
@@ -59,14 +84,15 @@ namespace tdogl {
         GLuint object() const;
         
         // tdogl::Shader objects can be copied and assigned because they are reference counted
-        // like a shared pointer
+        // like a shared pointer. The count is atomic, so copies can be made and dropped on
+        // any thread. The last one deletes the shader through tdogl::GLDeleteQueue.
         Shader(const Shader& other);
         Shader& operator =(const Shader& other);
         ~Shader();
         
     private:
         GLuint _object;
-        unsigned* _refCount;
+        std::atomic<unsigned>* _refCount;
         
         void _retain();
         void _release();
@@ -0,0 +1,163 @@
+/*
+ tdogl::ShaderLibrary
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "ShaderLibrary.h"
+#include "Program.h"
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+using namespace tdogl;
+
+ShaderLibrary::ShaderLibrary(const std::string& directory) :
+    _directory(directory)
+{
+}
+
+ShaderLibrary::~ShaderLibrary() {
+    for(std::map<std::string, Program*>::iterator it = _programs.begin(); it != _programs.end(); ++it)
+        delete it->second;
+}
+
+Program& ShaderLibrary::program(const std::string& vertexFile,
+                                const std::string& fragmentFile,
+                                const std::vector<std::string>& defines)
+{
+    //the same set of defines in any order is the same permutation
+    std::vector<std::string> sortedDefines(defines);
+    std::sort(sortedDefines.begin(), sortedDefines.end());
+    sortedDefines.erase(std::unique(sortedDefines.begin(), sortedDefines.end()), sortedDefines.end());
+    std::string definesKey;
+    for(size_t i = 0; i < sortedDefines.size(); ++i){
+        definesKey += sortedDefines[i];
+        definesKey += ';';
+    }
+
+    std::string key = vertexFile + "|" + fragmentFile + "|" + definesKey;
+    std::map<std::string, Program*>::iterator found = _programs.find(key);
+    if(found != _programs.end())
+        return *found->second;
+
+    std::vector<Shader> shaders;
+    shaders.push_back(shader(vertexFile, GL_VERTEX_SHADER, sortedDefines, definesKey));
+    shaders.push_back(shader(fragmentFile, GL_FRAGMENT_SHADER, sortedDefines, definesKey));
+    Program* program = new Program(shaders);
+    _programs[key] = program;
+    return *program;
+}
+
+std::string ShaderLibrary::preprocess(const std::string& file, const std::vector<std::string>& defines) {
+    std::vector<std::string> sourceStrings;
+    std::vector<std::string> stack;
+    std::string code;
+    expandIncludes(file, sourceStrings, stack, code);
+    return Shader::addDefines(code, defines);
+}
+
+size_t ShaderLibrary::programCount() const {
+    return _programs.size();
+}
+
+size_t ShaderLibrary::shaderCount() const {
+    return _shaders.size();
+}
+
+const std::string& ShaderLibrary::readFile(const std::string& file) {
+    std::map<std::string, std::string>::iterator found = _files.find(file);
+    if(found != _files.end())
+        return found->second;
+
+    std::ifstream f;
+    f.open((_directory + file).c_str(), std::ios::in | std::ios::binary);
+    if(!f.is_open())
+        throw std::runtime_error(std::string("Failed to open file: ") + _directory + file);
+    std::stringstream buffer;
+    buffer << f.rdbuf();
+    return _files[file] = buffer.str();
+}
+
+void ShaderLibrary::expandIncludes(const std::string& file,
+                                   std::vector<std::string>& sourceStrings,
+                                   std::vector<std::string>& stack,
+                                   std::string& out)
+{
+    if(std::find(stack.begin(), stack.end(), file) != stack.end())
+        throw std::runtime_error("Shader include cycle at: " + file);
+    const std::string& text = readFile(file);
+    const size_t sourceString = sourceStrings.size();
+    sourceStrings.push_back(file);
+    stack.push_back(file);
+
+    std::istringstream lines(text);
+    std::string line;
+    unsigned lineNumber = 0;
+    while(std::getline(lines, line)){
+        ++lineNumber;
+        size_t start = line.find_first_not_of(" \t");
+        if(start == std::string::npos || line.compare(start, 8, "#include") != 0){
+            out += line;
+            out += '\n';
+            continue;
+        }
+
+        size_t open = line.find('"', start + 8);
+        size_t close = (open == std::string::npos ? std::string::npos : line.find('"', open + 1));
+        if(close == std::string::npos)
+            throw std::runtime_error("Malformed #include in " + file + ": " + line);
+        std::string included = line.substr(open + 1, close - open - 1);
+        if(std::find(stack.begin(), stack.end(), included) != stack.end())
+            throw std::runtime_error("Shader include cycle: " + file + " includes " + included);
+
+        //GLSL 1.50 numbers the line after "#line n s" as n + 1, in source string s
+        std::ostringstream directive;
+        if(std::find(sourceStrings.begin(), sourceStrings.end(), included) == sourceStrings.end()){
+            directive << "#line 0 " << sourceStrings.size() << '\n';
+            out += directive.str();
+            expandIncludes(included, sourceStrings, stack, out);
+            directive.str("");
+        }
+        directive << "#line " << lineNumber << ' ' << sourceString << '\n';
+        out += directive.str();
+    }
+
+    stack.pop_back();
+}
+
+Shader ShaderLibrary::shader(const std::string& file, GLenum shaderType, const std::vector<std::string>& defines, const std::string& definesKey) {
+    std::ostringstream key;
+    key << shaderType << '|' << file << '|' << definesKey;
+    std::map<std::string, Shader>::iterator found = _shaders.find(key.str());
+    if(found != _shaders.end())
+        return found->second;
+
+    std::vector<std::string> sourceStrings;
+    std::vector<std::string> stack;
+    std::string code;
+    expandIncludes(file, sourceStrings, stack, code);
+    try {
+        Shader compiled(Shader::addDefines(code, defines), shaderType);
+        _shaders.insert(std::make_pair(key.str(), compiled));
+        return compiled;
+    } catch(const std::exception& e) {
+        //the error gives source string numbers, so say which file each one is
+        std::ostringstream msg;
+        msg << e.what() << "\nSource strings of " << file << ":";
+        for(size_t i = 0; i < sourceStrings.size(); ++i)
+            msg << "\n  " << i << ": " << sourceStrings[i];
+        throw std::runtime_error(msg.str());
+    }
+}
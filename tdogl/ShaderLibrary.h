@@ -0,0 +1,97 @@
+/*
+ tdogl::ShaderLibrary
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "Shader.h"
+
+namespace tdogl {
+
+    class Program;
+
+    /**
+     Loads shader files from a directory, and builds the permutations of them that are asked
+     for: the same source compiled with different sets of #defines.
+
+     A permutation is compiled the first time it is asked for, and then kept, keyed by the
+     files and the set of defines. The order of the defines doesn't matter. Each file is
+     read once, and a compiled shader is shared by every program that uses it with the same
+     defines.
+
+     The sources may contain `#include "file"` lines, relative to the directory. Each file
+     is included at most once per shader, like `#pragma once`, and an include cycle is an
+     error. #line directives keep the line numbers of compile errors right, with the
+     included files numbered as source strings, in the GLSL 1.50 convention. A compile
+     error lists which file each source string number is.
+     */
+    class ShaderLibrary {
+    public:
+        /**
+         @param directory  Prefixed to every file name, e.g. "shaders/"
+         */
+        explicit ShaderLibrary(const std::string& directory);
+
+        /**
+         Deletes every program it built
+         */
+        ~ShaderLibrary();
+
+        /**
+         @result The program of `vertexFile` and `fragmentFile`, each with a #define for
+                 every one of `defines` (see tdogl::Shader::addDefines). Stays valid until
+                 the library is deleted.
+
+         @throws std::exception if a file can't be read, or the shaders don't compile or link.
+         */
+        Program& program(const std::string& vertexFile,
+                         const std::string& fragmentFile,
+                         const std::vector<std::string>& defines = std::vector<std::string>());
+
+        /**
+         @result The code that is compiled for `file` with `defines`: the includes
+                 expanded and the defines added
+         */
+        std::string preprocess(const std::string& file, const std::vector<std::string>& defines);
+
+        /** @result The number of programs built so far */
+        size_t programCount() const;
+
+        /** @result The number of shaders compiled so far */
+        size_t shaderCount() const;
+
+    private:
+        std::string _directory;
+        std::map<std::string, std::string> _files;      //the text of each file read, by name
+        std::map<std::string, Shader> _shaders;         //by type, file and defines
+        std::map<std::string, Program*> _programs;      //by files and defines
+
+        const std::string& readFile(const std::string& file);
+        void expandIncludes(const std::string& file,
+                            std::vector<std::string>& sourceStrings,
+                            std::vector<std::string>& stack,
+                            std::string& out);
+        Shader shader(const std::string& file, GLenum shaderType, const std::vector<std::string>& defines, const std::string& definesKey);
+
+        //copying disabled
+        ShaderLibrary(const ShaderLibrary&);
+        const ShaderLibrary& operator=(const ShaderLibrary&);
+    };
+
+}
@@ -17,46 +17,67 @@
  */
 
 #include "Texture.h"
+#include "GLDeleteQueue.h"
 #include <stdexcept>
 
 using namespace tdogl;
 
+//only colour bitmaps are uploaded, see ExpandToColor
 static GLenum TextureFormatForBitmapFormat(Bitmap::Format format, bool srgb)
 {
     switch (format) {
-        case Bitmap::Format_Grayscale: return GL_LUMINANCE;
-        case Bitmap::Format_GrayscaleAlpha: return GL_LUMINANCE_ALPHA;
         case Bitmap::Format_RGB: return (srgb ? GL_SRGB : GL_RGB);
         case Bitmap::Format_RGBA: return (srgb ? GL_SRGB_ALPHA : GL_RGBA);
         default: throw std::runtime_error("Unrecognised Bitmap::Format");
     }
 }
 
+//GL_LUMINANCE is gone from the core profile, and GL_RED has no sRGB format there, so
+//greyscale bitmaps are uploaded as RGB(A)
+static Bitmap ExpandToColor(const Bitmap& bitmap)
+{
+    if(bitmap.format() != Bitmap::Format_Grayscale && bitmap.format() != Bitmap::Format_GrayscaleAlpha)
+        return bitmap;
+    Bitmap::Format format = (bitmap.format() == Bitmap::Format_Grayscale ? Bitmap::Format_RGB : Bitmap::Format_RGBA);
+    Bitmap expanded(bitmap.width(), bitmap.height(), format);
+    expanded.copyRectFromBitmap(bitmap, 0, 0, 0, 0, 0, 0);
+    return expanded;
+}
+
 Texture::Texture(const Bitmap& bitmap, GLint minMagFiler, GLint wrapMode) :
     _originalWidth((GLfloat)bitmap.width()),
     _originalHeight((GLfloat)bitmap.height())
 {
+    const Bitmap colorBitmap = ExpandToColor(bitmap);
     glGenTextures(1, &_object);
     glBindTexture(GL_TEXTURE_2D, _object);
+    //a mipmap filter is only valid for minification
+    GLint magFilter = minMagFiler;
+    if(minMagFiler == GL_NEAREST_MIPMAP_NEAREST || minMagFiler == GL_NEAREST_MIPMAP_LINEAR)
+        magFilter = GL_NEAREST;
+    else if(isMipmapFilter(minMagFiler))
+        magFilter = GL_LINEAR;
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minMagFiler);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, minMagFiler);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode);
     glTexImage2D(GL_TEXTURE_2D,
                  0, 
-                 TextureFormatForBitmapFormat(bitmap.format(), true),
+                 TextureFormatForBitmapFormat(colorBitmap.format(), true),
                  (GLsizei)bitmap.width(), 
                  (GLsizei)bitmap.height(),
                  0, 
-                 TextureFormatForBitmapFormat(bitmap.format(), false),
+                 TextureFormatForBitmapFormat(colorBitmap.format(), false),
                  GL_UNSIGNED_BYTE, 
-                 bitmap.pixelBuffer());
+                 colorBitmap.pixelBuffer());
+    if(isMipmapFilter(minMagFiler))
+        glGenerateMipmap(GL_TEXTURE_2D);
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 Texture::~Texture()
 {
-    glDeleteTextures(1, &_object);
+    GLDeleteQueue::deleteTexture(_object);
 }
 
 GLuint Texture::object() const
@@ -73,3 +94,9 @@ GLfloat Texture::originalHeight() const
 {
     return _originalHeight;
 }
+
+bool Texture::isMipmapFilter(GLint minMagFilter)
+{
+    return minMagFilter == GL_NEAREST_MIPMAP_NEAREST || minMagFilter == GL_NEAREST_MIPMAP_LINEAR ||
+           minMagFilter == GL_LINEAR_MIPMAP_NEAREST || minMagFilter == GL_LINEAR_MIPMAP_LINEAR;
+}
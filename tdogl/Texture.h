@@ -25,6 +25,9 @@ namespace tdogl {
     
     /**
      Represents an OpenGL texture
+
+     The texture is deleted through tdogl::GLDeleteQueue, so the Texture can be deleted
+     on any thread.
      */
     class Texture {
     public:
@@ -36,7 +39,8 @@ namespace tdogl {
          be from the bottom row up.
          
          @param bitmap  The bitmap to load the texture from
-         @param minMagFiler  GL_NEAREST or GL_LINEAR
+         @param minMagFiler  GL_NEAREST or GL_LINEAR, or one of the GL_*_MIPMAP_* filters to
+                             generate mipmaps. Magnification then uses the filter without them.
          @param wrapMode GL_REPEAT, GL_MIRRORED_REPEAT, GL_CLAMP_TO_EDGE, or GL_CLAMP_TO_BORDER
          */
         Texture(const Bitmap& bitmap,
@@ -44,7 +48,8 @@ namespace tdogl {
                 GLint wrapMode = GL_CLAMP_TO_EDGE);
         
         /**
-         Deletes the texture object with glDeleteTextures
+         Deletes the texture object with glDeleteTextures, on the GL thread (see
+         tdogl::GLDeleteQueue)
          */
         ~Texture();
         
@@ -62,6 +67,9 @@ namespace tdogl {
          @result The original height (in pixels) of the bitmap this texture was made from
          */
         GLfloat originalHeight() const;
+
+        /** @result True if `minMagFilter` is one of the GL_*_MIPMAP_* filters */
+        static bool isMipmapFilter(GLint minMagFilter);
         
     private:
         GLuint _object;
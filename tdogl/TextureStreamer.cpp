@@ -0,0 +1,375 @@
+/*
+ tdogl::TextureStreamer
+
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "TextureStreamer.h"
+#include "Camera.h"
+#include "GLDeleteQueue.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+using namespace tdogl;
+
+//only colour bitmaps are uploaded, see ExpandToColor
+static GLenum TextureFormatForBitmapFormat(Bitmap::Format format, bool srgb) {
+    switch (format) {
+        case Bitmap::Format_RGB: return (srgb ? GL_SRGB : GL_RGB);
+        case Bitmap::Format_RGBA: return (srgb ? GL_SRGB_ALPHA : GL_RGBA);
+        default: throw std::runtime_error("Unrecognised Bitmap::Format");
+    }
+}
+
+//GL_LUMINANCE is gone from the core profile, and GL_RED has no sRGB format there, so
+//greyscale images are streamed as RGB(A)
+static Bitmap ExpandToColor(const Bitmap& image) {
+    if(image.format() != Bitmap::Format_Grayscale && image.format() != Bitmap::Format_GrayscaleAlpha)
+        return image;
+    Bitmap::Format format = (image.format() == Bitmap::Format_Grayscale ? Bitmap::Format_RGB : Bitmap::Format_RGBA);
+    Bitmap expanded(image.width(), image.height(), format);
+    expanded.copyRectFromBitmap(image, 0, 0, 0, 0, 0, 0);
+    return expanded;
+}
+
+//drivers store RGB textures as RGBA
+static size_t BytesPerPixel(Bitmap::Format format) {
+    return (format == Bitmap::Format_RGB ? 4 : (size_t)format);
+}
+
+static GLsizei MipSize(GLsizei size, unsigned mip) {
+    return std::max(1, size >> mip);
+}
+
+static unsigned MipCount(GLsizei width, GLsizei height) {
+    unsigned count = 1;
+    while(MipSize(std::max(width, height), count - 1) > 1)
+        ++count;
+    return count;
+}
+
+static unsigned TailMip(GLsizei width, GLsizei height, GLsizei tailSize) {
+    unsigned mip = 0;
+    while(MipSize(std::max(width, height), mip) > tailSize)
+        ++mip;
+    return mip;
+}
+
+TextureStreamer::TextureStreamer(const std::string& directory, size_t budgetBytes, GLsizei tailSize) :
+    _directory(directory),
+    _budget(budgetBytes),
+    _tailSize(std::max(1, tailSize)),
+    _uploadedBytes(0),
+    _pendingLoads(0),
+    _stop(false)
+{
+    _thread = std::thread(&TextureStreamer::run, this);
+}
+
+TextureStreamer::~TextureStreamer() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    _thread.join();
+
+    for(size_t i = 0; i < _requested.size(); ++i)
+        delete _requested[i];
+    for(size_t i = 0; i < _finished.size(); ++i)
+        delete _finished[i];
+    for(size_t i = 0; i < _textures.size(); ++i)
+        GLDeleteQueue::deleteTexture(_textures[i].object);
+}
+
+TextureStreamer::TextureId TextureStreamer::add(const std::string& file) {
+    Streamed texture;
+    texture.file = file;
+    texture.object = 0;
+    texture.width = 0;
+    texture.height = 0;
+    texture.format = Bitmap::Format_RGBA;
+    texture.mipCount = 1;
+    texture.tailMip = 0;
+    texture.residentMip = 1;
+    texture.desiredMip = 0;
+    texture.screenPixels = 0.0f;
+    texture.loading = false;
+
+    //a grey placeholder at mip 0, replaced by the tail when it arrives
+    static const unsigned char grey[4] = { 128, 128, 128, 255 };
+    glGenTextures(1, &texture.object);
+    glBindTexture(GL_TEXTURE_2D, texture.object);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB_ALPHA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    TextureId id = (TextureId)_textures.size();
+    _textures.push_back(texture);
+    queueLoad(id, 0, 0);
+    return id;
+}
+
+GLuint TextureStreamer::object(TextureId texture) const {
+    return _textures.at(texture).object;
+}
+
+void TextureStreamer::beginFrame() {
+    for(size_t i = 0; i < _textures.size(); ++i)
+        _textures[i].screenPixels = 0.0f;
+}
+
+void TextureStreamer::request(TextureId texture, float screenPixels) {
+    Streamed& streamed = _textures.at(texture);
+    streamed.screenPixels = std::max(streamed.screenPixels, screenPixels);
+}
+
+void TextureStreamer::update(size_t uploadBytes) {
+    //the smallest mip that still has a texel per pixel on screen
+    for(size_t i = 0; i < _textures.size(); ++i){
+        Streamed& texture = _textures[i];
+        if(texture.width == 0)
+            continue;
+        const GLsizei size = std::max(texture.width, texture.height);
+        unsigned mip = texture.tailMip;
+        if(texture.screenPixels > 0.0f){
+            mip = 0;
+            while(mip < texture.tailMip && MipSize(size, mip + 1) >= texture.screenPixels)
+                ++mip;
+        }
+        texture.desiredMip = mip;
+    }
+
+    //over the budget, the textures smallest on screen give up a mip each, until it fits
+    size_t total = 0;
+    for(size_t i = 0; i < _textures.size(); ++i)
+        total += bytesFrom(_textures[i], _textures[i].desiredMip);
+    while(total > _budget){
+        Streamed* smallest = NULL;
+        for(size_t i = 0; i < _textures.size(); ++i){
+            Streamed& texture = _textures[i];
+            if(texture.width == 0 || texture.desiredMip >= texture.tailMip)
+                continue;
+            if(!smallest || texture.screenPixels < smallest->screenPixels)
+                smallest = &texture;
+        }
+        if(!smallest)
+            break; //only tails are left
+        total -= bytesFrom(*smallest, smallest->desiredMip);
+        ++smallest->desiredMip;
+        total += bytesFrom(*smallest, smallest->desiredMip);
+    }
+
+    //free what isn't wanted before anything new goes up
+    for(size_t i = 0; i < _textures.size(); ++i){
+        Streamed& texture = _textures[i];
+        if(texture.width != 0 && texture.residentMip < texture.desiredMip)
+            evict(texture, texture.desiredMip);
+    }
+
+    //upload the finished loads, one at a time, so the rest wait for the next frame
+    size_t uploaded = 0;
+    for(;;){
+        Load* load = NULL;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(_finished.empty() || (uploaded > 0 && uploaded >= uploadBytes))
+                break;
+            load = _finished.front();
+            _finished.pop_front();
+        }
+        --_pendingLoads;
+        _textures[load->texture].loading = false;
+        if(!load->error.empty()){
+            std::string msg = "Failed to stream texture " + load->file + ": " + load->error;
+            delete load;
+            throw std::runtime_error(msg);
+        }
+        size_t before = (size_t)_uploadedBytes;
+        upload(*load);
+        uploaded += (size_t)_uploadedBytes - before;
+        delete load;
+    }
+
+    //ask for the mips that are missing
+    for(size_t i = 0; i < _textures.size(); ++i){
+        Streamed& texture = _textures[i];
+        if(texture.width != 0 && !texture.loading && texture.desiredMip < texture.residentMip)
+            queueLoad((TextureId)i, texture.desiredMip, texture.residentMip);
+    }
+}
+
+float TextureStreamer::screenPixels(const Camera& camera, const glm::vec3& center, float radius, float viewportHeight) {
+    float distance = std::max(glm::length(center - camera.position()), camera.nearPlane());
+    float tanHalfFov = std::tan(glm::radians(0.5f * camera.fieldOfView()));
+    return viewportHeight * radius / (distance * tanHalfFov);
+}
+
+unsigned TextureStreamer::residentMip(TextureId texture) const {
+    return _textures.at(texture).residentMip;
+}
+
+unsigned TextureStreamer::desiredMip(TextureId texture) const {
+    return _textures.at(texture).desiredMip;
+}
+
+size_t TextureStreamer::budget() const {
+    return _budget;
+}
+
+void TextureStreamer::setBudget(size_t budgetBytes) {
+    _budget = budgetBytes;
+}
+
+size_t TextureStreamer::residentBytes() const {
+    size_t total = 0;
+    for(size_t i = 0; i < _textures.size(); ++i)
+        total += bytesFrom(_textures[i], _textures[i].residentMip);
+    return total;
+}
+
+unsigned long long TextureStreamer::uploadedBytes() const {
+    return _uploadedBytes;
+}
+
+unsigned TextureStreamer::pendingLoads() const {
+    return _pendingLoads;
+}
+
+void TextureStreamer::run() {
+    for(;;){
+        Load* load = NULL;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while(!_stop && _requested.empty())
+                _wake.wait(lock);
+            if(_stop)
+                return;
+            load = _requested.front();
+            _requested.pop_front();
+        }
+
+        try {
+            decode(*load);
+        } catch(const std::exception& e) {
+            load->error = e.what();
+            load->mips.clear();
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _finished.push_back(load);
+    }
+}
+
+void TextureStreamer::decode(Load& load) const {
+    Bitmap image = ExpandToColor(Bitmap::bitmapFromFile(_directory + load.file));
+    image.flipVertically();
+    load.width = (GLsizei)image.width();
+    load.height = (GLsizei)image.height();
+    if(load.endMip == 0){
+        load.firstMip = TailMip(load.width, load.height, _tailSize);
+        load.endMip = MipCount(load.width, load.height);
+    }
+
+    for(unsigned mip = 0; mip < load.endMip; ++mip){
+        if(mip >= load.firstMip)
+            load.mips.push_back(image);
+        if(mip + 1 < load.endMip)
+            image = image.halfSize();
+    }
+}
+
+void TextureStreamer::upload(Load& load) {
+    Streamed& texture = _textures[load.texture];
+    const bool placeholder = (texture.width == 0);
+    if(placeholder){
+        texture.width = load.width;
+        texture.height = load.height;
+        texture.format = load.mips.front().format();
+        texture.mipCount = MipCount(load.width, load.height);
+        texture.tailMip = TailMip(load.width, load.height, _tailSize);
+        texture.residentMip = texture.mipCount;
+        texture.desiredMip = texture.tailMip;
+    }
+
+    //only the mips that join up with the resident ones, and are still wanted. If mips
+    //were evicted since the load was asked for, it no longer joins up.
+    if(load.endMip < texture.residentMip)
+        return;
+    const unsigned first = std::max(load.firstMip, std::min(texture.desiredMip, texture.tailMip));
+    if(first >= texture.residentMip)
+        return;
+
+    const GLenum internalFormat = TextureFormatForBitmapFormat(texture.format, true);
+    const GLenum format = TextureFormatForBitmapFormat(texture.format, false);
+    glBindTexture(GL_TEXTURE_2D, texture.object);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); //the small mips of RGB rows aren't 4 byte aligned
+    for(unsigned mip = first; mip < texture.residentMip; ++mip){
+        const Bitmap& bitmap = load.mips[mip - load.firstMip];
+        glTexImage2D(GL_TEXTURE_2D, (GLint)mip, internalFormat, (GLsizei)bitmap.width(), (GLsizei)bitmap.height(),
+                     0, format, GL_UNSIGNED_BYTE, bitmap.pixelBuffer());
+        _uploadedBytes += (size_t)bitmap.width() * bitmap.height() * BytesPerPixel(texture.format);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    if(placeholder && first > 0){
+        //free the grey pixel
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, 0, 0, 0, format, GL_UNSIGNED_BYTE, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)first);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)texture.mipCount - 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    texture.residentMip = first;
+}
+
+void TextureStreamer::evict(Streamed& texture, unsigned newResidentMip) {
+    //only the base level and up are sampled, so the mips below it can be emptied
+    const GLenum internalFormat = TextureFormatForBitmapFormat(texture.format, true);
+    const GLenum format = TextureFormatForBitmapFormat(texture.format, false);
+    glBindTexture(GL_TEXTURE_2D, texture.object);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)newResidentMip);
+    for(unsigned mip = texture.residentMip; mip < newResidentMip; ++mip)
+        glTexImage2D(GL_TEXTURE_2D, (GLint)mip, internalFormat, 0, 0, 0, format, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    texture.residentMip = newResidentMip;
+}
+
+void TextureStreamer::queueLoad(TextureId texture, unsigned firstMip, unsigned endMip) {
+    Load* load = new Load;
+    load->texture = texture;
+    load->file = _textures[texture].file;
+    load->firstMip = firstMip;
+    load->endMip = endMip;
+    load->width = 0;
+    load->height = 0;
+    _textures[texture].loading = true;
+    ++_pendingLoads;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _requested.push_back(load);
+    }
+    _wake.notify_one();
+}
+
+size_t TextureStreamer::bytesFrom(const Streamed& texture, unsigned mip) const {
+    size_t bytes = 0;
+    for(unsigned level = mip; level < texture.mipCount && texture.width != 0; ++level)
+        bytes += (size_t)MipSize(texture.width, level) * MipSize(texture.height, level) * BytesPerPixel(texture.format);
+    return bytes;
+}
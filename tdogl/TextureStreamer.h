@@ -0,0 +1,174 @@
+/*
+ tdogl::TextureStreamer
+
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "Bitmap.h"
+
+namespace tdogl {
+
+    class Camera;
+
+    /**
+     Keeps each texture at the level of detail it is seen at, within a budget of video memory.
+
+     A texture starts with only its small mips: the ones no bigger than `tailSize`, which
+     always stay resident. Each frame, the caller reports how many pixels tall the instances
+     using it are on screen, and that picks the mip it needs. A background thread decodes
+     the file and makes the missing mips, and `update` uploads them a few at a time. Mips
+     that are no longer needed are freed right away.
+
+     When the mips wanted add up to more than the budget, the textures that are smallest on
+     screen get one mip less, until they fit.
+
+     The GL texture object of a texture never changes, so it can be recorded in draw
+     commands. Until the first mips arrive, it is a grey pixel.
+     */
+    class TextureStreamer {
+    public:
+        typedef unsigned TextureId;
+        static const TextureId NoTexture = 0xFFFFFFFF;
+
+        /**
+         @param directory    Prefixed to every file name, e.g. "textures/"
+         @param budgetBytes  Of all the streamed textures together
+         @param tailSize     Mips this big or smaller are loaded first and never evicted
+         */
+        TextureStreamer(const std::string& directory, size_t budgetBytes, GLsizei tailSize = 64);
+
+        /** Stops the background thread, and deletes the textures */
+        ~TextureStreamer();
+
+        /**
+         Starts streaming an image file. It is flipped so the first row is the bottom one,
+         as OpenGL expects.
+         */
+        TextureId add(const std::string& file);
+
+        /** @result The GL texture object, the same for the whole life of the texture */
+        GLuint object(TextureId texture) const;
+
+        /**
+         Forgets the footprints of the last frame. Call before the `request`s of a frame.
+         */
+        void beginFrame();
+
+        /**
+         Reports that `texture` covers about `screenPixels` pixels, top to bottom, on an
+         instance this frame. A texture that gets no requests in a frame only keeps its tail.
+         */
+        void request(TextureId texture, float screenPixels);
+
+        /**
+         Picks the mips to keep, frees the ones not needed, queues the loads of the missing
+         ones, and uploads the loads that have finished.
+
+         @param uploadBytes  Stops uploading once this many bytes went up this frame. At
+                             least one load is uploaded, however big.
+
+         @throws std::exception if a file failed to load.
+         */
+        void update(size_t uploadBytes);
+
+        /**
+         @result About how many pixels tall the sphere at `center` is on a viewport
+                 `viewportHeight` pixels tall
+         */
+        static float screenPixels(const Camera& camera, const glm::vec3& center, float radius, float viewportHeight);
+
+        /** @result The most detailed mip resident, 0 for full size */
+        unsigned residentMip(TextureId texture) const;
+
+        /** @result The mip picked by the last `update` */
+        unsigned desiredMip(TextureId texture) const;
+
+        size_t budget() const;
+        void setBudget(size_t budgetBytes);
+
+        /** @result The bytes of all the resident mips */
+        size_t residentBytes() const;
+
+        /** @result The bytes uploaded so far, in total */
+        unsigned long long uploadedBytes() const;
+
+        /** @result The number of loads queued or being decoded */
+        unsigned pendingLoads() const;
+
+    private:
+        struct Streamed {
+            std::string file;
+            GLuint object;
+            GLsizei width;          //of mip 0, 0 until the first load finishes
+            GLsizei height;
+            Bitmap::Format format;
+            unsigned mipCount;
+            unsigned tailMip;       //the first mip no bigger than the tail size
+            unsigned residentMip;   //mipCount while only the placeholder is there
+            unsigned desiredMip;
+            float screenPixels;     //the biggest request this frame
+            bool loading;
+        };
+
+        //the mips [firstMip, endMip) of a texture. A load of the tail has endMip 0, as the
+        //size isn't known until the file is decoded.
+        struct Load {
+            TextureId texture;
+            std::string file;
+            unsigned firstMip;
+            unsigned endMip;
+            GLsizei width;
+            GLsizei height;
+            std::vector<Bitmap> mips;
+            std::string error;
+        };
+
+        std::string _directory;
+        size_t _budget;
+        GLsizei _tailSize;
+        std::vector<Streamed> _textures;
+        unsigned long long _uploadedBytes;
+        unsigned _pendingLoads;
+
+        //shared with the background thread
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::deque<Load*> _requested;
+        std::deque<Load*> _finished;
+        bool _stop;
+        std::thread _thread;
+
+        void run();
+        void decode(Load& load) const;
+        void upload(Load& load);
+        void evict(Streamed& texture, unsigned newResidentMip);
+        void queueLoad(TextureId texture, unsigned firstMip, unsigned endMip);
+        size_t bytesFrom(const Streamed& texture, unsigned mip) const;
+
+        //copying disabled
+        TextureStreamer(const TextureStreamer&);
+        const TextureStreamer& operator=(const TextureStreamer&);
+    };
+
+}
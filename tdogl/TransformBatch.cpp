@@ -0,0 +1,151 @@
+/*
+ tdogl::TransformBatch
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "TransformBatch.h"
+#include <glm/gtc/matrix_inverse.hpp>
+
+#if (GLM_ARCH & GLM_ARCH_SSE2)
+#include <glm/gtx/simd_mat4.hpp>
+#include <glm/gtx/simd_vec4.hpp>
+#define TDOGL_TRANSFORM_SIMD 1
+#endif
+
+using namespace tdogl;
+
+#ifdef TDOGL_TRANSFORM_SIMD
+
+// glm::mat4 is column major, so each column is one unaligned 4 float load
+static glm::simdMat4 LoadMatrix(const glm::mat4& m) {
+    const float* p = &m[0][0];
+    __m128 columns[4] = { _mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8), _mm_loadu_ps(p + 12) };
+    return glm::simdMat4(columns);
+}
+
+static glm::simdVec4 LoadVec3(const glm::vec3& v, float w) {
+    return glm::simdVec4(v, w);
+}
+
+// glm 0.9.6's abs(simdVec4) masks with a constant that is initialised to zero, so it
+// always returns zero. Clearing the sign bits here instead.
+static glm::simdVec4 Abs(const glm::simdVec4& v) {
+    return glm::simdVec4(_mm_andnot_ps(_mm_set1_ps(-0.0f), v.Data));
+}
+
+static void StoreVec3(const glm::simdVec4& v, glm::vec3& out) {
+    glm::vec4 result = glm::vec4_cast(v);
+    out = glm::vec3(result);
+}
+
+bool TransformBatch::simdEnabled() {
+    return true;
+}
+
+void TransformBatch::multiply(const glm::mat4& viewProjection, const glm::mat4* models, glm::mat4* out, size_t count) {
+    glm::simdMat4 vp = LoadMatrix(viewProjection);
+    for(size_t i = 0; i < count; ++i){
+        glm::simdMat4 result = vp * LoadMatrix(models[i]);
+        float* p = &out[i][0][0];
+        _mm_storeu_ps(p, result[0].Data);
+        _mm_storeu_ps(p + 4, result[1].Data);
+        _mm_storeu_ps(p + 8, result[2].Data);
+        _mm_storeu_ps(p + 12, result[3].Data);
+    }
+}
+
+void TransformBatch::normalMatrices(const glm::mat4* models, glm::mat3* out, size_t count) {
+    for(size_t i = 0; i < count; ++i){
+        glm::simdMat4 m = LoadMatrix(models[i]);
+
+        //the rows of inverse(A) are the cross products of A's columns divided by det(A),
+        //so they are the columns of transpose(inverse(A))
+        glm::simdVec4 c0 = glm::cross(m[1], m[2]);
+        glm::simdVec4 c1 = glm::cross(m[2], m[0]);
+        glm::simdVec4 c2 = glm::cross(m[0], m[1]);
+        glm::simdVec4 invDet(1.0f / glm::dot(m[0], c0));
+
+        //a mat3 is 9 packed floats: the 4th lane of each store is overwritten by the next column
+        float* p = &out[i][0][0];
+        _mm_storeu_ps(p, (c0 * invDet).Data);
+        _mm_storeu_ps(p + 3, (c1 * invDet).Data);
+        glm::vec4 last = glm::vec4_cast(c2 * invDet);
+        p[6] = last.x;
+        p[7] = last.y;
+        p[8] = last.z;
+    }
+}
+
+void TransformBatch::transformBoxes(const glm::mat4* models,
+                                    const glm::vec3* boxMin,
+                                    const glm::vec3* boxMax,
+                                    glm::vec3* outMin,
+                                    glm::vec3* outMax,
+                                    size_t count)
+{
+    const glm::simdVec4 half(0.5f);
+    for(size_t i = 0; i < count; ++i){
+        glm::simdMat4 m = LoadMatrix(models[i]);
+        glm::simdVec4 mn = LoadVec3(boxMin[i], 1.0f);
+        glm::simdVec4 mx = LoadVec3(boxMax[i], 1.0f);
+        glm::simdVec4 center = (mn + mx) * half;
+        glm::simdVec4 extent = (mx - mn) * half;
+
+        //the center is transformed as a point, the extent by the absolute rotation and scale
+        glm::simdVec4 worldCenter = m * center;
+        glm::simdVec4 worldExtent = Abs(m[0]) * glm::simdVec4(_mm_shuffle_ps(extent.Data, extent.Data, _MM_SHUFFLE(0, 0, 0, 0)))
+                                  + Abs(m[1]) * glm::simdVec4(_mm_shuffle_ps(extent.Data, extent.Data, _MM_SHUFFLE(1, 1, 1, 1)))
+                                  + Abs(m[2]) * glm::simdVec4(_mm_shuffle_ps(extent.Data, extent.Data, _MM_SHUFFLE(2, 2, 2, 2)));
+        StoreVec3(worldCenter - worldExtent, outMin[i]);
+        StoreVec3(worldCenter + worldExtent, outMax[i]);
+    }
+}
+
+#else
+
+bool TransformBatch::simdEnabled() {
+    return false;
+}
+
+void TransformBatch::multiply(const glm::mat4& viewProjection, const glm::mat4* models, glm::mat4* out, size_t count) {
+    for(size_t i = 0; i < count; ++i)
+        out[i] = viewProjection * models[i];
+}
+
+void TransformBatch::normalMatrices(const glm::mat4* models, glm::mat3* out, size_t count) {
+    for(size_t i = 0; i < count; ++i)
+        out[i] = glm::inverseTranspose(glm::mat3(models[i]));
+}
+
+void TransformBatch::transformBoxes(const glm::mat4* models,
+                                    const glm::vec3* boxMin,
+                                    const glm::vec3* boxMax,
+                                    glm::vec3* outMin,
+                                    glm::vec3* outMax,
+                                    size_t count)
+{
+    for(size_t i = 0; i < count; ++i){
+        const glm::mat4& m = models[i];
+        glm::vec3 center = 0.5f * (boxMin[i] + boxMax[i]);
+        glm::vec3 extent = 0.5f * (boxMax[i] - boxMin[i]);
+        glm::vec3 worldCenter = glm::vec3(m * glm::vec4(center, 1.0f));
+        glm::vec3 worldExtent = glm::abs(glm::vec3(m[0])) * extent.x
+                              + glm::abs(glm::vec3(m[1])) * extent.y
+                              + glm::abs(glm::vec3(m[2])) * extent.z;
+        outMin[i] = worldCenter - worldExtent;
+        outMax[i] = worldCenter + worldExtent;
+    }
+}
+
+#endif
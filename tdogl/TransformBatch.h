@@ -0,0 +1,65 @@
+/*
+ tdogl::TransformBatch
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+
+namespace tdogl {
+
+    /**
+     Transforms arrays of matrices and bounding boxes four floats at a time, using glm's
+     SSE types (glm::simdMat4 and glm::simdVec4 from glm/gtx/simd_mat4.hpp).
+
+     The model matrices must be affine, i.e. have a bottom row of (0, 0, 0, 1). If the
+     compiler doesn't target SSE2, plain glm is used and the results are the same. The
+     arrays don't need any particular alignment.
+     */
+    class TransformBatch {
+    public:
+        /** @result True if the SSE code path is compiled in */
+        static bool simdEnabled();
+
+        /**
+         out[i] = viewProjection * models[i]
+
+         `out` may be the same array as `models`.
+         */
+        static void multiply(const glm::mat4& viewProjection,
+                             const glm::mat4* models,
+                             glm::mat4* out,
+                             size_t count);
+
+        /**
+         out[i] = transpose(inverse(mat3(models[i]))), the matrix that transforms normals to
+         world space.
+         */
+        static void normalMatrices(const glm::mat4* models, glm::mat3* out, size_t count);
+
+        /**
+         Transforms object space axis aligned boxes, giving the world space axis aligned boxes
+         that enclose them. Same results as tdogl::Frustum::transformBox.
+         */
+        static void transformBoxes(const glm::mat4* models,
+                                   const glm::vec3* boxMin,
+                                   const glm::vec3* boxMax,
+                                   glm::vec3* outMin,
+                                   glm::vec3* outMax,
+                                   size_t count);
+    };
+
+}
@@ -0,0 +1,84 @@
+/*
+ tdogl::TripleBuffer
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+
+namespace tdogl {
+
+    /**
+     Passes the newest value of a T from one writer thread to one reader thread, without
+     locks and without either thread ever waiting for the other.
+
+     The writer fills `writeBuffer` and calls `publish`. The reader calls `consume`, and
+     if that returns true, `readBuffer` is the most recently published value. Values that
+     are published while the reader is busy are skipped, never queued.
+
+     Each thread must only use its own half of the interface.
+     */
+    template <typename T>
+    class TripleBuffer {
+    public:
+        TripleBuffer() :
+            _write(0),
+            _middle(1),
+            _read(2)
+        {
+        }
+
+        /** Writer: the buffer to fill. It holds an old value, not the last one published. */
+        T& writeBuffer() {
+            return _buffers[_write];
+        }
+
+        /** Writer: makes `writeBuffer` available to the reader, and starts a new one */
+        void publish() {
+            _write = _middle.exchange(_write | FreshBit) & IndexMask;
+        }
+
+        /**
+         Reader: switches `readBuffer` to the newest published value.
+
+         @result False if nothing was published since the last call
+         */
+        bool consume() {
+            if((_middle.load() & FreshBit) == 0)
+                return false;
+            _read = _middle.exchange(_read) & IndexMask;
+            return true;
+        }
+
+        /** Reader: the value taken by the last successful `consume` */
+        const T& readBuffer() const {
+            return _buffers[_read];
+        }
+
+    private:
+        static const unsigned IndexMask = 3;
+        static const unsigned FreshBit = 4;
+
+        T _buffers[3];
+        unsigned _write;
+        std::atomic<unsigned> _middle; //index of the buffer between writer and reader, plus FreshBit
+        unsigned _read;
+
+        //copying disabled
+        TripleBuffer(const TripleBuffer&);
+        const TripleBuffer& operator=(const TripleBuffer&);
+    };
+
+}
@@ -0,0 +1,488 @@
+/*
+ tdogl::VirtualTexture
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "VirtualTexture.h"
+#include <stdexcept>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+
+using namespace tdogl;
+
+static const unsigned NoPage = 0xFFFFFFFF;
+
+//tiles are keyed by mip, row and column, a byte each
+static unsigned TileKey(unsigned mip, unsigned x, unsigned y) {
+    return (mip << 16) | (y << 8) | x;
+}
+
+static unsigned TileMip(unsigned tile) { return tile >> 16; }
+static unsigned TileY(unsigned tile) { return (tile >> 8) & 0xFF; }
+static unsigned TileX(unsigned tile) { return tile & 0xFF; }
+
+static std::string TileFileName(unsigned mip, unsigned x, unsigned y) {
+    std::ostringstream name;
+    name << "tile_" << mip << "_" << x << "_" << y << ".png";
+    return name.str();
+}
+
+static bool IsPowerOfTwo(unsigned n) {
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+//the number of mips until one tile covers the image
+static unsigned MipCountForTiles(unsigned size, unsigned tileSize) {
+    unsigned count = 1;
+    while((size >> (count - 1)) > tileSize)
+        ++count;
+    return count;
+}
+
+void VirtualTexture::bake(const std::string& imagePath, const std::string& directory, unsigned tileSize, unsigned border) {
+    Bitmap image = Bitmap::bitmapFromFile(imagePath);
+    image.flipVertically();
+    const unsigned size = image.width();
+    if(image.height() != size || !IsPowerOfTwo(size))
+        throw std::runtime_error("A virtual texture must be square, and a power of two wide: " + imagePath);
+    if(!IsPowerOfTwo(tileSize) || tileSize > size || size / tileSize > 256)
+        throw std::runtime_error("A virtual texture tile must be a power of two, with at most 256 along each side of the image");
+    if(border > tileSize)
+        throw std::runtime_error("A virtual texture tile border can't be wider than the tile");
+
+    const unsigned mipCount = MipCountForTiles(size, tileSize);
+    const unsigned pageSize = tileSize + 2 * border;
+    for(unsigned mip = 0; mip < mipCount; ++mip){
+        //the image with its edges repeated around it, so every tile has a full border
+        const unsigned mipSize = image.width();
+        Bitmap padded(mipSize + 2 * border, mipSize + 2 * border, image.format());
+        padded.copyRectFromBitmap(image, 0, 0, border, border, mipSize, mipSize);
+        for(unsigned i = 0; i < border; ++i){
+            padded.copyRectFromBitmap(padded, border, border, i, border, 1, mipSize);
+            padded.copyRectFromBitmap(padded, border + mipSize - 1, border, border + mipSize + i, border, 1, mipSize);
+        }
+        for(unsigned i = 0; i < border; ++i){
+            padded.copyRectFromBitmap(padded, 0, border, 0, i, mipSize + 2 * border, 1);
+            padded.copyRectFromBitmap(padded, 0, border + mipSize - 1, 0, border + mipSize + i, mipSize + 2 * border, 1);
+        }
+
+        //saved the right way up, so the files can be looked at
+        const unsigned tilesAcross = mipSize / tileSize;
+        Bitmap tile(pageSize, pageSize, image.format());
+        for(unsigned y = 0; y < tilesAcross; ++y){
+            for(unsigned x = 0; x < tilesAcross; ++x){
+                tile.copyRectFromBitmap(padded, x * tileSize, y * tileSize, 0, 0, pageSize, pageSize);
+                tile.flipVertically();
+                tile.saveToPngFile(directory + TileFileName(mip, x, y));
+            }
+        }
+
+        if(mip + 1 < mipCount)
+            image = image.halfSize();
+    }
+
+    std::ofstream info((directory + "info.txt").c_str());
+    info << "size " << size << "\n"
+         << "tileSize " << tileSize << "\n"
+         << "border " << border << "\n"
+         << "mipCount " << mipCount << "\n";
+    if(!info)
+        throw std::runtime_error("Failed to write file: " + directory + "info.txt");
+}
+
+//a tile file as RGBA rows from the bottom up, ready to upload
+static Bitmap LoadTile(const std::string& path, unsigned pageSize) {
+    Bitmap tile = Bitmap::bitmapFromFile(path);
+    if(tile.width() != pageSize || tile.height() != pageSize)
+        throw std::runtime_error("Virtual texture tile is the wrong size: " + path);
+    tile.flipVertically();
+    if(tile.format() == Bitmap::Format_RGBA)
+        return tile;
+    Bitmap rgba(pageSize, pageSize, Bitmap::Format_RGBA);
+    rgba.copyRectFromBitmap(tile, 0, 0, 0, 0, 0, 0);
+    return rgba;
+}
+
+VirtualTexture::VirtualTexture(const std::string& directory, unsigned cacheSide, GLsizei feedbackWidth, GLsizei feedbackHeight) :
+    _directory(directory),
+    _size(0),
+    _tileSize(0),
+    _border(0),
+    _mipCount(0),
+    _cacheSide(cacheSide),
+    _feedbackWidth(feedbackWidth),
+    _feedbackHeight(feedbackHeight),
+    _cache(0),
+    _indirection(0),
+    _feedbackFramebuffer(0),
+    _feedbackColor(0),
+    _feedbackDepth(0),
+    _feedbackIndex(0),
+    _feedbackPending(false),
+    _previousFramebuffer(0),
+    _frame(1),
+    _uploadedTiles(0),
+    _indirectionDirty(true),
+    _stop(false)
+{
+    _feedbackBuffers[0] = _feedbackBuffers[1] = 0;
+    if(cacheSide == 0 || cacheSide > 256 || feedbackWidth <= 0 || feedbackHeight <= 0)
+        throw std::runtime_error("Invalid virtual texture cache or feedback size");
+
+    std::ifstream info((directory + "info.txt").c_str());
+    if(!info.is_open())
+        throw std::runtime_error("Failed to open file: " + directory + "info.txt");
+    std::string key;
+    unsigned value = 0;
+    while(info >> key >> value){
+        if(key == "size") _size = value;
+        else if(key == "tileSize") _tileSize = value;
+        else if(key == "border") _border = value;
+        else if(key == "mipCount") _mipCount = value;
+    }
+    if(!IsPowerOfTwo(_size) || !IsPowerOfTwo(_tileSize) || _tileSize > _size || _size / _tileSize > 256 ||
+       _mipCount != MipCountForTiles(_size, _tileSize))
+        throw std::runtime_error("Invalid virtual texture info: " + directory + "info.txt");
+
+    //the last mip, which is always there to fall back to
+    const unsigned pageSize = _tileSize + 2 * _border;
+    const unsigned lastTile = TileKey(_mipCount - 1, 0, 0);
+    Bitmap lastBitmap = LoadTile(tilePath(lastTile), pageSize);
+
+    glGenTextures(1, &_cache);
+    glBindTexture(GL_TEXTURE_2D, _cache);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, (GLsizei)(cacheSide * pageSize), (GLsizei)(cacheSide * pageSize),
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    //a texel per tile, in a mip chain of its own that lines up with the tiles of each mip
+    glGenTextures(1, &_indirection);
+    glBindTexture(GL_TEXTURE_2D, _indirection);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)_mipCount - 1);
+    for(unsigned mip = 0; mip < _mipCount; ++mip)
+        glTexImage2D(GL_TEXTURE_2D, (GLint)mip, GL_RGBA8, (GLsizei)tilesAcross(mip), (GLsizei)tilesAcross(mip),
+                     0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenRenderbuffers(1, &_feedbackColor);
+    glBindRenderbuffer(GL_RENDERBUFFER, _feedbackColor);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, feedbackWidth, feedbackHeight);
+    glGenRenderbuffers(1, &_feedbackDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, _feedbackDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedbackWidth, feedbackHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &_feedbackFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, _feedbackFramebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, _feedbackColor);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _feedbackDepth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if(status != GL_FRAMEBUFFER_COMPLETE){
+        deleteObjects();
+        std::ostringstream msg;
+        msg << "Virtual texture feedback framebuffer incomplete, status 0x" << std::hex << status;
+        throw std::runtime_error(msg.str());
+    }
+
+    glGenBuffers(2, _feedbackBuffers);
+    for(unsigned i = 0; i < 2; ++i){
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, _feedbackBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)feedbackWidth * feedbackHeight * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    //page 0 holds the last mip for good
+    Page empty;
+    empty.tile = -1;
+    empty.lastUsedFrame = 0;
+    _pages.assign(cacheSide * cacheSide, empty);
+    _pages[0].tile = (int)lastTile;
+    _pagesByTile[lastTile] = 0;
+    uploadTile(0, lastBitmap);
+    updateIndirection();
+
+    _thread = std::thread(&VirtualTexture::run, this);
+}
+
+VirtualTexture::~VirtualTexture() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    _thread.join();
+
+    for(size_t i = 0; i < _requested.size(); ++i)
+        delete _requested[i];
+    for(size_t i = 0; i < _finished.size(); ++i)
+        delete _finished[i];
+    deleteObjects();
+}
+
+GLuint VirtualTexture::cacheTexture() const {
+    return _cache;
+}
+
+GLuint VirtualTexture::indirectionTexture() const {
+    return _indirection;
+}
+
+unsigned VirtualTexture::size() const {
+    return _size;
+}
+
+unsigned VirtualTexture::tileSize() const {
+    return _tileSize;
+}
+
+unsigned VirtualTexture::border() const {
+    return _border;
+}
+
+unsigned VirtualTexture::mipCount() const {
+    return _mipCount;
+}
+
+unsigned VirtualTexture::cacheSide() const {
+    return _cacheSide;
+}
+
+GLsizei VirtualTexture::feedbackWidth() const {
+    return _feedbackWidth;
+}
+
+GLsizei VirtualTexture::feedbackHeight() const {
+    return _feedbackHeight;
+}
+
+void VirtualTexture::bindFeedback() {
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &_previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, _previousViewport);
+
+    //alpha 0 is "no surface here", so the caller's clear color is left alone
+    static const GLfloat none[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    static const GLfloat farDepth = 1.0f;
+    glBindFramebuffer(GL_FRAMEBUFFER, _feedbackFramebuffer);
+    glViewport(0, 0, _feedbackWidth, _feedbackHeight);
+    glDepthMask(GL_TRUE);
+    glClearBufferfv(GL_COLOR, 0, none);
+    glClearBufferfv(GL_DEPTH, 0, &farDepth);
+}
+
+void VirtualTexture::readFeedback() {
+    //into a buffer, so the read finishes in the background, and is looked at next frame
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _feedbackBuffers[_feedbackIndex]);
+    glReadPixels(0, 0, _feedbackWidth, _feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)_previousFramebuffer);
+    glViewport(_previousViewport[0], _previousViewport[1], _previousViewport[2], _previousViewport[3]);
+
+    const unsigned previous = 1 - _feedbackIndex;
+    if(_feedbackPending){
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, _feedbackBuffers[previous]);
+        const unsigned char* pixels = (const unsigned char*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if(pixels){
+            requestTiles(pixels, (size_t)_feedbackWidth * _feedbackHeight);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    _feedbackPending = true;
+    _feedbackIndex = previous;
+}
+
+void VirtualTexture::update(unsigned maxTiles) {
+    for(unsigned uploaded = 0; uploaded < maxTiles; ++uploaded){
+        TileLoad* load = NULL;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(_finished.empty())
+                break;
+            load = _finished.front();
+            _finished.pop_front();
+        }
+        _pendingTiles.erase(load->tile);
+        if(!load->error.empty()){
+            std::string msg = "Failed to load virtual texture tile " + tilePath(load->tile) + ": " + load->error;
+            delete load;
+            throw std::runtime_error(msg);
+        }
+
+        //an empty page, or else the one needed longest ago. Never one needed this frame,
+        //and never page 0. If there is none, the tile is asked for again later.
+        unsigned page = NoPage;
+        for(unsigned i = 1; i < _pages.size(); ++i){
+            if(_pages[i].tile < 0){
+                page = i;
+                break;
+            }
+            if(_pages[i].lastUsedFrame < _frame && (page == NoPage || _pages[i].lastUsedFrame < _pages[page].lastUsedFrame))
+                page = i;
+        }
+        if(page != NoPage){
+            if(_pages[page].tile >= 0)
+                _pagesByTile.erase((unsigned)_pages[page].tile);
+            _pages[page].tile = (int)load->tile;
+            _pages[page].lastUsedFrame = _frame;
+            _pagesByTile[load->tile] = page;
+            uploadTile(page, load->bitmap);
+            _indirectionDirty = true;
+        }
+        delete load;
+    }
+
+    if(_indirectionDirty)
+        updateIndirection();
+    ++_frame;
+}
+
+unsigned VirtualTexture::residentPages() const {
+    return (unsigned)_pagesByTile.size();
+}
+
+unsigned VirtualTexture::pendingTiles() const {
+    return (unsigned)_pendingTiles.size();
+}
+
+unsigned long long VirtualTexture::uploadedTiles() const {
+    return _uploadedTiles;
+}
+
+void VirtualTexture::run() {
+    const unsigned pageSize = _tileSize + 2 * _border;
+    for(;;){
+        TileLoad* load = NULL;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while(!_stop && _requested.empty())
+                _wake.wait(lock);
+            if(_stop)
+                return;
+            load = _requested.front();
+            _requested.pop_front();
+        }
+
+        try {
+            load->bitmap = LoadTile(tilePath(load->tile), pageSize);
+        } catch(const std::exception& e) {
+            load->error = e.what();
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _finished.push_back(load);
+    }
+}
+
+std::string VirtualTexture::tilePath(unsigned tile) const {
+    return _directory + TileFileName(TileMip(tile), TileX(tile), TileY(tile));
+}
+
+unsigned VirtualTexture::tilesAcross(unsigned mip) const {
+    return std::max(1u, (_size / _tileSize) >> mip);
+}
+
+void VirtualTexture::requestTiles(const unsigned char* pixels, size_t pixelCount) {
+    //each pixel names the tile it sampled: x, y and mip in red, green and blue
+    std::set<unsigned> seen;
+    for(size_t i = 0; i < pixelCount; ++i){
+        const unsigned char* pixel = pixels + 4 * i;
+        if(pixel[3] != 255)
+            continue;
+        const unsigned mip = pixel[2];
+        if(mip < _mipCount && pixel[0] < tilesAcross(mip) && pixel[1] < tilesAcross(mip))
+            seen.insert(TileKey(mip, pixel[0], pixel[1]));
+    }
+
+    //each tile needs the ones above it too, to fall back on while it loads
+    std::set<unsigned> needed;
+    for(std::set<unsigned>::const_iterator it = seen.begin(); it != seen.end(); ++it){
+        unsigned x = TileX(*it), y = TileY(*it);
+        for(unsigned mip = TileMip(*it); mip < _mipCount; ++mip, x >>= 1, y >>= 1){
+            if(!needed.insert(TileKey(mip, x, y)).second)
+                break;
+        }
+    }
+
+    //the coarsest first, since they cover the most
+    std::vector<TileLoad*> loads;
+    for(std::set<unsigned>::const_reverse_iterator it = needed.rbegin(); it != needed.rend(); ++it){
+        std::map<unsigned, unsigned>::const_iterator found = _pagesByTile.find(*it);
+        if(found != _pagesByTile.end())
+            _pages[found->second].lastUsedFrame = _frame;
+        else if(_pendingTiles.insert(*it).second)
+            loads.push_back(new TileLoad(*it));
+    }
+
+    if(!loads.empty()){
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _requested.insert(_requested.end(), loads.begin(), loads.end());
+        }
+        _wake.notify_one();
+    }
+}
+
+void VirtualTexture::uploadTile(unsigned page, const Bitmap& tile) {
+    const unsigned pageSize = _tileSize + 2 * _border;
+    glBindTexture(GL_TEXTURE_2D, _cache);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (GLint)((page % _cacheSide) * pageSize), (GLint)((page / _cacheSide) * pageSize),
+                    (GLsizei)pageSize, (GLsizei)pageSize, GL_RGBA, GL_UNSIGNED_BYTE, tile.pixelBuffer());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    ++_uploadedTiles;
+}
+
+void VirtualTexture::updateIndirection() {
+    //each texel points at the page of its tile, or of the nearest tile above it in the cache
+    _indirectionTexels.resize((size_t)tilesAcross(0) * tilesAcross(0) * 4);
+    glBindTexture(GL_TEXTURE_2D, _indirection);
+    for(unsigned mip = 0; mip < _mipCount; ++mip){
+        const unsigned across = tilesAcross(mip);
+        for(unsigned y = 0; y < across; ++y){
+            for(unsigned x = 0; x < across; ++x){
+                unsigned resident = mip;
+                std::map<unsigned, unsigned>::const_iterator found = _pagesByTile.find(TileKey(mip, x, y));
+                while(found == _pagesByTile.end()){
+                    ++resident;
+                    found = _pagesByTile.find(TileKey(resident, x >> (resident - mip), y >> (resident - mip)));
+                }
+                unsigned char* texel = &_indirectionTexels[4 * (y * across + x)];
+                texel[0] = (unsigned char)(found->second % _cacheSide);
+                texel[1] = (unsigned char)(found->second / _cacheSide);
+                texel[2] = (unsigned char)resident;
+                texel[3] = 255;
+            }
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, (GLint)mip, 0, 0, (GLsizei)across, (GLsizei)across, GL_RGBA, GL_UNSIGNED_BYTE, &_indirectionTexels[0]);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    _indirectionDirty = false;
+}
+
+void VirtualTexture::deleteObjects() {
+    glDeleteBuffers(2, _feedbackBuffers);
+    glDeleteFramebuffers(1, &_feedbackFramebuffer);
+    GLuint renderbuffers[2] = { _feedbackColor, _feedbackDepth };
+    glDeleteRenderbuffers(2, renderbuffers);
+    GLuint textures[2] = { _cache, _indirection };
+    glDeleteTextures(2, textures);
+}
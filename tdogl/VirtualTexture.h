@@ -0,0 +1,189 @@
+/*
+ tdogl::VirtualTexture
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "Bitmap.h"
+
+namespace tdogl {
+
+    /**
+     A texture too big to keep in video memory, of which only the tiles that are on screen
+     are loaded, at the mip they are seen at.
+
+     The image is cut into tiles offline by `bake`, one PNG file per tile of each mip. Each
+     tile has a border of the pixels around it, so bilinear filtering works across tiles.
+
+     Drawing takes two passes:
+      - the feedback pass draws the surfaces into a small framebuffer, between
+        `bindFeedback` and `readFeedback`. Each pixel records the tile and mip it needs.
+        The pixels are read back a frame later, so the GPU isn't waited on.
+      - the colour pass samples the texture with the functions in
+        "ShaderInclude - VirtualTexture.txt".
+
+     A background thread loads the tiles the feedback asks for. `update` copies them into
+     the page cache, a texture of tiles in any order, replacing the least recently needed
+     ones. The indirection texture has a texel for every tile of every mip, pointing at
+     the page that holds it, or at the page of the nearest mip above it that is loaded. The
+     last mip is one tile, loaded up front and never replaced, so every texel points
+     somewhere.
+     */
+    class VirtualTexture {
+    public:
+        /**
+         Cuts an image into the tiles of every mip, and writes them into `directory`, with
+         an "info.txt" that describes them. The directory must exist.
+
+         The image must be square, a power of two wide, and at most 256 tiles wide. Tiles
+         are numbered from the bottom left, like texture coordinates: "tile_<mip>_<x>_<y>.png".
+
+         @param tileSize  Width and height of a tile, without the border. A power of two.
+         @param border    Pixels on each side of a tile, copied from its neighbours
+
+         @throws std::exception if the image can't be read, or a tile can't be written.
+         */
+        static void bake(const std::string& imagePath, const std::string& directory, unsigned tileSize, unsigned border = 1);
+
+        /**
+         Loads the info of tiles made by `bake`, and the tile of the last mip.
+
+         @param directory      Holds the tiles, e.g. "terrain/"
+         @param cacheSide      Pages along each side of the page cache
+         @param feedbackWidth  Size of the feedback framebuffer. A quarter of the viewport
+         @param feedbackHeight   is usually plenty.
+
+         @throws std::exception if the tiles can't be read, or the framebuffer is incomplete.
+         */
+        VirtualTexture(const std::string& directory, unsigned cacheSide, GLsizei feedbackWidth, GLsizei feedbackHeight);
+
+        /** Stops the background thread, and deletes the textures and buffers */
+        ~VirtualTexture();
+
+        /** @result The page cache. GL_TEXTURE_2D. */
+        GLuint cacheTexture() const;
+
+        /** @result The indirection table. GL_TEXTURE_2D with one mip per mip of the image. */
+        GLuint indirectionTexture() const;
+
+        /** @result The width and height of mip 0, in pixels */
+        unsigned size() const;
+        unsigned tileSize() const;
+        unsigned border() const;
+        unsigned mipCount() const;
+        unsigned cacheSide() const;
+        GLsizei feedbackWidth() const;
+        GLsizei feedbackHeight() const;
+
+        /**
+         Binds and clears the feedback framebuffer, and sets the viewport to it. Draw the
+         surfaces with the feedback shader next.
+         */
+        void bindFeedback();
+
+        /**
+         Starts reading back the feedback just drawn, and asks for the tiles in the feedback
+         of the frame before. Restores the framebuffer binding and the viewport of
+         `bindFeedback`.
+         */
+        void readFeedback();
+
+        /**
+         Copies up to `maxTiles` of the loaded tiles into the page cache, and updates the
+         indirection table to match. Starts a new frame for the least-recently-used order.
+
+         @throws std::exception if a tile failed to load.
+         */
+        void update(unsigned maxTiles);
+
+        /** @result The pages that hold a tile */
+        unsigned residentPages() const;
+
+        /** @result The tiles asked for that aren't in the cache yet */
+        unsigned pendingTiles() const;
+
+        /** @result The tiles copied into the cache so far, in total */
+        unsigned long long uploadedTiles() const;
+
+    private:
+        struct Page {
+            int tile;                   //key of the tile it holds, -1 if none
+            unsigned long long lastUsedFrame;
+        };
+
+        struct TileLoad {
+            unsigned tile;
+            Bitmap bitmap;
+            std::string error;
+            TileLoad(unsigned tile) : tile(tile), bitmap(1, 1, Bitmap::Format_RGBA) {}
+        };
+
+        std::string _directory;
+        unsigned _size;
+        unsigned _tileSize;
+        unsigned _border;
+        unsigned _mipCount;
+        unsigned _cacheSide;
+        GLsizei _feedbackWidth;
+        GLsizei _feedbackHeight;
+        GLuint _cache;
+        GLuint _indirection;
+        GLuint _feedbackFramebuffer;
+        GLuint _feedbackColor;
+        GLuint _feedbackDepth;
+        GLuint _feedbackBuffers[2];     //pixel pack buffers, read into in turn
+        unsigned _feedbackIndex;
+        bool _feedbackPending;          //the other buffer holds last frame's feedback
+        GLint _previousFramebuffer;
+        GLint _previousViewport[4];
+        unsigned long long _frame;
+        unsigned long long _uploadedTiles;
+        std::vector<Page> _pages;
+        std::map<unsigned, unsigned> _pagesByTile;
+        std::set<unsigned> _pendingTiles;    //asked for, and not in the cache yet
+        bool _indirectionDirty;
+        std::vector<unsigned char> _indirectionTexels;
+
+        //shared with the background thread
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::deque<TileLoad*> _requested;
+        std::deque<TileLoad*> _finished;
+        bool _stop;
+        std::thread _thread;
+
+        void run();
+        std::string tilePath(unsigned tile) const;
+        unsigned tilesAcross(unsigned mip) const;
+        void requestTiles(const unsigned char* pixels, size_t pixelCount);
+        void uploadTile(unsigned page, const Bitmap& tile);
+        void updateIndirection();
+        void deleteObjects();
+
+        //copying disabled
+        VirtualTexture(const VirtualTexture&);
+        const VirtualTexture& operator=(const VirtualTexture&);
+    };
+
+}
@@ -7,6 +7,8 @@
 #include <stdexcept>
 #include <vector>
 #include <iostream>
+#include <string>
+#include <cstdlib>
 #include "tdogl/Shader.h"
 #include "tdogl/Program.h"
 #include "tdogl/Texture.h"
@@ -171,11 +173,48 @@ void AppMain()
 	glfwTerminate();
 }
 void AppMain_7();
+bool HeadlessMain_7(int frames, const std::string& outputPath, const std::string& referencePath);
+void BenchmarkMain_7(const std::string& outputPath, int frames, const std::string& sceneName);
+void BakeMeshMain(const std::string& objPath, const std::string& meshPath, unsigned lods);
+void BenchmarkMeshLoadMain(const std::string& objPath, int iterations);
+void BakeVirtualTextureMain(const std::string& imagePath, const std::string& directory, unsigned tileSize);
+void BenchmarkTransformsMain(int count);
+void BenchmarkJobsMain(int count);
+void BenchmarkOcclusionMain(int count);
+
+// converts a command line argument to a std::string (paths are expected to be ASCII)
+static std::string ArgToString(const _TCHAR* arg)
+{
+	std::string result;
+	for (; *arg; ++arg)
+		result += (char) *arg;
+	return result;
+}
 
 int _tmain(int argc, _TCHAR* argv[])
 {
 	try {
-		AppMain_7();
+		std::string mode = (argc > 1 ? ArgToString(argv[1]) : std::string());
+		if (mode == "--bake-mesh" && argc >= 4)
+			BakeMeshMain(ArgToString(argv[2]), ArgToString(argv[3]), argc > 4 ? atoi(ArgToString(argv[4]).c_str()) : 4);
+		else if (mode == "--bake-virtual-texture" && argc >= 4)
+			BakeVirtualTextureMain(ArgToString(argv[2]), ArgToString(argv[3]), argc > 4 ? atoi(ArgToString(argv[4]).c_str()) : 128);
+		else if (mode == "--bench-mesh-load" && argc >= 3)
+			BenchmarkMeshLoadMain(ArgToString(argv[2]), argc > 3 ? atoi(ArgToString(argv[3]).c_str()) : 20);
+		else if (mode == "--bench-transforms")
+			BenchmarkTransformsMain(argc > 2 ? atoi(ArgToString(argv[2]).c_str()) : 1000000);
+		else if (mode == "--bench-jobs")
+			BenchmarkJobsMain(argc > 2 ? atoi(ArgToString(argv[2]).c_str()) : 1000000);
+		else if (mode == "--bench-occlusion")
+			BenchmarkOcclusionMain(argc > 2 ? atoi(ArgToString(argv[2]).c_str()) : 100000);
+		else if (mode == "--headless" && argc >= 4) {
+			std::string referencePath = (argc > 4 ? ArgToString(argv[4]) : std::string());
+			if (!HeadlessMain_7(atoi(ArgToString(argv[2]).c_str()), ArgToString(argv[3]), referencePath))
+				return EXIT_FAILURE;
+		} else if (mode == "--bench" && argc >= 3)
+			BenchmarkMain_7(ArgToString(argv[2]), argc > 3 ? atoi(ArgToString(argv[3]).c_str()) : 600, argc > 4 ? ArgToString(argv[4]) : std::string());
+		else
+			AppMain_7();
 	} catch (const std::exception& e) {
 		std::cerr << "ERROR: " << e.what() << std::endl;
 		return EXIT_FAILURE;